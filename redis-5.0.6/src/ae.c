@@ -30,6 +30,7 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include "fmacros.h"
 #include <stdio.h>
 #include <sys/time.h>
 #include <sys/types.h>
@@ -49,13 +50,17 @@
 #ifdef HAVE_EVPORT
 #include "ae_evport.c"
 #else
-    #ifdef HAVE_EPOLL
-    #include "ae_epoll.c"
+    #ifdef HAVE_IOURING
+    #include "ae_iouring.c"
     #else
-        #ifdef HAVE_KQUEUE
-        #include "ae_kqueue.c"
+        #ifdef HAVE_EPOLL
+        #include "ae_epoll.c"
         #else
-        #include "ae_select.c"
+            #ifdef HAVE_KQUEUE
+            #include "ae_kqueue.c"
+            #else
+            #include "ae_select.c"
+            #endif
         #endif
     #endif
 #endif
@@ -70,7 +75,10 @@ aeEventLoop *aeCreateEventLoop(int setsize) {
     if (eventLoop->events == NULL || eventLoop->fired == NULL) goto err;
     eventLoop->setsize = setsize;
     eventLoop->lastTime = time(NULL);
-    eventLoop->timeEventHead = NULL;
+    eventLoop->timeEvents = NULL;
+    eventLoop->timeEventsNum = 0;
+    eventLoop->timeEventsSize = 0;
+    eventLoop->timeEventsCycle = 0;
     eventLoop->timeEventNextId = 0;
     eventLoop->stop = 0;
     eventLoop->maxfd = -1;
@@ -123,9 +131,14 @@ int aeResizeSetSize(aeEventLoop *eventLoop, int setsize) {
 }
 
 void aeDeleteEventLoop(aeEventLoop *eventLoop) {
+    int j;
+
     aeApiFree(eventLoop);
     zfree(eventLoop->events);
     zfree(eventLoop->fired);
+    for (j = 0; j < eventLoop->timeEventsNum; j++)
+        zfree(eventLoop->timeEvents[j]);
+    zfree(eventLoop->timeEvents);
     zfree(eventLoop);
 }
 
@@ -205,6 +218,51 @@ static void aeAddMillisecondsToNow(long long milliseconds, long *sec, long *ms)
     *ms = when_ms;
 }
 
+/* Time events are stored in a binary min-heap ordered by deadline, so that
+ * the nearest timer is always at index 0. Every event remembers its index
+ * in the heap, so that it can be moved when its deadline changes. */
+static int aeTimeEventBefore(aeTimeEvent *a, aeTimeEvent *b) {
+    return a->when_sec < b->when_sec ||
+           (a->when_sec == b->when_sec && a->when_ms < b->when_ms);
+}
+
+static void aeTimeEventsSet(aeEventLoop *eventLoop, int index, aeTimeEvent *te) {
+    eventLoop->timeEvents[index] = te;
+    te->index = index;
+}
+
+/* Move the event at 'index' up or down until the heap property holds. */
+static void aeTimeEventsFix(aeEventLoop *eventLoop, int index) {
+    aeTimeEvent **heap = eventLoop->timeEvents;
+    aeTimeEvent *te = heap[index];
+
+    while (index > 0) {
+        int parent = (index-1)/2;
+        if (!aeTimeEventBefore(te,heap[parent])) break;
+        aeTimeEventsSet(eventLoop,index,heap[parent]);
+        index = parent;
+    }
+    while (1) {
+        int child = index*2+1;
+        if (child >= eventLoop->timeEventsNum) break;
+        if (child+1 < eventLoop->timeEventsNum &&
+            aeTimeEventBefore(heap[child+1],heap[child])) child++;
+        if (!aeTimeEventBefore(heap[child],te)) break;
+        aeTimeEventsSet(eventLoop,index,heap[child]);
+        index = child;
+    }
+    aeTimeEventsSet(eventLoop,index,te);
+}
+
+/* Remove the event at 'index' from the heap, without freeing it. */
+static void aeTimeEventsRemove(aeEventLoop *eventLoop, int index) {
+    aeTimeEvent *last = eventLoop->timeEvents[--eventLoop->timeEventsNum];
+
+    if (index == eventLoop->timeEventsNum) return;
+    aeTimeEventsSet(eventLoop,index,last);
+    aeTimeEventsFix(eventLoop,index);
+}
+
 long long aeCreateTimeEvent(aeEventLoop *eventLoop, long long milliseconds,
         aeTimeProc *proc, void *clientData,
         aeEventFinalizerProc *finalizerProc)
@@ -219,23 +277,40 @@ long long aeCreateTimeEvent(aeEventLoop *eventLoop, long long milliseconds,
     te->timeProc = proc;
     te->finalizerProc = finalizerProc;
     te->clientData = clientData;
-    te->prev = NULL;
-    te->next = eventLoop->timeEventHead;
-    if (te->next)
-        te->next->prev = te;
-    eventLoop->timeEventHead = te;
+    /* Events created by time events are not processed in the same
+     * processTimeEvents() call. */
+    te->cycle = eventLoop->timeEventsCycle;
+
+    if (eventLoop->timeEventsNum == eventLoop->timeEventsSize) {
+        int size = eventLoop->timeEventsSize ? eventLoop->timeEventsSize*2 : 16;
+        eventLoop->timeEvents =
+            zrealloc(eventLoop->timeEvents,sizeof(aeTimeEvent*)*size);
+        eventLoop->timeEventsSize = size;
+    }
+    aeTimeEventsSet(eventLoop,eventLoop->timeEventsNum++,te);
+    aeTimeEventsFix(eventLoop,te->index);
     return id;
 }
 
+/* Flag the event as deleted, and move it at the top of the heap: the
+ * event is actually released (calling its finalizer) by the next call to
+ * processTimeEvents(), since we may be called by a time event handler.
+ *
+ * Note that finding the event by ID is O(N), however it's just a scan of
+ * the heap array, and deleting timers is much less frequent than searching
+ * for the nearest one, that is done at every event loop iteration. */
 int aeDeleteTimeEvent(aeEventLoop *eventLoop, long long id)
 {
-    aeTimeEvent *te = eventLoop->timeEventHead;
-    while(te) {
+    int j;
+
+    for (j = 0; j < eventLoop->timeEventsNum; j++) {
+        aeTimeEvent *te = eventLoop->timeEvents[j];
         if (te->id == id) {
             te->id = AE_DELETED_EVENT_ID;
+            te->when_sec = te->when_ms = 0;
+            aeTimeEventsFix(eventLoop,j);
             return AE_OK;
         }
-        te = te->next;
     }
     return AE_ERR; /* NO event with the specified ID found */
 }
@@ -245,32 +320,17 @@ int aeDeleteTimeEvent(aeEventLoop *eventLoop, long long id)
  * put in sleep without to delay any event.
  * If there are no timers NULL is returned.
  *
- * Note that's O(N) since time events are unsorted.
- * Possible optimizations (not needed by Redis so far, but...):
- * 1) Insert the event in order, so that the nearest is just the head.
- *    Much better but still insertion or deletion of timers is O(N).
- * 2) Use a skiplist to have this operation as O(1) and insertion as O(log(N)).
- */
+ * This is O(1) since time events are kept in a heap. */
 static aeTimeEvent *aeSearchNearestTimer(aeEventLoop *eventLoop)
 {
-    aeTimeEvent *te = eventLoop->timeEventHead;
-    aeTimeEvent *nearest = NULL;
-
-    while(te) {
-        if (!nearest || te->when_sec < nearest->when_sec ||
-                (te->when_sec == nearest->when_sec &&
-                 te->when_ms < nearest->when_ms))
-            nearest = te;
-        te = te->next;
-    }
-    return nearest;
+    return eventLoop->timeEventsNum ? eventLoop->timeEvents[0] : NULL;
 }
 
 /* Process time events */
 static int processTimeEvents(aeEventLoop *eventLoop) {
-    int processed = 0;
+    int processed = 0, j;
     aeTimeEvent *te;
-    long long maxId;
+    long long cycle = ++eventLoop->timeEventsCycle;
     time_t now = time(NULL);
 
     /* If the system clock is moved to the future, and then set back to the
@@ -282,61 +342,56 @@ static int processTimeEvents(aeEventLoop *eventLoop) {
      * processing events earlier is less dangerous than delaying them
      * indefinitely, and practice suggests it is. */
     if (now < eventLoop->lastTime) {
-        te = eventLoop->timeEventHead;
-        while(te) {
-            te->when_sec = 0;
-            te = te->next;
+        /* Setting all the deadlines to the same value keeps the heap
+         * valid. */
+        for (j = 0; j < eventLoop->timeEventsNum; j++) {
+            te = eventLoop->timeEvents[j];
+            te->when_sec = te->when_ms = 0;
         }
     }
     eventLoop->lastTime = now;
 
-    te = eventLoop->timeEventHead;
-    maxId = eventLoop->timeEventNextId-1;
-    while(te) {
+    /* Process the events at the top of the heap as long as they are due. */
+    while(eventLoop->timeEventsNum) {
         long now_sec, now_ms;
         long long id;
+        int retval;
+
+        te = eventLoop->timeEvents[0];
 
         /* Remove events scheduled for deletion. */
         if (te->id == AE_DELETED_EVENT_ID) {
-            aeTimeEvent *next = te->next;
-            if (te->prev)
-                te->prev->next = te->next;
-            else
-                eventLoop->timeEventHead = te->next;
-            if (te->next)
-                te->next->prev = te->prev;
+            aeTimeEventsRemove(eventLoop,0);
             if (te->finalizerProc)
                 te->finalizerProc(eventLoop, te->clientData);
             zfree(te);
-            te = next;
             continue;
         }
 
         /* Make sure we don't process time events created by time events in
-         * this iteration. Note that this check is currently useless: we always
-         * add new timers on the head, however if we change the implementation
-         * detail, this check may be useful again: we keep it here for future
-         * defense. */
-        if (te->id > maxId) {
-            te = te->next;
-            continue;
-        }
-        aeGetTime(&now_sec, &now_ms);
-        if (now_sec > te->when_sec ||
-            (now_sec == te->when_sec && now_ms >= te->when_ms))
-        {
-            int retval;
+         * this iteration, nor the ones already processed and rescheduled
+         * to fire immediately: they'll be processed in the next cycle. */
+        if (te->cycle == cycle) break;
 
-            id = te->id;
-            retval = te->timeProc(eventLoop, id, te->clientData);
-            processed++;
-            if (retval != AE_NOMORE) {
-                aeAddMillisecondsToNow(retval,&te->when_sec,&te->when_ms);
-            } else {
-                te->id = AE_DELETED_EVENT_ID;
-            }
+        aeGetTime(&now_sec, &now_ms);
+        if (now_sec < te->when_sec ||
+            (now_sec == te->when_sec && now_ms < te->when_ms)) break;
+
+        te->cycle = cycle;
+        id = te->id;
+        retval = te->timeProc(eventLoop, id, te->clientData);
+        processed++;
+
+        /* The handler may have deleted this event, or created and deleted
+         * other events, so the event may no longer be at the top. */
+        if (te->id == AE_DELETED_EVENT_ID) continue;
+        if (retval != AE_NOMORE) {
+            aeAddMillisecondsToNow(retval,&te->when_sec,&te->when_ms);
+        } else {
+            te->id = AE_DELETED_EVENT_ID;
+            te->when_sec = te->when_ms = 0;
         }
-        te = te->next;
+        aeTimeEventsFix(eventLoop,te->index);
     }
     return processed;
 }
@@ -506,6 +561,35 @@ char *aeGetApiName(void) {
     return aeApiName();
 }
 
+/* Return 1 if the multiplexing layer can perform the reads and writes of
+ * many sockets at once via aeBatchIO(), otherwise 0. */
+int aeCanBatchIO(aeEventLoop *eventLoop) {
+#ifdef AE_HAVE_BATCH_IO
+    return aeApiCanBatchIO(eventLoop);
+#else
+    AE_NOTUSED(eventLoop);
+    return 0;
+#endif
+}
+
+/* Perform the 'count' socket reads and writes of 'reqs' with fewer system
+ * calls than doing them one after the other. Sockets are never waited for:
+ * a request that would block fails with EAGAIN. The outcome of every request
+ * is stored in its 'res' and 'err' fields when the function returns.
+ *
+ * AE_ERR is returned, without performing any request, if the multiplexing
+ * layer can't batch I/O: the caller should then use read(2) and write(2). */
+int aeBatchIO(aeEventLoop *eventLoop, aeIORequest *reqs, int count) {
+#ifdef AE_HAVE_BATCH_IO
+    return aeApiBatchIO(eventLoop,reqs,count) == 0 ? AE_OK : AE_ERR;
+#else
+    AE_NOTUSED(eventLoop);
+    AE_NOTUSED(reqs);
+    AE_NOTUSED(count);
+    return AE_ERR;
+#endif
+}
+
 void aeSetBeforeSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *beforesleep) {
     eventLoop->beforesleep = beforesleep;
 }
@@ -513,3 +597,92 @@ void aeSetBeforeSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *beforesleep
 void aeSetAfterSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *aftersleep) {
     eventLoop->aftersleep = aftersleep;
 }
+
+#ifdef AE_BENCHMARK_MAIN
+
+#include <assert.h>
+
+static long long aeBenchmarkMilliseconds(void) {
+    long sec, ms;
+
+    aeGetTime(&sec,&ms);
+    return ((long long)sec)*1000+ms;
+}
+
+static int aeBenchmarkIdleProc(aeEventLoop *eventLoop, long long id, void *clientData) {
+    AE_NOTUSED(eventLoop);
+    AE_NOTUSED(id);
+    AE_NOTUSED(clientData);
+    return AE_NOMORE;
+}
+
+static int aeBenchmarkTickProc(aeEventLoop *eventLoop, long long id, void *clientData) {
+    AE_NOTUSED(eventLoop);
+    AE_NOTUSED(id);
+    (*(long*)clientData)++;
+    return 0;
+}
+
+#define start_benchmark() start = aeBenchmarkMilliseconds()
+#define end_benchmark(msg) do { \
+    elapsed = aeBenchmarkMilliseconds()-start; \
+    printf("%ld timers, " msg ": %ld items in %lld ms\n", \
+        timers, count, elapsed); \
+} while(0);
+
+/* Measure timer insertion, deletion, and event loop overhead with 'timers'
+ * idle timers registered, in addition to a timer firing at every loop
+ * iteration. */
+static void aeBenchmark(long timers) {
+    aeEventLoop *el = aeCreateEventLoop(1024);
+    long long *ids = zmalloc(sizeof(long long)*(timers ? timers : 1));
+    long long start, elapsed, tickid;
+    long j, count, ticks = 0;
+
+    count = timers;
+    start_benchmark();
+    for (j = 0; j < count; j++) {
+        /* Spread the deadlines in the far future. */
+        ids[j] = aeCreateTimeEvent(el,3600000+(j*7919)%3600000,
+                                   aeBenchmarkIdleProc,NULL,NULL);
+        assert(ids[j] != AE_ERR);
+    }
+    end_benchmark("Creating timers");
+
+    tickid = aeCreateTimeEvent(el,0,aeBenchmarkTickProc,&ticks,NULL);
+    count = 100000;
+    start_benchmark();
+    for (j = 0; j < count; j++)
+        aeProcessEvents(el,AE_TIME_EVENTS|AE_DONT_WAIT);
+    end_benchmark("Event loop iterations");
+    assert(ticks > 0);
+    aeDeleteTimeEvent(el,tickid);
+
+    count = timers < 1000 ? timers : 1000;
+    start_benchmark();
+    for (j = 0; j < count; j++) {
+        int retval = aeDeleteTimeEvent(el,ids[(j*7919)%timers]);
+        assert(retval == AE_OK);
+        aeProcessEvents(el,AE_TIME_EVENTS|AE_DONT_WAIT);
+    }
+    end_benchmark("Deleting timers");
+
+    zfree(ids);
+    aeDeleteEventLoop(el);
+}
+
+/* ae-benchmark [timers ...] */
+int main(int argc, char **argv) {
+    int j;
+
+    if (argc > 1) {
+        for (j = 1; j < argc; j++)
+            aeBenchmark(strtol(argv[j],NULL,10));
+    } else {
+        aeBenchmark(0);
+        aeBenchmark(10000);
+        aeBenchmark(100000);
+    }
+    return 0;
+}
+#endif
@@ -34,6 +34,8 @@
 #define __AE_H__
 
 #include <time.h>
+#include <sys/types.h>
+#include <sys/uio.h>
 
 #define AE_OK 0
 #define AE_ERR -1
@@ -53,6 +55,9 @@
 #define AE_DONT_WAIT 4
 #define AE_CALL_AFTER_SLEEP 8
 
+#define AE_IO_READ 1    /* aeBatchIO() request reading from a socket. */
+#define AE_IO_WRITE 2   /* aeBatchIO() request writing to a socket. */
+
 #define AE_NOMORE -1
 #define AE_DELETED_EVENT_ID -1
 
@@ -83,8 +88,8 @@ typedef struct aeTimeEvent {
     aeTimeProc *timeProc;
     aeEventFinalizerProc *finalizerProc;
     void *clientData;
-    struct aeTimeEvent *prev;
-    struct aeTimeEvent *next;
+    int index; /* Position in the time events heap. */
+    long long cycle; /* Last processTimeEvents() cycle it was handled by. */
 } aeTimeEvent;
 
 /* A fired event */
@@ -93,6 +98,16 @@ typedef struct aeFiredEvent {
     int mask;
 } aeFiredEvent;
 
+/* A socket read or write performed by aeBatchIO() */
+typedef struct aeIORequest {
+    int fd;
+    int op; /* AE_IO_READ or AE_IO_WRITE */
+    struct iovec *iov; /* Buffers to fill or to send. */
+    int iovcnt;
+    ssize_t res; /* Bytes transferred, or -1 with the errno in 'err'. */
+    int err;
+} aeIORequest;
+
 /* State of an event based program */
 typedef struct aeEventLoop {
     int maxfd;   /* highest file descriptor currently registered */
@@ -101,7 +116,10 @@ typedef struct aeEventLoop {
     time_t lastTime;     /* Used to detect system clock skew */
     aeFileEvent *events; /* Registered events */
     aeFiredEvent *fired; /* Fired events */
-    aeTimeEvent *timeEventHead;
+    aeTimeEvent **timeEvents; /* Binary min-heap of time events by deadline */
+    int timeEventsNum;   /* Number of time events in the heap */
+    int timeEventsSize;  /* Allocated slots in the heap */
+    long long timeEventsCycle; /* Incremented at every processTimeEvents() */
     int stop;
     void *apidata; /* This is used for polling API specific data */
     aeBeforeSleepProc *beforesleep;
@@ -124,6 +142,8 @@ int aeProcessEvents(aeEventLoop *eventLoop, int flags);
 int aeWait(int fd, int mask, long long milliseconds);
 void aeMain(aeEventLoop *eventLoop);
 char *aeGetApiName(void);
+int aeCanBatchIO(aeEventLoop *eventLoop);
+int aeBatchIO(aeEventLoop *eventLoop, aeIORequest *reqs, int count);
 void aeSetBeforeSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *beforesleep);
 void aeSetAfterSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *aftersleep);
 int aeGetSetSize(aeEventLoop *eventLoop);
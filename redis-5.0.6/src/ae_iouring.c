@@ -0,0 +1,525 @@
+/* Linux io_uring(7) based ae.c module
+ *
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* This backend uses one-shot IORING_OP_POLL_ADD requests in order to
+ * implement the level triggered semantics ae.c expects: every time a poll
+ * request fires, the file descriptor is flagged as "dirty" and is re-armed
+ * the next time aeApiPoll() is called, if the file event is still
+ * registered. Interest changes performed by aeApiAddEvent() and
+ * aeApiDelEvent() are deferred as well, so that all the (re)arming requests
+ * of a given event loop iteration, together with the wait for new events,
+ * cost a single io_uring_enter(2) call.
+ *
+ * The only exception is the removal of the last event of a file descriptor:
+ * the caller is likely going to close(2) it, and an armed poll request holds
+ * a reference to the underlying file, so the removal request is submitted
+ * ASAP in that case.
+ *
+ * A second ring is used by aeApiBatchIO() in order to perform the reads and
+ * writes of many sockets with a single io_uring_enter(2) call. The requests
+ * are non blocking and the call waits for all of them to complete, so the
+ * caller buffers don't need to stay valid after it returns. */
+
+#include <linux/io_uring.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <poll.h>
+
+#define AE_IOURING_MAX_ENTRIES 4096 /* Submission queue size. */
+#define AE_IOURING_MAX_CQ_ENTRIES 65536 /* Completion queue size upper bound. */
+#define AE_IOURING_BATCH_ENTRIES 1024 /* Batch I/O submission queue size. */
+#define AE_IOURING_IGNORE UINT64_MAX /* user_data of requests we don't track */
+
+/* Tell ae.c that aeApiBatchIO() is implemented. */
+#define AE_HAVE_BATCH_IO 1
+
+typedef struct aeIOUring {
+    int fd;
+    /* Submission queue ring. */
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned sq_entries;
+    unsigned sq_queued;      /* SQEs queued but not yet submitted. */
+    struct io_uring_sqe *sqes;
+    /* Completion queue ring. */
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+    /* Memory mappings, to release them in aeIOUringRelease(). */
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size, sqes_size;
+} aeIOUring;
+
+typedef struct aeApiState {
+    aeIOUring ring;          /* Poll requests. */
+    aeIOUring batch;         /* aeApiBatchIO() requests, fd is -1 if n/a. */
+    struct msghdr *msgs;     /* Message headers of the batch requests. */
+    int msgs_size;
+    /* Per file descriptor state. */
+    int *armed;              /* Mask the poll request is armed with. */
+    unsigned *gen;           /* Used to detect stale completions. */
+    unsigned char *dirty;    /* Needs to be (re)armed in aeApiPoll(). */
+    int *dirty_fds;          /* List of the fds flagged as dirty. */
+    int dirty_count;
+} aeApiState;
+
+static int aeIOUringSetup(unsigned entries, struct io_uring_params *p) {
+    return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int aeIOUringEnter(int fd, unsigned to_submit, unsigned min_complete,
+                          unsigned flags, void *arg, size_t argsz)
+{
+    return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+                         flags, arg, argsz);
+}
+
+static inline uint64_t aeIOUringUserData(aeApiState *state, int fd) {
+    return ((uint64_t)state->gen[fd] << 32) | (uint32_t)fd;
+}
+
+/* Submit the queued requests without waiting for completions. */
+static void aeIOUringFlush(aeIOUring *ring) {
+    while (ring->sq_queued) {
+        int ret = aeIOUringEnter(ring->fd,ring->sq_queued,0,0,NULL,0);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            /* EAGAIN / EBUSY: the kernel can't accept more requests before
+             * we reap some completion. They remain in the ring and will be
+             * submitted by the next io_uring_enter(2) call. */
+            return;
+        }
+        ring->sq_queued -= (unsigned)ret;
+    }
+}
+
+/* Return a zeroed submission queue entry, flushing the ring if it's full. */
+static struct io_uring_sqe *aeIOUringGetSqe(aeIOUring *ring) {
+    unsigned head, tail = *ring->sq_tail;
+
+    head = __atomic_load_n(ring->sq_head,__ATOMIC_ACQUIRE);
+    if (tail - head >= ring->sq_entries) {
+        aeIOUringFlush(ring);
+        head = __atomic_load_n(ring->sq_head,__ATOMIC_ACQUIRE);
+        if (tail - head >= ring->sq_entries) return NULL;
+    }
+
+    unsigned idx = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[idx];
+    memset(sqe,0,sizeof(*sqe));
+    ring->sq_array[idx] = idx;
+    __atomic_store_n(ring->sq_tail,tail+1,__ATOMIC_RELEASE);
+    ring->sq_queued++;
+    return sqe;
+}
+
+/* Queue the removal of the poll request currently armed for 'fd', if any.
+ * The generation is incremented so that a completion of the old request
+ * already sitting in the completion queue is ignored. */
+static void aeIOUringDisarm(aeApiState *state, int fd) {
+    if (state->armed[fd] == AE_NONE) return;
+
+    struct io_uring_sqe *sqe = aeIOUringGetSqe(&state->ring);
+    if (sqe) {
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->fd = -1;
+        sqe->addr = aeIOUringUserData(state,fd);
+        sqe->user_data = AE_IOURING_IGNORE;
+    }
+    state->armed[fd] = AE_NONE;
+    state->gen[fd]++;
+}
+
+static int aeIOUringArm(aeApiState *state, int fd, int mask) {
+    struct io_uring_sqe *sqe = aeIOUringGetSqe(&state->ring);
+    if (!sqe) return -1;
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    if (mask & AE_READABLE) sqe->poll_events |= POLLIN;
+    if (mask & AE_WRITABLE) sqe->poll_events |= POLLOUT;
+    sqe->user_data = aeIOUringUserData(state,fd);
+    state->armed[fd] = mask;
+    return 0;
+}
+
+static void aeIOUringMarkDirty(aeApiState *state, int fd) {
+    if (state->dirty[fd]) return;
+    state->dirty[fd] = 1;
+    state->dirty_fds[state->dirty_count++] = fd;
+}
+
+static int aeIOUringResizeState(aeApiState *state, int oldsize, int setsize) {
+    state->armed = zrealloc(state->armed,sizeof(int)*setsize);
+    state->gen = zrealloc(state->gen,sizeof(unsigned)*setsize);
+    state->dirty = zrealloc(state->dirty,setsize);
+    state->dirty_fds = zrealloc(state->dirty_fds,sizeof(int)*setsize);
+    for (int j = oldsize; j < setsize; j++) {
+        state->armed[j] = AE_NONE;
+        state->gen[j] = 0;
+        state->dirty[j] = 0;
+    }
+    return 0;
+}
+
+static void aeIOUringRelease(aeIOUring *ring) {
+    if (ring->sqes) munmap(ring->sqes,ring->sqes_size);
+    if (ring->cq_ring && ring->cq_ring != ring->sq_ring)
+        munmap(ring->cq_ring,ring->cq_ring_size);
+    if (ring->sq_ring) munmap(ring->sq_ring,ring->sq_ring_size);
+    if (ring->fd != -1) close(ring->fd);
+    memset(ring,0,sizeof(*ring));
+    ring->fd = -1;
+}
+
+/* Create a ring with 'entries' submission queue entries, and a completion
+ * queue of 'cq_entries' entries, or twice 'entries' if zero. */
+static int aeIOUringInit(aeIOUring *ring, unsigned entries,
+                         unsigned cq_entries)
+{
+    struct io_uring_params p;
+
+    memset(ring,0,sizeof(*ring));
+    memset(&p,0,sizeof(p));
+    if (cq_entries) {
+        p.flags = IORING_SETUP_CQSIZE;
+        p.cq_entries = cq_entries;
+    }
+    ring->fd = aeIOUringSetup(entries,&p);
+    if (ring->fd == -1) return -1;
+
+    /* We need the timeout argument of io_uring_enter(2) and the guarantee
+     * that completions are never dropped: both are available since 5.11. */
+    if (!(p.features & IORING_FEAT_EXT_ARG) ||
+        !(p.features & IORING_FEAT_NODROP)) goto err;
+
+    ring->sq_ring_size = p.sq_off.array + p.sq_entries*sizeof(unsigned);
+    ring->cq_ring_size = p.cq_off.cqes +
+                         p.cq_entries*sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_ring_size > ring->sq_ring_size)
+            ring->sq_ring_size = ring->cq_ring_size;
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+    ring->sq_ring = mmap(NULL,ring->sq_ring_size,PROT_READ|PROT_WRITE,
+        MAP_SHARED|MAP_POPULATE,ring->fd,IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED) {
+        ring->sq_ring = NULL;
+        goto err;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ring = ring->sq_ring;
+    } else {
+        ring->cq_ring = mmap(NULL,ring->cq_ring_size,PROT_READ|PROT_WRITE,
+            MAP_SHARED|MAP_POPULATE,ring->fd,IORING_OFF_CQ_RING);
+        if (ring->cq_ring == MAP_FAILED) {
+            ring->cq_ring = NULL;
+            goto err;
+        }
+    }
+    ring->sqes_size = p.sq_entries*sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL,ring->sqes_size,PROT_READ|PROT_WRITE,
+        MAP_SHARED|MAP_POPULATE,ring->fd,IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        goto err;
+    }
+
+    ring->sq_head = (unsigned*)((char*)ring->sq_ring + p.sq_off.head);
+    ring->sq_tail = (unsigned*)((char*)ring->sq_ring + p.sq_off.tail);
+    ring->sq_mask = (unsigned*)((char*)ring->sq_ring + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned*)((char*)ring->sq_ring + p.sq_off.array);
+    ring->sq_entries = p.sq_entries;
+    ring->cq_head = (unsigned*)((char*)ring->cq_ring + p.cq_off.head);
+    ring->cq_tail = (unsigned*)((char*)ring->cq_ring + p.cq_off.tail);
+    ring->cq_mask = (unsigned*)((char*)ring->cq_ring + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)((char*)ring->cq_ring +
+                                        p.cq_off.cqes);
+    return 0;
+
+err:
+    aeIOUringRelease(ring);
+    return -1;
+}
+
+static int aeApiCreate(aeEventLoop *eventLoop) {
+    aeApiState *state = zmalloc(sizeof(aeApiState));
+    unsigned cq_entries;
+
+    if (!state) return -1;
+    memset(state,0,sizeof(*state));
+
+    /* Every registered fd may have a poll request in flight, so size the
+     * completion queue after the set size when possible. The kernel keeps
+     * the overflowing completions anyway (IORING_FEAT_NODROP). */
+    cq_entries = (unsigned)eventLoop->setsize*2;
+    if (cq_entries > AE_IOURING_MAX_CQ_ENTRIES)
+        cq_entries = AE_IOURING_MAX_CQ_ENTRIES;
+    if (cq_entries < AE_IOURING_MAX_ENTRIES*2)
+        cq_entries = AE_IOURING_MAX_ENTRIES*2;
+    if (aeIOUringInit(&state->ring,AE_IOURING_MAX_ENTRIES,cq_entries) == -1) {
+        zfree(state);
+        return -1;
+    }
+
+    /* Batched I/O is an optimization: just do without it if the second
+     * ring can't be created (for instance because of RLIMIT_MEMLOCK). */
+    aeIOUringInit(&state->batch,AE_IOURING_BATCH_ENTRIES,0);
+
+    aeIOUringResizeState(state,0,eventLoop->setsize);
+    eventLoop->apidata = state;
+    return 0;
+}
+
+static int aeApiResize(aeEventLoop *eventLoop, int setsize) {
+    aeApiState *state = eventLoop->apidata;
+
+    /* When shrinking, ae.c guarantees no fd >= setsize is registered, but
+     * dirty entries for such fds may still be in the list. */
+    int j = 0;
+    for (int i = 0; i < state->dirty_count; i++) {
+        int fd = state->dirty_fds[i];
+        if (fd < setsize) state->dirty_fds[j++] = fd;
+    }
+    state->dirty_count = j;
+    return aeIOUringResizeState(state,eventLoop->setsize,setsize);
+}
+
+static void aeApiFree(aeEventLoop *eventLoop) {
+    aeApiState *state = eventLoop->apidata;
+
+    aeIOUringRelease(&state->ring);
+    aeIOUringRelease(&state->batch);
+    zfree(state->msgs);
+    zfree(state->armed);
+    zfree(state->gen);
+    zfree(state->dirty);
+    zfree(state->dirty_fds);
+    zfree(state);
+}
+
+static int aeApiAddEvent(aeEventLoop *eventLoop, int fd, int mask) {
+    aeApiState *state = eventLoop->apidata;
+
+    /* Nothing to do if the armed request already covers the new mask. */
+    mask |= eventLoop->events[fd].mask; /* Merge old events */
+    if ((state->armed[fd] & mask) == (mask & (AE_READABLE|AE_WRITABLE)))
+        return 0;
+    aeIOUringMarkDirty(state,fd);
+    return 0;
+}
+
+static void aeApiDelEvent(aeEventLoop *eventLoop, int fd, int delmask) {
+    aeApiState *state = eventLoop->apidata;
+    int mask = eventLoop->events[fd].mask & (~delmask);
+
+    if ((mask & (AE_READABLE|AE_WRITABLE)) == AE_NONE) {
+        /* The fd is probably going to be closed: release the reference the
+         * armed request holds to the file right now. */
+        if (state->armed[fd] != AE_NONE) {
+            aeIOUringDisarm(state,fd);
+            aeIOUringFlush(&state->ring);
+        }
+    } else if (state->armed[fd] != AE_NONE) {
+        aeIOUringMarkDirty(state,fd);
+    }
+}
+
+static int aeApiPoll(aeEventLoop *eventLoop, struct timeval *tvp) {
+    aeApiState *state = eventLoop->apidata;
+    int numevents = 0, requeued = 0;
+
+    /* Queue the poll requests of the fds that fired in the previous
+     * iteration, or whose set of events changed. */
+    for (int i = 0; i < state->dirty_count; i++) {
+        int fd = state->dirty_fds[i];
+        int mask = eventLoop->events[fd].mask & (AE_READABLE|AE_WRITABLE);
+
+        state->dirty[fd] = 0;
+        if (state->armed[fd] == mask) continue;
+        aeIOUringDisarm(state,fd);
+        if (mask != AE_NONE && aeIOUringArm(state,fd,mask) == -1) {
+            /* Submission queue full even after flushing: retry later. */
+            state->dirty[fd] = 1;
+            state->dirty_fds[requeued++] = fd;
+        }
+    }
+    state->dirty_count = requeued;
+
+    /* Submit and wait for events with a single system call. */
+    unsigned flags = 0, min_complete = 0;
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    void *argp = NULL;
+    size_t argsz = 0;
+
+    if (!tvp || tvp->tv_sec || tvp->tv_usec) {
+        flags |= IORING_ENTER_GETEVENTS;
+        min_complete = 1;
+        if (tvp) {
+            memset(&arg,0,sizeof(arg));
+            ts.tv_sec = tvp->tv_sec;
+            ts.tv_nsec = tvp->tv_usec*1000;
+            arg.ts = (uint64_t)(uintptr_t)&ts;
+            flags |= IORING_ENTER_EXT_ARG;
+            argp = &arg;
+            argsz = sizeof(arg);
+        }
+    }
+    aeIOUring *ring = &state->ring;
+    if (ring->sq_queued || min_complete) {
+        int ret = aeIOUringEnter(ring->fd,ring->sq_queued,min_complete,
+                                 flags,argp,argsz);
+        if (ret > 0) ring->sq_queued -= (unsigned)ret;
+        /* On errors (EINTR, ETIME, ...) we just reap what is available. */
+    }
+
+    /* Reap the completions. */
+    unsigned head = *ring->cq_head;
+    unsigned tail = __atomic_load_n(ring->cq_tail,__ATOMIC_ACQUIRE);
+    while (head != tail && numevents < eventLoop->setsize) {
+        struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+        uint64_t ud = cqe->user_data;
+        int res = cqe->res;
+
+        head++;
+        if (ud == AE_IOURING_IGNORE) continue;
+        int fd = (int)(ud & 0xffffffff);
+        if (fd >= eventLoop->setsize || state->gen[fd] != (unsigned)(ud>>32))
+            continue; /* Stale completion of a removed request. */
+
+        /* The one-shot request is consumed: re-arm it the next time. */
+        state->armed[fd] = AE_NONE;
+        aeIOUringMarkDirty(state,fd);
+        if (res < 0) continue;
+
+        int mask = 0;
+        if (res & POLLIN) mask |= AE_READABLE;
+        if (res & POLLOUT) mask |= AE_WRITABLE;
+        if (res & POLLERR) mask |= AE_WRITABLE;
+        if (res & POLLHUP) mask |= AE_WRITABLE;
+        eventLoop->fired[numevents].fd = fd;
+        eventLoop->fired[numevents].mask = mask;
+        numevents++;
+    }
+    __atomic_store_n(ring->cq_head,head,__ATOMIC_RELEASE);
+    return numevents;
+}
+
+static int aeApiCanBatchIO(aeEventLoop *eventLoop) {
+    aeApiState *state = eventLoop->apidata;
+    return state->batch.fd != -1;
+}
+
+/* Perform the requests of 'reqs' using the batch ring: they are submitted
+ * in chunks as big as the submission queue, waiting for all the completions
+ * of a chunk with the same io_uring_enter(2) call used to submit it. */
+static int aeApiBatchIO(aeEventLoop *eventLoop, aeIORequest *reqs, int count) {
+    aeApiState *state = eventLoop->apidata;
+    aeIOUring *ring = &state->batch;
+
+    if (ring->fd == -1) return -1;
+    if (state->msgs_size < count) {
+        state->msgs = zrealloc(state->msgs,sizeof(struct msghdr)*count);
+        state->msgs_size = count;
+    }
+
+    for (int done = 0; done < count; ) {
+        int chunk = count-done, completed = 0;
+        if (chunk > (int)ring->sq_entries) chunk = ring->sq_entries;
+
+        for (int j = done; j < done+chunk; j++) {
+            aeIORequest *req = reqs+j;
+            struct msghdr *msg = state->msgs+j;
+            struct io_uring_sqe *sqe = aeIOUringGetSqe(ring);
+
+            /* The ring is empty when a chunk starts, so there is room. */
+            memset(msg,0,sizeof(*msg));
+            msg->msg_iov = req->iov;
+            msg->msg_iovlen = req->iovcnt;
+            sqe->opcode = (req->op == AE_IO_READ) ? IORING_OP_RECVMSG :
+                                                    IORING_OP_SENDMSG;
+            sqe->fd = req->fd;
+            sqe->addr = (uint64_t)(uintptr_t)msg;
+            sqe->len = 1;
+            /* MSG_DONTWAIT makes the kernel complete the request with
+             * -EAGAIN instead of waiting for the socket to be ready. */
+            sqe->msg_flags = MSG_DONTWAIT;
+            if (req->op == AE_IO_WRITE) sqe->msg_flags |= MSG_NOSIGNAL;
+            sqe->user_data = j;
+        }
+
+        while (completed < chunk) {
+            int ret = aeIOUringEnter(ring->fd,ring->sq_queued,
+                                     chunk-completed,IORING_ENTER_GETEVENTS,
+                                     NULL,0);
+            if (ret >= 0) {
+                ring->sq_queued -= (unsigned)ret;
+            } else if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                /* The requests that could not be submitted are withdrawn
+                 * from the ring and failed with the same error. */
+                unsigned tail = *ring->sq_tail;
+                for (unsigned j = 0; j < ring->sq_queued; j++) {
+                    aeIORequest *req = reqs+done+chunk-1-j;
+                    req->res = -1;
+                    req->err = errno;
+                    completed++;
+                }
+                __atomic_store_n(ring->sq_tail,tail-ring->sq_queued,
+                                 __ATOMIC_RELEASE);
+                ring->sq_queued = 0;
+            }
+
+            unsigned head = *ring->cq_head;
+            unsigned tail = __atomic_load_n(ring->cq_tail,__ATOMIC_ACQUIRE);
+            while (head != tail) {
+                struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+                aeIORequest *req = reqs+cqe->user_data;
+
+                if (cqe->res < 0) {
+                    req->res = -1;
+                    req->err = -cqe->res;
+                } else {
+                    req->res = cqe->res;
+                    req->err = 0;
+                }
+                completed++;
+                head++;
+            }
+            __atomic_store_n(ring->cq_head,head,__ATOMIC_RELEASE);
+        }
+        done += chunk;
+    }
+    return 0;
+}
+
+static char *aeApiName(void) {
+    return "io_uring";
+}
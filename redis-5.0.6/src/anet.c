@@ -159,6 +159,45 @@ int anetDisableTcpNoDelay(char *err, int fd)
 }
 
 
+/* Set TCP_DEFER_ACCEPT on a listening socket, so that connections are only
+ * reported as accepted once the client sent some data, or after 'seconds'
+ * seconds. */
+int anetDeferAccept(char *err, int fd, int seconds)
+{
+#ifdef TCP_DEFER_ACCEPT
+    if (setsockopt(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &seconds, sizeof(seconds)) == -1)
+    {
+        anetSetError(err, "setsockopt TCP_DEFER_ACCEPT: %s", strerror(errno));
+        return ANET_ERR;
+    }
+    return ANET_OK;
+#else
+    ((void) fd);
+    ((void) seconds);
+    anetSetError(err, "TCP_DEFER_ACCEPT is not supported by this system");
+    return ANET_ERR;
+#endif
+}
+
+/* Enable TCP Fast Open on a listening socket, with a queue of at most 'qlen'
+ * pending Fast Open requests. */
+int anetFastOpen(char *err, int fd, int qlen)
+{
+#ifdef TCP_FASTOPEN
+    if (setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN, &qlen, sizeof(qlen)) == -1)
+    {
+        anetSetError(err, "setsockopt TCP_FASTOPEN: %s", strerror(errno));
+        return ANET_ERR;
+    }
+    return ANET_OK;
+#else
+    ((void) fd);
+    ((void) qlen);
+    anetSetError(err, "TCP_FASTOPEN is not supported by this system");
+    return ANET_ERR;
+#endif
+}
+
 int anetSetSendBuffer(char *err, int fd, int buffsize)
 {
     if (setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &buffsize, sizeof(buffsize)) == -1)
@@ -246,6 +285,24 @@ static int anetSetReuseAddr(char *err, int fd) {
     return ANET_OK;
 }
 
+/* Allow several sockets to bind the same address and port, so that the
+ * kernel spreads the incoming connections across their accept queues. */
+static int anetSetReusePort(char *err, int fd) {
+#ifdef SO_REUSEPORT
+    int yes = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes)) == -1) {
+        anetSetError(err, "setsockopt SO_REUSEPORT: %s", strerror(errno));
+        return ANET_ERR;
+    }
+    return ANET_OK;
+#else
+    ((void) fd);
+    errno = ENOPROTOOPT;
+    anetSetError(err, "SO_REUSEPORT is not supported by this system");
+    return ANET_ERR;
+#endif
+}
+
 static int anetCreateSocket(char *err, int domain) {
     int s;
     if ((s = socket(domain, SOCK_STREAM, 0)) == -1) {
@@ -462,7 +519,7 @@ static int anetV6Only(char *err, int s) {
     return ANET_OK;
 }
 
-static int _anetTcpServer(char *err, int port, char *bindaddr, int af, int backlog)
+static int _anetTcpServer(char *err, int port, char *bindaddr, int af, int backlog, int flags)
 {
     int s = -1, rv;
     char _port[6];  /* strlen("65535") */
@@ -484,6 +541,8 @@ static int _anetTcpServer(char *err, int port, char *bindaddr, int af, int backl
 
         if (af == AF_INET6 && anetV6Only(err,s) == ANET_ERR) goto error;
         if (anetSetReuseAddr(err,s) == ANET_ERR) goto error;
+        if (flags & ANET_REUSEPORT && anetSetReusePort(err,s) == ANET_ERR)
+            goto error;
         if (anetListen(err,s,p->ai_addr,p->ai_addrlen,backlog) == ANET_ERR) s = ANET_ERR;
         goto end;
     }
@@ -502,12 +561,25 @@ end:
 
 int anetTcpServer(char *err, int port, char *bindaddr, int backlog)
 {
-    return _anetTcpServer(err, port, bindaddr, AF_INET, backlog);
+    return _anetTcpServer(err, port, bindaddr, AF_INET, backlog, ANET_NONE);
 }
 
 int anetTcp6Server(char *err, int port, char *bindaddr, int backlog)
 {
-    return _anetTcpServer(err, port, bindaddr, AF_INET6, backlog);
+    return _anetTcpServer(err, port, bindaddr, AF_INET6, backlog, ANET_NONE);
+}
+
+/* Like anetTcpServer() and anetTcp6Server(), but the socket is created with
+ * SO_REUSEPORT, so that it is possible to create multiple listening sockets
+ * for the same address and port. */
+int anetTcpReusePortServer(char *err, int port, char *bindaddr, int backlog)
+{
+    return _anetTcpServer(err, port, bindaddr, AF_INET, backlog, ANET_REUSEPORT);
+}
+
+int anetTcp6ReusePortServer(char *err, int port, char *bindaddr, int backlog)
+{
+    return _anetTcpServer(err, port, bindaddr, AF_INET6, backlog, ANET_REUSEPORT);
 }
 
 int anetUnixServer(char *err, char *path, mode_t perm, int backlog)
@@ -0,0 +1,354 @@
+/* Background KEYS.
+ *
+ * KEYS against a big database blocks the server for as long as it takes to
+ * visit and match every key. Against databases with at least
+ * keys-background-threshold keys, the client is instead blocked
+ * (BLOCKED_KEYS), and the keyspace is visited incrementally with
+ * dictScan(), a slice of time for every event loop iteration, so that the
+ * server keeps serving the other clients meanwhile. The keys found are
+ * copied in batches that are matched against the pattern by the
+ * BIO_KEYS_MATCH bio thread, and the matched batches are handed back to the
+ * main thread. Once the scan is over and all the batches were matched, the
+ * keys are sent to the client, that is finally unblocked.
+ *
+ * The keyspace is not frozen, so the reply has the same guarantees of a
+ * full SCAN: keys that exist for the whole duration of the command are
+ * reported, keys added or removed meanwhile may be reported or not. Keys
+ * may be reported multiple times only if the hash table shrinks while it
+ * is scanned, so the databases scanned by a background KEYS are not
+ * resized, and KEYS is not started in background against a database that
+ * is already shrinking.
+ *
+ * SWAPDB restarts the jobs scanning the swapped databases, so that the
+ * keys reported are the ones of the database the client selected, as it
+ * is after the swap. A restarted job waits for the database swapped in to
+ * complete shrinking, if needed, before scanning it.
+ *
+ * KEYS is always executed in the foreground by clients that can't block:
+ * inside MULTI/EXEC, Lua scripts and modules. */
+
+#include "server.h"
+#include "bio.h"
+
+#define BGKEYS_BATCH_LEN 1024   /* Keys matched by each bio job. */
+#define BGKEYS_MAX_PENDING 64   /* Max batches of a job queued to bio. */
+#define BGKEYS_STEP_US 1000     /* Scan time for every event loop iteration. */
+
+typedef struct bgkeysBatch {
+    struct bgkeysJob *job;
+    unsigned long gen;      /* Generation of the job that created it. */
+    int count;
+    sds keys[BGKEYS_BATCH_LEN];
+} bgkeysBatch;
+
+typedef struct bgkeysJob {
+    client *c;              /* Client to reply to, or NULL if it was
+                               unblocked before the job completed. */
+    int dbid;               /* ID of the scanned database. */
+    unsigned long gen;      /* Incremented when the job is restarted. */
+    stringmatchPattern *matcher; /* Compiled pattern, or NULL if it is "*".
+                                    Read only, used by the bio thread. */
+    int scanned;            /* True once the scan is complete. */
+    unsigned long cursor;   /* dictScan() cursor. */
+    bgkeysBatch *batch;     /* Batch being filled by the scan, or NULL. */
+    unsigned long pending;  /* Batches queued to the bio thread. */
+    list *matched;          /* Batches of matching keys. */
+    unsigned long nummatched; /* Keys in the matched batches. */
+} bgkeysJob;
+
+static list *bgkeys_jobs = NULL;    /* Active jobs, main thread only. */
+static long long bgkeys_timer = -1; /* Time event running the jobs. */
+
+/* Batches matched by the bio thread, not yet collected by the main thread. */
+static list *bgkeys_done = NULL;
+static pthread_mutex_t bgkeys_done_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Free a batch and the keys it contains. */
+static void bgkeysFreeBatch(bgkeysBatch *b) {
+    int j;
+
+    for (j = 0; j < b->count; j++) sdsfree(b->keys[j]);
+    zfree(b);
+}
+
+/* Take ownership of a batch of matching keys, or free it if the client of
+ * the job is gone, or if the job was restarted after the batch was created. */
+static void bgkeysAddMatched(bgkeysJob *job, bgkeysBatch *b) {
+    if (job->c == NULL || b->gen != job->gen || b->count == 0) {
+        bgkeysFreeBatch(b);
+        return;
+    }
+    listAddNodeTail(job->matched,b);
+    job->nummatched += b->count;
+}
+
+/* Drop the keys matched so far, to release memory early once the client
+ * of the job is gone. */
+static void bgkeysFreeMatched(bgkeysJob *job) {
+    while (listLength(job->matched)) {
+        listNode *ln = listFirst(job->matched);
+
+        bgkeysFreeBatch(ln->value);
+        listDelNode(job->matched,ln);
+    }
+    job->nummatched = 0;
+}
+
+/* Send the batch being filled by the scan to the bio thread. With the "*"
+ * pattern every key matches, so the batch is taken directly. */
+static void bgkeysSubmitBatch(bgkeysJob *job) {
+    bgkeysBatch *b = job->batch;
+
+    if (b == NULL) return;
+    job->batch = NULL;
+    if (job->matcher == NULL) {
+        bgkeysAddMatched(job,b);
+    } else {
+        job->pending++;
+        bioCreateBackgroundJob(BIO_KEYS_MATCH,b,NULL,NULL);
+    }
+}
+
+/* Remove from the batch the keys not matching the pattern of the job, then
+ * hand the batch back to the main thread. Called by the bio thread: the
+ * job itself is not released while it has pending batches, and its compiled
+ * pattern is never modified. */
+void bgkeysMatchBatchFromBioThread(void *batch) {
+    bgkeysBatch *b = batch;
+    stringmatchPattern *matcher = b->job->matcher;
+    int j, matched = 0;
+
+    for (j = 0; j < b->count; j++) {
+        sds key = b->keys[j];
+
+        if (stringmatchCompiled(matcher,key,sdslen(key)))
+            b->keys[matched++] = key;
+        else
+            sdsfree(key);
+    }
+    b->count = matched;
+
+    pthread_mutex_lock(&bgkeys_done_mutex);
+    listAddNodeTail(bgkeys_done,b);
+    pthread_mutex_unlock(&bgkeys_done_mutex);
+}
+
+/* Collect the batches matched by the bio thread. */
+static void bgkeysCollectMatched(void) {
+    pthread_mutex_lock(&bgkeys_done_mutex);
+    while (listLength(bgkeys_done)) {
+        listNode *ln = listFirst(bgkeys_done);
+        bgkeysBatch *b = ln->value;
+
+        listDelNode(bgkeys_done,ln);
+        b->job->pending--;
+        bgkeysAddMatched(b->job,b);
+    }
+    pthread_mutex_unlock(&bgkeys_done_mutex);
+}
+
+/* dictScan() callback copying the keys not logically expired into the
+ * current batch of the job. */
+static void bgkeysScanCallback(void *privdata, const dictEntry *de) {
+    bgkeysJob *job = privdata;
+    sds key = dictGetKey(de);
+
+    if (keyEntryIsExpired(server.db+job->dbid,(dictEntry*)de)) return;
+    if (job->batch == NULL) {
+        job->batch = zmalloc(sizeof(bgkeysBatch));
+        job->batch->job = job;
+        job->batch->gen = job->gen;
+        job->batch->count = 0;
+    }
+    job->batch->keys[job->batch->count++] = sdsdup(key);
+    if (job->batch->count == BGKEYS_BATCH_LEN) bgkeysSubmitBatch(job);
+}
+
+/* Return true if the hash table is being rehashed to a smaller one. */
+static int bgkeysDictIsShrinking(dict *d) {
+    return dictIsRehashing(d) && d->ht[1].size < d->ht[0].size;
+}
+
+/* Scan the database of the job until 'deadline' (in microseconds), the end
+ * of the scan, or until too many batches are waiting for the bio thread. */
+static void bgkeysScan(bgkeysJob *job, long long deadline) {
+    dict *d = server.db[job->dbid].dict;
+    long iterations = 0;
+
+    /* A job restarted by SWAPDB may find the database shrinking: rehash it
+     * a millisecond at a time before starting the scan. */
+    if (job->cursor == 0 && bgkeysDictIsShrinking(d)) {
+        if (d->iterators == 0) dictRehashMilliseconds(d,1);
+        if (bgkeysDictIsShrinking(d)) return;
+    }
+
+    while (job->pending < BGKEYS_MAX_PENDING) {
+        job->cursor = dictScan(d,job->cursor,bgkeysScanCallback,NULL,job);
+        if (job->cursor == 0) {
+            job->scanned = 1;
+            break;
+        }
+        if ((++iterations & 63) == 0 && ustime() >= deadline) break;
+    }
+    bgkeysSubmitBatch(job);
+}
+
+/* Release a job with no pending batches. */
+static void bgkeysFreeJob(bgkeysJob *job) {
+    serverAssert(job->pending == 0 && job->c == NULL);
+    if (job->batch) bgkeysFreeBatch(job->batch);
+    bgkeysFreeMatched(job);
+    listRelease(job->matched);
+    stringmatchFree(job->matcher);
+    zfree(job);
+}
+
+/* Time event running the background KEYS jobs: it is rescheduled to run
+ * at every event loop iteration as long as there are keys to scan, and
+ * every millisecond while only waiting for the bio thread. */
+static int bgkeysCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
+    long long deadline = ustime()+BGKEYS_STEP_US;
+    int scanning = 0;
+    listNode *ln;
+    listIter li;
+    UNUSED(eventLoop);
+    UNUSED(id);
+    UNUSED(clientData);
+
+    bgkeysCollectMatched();
+
+    /* Start from a different job every time, so that the time slice is
+     * shared among jobs. */
+    listRotate(bgkeys_jobs);
+    listRewind(bgkeys_jobs,&li);
+    while((ln = listNext(&li))) {
+        bgkeysJob *job = ln->value;
+
+        if (job->c && !job->scanned) {
+            if (job->pending < BGKEYS_MAX_PENDING && ustime() < deadline)
+                bgkeysScan(job,deadline);
+            if (!job->scanned) scanning = 1;
+        }
+        if (job->c && job->scanned && job->pending == 0) {
+            replyToBackgroundKeysClient(job->c);
+            unblockClient(job->c);
+        }
+        if (job->c == NULL && job->pending == 0) {
+            bgkeysFreeJob(job);
+            listDelNode(bgkeys_jobs,ln);
+        }
+    }
+
+    if (listLength(bgkeys_jobs) == 0) {
+        bgkeys_timer = -1;
+        return AE_NOMORE;
+    }
+    return scanning ? 0 : 1;
+}
+
+/* Called by KEYS: if the command should run in background, block the
+ * client, start the job and return 1. Otherwise 0 is returned and the
+ * caller should execute the command in the foreground. */
+int startBackgroundKeys(client *c, sds pattern) {
+    dict *d = c->db->dict;
+    bgkeysJob *job;
+
+    if (server.keys_background_threshold == 0 ||
+        dictSize(d) < server.keys_background_threshold ||
+        c->flags & (CLIENT_MULTI|CLIENT_LUA|CLIENT_MODULE)) return 0;
+    if (bgkeysDictIsShrinking(d)) return 0;
+
+    if (bgkeys_jobs == NULL) {
+        bgkeys_jobs = listCreate();
+        bgkeys_done = listCreate();
+    }
+    job = zmalloc(sizeof(*job));
+    job->c = c;
+    job->dbid = c->db->id;
+    job->gen = 0;
+    job->matcher = (pattern[0] == '*' && pattern[1] == '\0') ? NULL :
+                   stringmatchCompile(pattern,sdslen(pattern),0);
+    job->scanned = 0;
+    job->cursor = 0;
+    job->batch = NULL;
+    job->pending = 0;
+    job->matched = listCreate();
+    job->nummatched = 0;
+    listAddNodeTail(bgkeys_jobs,job);
+
+    c->bpop.keys_job = job;
+    c->bpop.timeout = 0;
+    blockClient(c,BLOCKED_KEYS);
+    if (bgkeys_timer == -1)
+        bgkeys_timer = aeCreateTimeEvent(server.el,0,bgkeysCron,NULL,NULL);
+    return 1;
+}
+
+/* Reply to a client blocked in a background KEYS with the keys matched so
+ * far: all of them if the job is complete. */
+void replyToBackgroundKeysClient(client *c) {
+    bgkeysJob *job = c->bpop.keys_job;
+    listNode *ln;
+    listIter li;
+    int j;
+
+    addReplyMultiBulkLen(c,job->nummatched);
+    listRewind(job->matched,&li);
+    while((ln = listNext(&li))) {
+        bgkeysBatch *b = ln->value;
+
+        for (j = 0; j < b->count; j++)
+            addReplyBulkCBuffer(c,b->keys[j],sdslen(b->keys[j]));
+    }
+}
+
+/* Detach the job from a client that gets unblocked: the job is released
+ * by bgkeysCron() once the bio thread is done with its batches. */
+void unblockClientFromBackgroundKeys(client *c) {
+    bgkeysJob *job = c->bpop.keys_job;
+
+    job->c = NULL;
+    bgkeysFreeMatched(job);
+    c->bpop.keys_job = NULL;
+}
+
+/* Return true if a background KEYS is scanning the database, so that its
+ * hash table should not be resized. */
+int backgroundKeysScanningDb(redisDb *db) {
+    listNode *ln;
+    listIter li;
+
+    if (bgkeys_jobs == NULL) return 0;
+    listRewind(bgkeys_jobs,&li);
+    while((ln = listNext(&li))) {
+        bgkeysJob *job = ln->value;
+
+        if (job->c && !job->scanned && job->dbid == db->id) return 1;
+    }
+    return 0;
+}
+
+/* Called by SWAPDB: restart the jobs scanning one of the swapped databases.
+ * The keys collected so far are dropped, and the batches still queued to
+ * the bio thread will be dropped when they come back. */
+void backgroundKeysSwapDb(int id1, int id2) {
+    listNode *ln;
+    listIter li;
+
+    if (bgkeys_jobs == NULL) return;
+    listRewind(bgkeys_jobs,&li);
+    while((ln = listNext(&li))) {
+        bgkeysJob *job = ln->value;
+
+        if (job->c == NULL || (job->dbid != id1 && job->dbid != id2))
+            continue;
+        if (job->batch) {
+            bgkeysFreeBatch(job->batch);
+            job->batch = NULL;
+        }
+        bgkeysFreeMatched(job);
+        job->gen++;
+        job->scanned = 0;
+        job->cursor = 0;
+    }
+}
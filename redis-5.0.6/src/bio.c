@@ -85,8 +85,8 @@ struct bio_job {
 
 void *bioProcessBackgroundJobs(void *arg);
 void lazyfreeFreeObjectFromBioThread(robj *o);
-void lazyfreeFreeDatabaseFromBioThread(dict *ht1, dict *ht2);
-void lazyfreeFreeSlotsMapFromBioThread(zskiplist *sl);
+void lazyfreeFreeDatabaseFromBioThread(dict *ht, expireIndex *ei);
+void bgkeysMatchBatchFromBioThread(void *batch);
 
 /* Make sure we have enough stack to perform all the things we do in the
  * main thread. */
@@ -191,14 +191,13 @@ void *bioProcessBackgroundJobs(void *arg) {
         } else if (type == BIO_LAZY_FREE) {
             /* What we free changes depending on what arguments are set:
              * arg1 -> free the object at pointer.
-             * arg2 & arg3 -> free two dictionaries (a Redis DB).
-             * only arg3 -> free the skiplist. */
+             * arg2 & arg3 -> free a dictionary and an expire index (a Redis DB). */
             if (job->arg1)
                 lazyfreeFreeObjectFromBioThread(job->arg1);
             else if (job->arg2 && job->arg3)
                 lazyfreeFreeDatabaseFromBioThread(job->arg2,job->arg3);
-            else if (job->arg3)
-                lazyfreeFreeSlotsMapFromBioThread(job->arg3);
+        } else if (type == BIO_KEYS_MATCH) {
+            bgkeysMatchBatchFromBioThread(job->arg1);
         } else {
             serverPanic("Wrong job type in bioProcessBackgroundJobs().");
         }
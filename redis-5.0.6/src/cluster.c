@@ -487,7 +487,7 @@ void clusterInit(void) {
     }
 
     if (listenToPort(server.port+CLUSTER_PORT_INCR,
-        server.cfd,&server.cfd_count) == C_ERR)
+        server.cfd,&server.cfd_count,1) == C_ERR)
     {
         exit(1);
     } else {
@@ -501,10 +501,9 @@ void clusterInit(void) {
         }
     }
 
-    /* The slots -> keys map is a radix tree. Initialize it here. */
-    server.cluster->slots_to_keys = raxNew();
-    memset(server.cluster->slots_keys_count,0,
-           sizeof(server.cluster->slots_keys_count));
+    /* The slots -> keys map links the main dict entries. Initialize it. */
+    memset(server.cluster->slots_to_keys,0,
+           sizeof(server.cluster->slots_to_keys));
 
     /* Set myself->port / cport to my listening ports, we'll just need to
      * discover the IP address via MEET messages. */
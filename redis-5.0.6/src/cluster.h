@@ -140,6 +140,13 @@ typedef struct clusterNode {
     list *fail_reports;         /* List of nodes signaling this as failing */
 } clusterNode;
 
+/* Keys of a hash slot: the main dict entries of the keys are linked in a
+ * list, see slotToKeyAdd(). */
+typedef struct slotToKeys {
+    struct dictEntry *head;     /* First entry of the slot, or NULL. */
+    uint64_t count;             /* Number of keys in the slot. */
+} slotToKeys;
+
 typedef struct clusterState {
     clusterNode *myself;  /* This node */
     uint64_t currentEpoch;
@@ -150,8 +157,7 @@ typedef struct clusterState {
     clusterNode *migrating_slots_to[CLUSTER_SLOTS];
     clusterNode *importing_slots_from[CLUSTER_SLOTS];
     clusterNode *slots[CLUSTER_SLOTS];
-    uint64_t slots_keys_count[CLUSTER_SLOTS];
-    rax *slots_to_keys;
+    slotToKeys slots_to_keys[CLUSTER_SLOTS];
     /* The following fields are used to take the slave state on elections. */
     mstime_t failover_auth_time; /* Time of previous or next election. */
     int failover_auth_count;    /* Number of votes received so far. */
@@ -84,6 +84,12 @@ configEnum supervised_mode_enum[] = {
     {NULL, 0}
 };
 
+configEnum hash_function_enum[] = {
+    {"siphash", DICT_HASH_SIPHASH},
+    {"aesni", DICT_HASH_AESNI},
+    {NULL, 0}
+};
+
 configEnum aof_fsync_enum[] = {
     {"everysec", AOF_FSYNC_EVERYSEC},
     {"always", AOF_FSYNC_ALWAYS},
@@ -226,6 +232,32 @@ void loadServerConfigFromString(char *config) {
             if (server.tcp_backlog < 0) {
                 err = "Invalid backlog value"; goto loaderr;
             }
+        } else if (!strcasecmp(argv[0],"tcp-listen-sockets") && argc == 2) {
+            server.tcp_listen_sockets = atoi(argv[1]);
+            if (server.tcp_listen_sockets < 1 ||
+                server.tcp_listen_sockets > CONFIG_MAX_TCP_LISTEN_SOCKETS)
+            {
+                err = "Invalid number of listening sockets"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"tcp-defer-accept") && argc == 2) {
+            server.tcp_defer_accept = atoi(argv[1]);
+            if (server.tcp_defer_accept < 0) {
+                err = "Invalid TCP_DEFER_ACCEPT timeout"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"tcp-fastopen") && argc == 2) {
+            server.tcp_fastopen = atoi(argv[1]);
+            if (server.tcp_fastopen < 0) {
+                err = "Invalid TCP_FASTOPEN queue length"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"io-threads") && argc == 2) {
+            server.io_threads_num = atoi(argv[1]);
+            if (server.io_threads_num < 1 || server.io_threads_num > 128) {
+                err = "Invalid number of I/O threads"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"io-threads-do-reads") && argc == 2) {
+            if ((server.io_threads_do_reads = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
         } else if (!strcasecmp(argv[0],"bind") && argc >= 2) {
             int j, addresses = argc-1;
 
@@ -332,6 +364,8 @@ void loadServerConfigFromString(char *config) {
             server.proto_max_bulk_len = memtoll(argv[1],NULL);
         } else if ((!strcasecmp(argv[0],"client-query-buffer-limit")) && argc == 2) {
             server.client_max_querybuf_len = memtoll(argv[1],NULL);
+        } else if ((!strcasecmp(argv[0],"client-output-buffer-total-limit")) && argc == 2) {
+            server.client_obuf_total_limit = memtoll(argv[1],NULL);
         } else if (!strcasecmp(argv[0],"lfu-log-factor") && argc == 2) {
             server.lfu_log_factor = atoi(argv[1]);
             if (server.lfu_log_factor < 0) {
@@ -598,6 +632,10 @@ void loadServerConfigFromString(char *config) {
             server.list_compress_depth = atoi(argv[1]);
         } else if (!strcasecmp(argv[0],"set-max-intset-entries") && argc == 2) {
             server.set_max_intset_entries = memtoll(argv[1], NULL);
+        } else if (!strcasecmp(argv[0],"set-max-listpack-entries") && argc == 2) {
+            server.set_max_listpack_entries = memtoll(argv[1], NULL);
+        } else if (!strcasecmp(argv[0],"set-max-listpack-value") && argc == 2) {
+            server.set_max_listpack_value = memtoll(argv[1], NULL);
         } else if (!strcasecmp(argv[0],"zset-max-ziplist-entries") && argc == 2) {
             server.zset_max_ziplist_entries = memtoll(argv[1], NULL);
         } else if (!strcasecmp(argv[0],"zset-max-ziplist-value") && argc == 2) {
@@ -694,6 +732,10 @@ void loadServerConfigFromString(char *config) {
             }
         } else if (!strcasecmp(argv[0],"lua-time-limit") && argc == 2) {
             server.lua_time_limit = strtoll(argv[1],NULL,10);
+        } else if (!strcasecmp(argv[0],"keys-background-threshold") &&
+                   argc == 2)
+        {
+            server.keys_background_threshold = strtoll(argv[1],NULL,10);
         } else if (!strcasecmp(argv[0],"lua-replicate-commands") && argc == 2) {
             server.lua_always_replicate_commands = yesnotoi(argv[1]);
         } else if (!strcasecmp(argv[0],"slowlog-log-slower-than") &&
@@ -786,6 +828,15 @@ void loadServerConfigFromString(char *config) {
                     "Allowed values: 'upstart', 'systemd', 'auto', or 'no'";
                 goto loaderr;
             }
+        } else if (!strcasecmp(argv[0],"hash-function") && argc == 2) {
+            server.hash_function =
+                configEnumGetValue(hash_function_enum,argv[1]);
+
+            if (server.hash_function == INT_MIN) {
+                err = "Invalid option for 'hash-function'. "
+                    "Allowed values: 'siphash' or 'aesni'";
+                goto loaderr;
+            }
         } else if (!strcasecmp(argv[0],"loadmodule") && argc >= 2) {
             queueLoadModule(argv[1],&argv[2],argc-2);
         } else if (!strcasecmp(argv[0],"sentinel")) {
@@ -1170,6 +1221,10 @@ void configSetCommand(client *c) {
       "list-compress-depth",server.list_compress_depth,0,INT_MAX) {
     } config_set_numerical_field(
       "set-max-intset-entries",server.set_max_intset_entries,0,LONG_MAX) {
+    } config_set_numerical_field(
+      "set-max-listpack-entries",server.set_max_listpack_entries,0,LONG_MAX) {
+    } config_set_numerical_field(
+      "set-max-listpack-value",server.set_max_listpack_value,0,LONG_MAX) {
     } config_set_numerical_field(
       "zset-max-ziplist-entries",server.zset_max_ziplist_entries,0,LONG_MAX) {
     } config_set_numerical_field(
@@ -1178,6 +1233,8 @@ void configSetCommand(client *c) {
       "hll-sparse-max-bytes",server.hll_sparse_max_bytes,0,LONG_MAX) {
     } config_set_numerical_field(
       "lua-time-limit",server.lua_time_limit,0,LONG_MAX) {
+    } config_set_numerical_field(
+      "keys-background-threshold",server.keys_background_threshold,0,LONG_MAX) {
     } config_set_numerical_field(
       "slowlog-log-slower-than",server.slowlog_log_slower_than,-1,LLONG_MAX) {
     } config_set_numerical_field(
@@ -1254,6 +1311,10 @@ void configSetCommand(client *c) {
       "proto-max-bulk-len",server.proto_max_bulk_len) {
     } config_set_memory_field(
       "client-query-buffer-limit",server.client_max_querybuf_len) {
+    } config_set_memory_field(
+      "client-output-buffer-total-limit",server.client_obuf_total_limit) {
+        rebuildClientOutputBufferMemoryIndex();
+        enforceClientOutputBufferTotalLimit();
     } config_set_memory_field("repl-backlog-size",ll) {
         resizeReplicationBacklog(ll);
     } config_set_memory_field("auto-aof-rewrite-min-size",ll) {
@@ -1345,6 +1406,7 @@ void configGetCommand(client *c) {
     config_get_numerical_field("maxmemory",server.maxmemory);
     config_get_numerical_field("proto-max-bulk-len",server.proto_max_bulk_len);
     config_get_numerical_field("client-query-buffer-limit",server.client_max_querybuf_len);
+    config_get_numerical_field("client-output-buffer-total-limit",server.client_obuf_total_limit);
     config_get_numerical_field("maxmemory-samples",server.maxmemory_samples);
     config_get_numerical_field("lfu-log-factor",server.lfu_log_factor);
     config_get_numerical_field("lfu-decay-time",server.lfu_decay_time);
@@ -1373,6 +1435,10 @@ void configGetCommand(client *c) {
             server.list_compress_depth);
     config_get_numerical_field("set-max-intset-entries",
             server.set_max_intset_entries);
+    config_get_numerical_field("set-max-listpack-entries",
+            server.set_max_listpack_entries);
+    config_get_numerical_field("set-max-listpack-value",
+            server.set_max_listpack_value);
     config_get_numerical_field("zset-max-ziplist-entries",
             server.zset_max_ziplist_entries);
     config_get_numerical_field("zset-max-ziplist-value",
@@ -1380,6 +1446,7 @@ void configGetCommand(client *c) {
     config_get_numerical_field("hll-sparse-max-bytes",
             server.hll_sparse_max_bytes);
     config_get_numerical_field("lua-time-limit",server.lua_time_limit);
+    config_get_numerical_field("keys-background-threshold",server.keys_background_threshold);
     config_get_numerical_field("slowlog-log-slower-than",
             server.slowlog_log_slower_than);
     config_get_numerical_field("latency-monitor-threshold",
@@ -1390,6 +1457,10 @@ void configGetCommand(client *c) {
     config_get_numerical_field("cluster-announce-port",server.cluster_announce_port);
     config_get_numerical_field("cluster-announce-bus-port",server.cluster_announce_bus_port);
     config_get_numerical_field("tcp-backlog",server.tcp_backlog);
+    config_get_numerical_field("tcp-listen-sockets",server.tcp_listen_sockets);
+    config_get_numerical_field("tcp-defer-accept",server.tcp_defer_accept);
+    config_get_numerical_field("tcp-fastopen",server.tcp_fastopen);
+    config_get_numerical_field("io-threads",server.io_threads_num);
     config_get_numerical_field("databases",server.dbnum);
     config_get_numerical_field("repl-ping-slave-period",server.repl_ping_slave_period);
     config_get_numerical_field("repl-ping-replica-period",server.repl_ping_slave_period);
@@ -1467,6 +1538,8 @@ void configGetCommand(client *c) {
             server.repl_slave_lazy_flush);
     config_get_bool_field("dynamic-hz",
             server.dynamic_hz);
+    config_get_bool_field("io-threads-do-reads",
+            server.io_threads_do_reads);
 
     /* Enum values */
     config_get_enum_field("maxmemory-policy",
@@ -1475,6 +1548,8 @@ void configGetCommand(client *c) {
             server.verbosity,loglevel_enum);
     config_get_enum_field("supervised",
             server.supervised_mode,supervised_mode_enum);
+    config_get_enum_field("hash-function",
+            server.hash_function,hash_function_enum);
     config_get_enum_field("appendfsync",
             server.aof_fsync,aof_fsync_enum);
     config_get_enum_field("syslog-facility",
@@ -2125,6 +2200,10 @@ int rewriteConfig(char *path) {
     rewriteConfigNumericalOption(state,"cluster-announce-port",server.cluster_announce_port,CONFIG_DEFAULT_CLUSTER_ANNOUNCE_PORT);
     rewriteConfigNumericalOption(state,"cluster-announce-bus-port",server.cluster_announce_bus_port,CONFIG_DEFAULT_CLUSTER_ANNOUNCE_BUS_PORT);
     rewriteConfigNumericalOption(state,"tcp-backlog",server.tcp_backlog,CONFIG_DEFAULT_TCP_BACKLOG);
+    rewriteConfigNumericalOption(state,"tcp-listen-sockets",server.tcp_listen_sockets,CONFIG_DEFAULT_TCP_LISTEN_SOCKETS);
+    rewriteConfigNumericalOption(state,"tcp-defer-accept",server.tcp_defer_accept,CONFIG_DEFAULT_TCP_DEFER_ACCEPT);
+    rewriteConfigNumericalOption(state,"tcp-fastopen",server.tcp_fastopen,CONFIG_DEFAULT_TCP_FASTOPEN);
+    rewriteConfigNumericalOption(state,"io-threads",server.io_threads_num,CONFIG_DEFAULT_IO_THREADS_NUM);
     rewriteConfigBindOption(state);
     rewriteConfigStringOption(state,"unixsocket",server.unixsocket,NULL);
     rewriteConfigOctalOption(state,"unixsocketperm",server.unixsocketperm,CONFIG_DEFAULT_UNIX_SOCKET_PERM);
@@ -2165,6 +2244,7 @@ int rewriteConfig(char *path) {
     rewriteConfigBytesOption(state,"maxmemory",server.maxmemory,CONFIG_DEFAULT_MAXMEMORY);
     rewriteConfigBytesOption(state,"proto-max-bulk-len",server.proto_max_bulk_len,CONFIG_DEFAULT_PROTO_MAX_BULK_LEN);
     rewriteConfigBytesOption(state,"client-query-buffer-limit",server.client_max_querybuf_len,PROTO_MAX_QUERYBUF_LEN);
+    rewriteConfigBytesOption(state,"client-output-buffer-total-limit",server.client_obuf_total_limit,CONFIG_DEFAULT_CLIENT_OBUF_TOTAL_LIMIT);
     rewriteConfigEnumOption(state,"maxmemory-policy",server.maxmemory_policy,maxmemory_policy_enum,CONFIG_DEFAULT_MAXMEMORY_POLICY);
     rewriteConfigNumericalOption(state,"maxmemory-samples",server.maxmemory_samples,CONFIG_DEFAULT_MAXMEMORY_SAMPLES);
     rewriteConfigNumericalOption(state,"lfu-log-factor",server.lfu_log_factor,CONFIG_DEFAULT_LFU_LOG_FACTOR);
@@ -2182,6 +2262,7 @@ int rewriteConfig(char *path) {
     rewriteConfigNumericalOption(state,"auto-aof-rewrite-percentage",server.aof_rewrite_perc,AOF_REWRITE_PERC);
     rewriteConfigBytesOption(state,"auto-aof-rewrite-min-size",server.aof_rewrite_min_size,AOF_REWRITE_MIN_SIZE);
     rewriteConfigNumericalOption(state,"lua-time-limit",server.lua_time_limit,LUA_SCRIPT_TIME_LIMIT);
+    rewriteConfigNumericalOption(state,"keys-background-threshold",server.keys_background_threshold,CONFIG_DEFAULT_KEYS_BACKGROUND_THRESHOLD);
     rewriteConfigYesNoOption(state,"cluster-enabled",server.cluster_enabled,0);
     rewriteConfigStringOption(state,"cluster-config-file",server.cluster_configfile,CONFIG_DEFAULT_CLUSTER_CONFIG_FILE);
     rewriteConfigYesNoOption(state,"cluster-require-full-coverage",server.cluster_require_full_coverage,CLUSTER_DEFAULT_REQUIRE_FULL_COVERAGE);
@@ -2200,6 +2281,8 @@ int rewriteConfig(char *path) {
     rewriteConfigNumericalOption(state,"list-max-ziplist-size",server.list_max_ziplist_size,OBJ_LIST_MAX_ZIPLIST_SIZE);
     rewriteConfigNumericalOption(state,"list-compress-depth",server.list_compress_depth,OBJ_LIST_COMPRESS_DEPTH);
     rewriteConfigNumericalOption(state,"set-max-intset-entries",server.set_max_intset_entries,OBJ_SET_MAX_INTSET_ENTRIES);
+    rewriteConfigNumericalOption(state,"set-max-listpack-entries",server.set_max_listpack_entries,OBJ_SET_MAX_LISTPACK_ENTRIES);
+    rewriteConfigNumericalOption(state,"set-max-listpack-value",server.set_max_listpack_value,OBJ_SET_MAX_LISTPACK_VALUE);
     rewriteConfigNumericalOption(state,"zset-max-ziplist-entries",server.zset_max_ziplist_entries,OBJ_ZSET_MAX_ZIPLIST_ENTRIES);
     rewriteConfigNumericalOption(state,"zset-max-ziplist-value",server.zset_max_ziplist_value,OBJ_ZSET_MAX_ZIPLIST_VALUE);
     rewriteConfigNumericalOption(state,"hll-sparse-max-bytes",server.hll_sparse_max_bytes,CONFIG_DEFAULT_HLL_SPARSE_MAX_BYTES);
@@ -2213,11 +2296,13 @@ int rewriteConfig(char *path) {
     rewriteConfigYesNoOption(state,"aof-load-truncated",server.aof_load_truncated,CONFIG_DEFAULT_AOF_LOAD_TRUNCATED);
     rewriteConfigYesNoOption(state,"aof-use-rdb-preamble",server.aof_use_rdb_preamble,CONFIG_DEFAULT_AOF_USE_RDB_PREAMBLE);
     rewriteConfigEnumOption(state,"supervised",server.supervised_mode,supervised_mode_enum,SUPERVISED_NONE);
+    rewriteConfigEnumOption(state,"hash-function",server.hash_function,hash_function_enum,CONFIG_DEFAULT_HASH_FUNCTION);
     rewriteConfigYesNoOption(state,"lazyfree-lazy-eviction",server.lazyfree_lazy_eviction,CONFIG_DEFAULT_LAZYFREE_LAZY_EVICTION);
     rewriteConfigYesNoOption(state,"lazyfree-lazy-expire",server.lazyfree_lazy_expire,CONFIG_DEFAULT_LAZYFREE_LAZY_EXPIRE);
     rewriteConfigYesNoOption(state,"lazyfree-lazy-server-del",server.lazyfree_lazy_server_del,CONFIG_DEFAULT_LAZYFREE_LAZY_SERVER_DEL);
     rewriteConfigYesNoOption(state,"replica-lazy-flush",server.repl_slave_lazy_flush,CONFIG_DEFAULT_SLAVE_LAZY_FLUSH);
     rewriteConfigYesNoOption(state,"dynamic-hz",server.dynamic_hz,CONFIG_DEFAULT_DYNAMIC_HZ);
+    rewriteConfigYesNoOption(state,"io-threads-do-reads",server.io_threads_do_reads,CONFIG_DEFAULT_IO_THREADS_DO_READS);
 
     /* Rewrite Sentinel config if in Sentinel mode. */
     if (server.sentinel_mode) rewriteConfigSentinelOption(state);
@@ -78,6 +78,12 @@
 #define HAVE_EPOLL 1
 #endif
 
+/* The io_uring backend needs Linux 5.11 or greater at runtime, so it is
+ * only used when explicitly requested at build time (make USE_IOURING=yes). */
+#if defined(__linux__) && defined(USE_IOURING)
+#define HAVE_IOURING 1
+#endif
+
 #if (defined(__APPLE__) && defined(MAC_OS_X_VERSION_10_6)) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined (__NetBSD__)
 #define HAVE_KQUEUE 1
 #endif
@@ -39,6 +39,8 @@
  *----------------------------------------------------------------------------*/
 
 int keyIsExpired(redisDb *db, robj *key);
+static int deleteExpiredKey(redisDb *db, robj *key);
+static robj *lookupKeyReadEntry(redisDb *db, robj *key, dictEntry *de, int flags);
 
 /* Update LFU when an object is accessed.
  * Firstly, decrement the counter if the decrement time is reached.
@@ -49,31 +51,33 @@ void updateLFU(robj *val) {
     val->lru = (LFUGetTimeInMinutes()<<8) | counter;
 }
 
+/* Return the value of the main dict entry 'de' found by a lookup, updating
+ * the access time of the key according to 'flags'. */
+static robj *lookupKeyEntry(dictEntry *de, int flags) {
+    robj *val = dictGetVal(de);
+
+    /* Update the access time for the ageing algorithm.
+     * Don't do it if we have a saving child, as this will trigger
+     * a copy on write madness. */
+    if (server.rdb_child_pid == -1 &&
+        server.aof_child_pid == -1 &&
+        !(flags & LOOKUP_NOTOUCH))
+    {
+        if (server.maxmemory_policy & MAXMEMORY_FLAG_LFU) {
+            updateLFU(val);
+        } else {
+            val->lru = LRU_CLOCK();
+        }
+    }
+    return val;
+}
+
 /* Low level key lookup API, not actually called directly from commands
  * implementations that should instead rely on lookupKeyRead(),
  * lookupKeyWrite() and lookupKeyReadWithFlags(). */
 robj *lookupKey(redisDb *db, robj *key, int flags) {
     dictEntry *de = dictFind(db->dict,key->ptr);
-    if (de) {
-        robj *val = dictGetVal(de);
-
-        /* Update the access time for the ageing algorithm.
-         * Don't do it if we have a saving child, as this will trigger
-         * a copy on write madness. */
-        if (server.rdb_child_pid == -1 &&
-            server.aof_child_pid == -1 &&
-            !(flags & LOOKUP_NOTOUCH))
-        {
-            if (server.maxmemory_policy & MAXMEMORY_FLAG_LFU) {
-                updateLFU(val);
-            } else {
-                val->lru = LRU_CLOCK();
-            }
-        }
-        return val;
-    } else {
-        return NULL;
-    }
+    return de ? lookupKeyEntry(de,flags) : NULL;
 }
 
 /* Lookup a key for read operations, or return NULL if the key is not found
@@ -98,9 +102,15 @@ robj *lookupKey(redisDb *db, robj *key, int flags) {
  * correctly report a key is expired on slaves even if the master is lagging
  * expiring our key via DELs in the replication link. */
 robj *lookupKeyReadWithFlags(redisDb *db, robj *key, int flags) {
-    robj *val;
+    /* The expire time is stored in the entry, so a single lookup is needed
+     * both to check if the key is expired and to access its value. */
+    return lookupKeyReadEntry(db,key,dictFind(db->dict,key->ptr),flags);
+}
 
-    if (expireIfNeeded(db,key) == 1) {
+/* Implements lookupKeyReadWithFlags() given the main dict entry 'de' of
+ * the key, or NULL if the key does not exist. */
+static robj *lookupKeyReadEntry(redisDb *db, robj *key, dictEntry *de, int flags) {
+    if (de && keyEntryIsExpired(db,de) && deleteExpiredKey(db,key) == 1) {
         /* Key expired. If we are in the context of a master, expireIfNeeded()
          * returns 0 only when the key does not exist at all, so it's safe
          * to return NULL ASAP. */
@@ -130,12 +140,12 @@ robj *lookupKeyReadWithFlags(redisDb *db, robj *key, int flags) {
             return NULL;
         }
     }
-    val = lookupKey(db,key,flags);
-    if (val == NULL)
+    if (de == NULL) {
         server.stat_keyspace_misses++;
-    else
-        server.stat_keyspace_hits++;
-    return val;
+        return NULL;
+    }
+    server.stat_keyspace_hits++;
+    return lookupKeyEntry(de,flags);
 }
 
 /* Like lookupKeyReadWithFlags(), but does not use any flag, which is the
@@ -144,14 +154,68 @@ robj *lookupKeyRead(redisDb *db, robj *key) {
     return lookupKeyReadWithFlags(db,key,LOOKUP_NONE);
 }
 
+/* Like lookupKeyRead() for 'count' keys at once, storing the value of
+ * keys[j] (or NULL) in vals[j]. The keys are looked up in batches with
+ * dictFindBatch(), so that the cache misses of the different lookups
+ * overlap instead of being serialized.
+ *
+ * Looking up a key may expire it, and the keyspace notification hooks of
+ * modules may then overwrite or delete the keys already looked up, so the
+ * reference count of every value stored in 'vals' is incremented: the
+ * caller should call decrRefCount() on every non NULL value once done. */
+void lookupKeysRead(redisDb *db, robj **keys, int count, robj **vals) {
+    void *names[DICT_BATCH_SIZE];
+    dictEntry *des[DICT_BATCH_SIZE];
+    int j, k;
+
+    for (j = 0; j < count; j += DICT_BATCH_SIZE) {
+        int n = count-j < DICT_BATCH_SIZE ? count-j : DICT_BATCH_SIZE;
+        int expired = 0;
+
+        for (k = 0; k < n; k++) names[k] = keys[j+k]->ptr;
+        dictFindBatch(db->dict,names,n,des);
+        for (k = 0; k < n; k++) {
+            /* Expiring a key frees its entry, that may have been found
+             * again for a duplicated key, and calls the keyspace
+             * notification hooks of modules, that may change other keys
+             * as well: after the first expired key of the batch, the
+             * entries found by dictFindBatch() can't be trusted anymore. */
+            if (expired) des[k] = dictFind(db->dict,names[k]);
+            if (des[k] && keyEntryIsExpired(db,des[k])) expired = 1;
+            vals[j+k] = lookupKeyReadEntry(db,keys[j+k],des[k],LOOKUP_NONE);
+            if (vals[j+k]) incrRefCount(vals[j+k]);
+        }
+    }
+}
+
+/* Prefetch into the CPU caches the main dict entries and the values of the
+ * keys keys[0], keys[step], keys[step*2], ... up to 'count' keys, but no
+ * more than DICT_BATCH_SIZE, before operating on them one after the other.
+ * Commands operating on many keys call this every DICT_BATCH_SIZE keys. */
+void dbPrefetchKeys(redisDb *db, robj **keys, int count, int step) {
+    void *names[DICT_BATCH_SIZE];
+    int j;
+
+    if (count > DICT_BATCH_SIZE) count = DICT_BATCH_SIZE;
+    for (j = 0; j < count; j++) names[j] = keys[j*step]->ptr;
+    dictPrefetch(db->dict,names,count);
+}
+
 /* Lookup a key for write operations, and as a side effect, if needed, expires
  * the key if its TTL is reached.
  *
  * Returns the linked value object if the key exists or NULL if the key
  * does not exist in the specified DB. */
 robj *lookupKeyWrite(redisDb *db, robj *key) {
-    expireIfNeeded(db,key);
-    return lookupKey(db,key,LOOKUP_NONE);
+    dictEntry *de = dictFind(db->dict,key->ptr);
+
+    if (de == NULL) return NULL;
+    if (keyEntryIsExpired(db,de)) {
+        deleteExpiredKey(db,key);
+        /* Slaves don't delete expired keys, see expireIfNeeded(). */
+        if (server.masterhost == NULL) return NULL;
+    }
+    return lookupKeyEntry(de,LOOKUP_NONE);
 }
 
 robj *lookupKeyReadOrReply(client *c, robj *key, robj *reply) {
@@ -167,18 +231,20 @@ robj *lookupKeyWriteOrReply(client *c, robj *key, robj *reply) {
 }
 
 /* Add the key to the DB. It's up to the caller to increment the reference
- * counter of the value if needed.
+ * counter of the value if needed. The key name is copied inside the dict
+ * entry, so 'key' is not retained.
  *
  * The program is aborted if the key already exists. */
 void dbAdd(redisDb *db, robj *key, robj *val) {
-    sds copy = sdsdup(key->ptr);
-    int retval = dictAdd(db->dict, copy, val);
+    dictEntry *de = dictAddRaw(db->dict, key->ptr, NULL);
 
-    serverAssertWithInfo(NULL,key,retval == DICT_OK);
+    serverAssertWithInfo(NULL,key,de != NULL);
+    dictSetVal(db->dict, de, val);
+    dbEntryMetadata(db,de)->expire = -1;
     if (val->type == OBJ_LIST ||
         val->type == OBJ_ZSET)
         signalKeyAsReady(db, key);
-    if (server.cluster_enabled) slotToKeyAdd(key);
+    if (server.cluster_enabled) slotToKeyAdd(de);
 }
 
 /* Overwrite an existing key with a new value. Incrementing the reference
@@ -235,7 +301,7 @@ int dbExists(redisDb *db, robj *key) {
 robj *dbRandomKey(redisDb *db) {
     dictEntry *de;
     int maxtries = 100;
-    int allvolatile = dictSize(db->dict) == dictSize(db->expires);
+    int allvolatile = dictSize(db->dict) == expireIndexSize(db->expires);
 
     while(1) {
         sds key;
@@ -246,7 +312,7 @@ robj *dbRandomKey(redisDb *db) {
 
         key = dictGetKey(de);
         keyobj = createStringObject(key,sdslen(key));
-        if (dictFind(db->expires,key)) {
+        if (dbEntryMetadata(db,de)->expire != -1) {
             if (allvolatile && server.masterhost && --maxtries == 0) {
                 /* If the DB is composed only of keys with an expire set,
                  * it could happen that all the keys are already logically
@@ -269,11 +335,13 @@ robj *dbRandomKey(redisDb *db) {
 
 /* Delete a key, value, and associated expiration entry if any, from the DB */
 int dbSyncDelete(redisDb *db, robj *key) {
-    /* Deleting an entry from the expires dict will not free the sds of
-     * the key, because it is shared with the main dictionary. */
-    if (dictSize(db->expires) > 0) dictDelete(db->expires,key->ptr);
-    if (dictDelete(db->dict,key->ptr) == DICT_OK) {
-        if (server.cluster_enabled) slotToKeyDel(key);
+    dictEntry *de = dictUnlink(db->dict,key->ptr);
+    if (de) {
+        /* The expire index references the entry: remove it before the
+         * entry is freed. */
+        if (dbEntryMetadata(db,de)->expire != -1) expireIndexDel(db,de);
+        if (server.cluster_enabled) slotToKeyDel(de);
+        dictFreeUnlinkedEntry(db->dict,de);
         return 1;
     } else {
         return 0;
@@ -361,17 +429,14 @@ long long emptyDb(int dbnum, int flags, void(callback)(void*)) {
         if (async) {
             emptyDbAsync(&server.db[j]);
         } else {
+            /* The index only references the entries of the main dict. */
+            expireIndexRelease(server.db[j].expires);
+            server.db[j].expires = expireIndexCreate();
             dictEmpty(server.db[j].dict,callback);
-            dictEmpty(server.db[j].expires,callback);
-        }
-    }
-    if (server.cluster_enabled) {
-        if (async) {
-            slotToKeyFlushAsync();
-        } else {
-            slotToKeyFlush();
         }
     }
+    /* The slots -> keys lists are made of the entries just released. */
+    if (server.cluster_enabled) slotToKeyFlush();
     if (dbnum == -1) flushSlaveKeysWithExpireList();
     return removed;
 }
@@ -469,6 +534,8 @@ void delGenericCommand(client *c, int lazy) {
     int numdel = 0, j;
 
     for (j = 1; j < c->argc; j++) {
+        if ((j-1) % DICT_BATCH_SIZE == 0)
+            dbPrefetchKeys(c->db,c->argv+j,c->argc-j,1);
         expireIfNeeded(c->db,c->argv[j]);
         int deleted  = lazy ? dbAsyncDelete(c->db,c->argv[j]) :
                               dbSyncDelete(c->db,c->argv[j]);
@@ -494,11 +561,19 @@ void unlinkCommand(client *c) {
 /* EXISTS key1 key2 ... key_N.
  * Return value is the number of keys existing. */
 void existsCommand(client *c) {
+    robj *vals[DICT_BATCH_SIZE];
     long long count = 0;
-    int j;
+    int j, k;
 
-    for (j = 1; j < c->argc; j++) {
-        if (lookupKeyRead(c->db,c->argv[j])) count++;
+    for (j = 1; j < c->argc; j += DICT_BATCH_SIZE) {
+        int n = c->argc-j < DICT_BATCH_SIZE ? c->argc-j : DICT_BATCH_SIZE;
+
+        lookupKeysRead(c->db,c->argv+j,n,vals);
+        for (k = 0; k < n; k++) {
+            if (vals[k] == NULL) continue;
+            count++;
+            decrRefCount(vals[k]);
+        }
     }
     addReplyLongLong(c,count);
 }
@@ -537,26 +612,31 @@ void keysCommand(client *c) {
     dictIterator *di;
     dictEntry *de;
     sds pattern = c->argv[1]->ptr;
-    int plen = sdslen(pattern), allkeys;
+    stringmatchPattern *matcher = NULL;
     unsigned long numkeys = 0;
-    void *replylen = addDeferredMultiBulkLength(c);
+    void *replylen;
+
+    if (startBackgroundKeys(c,pattern)) return;
+    replylen = addDeferredMultiBulkLength(c);
 
     di = dictGetSafeIterator(c->db->dict);
-    allkeys = (pattern[0] == '*' && pattern[1] == '\0');
+    if (!(pattern[0] == '*' && pattern[1] == '\0'))
+        matcher = stringmatchCompile(pattern,sdslen(pattern),0);
     while((de = dictNext(di)) != NULL) {
         sds key = dictGetKey(de);
         robj *keyobj;
 
-        if (allkeys || stringmatchlen(pattern,plen,key,sdslen(key),0)) {
-            keyobj = createStringObject(key,sdslen(key));
-            if (!keyIsExpired(c->db,keyobj)) {
+        if (!matcher || stringmatchCompiled(matcher,key,sdslen(key))) {
+            if (!keyEntryIsExpired(c->db,de)) {
+                keyobj = createStringObject(key,sdslen(key));
                 addReplyBulk(c,keyobj);
+                decrRefCount(keyobj);
                 numkeys++;
             }
-            decrRefCount(keyobj);
         }
     }
     dictReleaseIterator(di);
+    stringmatchFree(matcher);
     setDeferredMultiBulkLength(c,replylen,numkeys);
 }
 
@@ -628,6 +708,7 @@ void scanGenericCommand(client *c, robj *o, unsigned long cursor) {
     long count = 10;
     sds pat = NULL;
     int patlen = 0, use_pattern = 0;
+    stringmatchPattern *matcher = NULL;
     dict *ht;
 
     /* Object must be NULL (to iterate keys names), or the type of the object
@@ -669,9 +750,12 @@ void scanGenericCommand(client *c, robj *o, unsigned long cursor) {
         }
     }
 
+    /* The pattern is compiled once for all the elements to filter. */
+    if (use_pattern) matcher = stringmatchCompile(pat,patlen,0);
+
     /* Step 2: Iterate the collection.
      *
-     * Note that if the object is encoded with a ziplist, intset, or any other
+     * Note that if the object is encoded with a listpack, intset, or any other
      * representation that is not a hash table, we are sure that it is also
      * composed of a small number of elements. So to avoid taking state we
      * just return everything inside the object in a single call, setting the
@@ -710,25 +794,27 @@ void scanGenericCommand(client *c, robj *o, unsigned long cursor) {
         } while (cursor &&
               maxiterations-- &&
               listLength(keys) < (unsigned long)count);
-    } else if (o->type == OBJ_SET) {
+    } else if (o->type == OBJ_SET && o->encoding == OBJ_ENCODING_INTSET) {
         int pos = 0;
         int64_t ll;
 
         while(intsetGet(o->ptr,pos++,&ll))
             listAddNodeTail(keys,createStringObjectFromLongLong(ll));
         cursor = 0;
-    } else if (o->type == OBJ_HASH || o->type == OBJ_ZSET) {
-        unsigned char *p = ziplistIndex(o->ptr,0);
+    } else if (o->type == OBJ_HASH || o->type == OBJ_ZSET ||
+               o->type == OBJ_SET)
+    {
+        unsigned char *p = lpFirst(o->ptr);
         unsigned char *vstr;
         unsigned int vlen;
         long long vll;
 
         while(p) {
-            ziplistGet(p,&vstr,&vlen,&vll);
+            vstr = lpGetValue(p,&vlen,&vll);
             listAddNodeTail(keys,
                 (vstr != NULL) ? createStringObject((char*)vstr,vlen) :
                                  createStringObjectFromLongLong(vll));
-            p = ziplistNext(o->ptr,p);
+            p = lpNext(o->ptr,p);
         }
         cursor = 0;
     } else {
@@ -745,7 +831,7 @@ void scanGenericCommand(client *c, robj *o, unsigned long cursor) {
         /* Filter element if it does not match the pattern. */
         if (!filter && use_pattern) {
             if (sdsEncodedObject(kobj)) {
-                if (!stringmatchlen(pat, patlen, kobj->ptr, sdslen(kobj->ptr), 0))
+                if (!stringmatchCompiled(matcher, kobj->ptr, sdslen(kobj->ptr)))
                     filter = 1;
             } else {
                 char buf[LONG_STR_SIZE];
@@ -753,7 +839,7 @@ void scanGenericCommand(client *c, robj *o, unsigned long cursor) {
 
                 serverAssert(kobj->encoding == OBJ_ENCODING_INT);
                 len = ll2string(buf,sizeof(buf),(long)kobj->ptr);
-                if (!stringmatchlen(pat, patlen, buf, len, 0)) filter = 1;
+                if (!stringmatchCompiled(matcher, buf, len)) filter = 1;
             }
         }
 
@@ -794,6 +880,7 @@ void scanGenericCommand(client *c, robj *o, unsigned long cursor) {
     }
 
 cleanup:
+    stringmatchFree(matcher);
     listSetFreeMethod(keys,decrRefCountVoid);
     listRelease(keys);
 }
@@ -1026,6 +1113,10 @@ int dbSwapDatabases(int id1, int id2) {
      * if needed. */
     scanDatabaseForReadyLists(db1);
     scanDatabaseForReadyLists(db2);
+
+    /* Background KEYS jobs must not continue scanning the hash table that
+     * is now another database. */
+    backgroundKeysSwapDb(id1,id2);
     return C_OK;
 }
 
@@ -1063,10 +1154,17 @@ void swapdbCommand(client *c) {
  *----------------------------------------------------------------------------*/
 
 int removeExpire(redisDb *db, robj *key) {
+    dictEntry *de = dictFind(db->dict,key->ptr);
+    keyMetadata *km;
+
     /* An expire may only be removed if there is a corresponding entry in the
      * main dict. Otherwise, the key will never be freed. */
-    serverAssertWithInfo(NULL,key,dictFind(db->dict,key->ptr) != NULL);
-    return dictDelete(db->expires,key->ptr) == DICT_OK;
+    serverAssertWithInfo(NULL,key,de != NULL);
+    km = dbEntryMetadata(db,de);
+    if (km->expire == -1) return 0;
+    expireIndexDel(db,de);
+    km->expire = -1;
+    return 1;
 }
 
 /* Set an expire to the specified key. If the expire is set in the context
@@ -1074,13 +1172,17 @@ int removeExpire(redisDb *db, robj *key) {
  * to NULL. The 'when' parameter is the absolute unix time in milliseconds
  * after which the key will no longer be considered valid. */
 void setExpire(client *c, redisDb *db, robj *key, long long when) {
-    dictEntry *kde, *de;
+    dictEntry *de;
+    keyMetadata *km;
 
-    /* Reuse the sds from the main dict in the expire dict */
-    kde = dictFind(db->dict,key->ptr);
-    serverAssertWithInfo(NULL,key,kde != NULL);
-    de = dictAddOrFind(db->expires,dictGetKey(kde));
-    dictSetSignedIntegerVal(de,when);
+    /* The expire is stored in the main dict entry, that is also referenced
+     * by the expire index. */
+    de = dictFind(db->dict,key->ptr);
+    serverAssertWithInfo(NULL,key,de != NULL);
+    km = dbEntryMetadata(db,de);
+    if (km->expire != -1) expireIndexDel(db,de);
+    km->expire = when;
+    expireIndexAdd(db,de);
 
     int writable_slave = server.masterhost && server.repl_slave_ro == 0;
     if (c && writable_slave && !(c->flags & CLIENT_MASTER))
@@ -1094,13 +1196,10 @@ long long getExpire(redisDb *db, robj *key) {
     dictEntry *de;
 
     /* No expire? return ASAP */
-    if (dictSize(db->expires) == 0 ||
-       (de = dictFind(db->expires,key->ptr)) == NULL) return -1;
+    if (expireIndexSize(db->expires) == 0 ||
+       (de = dictFind(db->dict,key->ptr)) == NULL) return -1;
 
-    /* The entry was found in the expire dict, this means it should also
-     * be present in the main dict (safety check). */
-    serverAssertWithInfo(NULL,key,dictFind(db->dict,key->ptr) != NULL);
-    return dictGetSignedIntegerVal(de);
+    return dbEntryMetadata(db,de)->expire;
 }
 
 /* Propagate expires into slaves and the AOF file.
@@ -1129,7 +1228,17 @@ void propagateExpire(redisDb *db, robj *key, int lazy) {
 
 /* Check if the key is expired. */
 int keyIsExpired(redisDb *db, robj *key) {
-    mstime_t when = getExpire(db,key);
+    dictEntry *de;
+
+    /* No expire? return ASAP */
+    if (expireIndexSize(db->expires) == 0 ||
+       (de = dictFind(db->dict,key->ptr)) == NULL) return 0;
+    return keyEntryIsExpired(db,de);
+}
+
+/* Check if the key stored at the main dict entry 'de' is expired. */
+int keyEntryIsExpired(redisDb *db, dictEntry *de) {
+    mstime_t when = dbEntryMetadata(db,de)->expire;
 
     if (when < 0) return 0; /* No expire for this key */
 
@@ -1167,7 +1276,12 @@ int keyIsExpired(redisDb *db, robj *key) {
  * otherwise the function returns 1 if the key is expired. */
 int expireIfNeeded(redisDb *db, robj *key) {
     if (!keyIsExpired(db,key)) return 0;
+    return deleteExpiredKey(db,key);
+}
 
+/* The second half of expireIfNeeded(), called once the key is known to be
+ * logically expired. */
+static int deleteExpiredKey(redisDb *db, robj *key) {
     /* If we are running in the context of a slave, instead of
      * evicting the expired key from the database, we return ASAP:
      * the slave key expiration is controlled by the master that will
@@ -1282,6 +1396,27 @@ int *zunionInterGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *nu
     return keys;
 }
 
+/* Helper function to extract keys from the following commands:
+ * SINTERCARD <num-keys> <key> <key> ... <key> [LIMIT <limit>]
+ * ZINTERCARD <num-keys> <key> <key> ... <key> [LIMIT <limit>] */
+int *intercardGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys) {
+    int i, num, *keys;
+    UNUSED(cmd);
+
+    num = atoi(argv[1]->ptr);
+    /* Sanity check. Don't return any key if the command is going to
+     * reply with syntax error. */
+    if (num < 1 || num > (argc-2)) {
+        *numkeys = 0;
+        return NULL;
+    }
+
+    keys = zmalloc(sizeof(int)*num);
+    for (i = 0; i < num; i++) keys[i] = 2+i;
+    *numkeys = num;
+    return keys;
+}
+
 /* Helper function to extract keys from the following commands:
  * EVAL <script> <num-keys> <key> <key> ... <key> [more stuff]
  * EVALSHA <script> <num-keys> <key> <key> ... <key> [more stuff] */
@@ -1467,84 +1602,107 @@ int *xreadGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys)
 /* Slot to Key API. This is used by Redis Cluster in order to obtain in
  * a fast way a key that belongs to a specified hash slot. This is useful
  * while rehashing the cluster and in other conditions when we need to
- * understand if we have keys for a given hash slot. */
-void slotToKeyUpdateKey(robj *key, int add) {
-    unsigned int hashslot = keyHashSlot(key->ptr,sdslen(key->ptr));
-    unsigned char buf[64];
-    unsigned char *indexed = buf;
-    size_t keylen = sdslen(key->ptr);
-
-    server.cluster->slots_keys_count[hashslot] += add ? 1 : -1;
-    if (keylen+2 > 64) indexed = zmalloc(keylen+2);
-    indexed[0] = (hashslot >> 8) & 0xff;
-    indexed[1] = hashslot & 0xff;
-    memcpy(indexed+2,key->ptr,keylen);
-    if (add) {
-        raxInsert(server.cluster->slots_to_keys,indexed,keylen+2,NULL,NULL);
-    } else {
-        raxRemove(server.cluster->slots_to_keys,indexed,keylen+2,NULL);
-    }
-    if (indexed != buf) zfree(indexed);
+ * understand if we have keys for a given hash slot.
+ *
+ * In cluster mode the main dict entries carry a clusterKeyMetadata, and the
+ * entries of the keys of every slot are linked in a doubly linked list, so
+ * that keys are added and removed in constant time, without copying the key
+ * names in a separate index. Only DB 0 is used in cluster mode. */
+
+/* Create the main dict of a DB, with room for the slot links of the
+ * entries in cluster mode. */
+dict *dbDictCreate(void) {
+    return dictCreate(server.cluster_enabled ? &clusterDbDictType :
+                                               &dbDictType,NULL);
 }
 
-void slotToKeyAdd(robj *key) {
-    slotToKeyUpdateKey(key,1);
+static slotToKeys *slotToKeysOfEntry(dictEntry *de) {
+    sds key = dictGetKey(de);
+    return &server.cluster->slots_to_keys[keyHashSlot(key,sdslen(key))];
 }
 
-void slotToKeyDel(robj *key) {
-    slotToKeyUpdateKey(key,0);
+/* Link the entry 'de', just added to the main dict of DB 0, in the list
+ * of its hash slot. */
+void slotToKeyAdd(dictEntry *de) {
+    slotToKeys *slot = slotToKeysOfEntry(de);
+    clusterKeyMetadata *ckm = dbEntrySlotMetadata(server.db,de);
+
+    ckm->slot_prev = NULL;
+    ckm->slot_next = slot->head;
+    if (slot->head) dbEntrySlotMetadata(server.db,slot->head)->slot_prev = de;
+    slot->head = de;
+    slot->count++;
 }
 
+/* Unlink the entry 'de' from the list of its hash slot, before the entry
+ * is freed. */
+void slotToKeyDel(dictEntry *de) {
+    slotToKeys *slot = slotToKeysOfEntry(de);
+    clusterKeyMetadata *ckm = dbEntrySlotMetadata(server.db,de);
+
+    if (ckm->slot_prev)
+        dbEntrySlotMetadata(server.db,ckm->slot_prev)->slot_next =
+            ckm->slot_next;
+    else
+        slot->head = ckm->slot_next;
+    if (ckm->slot_next)
+        dbEntrySlotMetadata(server.db,ckm->slot_next)->slot_prev =
+            ckm->slot_prev;
+    slot->count--;
+}
+
+/* Update the links to the entry 'de' after it was reallocated at a
+ * different address, like active defrag does. */
+void slotToKeyEntryMoved(dictEntry *de) {
+    clusterKeyMetadata *ckm = dbEntrySlotMetadata(server.db,de);
+
+    if (ckm->slot_prev)
+        dbEntrySlotMetadata(server.db,ckm->slot_prev)->slot_next = de;
+    else
+        slotToKeysOfEntry(de)->head = de;
+    if (ckm->slot_next)
+        dbEntrySlotMetadata(server.db,ckm->slot_next)->slot_prev = de;
+}
+
+/* Forget all the lists, when the entries of DB 0 are released. */
 void slotToKeyFlush(void) {
-    raxFree(server.cluster->slots_to_keys);
-    server.cluster->slots_to_keys = raxNew();
-    memset(server.cluster->slots_keys_count,0,
-           sizeof(server.cluster->slots_keys_count));
+    memset(server.cluster->slots_to_keys,0,
+           sizeof(server.cluster->slots_to_keys));
 }
 
 /* Pupulate the specified array of objects with keys in the specified slot.
  * New objects are returned to represent keys, it's up to the caller to
  * decrement the reference count to release the keys names. */
 unsigned int getKeysInSlot(unsigned int hashslot, robj **keys, unsigned int count) {
-    raxIterator iter;
-    int j = 0;
-    unsigned char indexed[2];
-
-    indexed[0] = (hashslot >> 8) & 0xff;
-    indexed[1] = hashslot & 0xff;
-    raxStart(&iter,server.cluster->slots_to_keys);
-    raxSeek(&iter,">=",indexed,2);
-    while(count-- && raxNext(&iter)) {
-        if (iter.key[0] != indexed[0] || iter.key[1] != indexed[1]) break;
-        keys[j++] = createStringObject((char*)iter.key+2,iter.key_len-2);
+    dictEntry *de = server.cluster->slots_to_keys[hashslot].head;
+    unsigned int j = 0;
+
+    while (de && j < count) {
+        sds key = dictGetKey(de);
+
+        keys[j++] = createStringObject(key,sdslen(key));
+        de = dbEntrySlotMetadata(server.db,de)->slot_next;
     }
-    raxStop(&iter);
     return j;
 }
 
 /* Remove all the keys in the specified hash slot.
  * The number of removed items is returned. */
 unsigned int delKeysInSlot(unsigned int hashslot) {
-    raxIterator iter;
-    int j = 0;
-    unsigned char indexed[2];
-
-    indexed[0] = (hashslot >> 8) & 0xff;
-    indexed[1] = hashslot & 0xff;
-    raxStart(&iter,server.cluster->slots_to_keys);
-    while(server.cluster->slots_keys_count[hashslot]) {
-        raxSeek(&iter,">=",indexed,2);
-        raxNext(&iter);
-
-        robj *key = createStringObject((char*)iter.key+2,iter.key_len-2);
-        dbDelete(&server.db[0],key);
-        decrRefCount(key);
+    slotToKeys *slot = &server.cluster->slots_to_keys[hashslot];
+    unsigned int j = 0;
+
+    while (slot->head) {
+        sds key = dictGetKey(slot->head);
+        robj *keyobj = createStringObject(key,sdslen(key));
+
+        dbDelete(&server.db[0],keyobj);
+        decrRefCount(keyobj);
         j++;
     }
-    raxStop(&iter);
     return j;
 }
 
 unsigned int countKeysInSlot(unsigned int hashslot) {
-    return server.cluster->slots_keys_count[hashslot];
+    return server.cluster->slots_to_keys[hashslot].count;
 }
@@ -95,6 +95,18 @@ sds activeDefragSds(sds sdsptr) {
     return NULL;
 }
 
+/* Defrag helper for the listpacks of sets, sorted sets and hashes, that
+ * may have an lpFindIndexed() index, see listpack.c.
+ *
+ * returns NULL in case the allocation wasn't moved.
+ * when it returns a non-null value, the old pointer was already released
+ * and should NOT be accessed. */
+unsigned char *activeDefragListpack(unsigned char *lp) {
+    unsigned char *newlp = activeDefragAlloc(lp);
+    if (newlp) lpIndexInvalidate(lp);
+    return newlp;
+}
+
 /* Defrag helper for robj and/or string objects
  *
  * returns NULL in case the allocatoin wasn't moved.
@@ -143,7 +155,7 @@ long dictIterDefragEntry(dictIterator *iter) {
      * of the dict and it's iterator, but the benefit is that it is very easy
      * to use, and require no other chagnes in the dict. */
     long defragged = 0;
-    dictht *ht;
+    dictEntry **ref;
     /* Handle the next entry (if there is one), and update the pointer in the
      * current entry. */
     if (iter->nextEntry) {
@@ -155,12 +167,12 @@ long dictIterDefragEntry(dictIterator *iter) {
         }
     }
     /* handle the case of the first entry in the hash bucket. */
-    ht = &iter->d->ht[iter->table];
-    if (ht->table[iter->index] == iter->entry) {
+    ref = dictHtBucket(&iter->d->ht[iter->table],iter->index,sizeof(dictEntry*));
+    if (*ref == iter->entry) {
         dictEntry *newde = activeDefragAlloc(iter->entry);
         if (newde) {
             iter->entry = newde;
-            ht->table[iter->index] = newde;
+            *ref = newde;
             defragged++;
         }
     }
@@ -171,17 +183,30 @@ long dictIterDefragEntry(dictIterator *iter) {
  * receives a pointer to the dict* and implicitly updates it when the dict
  * struct itself was moved. Returns a stat of how many pointers were moved. */
 long dictDefragTables(dict* d) {
-    dictEntry **newtable;
     long defragged = 0;
-    /* handle the first hash table */
-    newtable = activeDefragAlloc(d->ht[0].table);
-    if (newtable)
-        defragged++, d->ht[0].table = newtable;
-    /* handle the second hash table */
-    if (d->ht[1].table) {
-        newtable = activeDefragAlloc(d->ht[1].table);
+    int j;
+
+    for (j = 0; j < 2; j++) {
+        dictht *ht = &d->ht[j];
+        void *newtable;
+
+        if (ht->table == NULL) continue;
+        newtable = activeDefragAlloc(ht->table);
         if (newtable)
-            defragged++, d->ht[1].table = newtable;
+            defragged++, ht->table = newtable;
+        /* Segmented tables: handle the segments as well. */
+        if (ht->segbits) {
+            void **segs = ht->table;
+            unsigned long i;
+
+            for (i = 0; i < (ht->size >> ht->segbits); i++) {
+                void *newseg;
+
+                if (segs[i] == NULL) continue;
+                if ((newseg = activeDefragAlloc(segs[i])) != NULL)
+                    defragged++, segs[i] = newseg;
+            }
+        }
     }
     return defragged;
 }
@@ -425,8 +450,8 @@ long activeDefragQuickListNodes(quicklist *ql) {
             node = newnode;
             defragged++;
         }
-        if ((newzl = activeDefragAlloc(node->zl)))
-            defragged++, node->zl = newzl;
+        if ((newzl = activeDefragAlloc(node->entry)))
+            defragged++, node->entry = newzl;
         node = node->next;
     }
     return defragged;
@@ -767,17 +792,11 @@ long defragKey(redisDb *db, dictEntry *de) {
     long defragged = 0;
     sds newsds;
 
-    /* Try to defrag the key name. */
-    newsds = activeDefragSds(keysds);
+    /* Try to defrag the key name. Keys embedded in the dict entry are moved
+     * together with the entry by defragDbDictBucketCallback(). */
+    newsds = dictIsEmbeddingKeys(db->dict) ? NULL : activeDefragSds(keysds);
     if (newsds)
         defragged++, de->key = newsds;
-    if (dictSize(db->expires)) {
-         /* Dirty code:
-          * I can't search in db->expires for that key after i already released
-          * the pointer it holds it won't be able to do the string compare */
-        uint64_t hash = dictGetHash(db->dict, de->key);
-        replaceSateliteDictKeyPtrAndOrDefragDictEntry(db->expires, keysds, newsds, hash, &defragged);
-    }
 
     /* Try to defrag robj and / or string value. */
     ob = dictGetVal(de);
@@ -791,9 +810,6 @@ long defragKey(redisDb *db, dictEntry *de) {
     } else if (ob->type == OBJ_LIST) {
         if (ob->encoding == OBJ_ENCODING_QUICKLIST) {
             defragged += defragQuicklist(db, de);
-        } else if (ob->encoding == OBJ_ENCODING_ZIPLIST) {
-            if ((newzl = activeDefragAlloc(ob->ptr)))
-                defragged++, ob->ptr = newzl;
         } else {
             serverPanic("Unknown list encoding");
         }
@@ -804,12 +820,15 @@ long defragKey(redisDb *db, dictEntry *de) {
             intset *newis, *is = ob->ptr;
             if ((newis = activeDefragAlloc(is)))
                 defragged++, ob->ptr = newis;
+        } else if (ob->encoding == OBJ_ENCODING_LISTPACK) {
+            if ((newzl = activeDefragListpack(ob->ptr)))
+                defragged++, ob->ptr = newzl;
         } else {
             serverPanic("Unknown set encoding");
         }
     } else if (ob->type == OBJ_ZSET) {
-        if (ob->encoding == OBJ_ENCODING_ZIPLIST) {
-            if ((newzl = activeDefragAlloc(ob->ptr)))
+        if (ob->encoding == OBJ_ENCODING_LISTPACK) {
+            if ((newzl = activeDefragListpack(ob->ptr)))
                 defragged++, ob->ptr = newzl;
         } else if (ob->encoding == OBJ_ENCODING_SKIPLIST) {
             defragged += defragZsetSkiplist(db, de);
@@ -817,8 +836,8 @@ long defragKey(redisDb *db, dictEntry *de) {
             serverPanic("Unknown sorted set encoding");
         }
     } else if (ob->type == OBJ_HASH) {
-        if (ob->encoding == OBJ_ENCODING_ZIPLIST) {
-            if ((newzl = activeDefragAlloc(ob->ptr)))
+        if (ob->encoding == OBJ_ENCODING_LISTPACK) {
+            if ((newzl = activeDefragListpack(ob->ptr)))
                 defragged++, ob->ptr = newzl;
         } else if (ob->encoding == OBJ_ENCODING_HT) {
             defragged += defragHash(db, de);
@@ -847,16 +866,32 @@ void defragScanCallback(void *privdata, const dictEntry *de) {
     server.stat_active_defrag_scanned++;
 }
 
-/* Defrag scan callback for each hash table bicket,
+/* Defrag scan callback for each entry reference of the hash table buckets,
  * used in order to defrag the dictEntry allocations. */
 void defragDictBucketCallback(void *privdata, dictEntry **bucketref) {
     UNUSED(privdata); /* NOTE: this function is also used by both activeDefragCycle and scanLaterHash, etc. don't use privdata */
-    while(*bucketref) {
-        dictEntry *de = *bucketref, *newde;
-        if ((newde = activeDefragAlloc(de))) {
-            *bucketref = newde;
-        }
-        bucketref = &(*bucketref)->next;
+    dictEntry *newde;
+    if ((newde = activeDefragAlloc(*bucketref))) {
+        *bucketref = newde;
+    }
+}
+
+/* Defrag scan callback for the entry references of the main db dictionary.
+ * The key is embedded in the entry, so when the entry is moved the key
+ * pointer is updated, as well as the references of the expire index and,
+ * in cluster mode, of the list of keys of the slot. */
+void defragDbDictBucketCallback(void *privdata, dictEntry **bucketref) {
+    redisDb *db = privdata;
+    dictEntry *newde, *de = *bucketref;
+    sds oldkey = dictGetKey(de);
+
+    if ((newde = activeDefragAlloc(de))) {
+        newde->key = (char*)newde + ((char*)oldkey - (char*)de);
+        *bucketref = newde;
+        if (dbEntryMetadata(db,newde)->expire != -1)
+            expireIndexEntryMoved(db,newde);
+        if (server.cluster_enabled) slotToKeyEntryMoved(newde);
+        server.stat_active_defrag_hits++;
     }
 }
 
@@ -1106,7 +1141,7 @@ void activeDefragCycle(void) {
                 break; /* this will exit the function and we'll continue on the next cycle */
             }
 
-            cursor = dictScan(db->dict, cursor, defragScanCallback, defragDictBucketCallback, db);
+            cursor = dictScan(db->dict, cursor, defragScanCallback, defragDbDictBucketCallback, db);
 
             /* Once in 16 scan iterations, 512 pointer reallocations. or 64 keys
              * (if we have a lot of pointers in one hash bucket or rehasing),
@@ -3,7 +3,8 @@
  * This file implements in memory hash tables with insert/del/replace/find/
  * get-random-element operations. Hash tables will auto resize if needed
  * tables of power of two in size are used, collisions are handled by
- * chaining. See the source code for more information... :)
+ * chaining, or by bucketized open addressing for dictionaries whose type
+ * sets 'openAddressing'. See the source code for more information... :)
  *
  * Copyright (c) 2006-2012, Salvatore Sanfilippo <antirez at gmail dot com>
  * All rights reserved.
@@ -69,9 +70,280 @@ static unsigned long _dictNextPower(unsigned long size);
 static long _dictKeyIndex(dict *ht, const void *key, uint64_t hash, dictEntry **existing);
 static int _dictInit(dict *ht, dictType *type, void *privDataPtr);
 
+/* ------------------------- open addressing tables -------------------------
+ *
+ * Dictionaries whose type sets 'openAddressing' don't chain the entries:
+ * the hash table is an array of buckets, every bucket holding up to
+ * DICT_BUCKET_SLOTS entry pointers and a 64 bit metadata word with:
+ *
+ * - A presence bit for every slot (bits 0-6).
+ * - The "everfull" bit (bit 7), set when the bucket becomes full, and only
+ *   cleared when the table is reallocated.
+ * - A one byte tag for every slot (bytes 1-7), taken from the high bits of
+ *   the hash of the key stored in the slot.
+ *
+ * A key is stored in the first bucket with a free slot starting from the
+ * bucket (hash & sizemask), probing linearly. Lookups stop probing at the
+ * first bucket that was never full, so deleting an entry just clears its
+ * presence bit. Inside a bucket the tags of all the slots are matched at
+ * once with a few arithmetic operations on the metadata word, so the keys
+ * are compared only for the slots with a matching tag, which usually means
+ * a single key comparison for every successful lookup.
+ *
+ * Since the everfull bits are never cleared, deleting and adding keys would
+ * eventually set them in all the buckets, and every miss would scan the
+ * whole table. So we count the "stale" buckets, that have the everfull bit
+ * but are not full anymore, and when they are too many the table is
+ * rehashed to a new table of the same size, see _dictOpenNeedsRebuild().
+ *
+ * Since entries don't need a 'next' pointer, they are allocated without
+ * it, and a bucket (64 bytes on 64 bit systems) is exactly a cache line.
+ *
+ * Incremental rehashing works exactly like in chained tables, moving a
+ * bucket at a time from ht[0] to ht[1]. dictScan() guarantees are also
+ * preserved: when visiting a bucket, the buckets following it are also
+ * visited as long as the probing would continue there, so every key is
+ * found when the cursor visits the bucket its hash maps to. */
+
+typedef struct dictBucket {
+    uint64_t meta;  /* Presence bits, everfull bit, and slot tags. */
+    dictEntry *entries[DICT_BUCKET_SLOTS];
+} dictBucket;
+
+#define DICT_BUCKET_PRESENCE ((1<<DICT_BUCKET_SLOTS)-1)
+#define DICT_BUCKET_EVERFULL (1<<DICT_BUCKET_SLOTS)
+#define DICT_BUCKET_LSB 0x0001010101010101ULL /* Low bit of every tag. */
+#define DICT_BUCKET_MSB 0x0080808080808080ULL /* High bit of every tag. */
+
+#define dictHashTag(hash) ((uint8_t)((hash) >> 56))
+
+/* Index of the lowest bit set in 'v', that must be non zero. */
+static inline int dictLowestBit(uint64_t v) {
+#if defined(__GNUC__)
+    return __builtin_ctzll(v);
+#else
+    int j = 0;
+    while (!(v & 1)) { v >>= 1; j++; }
+    return j;
+#endif
+}
+
+/* Return a bitmap of the used slots of the bucket whose tag may be 'tag'.
+ * The tags are compared all at once: after the XOR the matching tags are
+ * zero bytes, that we detect with the classic "has zero byte" trick. This
+ * may report false positives (only for bytes following a zero one), which
+ * is fine since the caller compares the keys anyway. */
+static inline unsigned int dictBucketMatch(uint64_t meta, uint8_t tag) {
+    uint64_t x = (meta ^ (DICT_BUCKET_LSB*tag*256)) >> 8;
+    uint64_t zero = (x - DICT_BUCKET_LSB) & ~x & DICT_BUCKET_MSB;
+    unsigned int match = 0;
+
+    while (zero) {
+        match |= 1 << (dictLowestBit(zero) >> 3);
+        zero &= zero-1;
+    }
+    return match & meta;
+}
+
+/* ------------------------------ segments ----------------------------------
+ *
+ * Tables bigger than DICT_SEGMENT_BYTES are not allocated as a single array
+ * of buckets: 'table' is instead a directory of segments of 2^segbits
+ * buckets. Segments are allocated only when an entry is first stored in
+ * them, and while rehashing the segments of the old table are released as
+ * soon as the rehashing index moves past them. This way growing a huge
+ * table never requires a huge allocation, and the old and the new tables
+ * are not fully allocated at the same time.
+ *
+ * The buckets of a segment that is not allocated are empty (and, in open
+ * addressing tables, were never full), with an exception: the buckets of
+ * the old table that were already rehashed are empty but may have been
+ * full, so the probing in the old table continues at the rehashing index
+ * when it reaches them, see _dictProbeIdx(). */
+
+#define dictBucketSize(d) \
+    (dictIsOpenAddressing(d) ? sizeof(dictBucket) : sizeof(dictEntry*))
+#define _dictOpenBucket(ht,idx) \
+    ((dictBucket*)dictHtBucket(ht,idx,sizeof(dictBucket)))
+#define _dictChainRef(ht,idx) \
+    ((dictEntry**)dictHtBucket(ht,idx,sizeof(dictEntry*)))
+#define DICT_INSERT_MAX_PROBES 64 /* See _dictInsertTable(). */
+
+/* Return the first bucket of the segment following the one of 'idx'. */
+static unsigned long _dictNextSegment(dictht *ht, unsigned long idx) {
+    return (idx | ((1UL << ht->segbits)-1)) + 1;
+}
+
+/* Initialize 'ht' as an empty table of 'size' buckets of 'bucketsize'
+ * bytes. Single array tables are allocated at once, while segments are
+ * allocated later by _dictHtBucketAlloc(). */
+static void _dictHtInit(dictht *ht, unsigned long size, size_t bucketsize) {
+    unsigned long segsize = DICT_SEGMENT_BYTES/bucketsize;
+
+    ht->size = size;
+    ht->sizemask = size-1;
+    ht->used = 0;
+    ht->segments = 0;
+    ht->segbits = 0;
+    ht->everfull = 0;
+    ht->stale = 0;
+    if (size <= segsize) {
+        ht->table = zcalloc(size*bucketsize);
+        return;
+    }
+    while ((1UL << ht->segbits) < segsize) ht->segbits++;
+    ht->table = zcalloc(sizeof(void*)*(size >> ht->segbits));
+}
+
+/* Like dictHtBucket(), but allocates the segment of the bucket if needed. */
+static void *_dictHtBucketAlloc(dictht *ht, unsigned long idx, size_t bucketsize) {
+    void **segref;
+
+    if (ht->segbits == 0) return dictHtBucket(ht,idx,bucketsize);
+    segref = (void**)ht->table + (idx >> ht->segbits);
+    if (*segref == NULL) {
+        *segref = zcalloc(bucketsize << ht->segbits);
+        ht->segments++;
+    }
+    return dictHtBucket(ht,idx,bucketsize);
+}
+
+/* Release the segment of the bucket 'idx', that must be empty. */
+static void _dictHtFreeSegment(dictht *ht, unsigned long idx) {
+    void **segref = (void**)ht->table + (idx >> ht->segbits);
+
+    if (*segref == NULL) return;
+    zfree(*segref);
+    *segref = NULL;
+    ht->segments--;
+}
+
+/* Release the memory of the table, but not the entries. */
+static void _dictHtFree(dictht *ht) {
+    unsigned long j;
+
+    if (ht->segbits) {
+        for (j = 0; j < ht->size; j = _dictNextSegment(ht,j))
+            _dictHtFreeSegment(ht,j);
+    }
+    zfree(ht->table);
+}
+
+/* Return the bucket where probing the table 'ht' of 'd' at bucket 'idx'
+ * should actually continue: the buckets of the old table already rehashed
+ * are skipped, since they are empty and their segments may be released. */
+static inline unsigned long _dictProbeIdx(dict *d, dictht *ht, unsigned long idx) {
+    if (ht == &d->ht[0] && (long)idx < d->rehashidx)
+        return d->rehashidx;
+    return idx;
+}
+
+/* Return the position (bucket*DICT_BUCKET_SLOTS+slot) of the entry with the
+ * specified key in the table, or -1 if the key is not there. */
+static long _dictOpenFind(dict *d, dictht *ht, const void *key, uint64_t hash) {
+    unsigned long idx = hash & ht->sizemask, probes = 0;
+    uint8_t tag = dictHashTag(hash);
+
+    if (ht->size == 0) return -1;
+    do {
+        dictBucket *b;
+        unsigned int match;
+
+        idx = _dictProbeIdx(d,ht,idx);
+        if ((b = _dictOpenBucket(ht,idx)) == NULL) break;
+        match = dictBucketMatch(b->meta,tag);
+        while (match) {
+            int slot = dictLowestBit(match);
+            dictEntry *he = b->entries[slot];
+            if (key==he->key || dictCompareKeys(d, key, he->key))
+                return idx*DICT_BUCKET_SLOTS+slot;
+            match &= match-1;
+        }
+        if (!(b->meta & DICT_BUCKET_EVERFULL)) break;
+        idx = (idx+1) & ht->sizemask;
+    } while(++probes < ht->size);
+    return -1;
+}
+
+/* Store the entry in the first free slot found probing from the bucket the
+ * hash maps to. The caller makes sure the table has a free slot. The table
+ * may be the old one of a rehashing, when _dictInsertTable() selects it:
+ * in that case it also checked that a free slot is found before the probe
+ * wraps around, so the entry lands in a bucket not yet rehashed, and is
+ * moved to the new table later with it. */
+static void _dictOpenInsert(dictht *ht, dictEntry *he, uint64_t hash) {
+    unsigned long idx = hash & ht->sizemask;
+    dictBucket *b;
+    int slot;
+
+    while(1) {
+        b = _dictHtBucketAlloc(ht,idx,sizeof(dictBucket));
+        if ((b->meta & DICT_BUCKET_PRESENCE) != DICT_BUCKET_PRESENCE) break;
+        idx = (idx+1) & ht->sizemask;
+    }
+    slot = dictLowestBit(~b->meta & DICT_BUCKET_PRESENCE);
+    b->entries[slot] = he;
+    b->meta &= ~((uint64_t)0xff << (8*(slot+1)));
+    b->meta |= ((uint64_t)dictHashTag(hash) << (8*(slot+1))) | (1<<slot);
+    if ((b->meta & DICT_BUCKET_PRESENCE) == DICT_BUCKET_PRESENCE) {
+        if (b->meta & DICT_BUCKET_EVERFULL) ht->stale--;
+        else ht->everfull++;
+        b->meta |= DICT_BUCKET_EVERFULL;
+    }
+    ht->used++;
+}
+
+/* Remove the entry at the specified position from the table. */
+static dictEntry *_dictOpenRemove(dictht *ht, long pos) {
+    dictBucket *b = _dictOpenBucket(ht,pos/DICT_BUCKET_SLOTS);
+    int slot = pos % DICT_BUCKET_SLOTS;
+
+    if ((b->meta & DICT_BUCKET_PRESENCE) == DICT_BUCKET_PRESENCE) ht->stale++;
+    b->meta &= ~(uint64_t)(1<<slot);
+    ht->used--;
+    return b->entries[slot];
+}
+
+/* Return the first entry of the chain of the bucket 'idx' of the chained
+ * table 'ht', or NULL. */
+static dictEntry *_dictChainHead(dictht *ht, unsigned long idx) {
+    dictEntry **ref;
+
+    if (ht->size == 0) return NULL;
+    ref = _dictChainRef(ht,idx);
+    return ref ? *ref : NULL;
+}
+
+/* Return the entry at the specified position of the table. */
+static dictEntry *_dictOpenEntry(dictht *ht, long pos) {
+    return _dictOpenBucket(ht,pos/DICT_BUCKET_SLOTS)->entries[pos%DICT_BUCKET_SLOTS];
+}
+
+/* Open addressing tables are grown when 7/8 of the slots are used, or
+ * when 31/32 of the slots are used if resizing is disabled: unlike chained
+ * tables, they can't hold more elements than slots. */
+static int _dictOpenNeedsExpand(dictht *ht, int can_resize) {
+    unsigned long slots = ht->size*DICT_BUCKET_SLOTS;
+
+    if (can_resize) return ht->used*8 >= slots*7;
+    return ht->used*32 >= slots*31;
+}
+
+/* Open addressing tables are rebuilt when the stale buckets are more than
+ * the buckets that were never full: since only the latter stop the probing,
+ * a miss costs then more than twice what it would cost after rebuilding
+ * the table. To bound the rebuilding work done per deleted entry, we also
+ * require 1/8 of the buckets to be stale, or 1/4 if resizing is disabled. */
+static int _dictOpenNeedsRebuild(dictht *ht, int can_resize) {
+    if (ht->stale <= ht->size - ht->everfull) return 0;
+    if (can_resize) return ht->stale*8 > ht->size;
+    return ht->stale*4 > ht->size;
+}
+
 /* -------------------------- hash functions -------------------------------- */
 
 static uint8_t dict_hash_function_seed[16];
+static int dict_hash_function_type = DICT_HASH_SIPHASH;
 
 void dictSetHashFunctionSeed(uint8_t *seed) {
     memcpy(dict_hash_function_seed,seed,sizeof(dict_hash_function_seed));
@@ -82,12 +354,31 @@ uint8_t *dictGetHashFunctionSeed(void) {
 }
 
 /* The default hashing function uses SipHash implementation
- * in siphash.c. */
+ * in siphash.c. On CPUs with AES-NI, the faster aeshash() in aeshash.c can
+ * be used instead. */
 
 uint64_t siphash(const uint8_t *in, const size_t inlen, const uint8_t *k);
 uint64_t siphash_nocase(const uint8_t *in, const size_t inlen, const uint8_t *k);
+uint64_t aeshash(const uint8_t *in, const size_t inlen, const uint8_t *k);
+int aeshashSupported(void);
+
+/* Select the function used by dictGenHashFunction(). Since the hash of the
+ * keys already stored would change, this should be called before any dict
+ * using it is populated. Returns DICT_ERR if the function is not supported
+ * by this CPU. */
+int dictSetHashFunctionType(int type) {
+    if (type == DICT_HASH_AESNI && !aeshashSupported()) return DICT_ERR;
+    dict_hash_function_type = type;
+    return DICT_OK;
+}
+
+int dictGetHashFunctionType(void) {
+    return dict_hash_function_type;
+}
 
 uint64_t dictGenHashFunction(const void *key, int len) {
+    if (dict_hash_function_type == DICT_HASH_AESNI)
+        return aeshash(key,len,dict_hash_function_seed);
     return siphash(key,len,dict_hash_function_seed);
 }
 
@@ -105,6 +396,10 @@ static void _dictReset(dictht *ht)
     ht->size = 0;
     ht->sizemask = 0;
     ht->used = 0;
+    ht->segments = 0;
+    ht->segbits = 0;
+    ht->everfull = 0;
+    ht->stale = 0;
 }
 
 /* Create a new hash table */
@@ -152,16 +447,23 @@ int dictExpand(dict *d, unsigned long size)
         return DICT_ERR;
 
     dictht n; /* the new hash table */
-    unsigned long realsize = _dictNextPower(size);
+    unsigned long realsize;
+
+    if (dictIsOpenAddressing(d)) {
+        /* Open addressing tables are sized in buckets, so that 1/8 of the
+         * slots are free after storing 'size' elements. */
+        if (size > ULONG_MAX/8) size = ULONG_MAX/8;
+        realsize = _dictNextPower((size*8+DICT_BUCKET_SLOTS*7-1)/
+                                  (DICT_BUCKET_SLOTS*7));
+    } else {
+        realsize = _dictNextPower(size);
+    }
 
     /* Rehashing to the same table size is not useful. */
     if (realsize == d->ht[0].size) return DICT_ERR;
 
     /* Allocate the new hash table and initialize all pointers to NULL */
-    n.size = realsize;
-    n.sizemask = realsize-1;
-    n.table = zcalloc(realsize*sizeof(dictEntry*));
-    n.used = 0;
+    _dictHtInit(&n,realsize,dictBucketSize(d));
 
     /* Is this the first initialization? If so it's not really a rehashing
      * we just set the first hash table so that it can accept keys. */
@@ -176,6 +478,24 @@ int dictExpand(dict *d, unsigned long size)
     return DICT_OK;
 }
 
+/* Start rehashing an open addressing table to a new table of the same
+ * size, where the everfull bits only reflect the entries still there. */
+static int _dictOpenRebuild(dict *d) {
+    _dictHtInit(&d->ht[1],d->ht[0].size,sizeof(dictBucket));
+    d->rehashidx = 0;
+    return DICT_OK;
+}
+
+/* Move the rehashing index to the next bucket, releasing the segment of
+ * the old table the index moved past, if any. */
+static void _dictRehashAdvance(dict *d) {
+    dictht *ht = &d->ht[0];
+
+    d->rehashidx++;
+    if (ht->segbits && (d->rehashidx & ((1UL << ht->segbits)-1)) == 0)
+        _dictHtFreeSegment(ht,d->rehashidx-1);
+}
+
 /* Performs N steps of incremental rehashing. Returns 1 if there are still
  * keys to move from the old to the new hash table, otherwise 0 is returned.
  *
@@ -195,31 +515,68 @@ int dictRehash(dict *d, int n) {
         /* Note that rehashidx can't overflow as we are sure there are more
          * elements because ht[0].used != 0 */
         assert(d->ht[0].size > (unsigned long)d->rehashidx);
-        while(d->ht[0].table[d->rehashidx] == NULL) {
-            d->rehashidx++;
+        if (dictHtBucket(&d->ht[0],d->rehashidx,dictBucketSize(d)) == NULL) {
+            /* Skip a segment that was never allocated. */
+            d->rehashidx = _dictNextSegment(&d->ht[0],d->rehashidx);
+            if (--empty_visits == 0) return 1;
+            n++;
+            continue;
+        }
+        if (dictIsOpenAddressing(d)) {
+            dictBucket *b = _dictOpenBucket(&d->ht[0],d->rehashidx);
+            unsigned int used = b->meta & DICT_BUCKET_PRESENCE;
+
+            if (used == 0) {
+                _dictRehashAdvance(d);
+                if (--empty_visits == 0) return 1;
+                n++; /* Empty buckets don't count as a step. */
+                continue;
+            }
+            /* Move all the keys in this bucket to the new hash table. The
+             * everfull bit is retained, since lookups in the old table
+             * may still need to probe past this bucket. */
+            while (used) {
+                int slot = dictLowestBit(used);
+                de = b->entries[slot];
+                _dictOpenInsert(&d->ht[1],de,dictHashKey(d, de->key));
+                d->ht[0].used--;
+                used &= used-1;
+            }
+            if ((b->meta & DICT_BUCKET_PRESENCE) == DICT_BUCKET_PRESENCE)
+                d->ht[0].stale++;
+            b->meta &= ~(uint64_t)DICT_BUCKET_PRESENCE;
+            _dictRehashAdvance(d);
+            continue;
+        }
+        if (*_dictChainRef(&d->ht[0],d->rehashidx) == NULL) {
+            _dictRehashAdvance(d);
             if (--empty_visits == 0) return 1;
+            n++;
+            continue;
         }
-        de = d->ht[0].table[d->rehashidx];
+        de = *_dictChainRef(&d->ht[0],d->rehashidx);
         /* Move all the keys in this bucket from the old to the new hash HT */
         while(de) {
-            uint64_t h;
+            dictEntry **ref;
 
             nextde = de->next;
             /* Get the index in the new hash table */
-            h = dictHashKey(d, de->key) & d->ht[1].sizemask;
-            de->next = d->ht[1].table[h];
-            d->ht[1].table[h] = de;
+            ref = _dictHtBucketAlloc(&d->ht[1],
+                dictHashKey(d, de->key) & d->ht[1].sizemask,
+                sizeof(dictEntry*));
+            de->next = *ref;
+            *ref = de;
             d->ht[0].used--;
             d->ht[1].used++;
             de = nextde;
         }
-        d->ht[0].table[d->rehashidx] = NULL;
-        d->rehashidx++;
+        *_dictChainRef(&d->ht[0],d->rehashidx) = NULL;
+        _dictRehashAdvance(d);
     }
 
     /* Check if we already rehashed the whole table... */
     if (d->ht[0].used == 0) {
-        zfree(d->ht[0].table);
+        _dictHtFree(&d->ht[0]);
         d->ht[0] = d->ht[1];
         _dictReset(&d->ht[1]);
         d->rehashidx = -1;
@@ -261,6 +618,37 @@ static void _dictRehashStep(dict *d) {
     if (d->iterators == 0) dictRehash(d,1);
 }
 
+/* Return the table where a new entry with the specified hash is stored.
+ *
+ * While rehashing, new entries are normally stored in the new table, but
+ * when the new table is segmented this would allocate its segments as soon
+ * as keys are added at random positions. So if the key maps to a bucket of
+ * the old table not yet rehashed, and to a segment of the new table not
+ * yet allocated, the entry is stored in the old table instead, and moved
+ * later with its bucket: this way the new table segments are mostly
+ * allocated in the same order the old table segments are released. Open
+ * addressing tables do that only while the old table is not almost full,
+ * and if a free slot is found probing a few buckets without wrapping to
+ * the already rehashed ones. */
+static dictht *_dictInsertTable(dict *d, uint64_t hash) {
+    dictht *ht0 = &d->ht[0], *ht1 = &d->ht[1];
+    unsigned long idx = hash & ht0->sizemask, j;
+
+    if (!dictIsRehashing(d)) return ht0;
+    if (ht1->segbits == 0 || (long)idx < d->rehashidx ||
+        dictHtBucket(ht1,hash & ht1->sizemask,dictBucketSize(d)) != NULL)
+        return ht1;
+    if (!dictIsOpenAddressing(d)) return ht0;
+    if (_dictOpenNeedsExpand(ht0,0)) return ht1;
+    for (j = idx; j < ht0->size && j < idx+DICT_INSERT_MAX_PROBES; j++) {
+        dictBucket *b = _dictOpenBucket(ht0,j);
+
+        if (b == NULL || (b->meta & DICT_BUCKET_PRESENCE) != DICT_BUCKET_PRESENCE)
+            return ht0;
+    }
+    return ht1;
+}
+
 /* Add an element to the target hash table */
 int dictAdd(dict *d, void *key, void *val)
 {
@@ -288,32 +676,51 @@ int dictAdd(dict *d, void *key, void *val)
  * with the existing entry if existing is not NULL.
  *
  * If key was added, the hash entry is returned to be manipulated by the caller.
+ *
+ * Dictionaries embedding their keys copy 'key' inside the entry allocation,
+ * so the caller retains the ownership of the key it passed.
  */
 dictEntry *dictAddRaw(dict *d, void *key, dictEntry **existing)
 {
     long index;
     dictEntry *entry;
     dictht *ht;
+    uint64_t hash;
+    size_t entrysize;
 
     if (dictIsRehashing(d)) _dictRehashStep(d);
 
     /* Get the index of the new element, or -1 if
      * the element already exists. */
-    if ((index = _dictKeyIndex(d, key, dictHashKey(d,key), existing)) == -1)
+    hash = dictHashKey(d,key);
+    if ((index = _dictKeyIndex(d, key, hash, existing)) == -1)
         return NULL;
 
     /* Allocate the memory and store the new entry.
      * Insert the element in top, with the assumption that in a database
      * system it is more likely that recently added entries are accessed
      * more frequently. */
-    ht = dictIsRehashing(d) ? &d->ht[1] : &d->ht[0];
-    entry = zmalloc(sizeof(*entry));
-    entry->next = ht->table[index];
-    ht->table[index] = entry;
-    ht->used++;
+    ht = _dictInsertTable(d,hash);
+    index = hash & ht->sizemask;
+    entrysize = dictEntryAllocSize(d)+d->type->entryMetadataBytes;
+    if (dictIsEmbeddingKeys(d)) {
+        entry = zmalloc(entrysize+d->type->keyEmbedLen(key));
+        entry->key = d->type->keyEmbed((char*)entry+entrysize,key);
+    } else {
+        entry = zmalloc(entrysize);
+        dictSetKey(d, entry, key);
+    }
+    if (d->type->entryMetadataBytes)
+        memset(dictEntryMetadata(d,entry),0,d->type->entryMetadataBytes);
+    if (dictIsOpenAddressing(d)) {
+        _dictOpenInsert(ht,entry,hash);
+    } else {
+        dictEntry **ref = _dictHtBucketAlloc(ht,index,sizeof(dictEntry*));
 
-    /* Set the hash entry fields. */
-    dictSetKey(d, entry, key);
+        entry->next = *ref;
+        *ref = entry;
+        ht->used++;
+    }
     return entry;
 }
 
@@ -363,7 +770,7 @@ dictEntry *dictAddOrFind(dict *d, void *key) {
  * of those functions. */
 static dictEntry *dictGenericDelete(dict *d, const void *key, int nofree) {
     uint64_t h, idx;
-    dictEntry *he, *prevHe;
+    dictEntry *he, *prevHe, **ref;
     int table;
 
     if (d->ht[0].used == 0 && d->ht[1].used == 0) return NULL;
@@ -372,8 +779,19 @@ static dictEntry *dictGenericDelete(dict *d, const void *key, int nofree) {
     h = dictHashKey(d, key);
 
     for (table = 0; table <= 1; table++) {
+        if (dictIsOpenAddressing(d)) {
+            long pos = _dictOpenFind(d, &d->ht[table], key, h);
+            if (pos != -1) {
+                he = _dictOpenRemove(&d->ht[table], pos);
+                if (!nofree) dictFreeUnlinkedEntry(d, he);
+                return he;
+            }
+            if (!dictIsRehashing(d)) break;
+            continue;
+        }
         idx = h & d->ht[table].sizemask;
-        he = d->ht[table].table[idx];
+        ref = d->ht[table].size ? _dictChainRef(&d->ht[table],idx) : NULL;
+        he = ref ? *ref : NULL;
         prevHe = NULL;
         while(he) {
             if (key==he->key || dictCompareKeys(d, key, he->key)) {
@@ -381,7 +799,7 @@ static dictEntry *dictGenericDelete(dict *d, const void *key, int nofree) {
                 if (prevHe)
                     prevHe->next = he->next;
                 else
-                    d->ht[table].table[idx] = he->next;
+                    *ref = he->next;
                 if (!nofree) {
                     dictFreeKey(d, he);
                     dictFreeVal(d, he);
@@ -448,7 +866,26 @@ int _dictClear(dict *d, dictht *ht, void(callback)(void *)) {
 
         if (callback && (i & 65535) == 0) callback(d->privdata);
 
-        if ((he = ht->table[i]) == NULL) continue;
+        if (dictHtBucket(ht,i,dictBucketSize(d)) == NULL) {
+            i = _dictNextSegment(ht,i)-1; /* Empty segment. */
+            continue;
+        }
+        if (dictIsOpenAddressing(d)) {
+            dictBucket *b = _dictOpenBucket(ht,i);
+            unsigned int used = b->meta & DICT_BUCKET_PRESENCE;
+
+            while (used) {
+                he = b->entries[dictLowestBit(used)];
+                dictFreeKey(d, he);
+                dictFreeVal(d, he);
+                zfree(he);
+                ht->used--;
+                used &= used-1;
+            }
+            continue;
+        }
+
+        if ((he = *_dictChainRef(ht,i)) == NULL) continue;
         while(he) {
             nextHe = he->next;
             dictFreeKey(d, he);
@@ -459,7 +896,7 @@ int _dictClear(dict *d, dictht *ht, void(callback)(void *)) {
         }
     }
     /* Free the table and the allocated cache structure */
-    zfree(ht->table);
+    _dictHtFree(ht);
     /* Re-initialize the table */
     _dictReset(ht);
     return DICT_OK; /* never fails */
@@ -473,17 +910,22 @@ void dictRelease(dict *d)
     zfree(d);
 }
 
-dictEntry *dictFind(dict *d, const void *key)
+/* Return the entry with the specified key given its hash, without performing
+ * any rehashing step. */
+static dictEntry *_dictFind(dict *d, const void *key, uint64_t h)
 {
     dictEntry *he;
-    uint64_t h, idx, table;
+    uint64_t idx, table;
 
-    if (d->ht[0].used + d->ht[1].used == 0) return NULL; /* dict is empty */
-    if (dictIsRehashing(d)) _dictRehashStep(d);
-    h = dictHashKey(d, key);
     for (table = 0; table <= 1; table++) {
+        if (dictIsOpenAddressing(d)) {
+            long pos = _dictOpenFind(d, &d->ht[table], key, h);
+            if (pos != -1) return _dictOpenEntry(&d->ht[table], pos);
+            if (!dictIsRehashing(d)) return NULL;
+            continue;
+        }
         idx = h & d->ht[table].sizemask;
-        he = d->ht[table].table[idx];
+        he = _dictChainHead(&d->ht[table],idx);
         while(he) {
             if (key==he->key || dictCompareKeys(d, key, he->key))
                 return he;
@@ -494,6 +936,115 @@ dictEntry *dictFind(dict *d, const void *key)
     return NULL;
 }
 
+dictEntry *dictFind(dict *d, const void *key)
+{
+    if (d->ht[0].used + d->ht[1].used == 0) return NULL; /* dict is empty */
+    if (dictIsRehashing(d)) _dictRehashStep(d);
+    return _dictFind(d, key, dictHashKey(d, key));
+}
+
+/* Batched lookups.
+ *
+ * Looking up a key in a large table is a chain of dependent cache misses:
+ * the bucket, the entry, then the key. When many keys are looked up at
+ * once we can do better, hashing all of them first and issuing prefetches
+ * for every step of every lookup before the next step, so that the memory
+ * accesses of the different keys overlap. */
+
+#if defined(__GNUC__)
+#define dictPrefetchAddr(addr) __builtin_prefetch(addr)
+#else
+#define dictPrefetchAddr(addr) ((void)(addr))
+#endif
+
+/* Prefetch the buckets the hash 'h' maps to. */
+static void _dictPrefetchBuckets(dict *d, uint64_t h) {
+    int table;
+
+    for (table = 0; table <= (dictIsRehashing(d) ? 1 : 0); table++) {
+        dictht *ht = &d->ht[table];
+
+        void *bucket;
+
+        if (ht->size == 0) continue;
+        bucket = dictHtBucket(ht,h & ht->sizemask,dictBucketSize(d));
+        if (bucket) dictPrefetchAddr(bucket);
+    }
+}
+
+/* Return the first entry of the bucket the hash 'h' maps to in the table
+ * 'ht' that may have the key, or NULL. */
+static dictEntry *_dictFirstCandidate(dict *d, dictht *ht, uint64_t h) {
+    if (ht->size == 0) return NULL;
+    if (dictIsOpenAddressing(d)) {
+        dictBucket *b = _dictOpenBucket(ht,h & ht->sizemask);
+        unsigned int match;
+
+        if (b == NULL) return NULL;
+        match = dictBucketMatch(b->meta,dictHashTag(h));
+        return match ? b->entries[dictLowestBit(match)] : NULL;
+    }
+    return _dictChainHead(ht,h & ht->sizemask);
+}
+
+/* Lookup up to DICT_BATCH_SIZE keys, storing the entries found (or NULL)
+ * into 'des' if it is not NULL, otherwise just prefetching what the lookups
+ * would access. */
+static void _dictBatchLookup(dict *d, void **keys, unsigned long count, dictEntry **des) {
+    uint64_t hashes[DICT_BATCH_SIZE];
+    dictEntry *candidates[DICT_BATCH_SIZE*2];
+    unsigned long j;
+
+    /* Perform the rehashing steps the single lookups would perform. */
+    for (j = 0; j < count && dictIsRehashing(d); j++) _dictRehashStep(d);
+
+    for (j = 0; j < count; j++) {
+        hashes[j] = dictHashKey(d, keys[j]);
+        _dictPrefetchBuckets(d,hashes[j]);
+    }
+    for (j = 0; j < count; j++) {
+        candidates[j*2] = _dictFirstCandidate(d,&d->ht[0],hashes[j]);
+        candidates[j*2+1] = dictIsRehashing(d) ?
+            _dictFirstCandidate(d,&d->ht[1],hashes[j]) : NULL;
+        if (candidates[j*2]) dictPrefetchAddr(candidates[j*2]);
+        if (candidates[j*2+1]) dictPrefetchAddr(candidates[j*2+1]);
+    }
+    for (j = 0; j < count*2; j++) {
+        if (candidates[j] == NULL) continue;
+        dictPrefetchAddr(candidates[j]->key);
+        if (des == NULL) dictPrefetchAddr(candidates[j]->v.val);
+    }
+    if (des == NULL) return;
+    for (j = 0; j < count; j++) des[j] = _dictFind(d, keys[j], hashes[j]);
+}
+
+/* Lookup 'count' keys at once, storing in des[j] the entry of keys[j], or
+ * NULL if the key is not in the dictionary. The result is the same of
+ * calling dictFind() for every key, but the lookups proceed in parallel. */
+void dictFindBatch(dict *d, void **keys, unsigned long count, dictEntry **des) {
+    unsigned long j;
+
+    if (d->ht[0].used + d->ht[1].used == 0) {
+        for (j = 0; j < count; j++) des[j] = NULL;
+        return;
+    }
+    for (j = 0; j < count; j += DICT_BATCH_SIZE) {
+        unsigned long n = count-j < DICT_BATCH_SIZE ? count-j : DICT_BATCH_SIZE;
+        _dictBatchLookup(d, keys+j, n, des+j);
+    }
+}
+
+/* Bring into the CPU caches the memory that looking up 'count' keys and
+ * accessing their values will touch, without waiting for it: this is
+ * useful before performing operations on many keys that can't use
+ * dictFindBatch(), like writes. Only the first DICT_BATCH_SIZE keys are
+ * prefetched, since more would not fit the caches anyway. */
+void dictPrefetch(dict *d, void **keys, unsigned long count) {
+    if (d->ht[0].used + d->ht[1].used == 0) return;
+    if (count > DICT_BATCH_SIZE) count = DICT_BATCH_SIZE;
+    _dictBatchLookup(d, keys, count, NULL);
+}
+
 void *dictFetchValue(dict *d, const void *key) {
     dictEntry *he;
 
@@ -562,9 +1113,55 @@ dictIterator *dictGetSafeIterator(dict *d) {
     return i;
 }
 
+/* dictNext() implementation for open addressing tables, where iter->index
+ * is the position (bucket*DICT_BUCKET_SLOTS+slot) of the last returned
+ * entry, and iter->nextEntry is not used. */
+static dictEntry *_dictOpenNext(dictIterator *iter) {
+    if (iter->index == -1 && iter->table == 0) {
+        if (iter->safe)
+            iter->d->iterators++;
+        else
+            iter->fingerprint = dictFingerprint(iter->d);
+    }
+    while (1) {
+        dictht *ht = &iter->d->ht[iter->table];
+        unsigned long bucket;
+        unsigned int used;
+        dictBucket *b;
+
+        iter->index++;
+        if (iter->index >= (long) (ht->size*DICT_BUCKET_SLOTS)) {
+            if (dictIsRehashing(iter->d) && iter->table == 0) {
+                iter->table++;
+                iter->index = -1;
+                continue;
+            }
+            return NULL;
+        }
+        bucket = iter->index / DICT_BUCKET_SLOTS;
+        b = _dictOpenBucket(ht,bucket);
+        if (b == NULL) {
+            /* Skip to the last slot of this segment. */
+            iter->index = _dictNextSegment(ht,bucket)*DICT_BUCKET_SLOTS-1;
+            continue;
+        }
+        used = b->meta & DICT_BUCKET_PRESENCE;
+        used &= ~((1u << (iter->index % DICT_BUCKET_SLOTS)) - 1);
+        if (used == 0) {
+            /* Skip to the last slot of this bucket. */
+            iter->index = bucket*DICT_BUCKET_SLOTS + DICT_BUCKET_SLOTS-1;
+            continue;
+        }
+        iter->index = bucket*DICT_BUCKET_SLOTS + dictLowestBit(used);
+        iter->entry = b->entries[dictLowestBit(used)];
+        return iter->entry;
+    }
+}
+
 /* 查找下一个哈希表节点 */
 dictEntry *dictNext(dictIterator *iter)
 {
+    if (dictIsOpenAddressing(iter->d)) return _dictOpenNext(iter);
     while (1) {
         if (iter->entry == NULL) {                          /* 哈希表节点为空 */
             dictht *ht = &iter->d->ht[iter->table];         /* 获取0号哈希表 */
@@ -584,7 +1181,7 @@ dictEntry *dictNext(dictIterator *iter)
                     break;
                 }
             }
-            iter->entry = ht->table[iter->index];
+            iter->entry = _dictChainHead(ht,iter->index);
         } else {                                            /* 哈希表节点不为空 */
             iter->entry = iter->nextEntry;
         }
@@ -618,6 +1215,33 @@ dictEntry *dictGetRandomKey(dict *d)
 
     if (dictSize(d) == 0) return NULL;
     if (dictIsRehashing(d)) _dictRehashStep(d);
+    if (dictIsOpenAddressing(d)) {
+        dictBucket *b;
+        unsigned int used;
+
+        do {
+            /* Same as below, but picking a random non empty bucket. */
+            if (dictIsRehashing(d)) {
+                h = d->rehashidx + (random() % (d->ht[0].size +
+                                                d->ht[1].size -
+                                                d->rehashidx));
+                b = (h >= d->ht[0].size) ?
+                    _dictOpenBucket(&d->ht[1],h - d->ht[0].size) :
+                    _dictOpenBucket(&d->ht[0],h);
+            } else {
+                h = random() & d->ht[0].sizemask;
+                b = _dictOpenBucket(&d->ht[0],h);
+            }
+            used = b ? b->meta & DICT_BUCKET_PRESENCE : 0;
+        } while(used == 0);
+
+        /* Select a random entry among the ones in the bucket. */
+        listlen = 0;
+        for (h = used; h; h &= h-1) listlen++;
+        listele = random() % listlen;
+        while(listele--) used &= used-1;
+        return b->entries[dictLowestBit(used)];
+    }
     if (dictIsRehashing(d)) {
         do {
             /* We are sure there are no elements in indexes from 0
@@ -625,13 +1249,14 @@ dictEntry *dictGetRandomKey(dict *d)
             h = d->rehashidx + (random() % (d->ht[0].size +
                                             d->ht[1].size -
                                             d->rehashidx));
-            he = (h >= d->ht[0].size) ? d->ht[1].table[h - d->ht[0].size] :
-                                      d->ht[0].table[h];
+            he = (h >= d->ht[0].size) ?
+                _dictChainHead(&d->ht[1],h - d->ht[0].size) :
+                _dictChainHead(&d->ht[0],h);
         } while(he == NULL);
     } else {
         do {
             h = random() & d->ht[0].sizemask;
-            he = d->ht[0].table[h];
+            he = _dictChainHead(&d->ht[0],h);
         } while(he == NULL);
     }
 
@@ -714,7 +1339,30 @@ unsigned int dictGetSomeKeys(dict *d, dictEntry **des, unsigned int count) {
                     continue;
             }
             if (i >= d->ht[j].size) continue; /* Out of range for this table. */
-            dictEntry *he = d->ht[j].table[i];
+            if (dictIsOpenAddressing(d)) {
+                dictBucket *b = _dictOpenBucket(&d->ht[j],i);
+                unsigned int used = b ? b->meta & DICT_BUCKET_PRESENCE : 0;
+
+                /* Same as below, for the entries of the bucket. */
+                if (used == 0) {
+                    emptylen++;
+                    if (emptylen >= 5 && emptylen > count) {
+                        i = random() & maxsizemask;
+                        emptylen = 0;
+                    }
+                } else {
+                    emptylen = 0;
+                    while (used) {
+                        *des = b->entries[dictLowestBit(used)];
+                        des++;
+                        used &= used-1;
+                        stored++;
+                        if (stored == count) return stored;
+                    }
+                }
+                continue;
+            }
+            dictEntry *he = _dictChainHead(&d->ht[j],i);
 
             /* Count contiguous empty buckets, and jump to other
              * locations if they reach 'count' (with a minimum of 5). */
@@ -837,7 +1485,80 @@ static unsigned long rev(unsigned long v) {
  *    we are sure we don't miss keys moving during rehashing.
  * 3) The reverse cursor is somewhat hard to understand at first, but this
  *    comment is supposed to help.
+ *
+ * OPEN ADDRESSING TABLES
+ *
+ * In open addressing tables a key may be stored in one of the buckets
+ * following the one its hash maps to, so when visiting a bucket we also
+ * visit the following ones as long as a lookup would continue probing,
+ * that is, as long as the visited buckets were full at some point, and
+ * return the keys mapping to the visited bucket. This way all the keys
+ * mapping to a bucket are returned when the cursor visits that bucket, and
+ * the above reasoning holds. Keys are hashed to check where they map only
+ * when needed: if the bucket before the visited one was never full, all
+ * the keys stored in the visited bucket map to it.
  */
+
+/* Emit the entries of the bucket 'idx' of the table 'ht' for dictScan(). */
+static void dictScanBucket(dict *d, dictht *ht, unsigned long idx,
+                           dictScanFunction *fn,
+                           dictScanBucketFunction *bucketfn,
+                           void *privdata)
+{
+    if (dictIsOpenAddressing(d)) {
+        unsigned long home = idx, prev = (idx-1) & ht->sizemask, probes = 0;
+        dictBucket *b = _dictOpenBucket(ht,prev);
+        int hashkeys = _dictProbeIdx(d,ht,idx) != idx ||
+                       _dictProbeIdx(d,ht,prev) != prev ||
+                       (b && b->meta & DICT_BUCKET_EVERFULL);
+
+        do {
+            unsigned int used, u;
+
+            idx = _dictProbeIdx(d,ht,idx);
+            if ((b = _dictOpenBucket(ht,idx)) == NULL) break;
+            used = b->meta & DICT_BUCKET_PRESENCE;
+            if (hashkeys) {
+                for (u = used; u; u &= u-1)
+                    dictPrefetchAddr(b->entries[dictLowestBit(u)]);
+            }
+            for (u = used; hashkeys && u; u &= u-1) {
+                int slot = dictLowestBit(u);
+                void *key = dictGetKey(b->entries[slot]);
+
+                if ((dictHashKey(d,key) & ht->sizemask) != home)
+                    used &= ~(1U << slot);
+            }
+            if (bucketfn) {
+                for (u = used; u; u &= u-1)
+                    bucketfn(privdata, &b->entries[dictLowestBit(u)]);
+            }
+            for (u = used; u; u &= u-1)
+                fn(privdata, b->entries[dictLowestBit(u)]);
+            if (!(b->meta & DICT_BUCKET_EVERFULL)) break;
+            idx = (idx+1) & ht->sizemask;
+            hashkeys = 1;
+        } while(++probes < ht->size);
+    } else {
+        dictEntry **ref = _dictChainRef(ht,idx);
+        const dictEntry *de, *next;
+
+        if (ref == NULL) return;
+        if (bucketfn) {
+            while (*ref) {
+                bucketfn(privdata, ref);
+                ref = &(*ref)->next;
+            }
+        }
+        de = *_dictChainRef(ht,idx);
+        while (de) {
+            next = de->next;
+            fn(privdata, de);
+            de = next;
+        }
+    }
+}
+
 unsigned long dictScan(dict *d,
                        unsigned long v,
                        dictScanFunction *fn,
@@ -845,7 +1566,6 @@ unsigned long dictScan(dict *d,
                        void *privdata)
 {
     dictht *t0, *t1;
-    const dictEntry *de, *next;
     unsigned long m0, m1;
 
     if (dictSize(d) == 0) return 0;
@@ -855,13 +1575,7 @@ unsigned long dictScan(dict *d,
         m0 = t0->sizemask;
 
         /* Emit entries at cursor */
-        if (bucketfn) bucketfn(privdata, &t0->table[v & m0]);
-        de = t0->table[v & m0];
-        while (de) {
-            next = de->next;
-            fn(privdata, de);
-            de = next;
-        }
+        dictScanBucket(d, t0, v & m0, fn, bucketfn, privdata);
 
         /* Set unmasked bits so incrementing the reversed cursor
          * operates on the masked bits */
@@ -886,25 +1600,13 @@ unsigned long dictScan(dict *d,
         m1 = t1->sizemask;
 
         /* Emit entries at cursor */
-        if (bucketfn) bucketfn(privdata, &t0->table[v & m0]);
-        de = t0->table[v & m0];
-        while (de) {
-            next = de->next;
-            fn(privdata, de);
-            de = next;
-        }
+        dictScanBucket(d, t0, v & m0, fn, bucketfn, privdata);
 
         /* Iterate over indices in larger table that are the expansion
          * of the index pointed to by the cursor in the smaller table */
         do {
             /* Emit entries at cursor */
-            if (bucketfn) bucketfn(privdata, &t1->table[v & m1]);
-            de = t1->table[v & m1];
-            while (de) {
-                next = de->next;
-                fn(privdata, de);
-                de = next;
-            }
+            dictScanBucket(d, t1, v & m1, fn, bucketfn, privdata);
 
             /* Increment the reverse cursor not covered by the smaller mask.*/
             v |= ~m1;
@@ -924,12 +1626,44 @@ unsigned long dictScan(dict *d,
 /* Expand the hash table if needed */
 static int _dictExpandIfNeeded(dict *d)
 {
-    /* Incremental rehashing already in progress. Return. */
-    if (dictIsRehashing(d)) return DICT_OK;
+    /* Incremental rehashing already in progress. Return. However open
+     * addressing tables can't hold more elements than slots, so the new
+     * table must have room for the elements still in the old table too.
+     * If it is getting full, because safe iterators prevented the rehashing
+     * from proceeding, we rehash more buckets at every insertion, so that
+     * the rehashing completes, and the table can grow again, before the new
+     * table is full. Entries can't be moved while safe iterators are active
+     * (they would be returned twice, or missed), so in that case we finish
+     * rehashing only as a last resort, when there is no room left. */
+    if (dictIsRehashing(d)) {
+        if (!dictIsOpenAddressing(d)) return DICT_OK;
+
+        unsigned long used = d->ht[0].used + d->ht[1].used;
+        unsigned long slots = d->ht[1].size*DICT_BUCKET_SLOTS;
+        if (used*32 < slots*31) return DICT_OK;
+        if (d->iterators == 0)
+            dictRehash(d,100);
+        else if (used+1 >= slots)
+            while(dictRehash(d,100));
+        if (dictIsRehashing(d)) return DICT_OK;
+    }
 
     /* If the hash table is empty expand it to the initial size. */
     if (d->ht[0].size == 0) return dictExpand(d, DICT_HT_INITIAL_SIZE);
 
+    if (dictIsOpenAddressing(d)) {
+        /* Growing or rebuilding the table starts a rehashing that can't
+         * proceed while safe iterators are active: defer it, as if resizing
+         * was disabled, so that it likely starts after the iteration. */
+        int can_resize = dict_can_resize && d->iterators == 0;
+
+        if (_dictOpenNeedsExpand(&d->ht[0],can_resize))
+            return dictExpand(d, d->ht[0].used*2);
+        if (_dictOpenNeedsRebuild(&d->ht[0],can_resize))
+            return _dictOpenRebuild(d);
+        return DICT_OK;
+    }
+
     /* If we reached the 1:1 ratio, and we are allowed to resize the hash
      * table (global setting) or we should avoid it but the ratio between
      * elements/buckets is over the "safe" threshold, we resize doubling
@@ -965,7 +1699,7 @@ static unsigned long _dictNextPower(unsigned long size)
  * index is always returned in the context of the second (new) hash table. */
 static long _dictKeyIndex(dict *d, const void *key, uint64_t hash, dictEntry **existing)
 {
-    unsigned long idx, table;
+    unsigned long idx = 0, table;
     dictEntry *he;
     if (existing) *existing = NULL;
 
@@ -973,9 +1707,20 @@ static long _dictKeyIndex(dict *d, const void *key, uint64_t hash, dictEntry **e
     if (_dictExpandIfNeeded(d) == DICT_ERR)
         return -1;
     for (table = 0; table <= 1; table++) {
+        /* Open addressing tables don't use the returned index, the
+         * entry is stored by _dictOpenInsert(). */
+        if (dictIsOpenAddressing(d)) {
+            long pos = _dictOpenFind(d, &d->ht[table], key, hash);
+            if (pos != -1) {
+                if (existing) *existing = _dictOpenEntry(&d->ht[table], pos);
+                return -1;
+            }
+            if (!dictIsRehashing(d)) break;
+            continue;
+        }
         idx = hash & d->ht[table].sizemask;
         /* Search if this slot does not already contain the given key */
-        he = d->ht[table].table[idx];
+        he = _dictChainHead(&d->ht[table],idx);
         while(he) {
             if (key==he->key || dictCompareKeys(d, key, he->key)) {
                 if (existing) *existing = he;
@@ -1018,9 +1763,33 @@ dictEntry **dictFindEntryRefByPtrAndHash(dict *d, const void *oldptr, uint64_t h
 
     if (d->ht[0].used + d->ht[1].used == 0) return NULL; /* dict is empty */
     for (table = 0; table <= 1; table++) {
+        if (d->ht[table].size == 0) return NULL;
+        if (dictIsOpenAddressing(d)) {
+            unsigned long probes = 0;
+
+            idx = hash & d->ht[table].sizemask;
+            do {
+                dictBucket *b;
+                unsigned int match;
+
+                idx = _dictProbeIdx(d,&d->ht[table],idx);
+                if ((b = _dictOpenBucket(&d->ht[table],idx)) == NULL) break;
+                match = dictBucketMatch(b->meta,dictHashTag(hash));
+                while (match) {
+                    heref = &b->entries[dictLowestBit(match)];
+                    if (oldptr==(*heref)->key)
+                        return heref;
+                    match &= match-1;
+                }
+                if (!(b->meta & DICT_BUCKET_EVERFULL)) break;
+                idx = (idx+1) & d->ht[table].sizemask;
+            } while(++probes < d->ht[table].size);
+            if (!dictIsRehashing(d)) return NULL;
+            continue;
+        }
         idx = hash & d->ht[table].sizemask;
-        heref = &d->ht[table].table[idx];
-        he = *heref;
+        heref = _dictChainRef(&d->ht[table],idx);
+        he = heref ? *heref : NULL;
         while(he) {
             if (oldptr==he->key)
                 return heref;
@@ -1032,6 +1801,22 @@ dictEntry **dictFindEntryRefByPtrAndHash(dict *d, const void *oldptr, uint64_t h
     return NULL;
 }
 
+/* Return the memory used by the table 'ht' of 'd'. */
+static size_t _dictHtMemUsage(dict *d, dictht *ht) {
+    if (ht->segbits == 0) return ht->size*dictBucketSize(d);
+    return (ht->size >> ht->segbits)*sizeof(void*) +
+           (ht->segments << ht->segbits)*dictBucketSize(d);
+}
+
+/* Return the memory used by the hash tables and the entries of the
+ * dictionary, including the entries metadata but not the keys and values. */
+size_t dictMemUsage(dict *d) {
+    size_t entrysize = dictEntryAllocSize(d)+d->type->entryMetadataBytes;
+
+    return _dictHtMemUsage(d,&d->ht[0]) + _dictHtMemUsage(d,&d->ht[1]) +
+           dictSize(d)*entrysize;
+}
+
 /* ------------------------------- Debugging ---------------------------------*/
 
 #define DICT_STATS_VECTLEN 50
@@ -1049,16 +1834,15 @@ size_t _dictGetStatsHt(char *buf, size_t bufsize, dictht *ht, int tableid) {
     /* Compute stats. */
     for (i = 0; i < DICT_STATS_VECTLEN; i++) clvector[i] = 0;
     for (i = 0; i < ht->size; i++) {
-        dictEntry *he;
+        dictEntry *he = _dictChainHead(ht,i);
 
-        if (ht->table[i] == NULL) {
+        if (he == NULL) {
             clvector[0]++;
             continue;
         }
         slots++;
         /* For each hash entry on this slot... */
         chainlen = 0;
-        he = ht->table[i];
         while(he) {
             chainlen++;
             he = he->next;
@@ -1096,16 +1880,83 @@ size_t _dictGetStatsHt(char *buf, size_t bufsize, dictht *ht, int tableid) {
     return strlen(buf);
 }
 
+/* Stats of open addressing tables: instead of the chain lengths we report
+ * the distribution of the number of entries per bucket, and how far from
+ * the bucket their hash maps to the entries are stored. */
+size_t _dictGetStatsOpenHt(char *buf, size_t bufsize, dict *d, dictht *ht,
+                           int tableid)
+{
+    unsigned long i, probelen, maxprobelen = 0;
+    unsigned long totprobelen = 0;
+    unsigned long fillvector[DICT_BUCKET_SLOTS+1];
+    size_t l = 0;
+
+    if (ht->used == 0) {
+        return snprintf(buf,bufsize,
+            "No stats available for empty dictionaries\n");
+    }
+
+    /* Compute stats. */
+    for (i = 0; i <= DICT_BUCKET_SLOTS; i++) fillvector[i] = 0;
+    for (i = 0; i < ht->size; i++) {
+        dictBucket *b = _dictOpenBucket(ht,i);
+        unsigned int used = b ? b->meta & DICT_BUCKET_PRESENCE : 0;
+        int count = 0;
+
+        for (; used; used &= used-1) {
+            dictEntry *he = b->entries[dictLowestBit(used)];
+            uint64_t h = dictHashKey(d, he->key) & ht->sizemask;
+
+            probelen = (i - h) & ht->sizemask;
+            if (probelen > maxprobelen) maxprobelen = probelen;
+            totprobelen += probelen;
+            count++;
+        }
+        fillvector[count]++;
+    }
+
+    /* Generate human readable stats. */
+    l += snprintf(buf+l,bufsize-l,
+        "Hash table %d stats (%s):\n"
+        " table size: %ld buckets of %d slots\n"
+        " number of elements: %ld\n"
+        " buckets ever full: %ld (%ld not full anymore)\n"
+        " max probe length: %ld\n"
+        " avg probe length: %.02f\n"
+        " Bucket fill distribution:\n",
+        tableid, (tableid == 0) ? "main hash table" : "rehashing target",
+        ht->size, DICT_BUCKET_SLOTS, ht->used, ht->everfull, ht->stale,
+        maxprobelen,
+        (float)totprobelen/ht->used);
+
+    for (i = 0; i <= DICT_BUCKET_SLOTS; i++) {
+        if (fillvector[i] == 0) continue;
+        if (l >= bufsize) break;
+        l += snprintf(buf+l,bufsize-l,
+            "   %ld: %ld (%.02f%%)\n",
+            i, fillvector[i], ((float)fillvector[i]/ht->size)*100);
+    }
+
+    if (bufsize) buf[bufsize-1] = '\0';
+    return strlen(buf);
+}
+
 void dictGetStats(char *buf, size_t bufsize, dict *d) {
     size_t l;
     char *orig_buf = buf;
     size_t orig_bufsize = bufsize;
 
-    l = _dictGetStatsHt(buf,bufsize,&d->ht[0],0);
+    if (dictIsOpenAddressing(d))
+        l = _dictGetStatsOpenHt(buf,bufsize,d,&d->ht[0],0);
+    else
+        l = _dictGetStatsHt(buf,bufsize,&d->ht[0],0);
     buf += l;
     bufsize -= l;
     if (dictIsRehashing(d) && bufsize > 0) {
-        _dictGetStatsHt(buf,bufsize,&d->ht[1],1);
+        if (dictIsOpenAddressing(d))
+            _dictGetStatsOpenHt(buf,bufsize,d,&d->ht[1],1);
+        else
+            _dictGetStatsHt(buf,bufsize,&d->ht[1],1);
     }
     /* Make sure there is a NULL term at the end. */
     if (orig_bufsize) orig_buf[orig_bufsize-1] = '\0';
@@ -1146,24 +1997,28 @@ dictType BenchmarkDictType = {
     NULL
 };
 
+dictType BenchmarkOpenDictType = {
+    hashCallback,
+    NULL,
+    NULL,
+    compareCallback,
+    freeCallback,
+    NULL,
+    1
+};
+
 #define start_benchmark() start = timeInMilliseconds()
 #define end_benchmark(msg) do { \
     elapsed = timeInMilliseconds()-start; \
-    printf(msg ": %ld items in %lld ms\n", count, elapsed); \
+    printf("%s, " msg ": %ld items in %lld ms\n", name, count, elapsed); \
 } while(0);
 
-/* dict-benchmark [count] */
-int main(int argc, char **argv) {
+/* Run the benchmark against a dictionary of the specified type. */
+void dictBenchmark(dictType *type, char *name, long count) {
     long j;
     long long start, elapsed;
-    dict *dict = dictCreate(&BenchmarkDictType,NULL);
-    long count = 0;
-
-    if (argc == 2) {
-        count = strtol(argv[1],NULL,10);
-    } else {
-        count = 5000000;
-    }
+    size_t used_memory = zmalloc_used_memory();
+    dict *dict = dictCreate(type,NULL);
 
     start_benchmark();
     for (j = 0; j < count; j++) {
@@ -1177,6 +2032,8 @@ int main(int argc, char **argv) {
     while (dictIsRehashing(dict)) {
         dictRehashMilliseconds(dict,100);
     }
+    printf("%s, Memory used: %zu bytes (%zu bytes of table and entries)\n",
+        name, zmalloc_used_memory()-used_memory, dictMemUsage(dict));
 
     start_benchmark();
     for (j = 0; j < count; j++) {
@@ -1215,6 +2072,38 @@ int main(int argc, char **argv) {
     }
     end_benchmark("Accessing missing");
 
+    /* Safe iterators must return every element present when the iteration
+     * started exactly once, even if the dictionary doubles meanwhile. */
+    start_benchmark();
+    char *seen = zcalloc(count);
+    long added = 0;
+    dictIterator *di = dictGetSafeIterator(dict);
+    dictEntry *de;
+    while ((de = dictNext(di)) != NULL) {
+        long val = (long)dictGetVal(de);
+        if (val < count) {
+            assert(seen[val] == 0);
+            seen[val] = 1;
+        }
+        if (added < count) {
+            int retval = dictAdd(dict,sdsfromlonglong(count+added),
+                                 (void*)(count+added));
+            assert(retval == DICT_OK);
+            added++;
+        }
+    }
+    dictReleaseIterator(di);
+    for (j = 0; j < count; j++) assert(seen[j] == 1);
+    zfree(seen);
+    end_benchmark("Adding while iterating");
+    assert((long)dictSize(dict) == count*2);
+    for (j = count; j < count*2; j++) {
+        sds key = sdsfromlonglong(j);
+        int retval = dictDelete(dict,key);
+        assert(retval == DICT_OK);
+        sdsfree(key);
+    }
+
     start_benchmark();
     for (j = 0; j < count; j++) {
         sds key = sdsfromlonglong(j);
@@ -1225,5 +2114,21 @@ int main(int argc, char **argv) {
         assert(retval == DICT_OK);
     }
     end_benchmark("Removing and adding");
+    dictRelease(dict);
+}
+
+/* dict-benchmark [count] */
+int main(int argc, char **argv) {
+    long count = 0;
+
+    if (argc == 2) {
+        count = strtol(argv[1],NULL,10);
+    } else {
+        count = 5000000;
+    }
+
+    dictBenchmark(&BenchmarkDictType,"chained",count);
+    dictBenchmark(&BenchmarkOpenDictType,"open addressing",count);
+    return 0;
 }
 #endif
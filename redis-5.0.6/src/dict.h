@@ -4,6 +4,7 @@
  */
 
 #include <stdint.h>
+#include <stddef.h>
 
 #ifndef __DICT_H
 #define __DICT_H
@@ -11,6 +12,10 @@
 #define DICT_OK 0
 #define DICT_ERR 1
 
+/* Functions used by dictGenHashFunction(). */
+#define DICT_HASH_SIPHASH 0
+#define DICT_HASH_AESNI 1
+
 /* Unused arguments generate annoying warnings... */
 #define DICT_NOTUSED(V) ((void) V)
 
@@ -33,14 +38,31 @@ typedef struct dictType {
     int (*keyCompare)(void *privdata, const void *key1, const void *key2);  /* 比较key是否相等 */
     void (*keyDestructor)(void *privdata, void *key);   /* 删除key */
     void (*valDestructor)(void *privdata, void *obj);   /* 删除value */
+    int openAddressing; /* Use bucketized open addressing, see dict.c. */
+    /* When set, keys are copied inside the entry allocation instead of
+     * being referenced: keyEmbedLen() returns the bytes needed to store the
+     * key and keyEmbed() writes it to the buffer, returning the key pointer
+     * to store in the entry. */
+    size_t (*keyEmbedLen)(const void *key);
+    void *(*keyEmbed)(void *buf, const void *key);
+    /* Bytes of zeroed metadata allocated after the fields of every entry,
+     * accessed with dictEntryMetadata(). */
+    size_t entryMetadataBytes;
 } dictType;
 
 /* 哈希表结构 */
 typedef struct dictht {
-    dictEntry **table;          /* 存放数组地址，数组用来存放桶 */
+    void *table;                /* 存放数组地址，数组用来存放桶；分段时为段目录 */
     unsigned long size;         /* 哈希表的大小 */
     unsigned long sizemask;     /* 哈希掩码(size-1) */
     unsigned long used;         /* 哈希表中有效节点 */
+    unsigned long segments;     /* Allocated segments, if segmented. */
+    int segbits;                /* log2 of buckets per segment, 0 if the
+                                   table is a single array. */
+    unsigned long everfull;     /* Open addressing only: buckets with the
+                                   everfull bit. */
+    unsigned long stale;        /* Open addressing only: buckets with the
+                                   everfull bit that are not full anymore. */
 } dictht;
 
 /* 字典结构 */
@@ -62,11 +84,22 @@ typedef struct dictIterator {
 } dictIterator;
 
 typedef void (dictScanFunction)(void *privdata, const dictEntry *de);
-typedef void (dictScanBucketFunction)(void *privdata, dictEntry **bucketref);
+/* Called by dictScan() with every reference to an entry stored in the
+ * visited buckets, so that the entry can be reallocated. */
+typedef void (dictScanBucketFunction)(void *privdata, dictEntry **entryref);
 
 /* This is the initial size of every hash table */
 #define DICT_HT_INITIAL_SIZE     4
 
+/* Number of entries in every bucket of open addressing hash tables. */
+#define DICT_BUCKET_SLOTS        7
+
+/* Tables taking more than this are allocated in segments of this size. */
+#define DICT_SEGMENT_BYTES       (1<<20)
+
+/* Max number of keys dictFindBatch() and dictPrefetch() look up at once. */
+#define DICT_BATCH_SIZE          16
+
 /* ------------------------------- Macros ------------------------------------*/
 #define dictFreeVal(d, entry) \
     if ((d)->type->valDestructor) \
@@ -110,10 +143,30 @@ typedef void (dictScanBucketFunction)(void *privdata, dictEntry **bucketref);
 #define dictGetSignedIntegerVal(he) ((he)->v.s64)
 #define dictGetUnsignedIntegerVal(he) ((he)->v.u64)
 #define dictGetDoubleVal(he) ((he)->v.d)
-#define dictSlots(d) ((d)->ht[0].size+(d)->ht[1].size)
+#define dictIsOpenAddressing(d) ((d)->type->openAddressing)
+#define dictIsEmbeddingKeys(d) ((d)->type->keyEmbed != NULL)
+/* Open addressing entries are allocated without the 'next' pointer, that
+ * is the last field of the structure. */
+#define dictEntryAllocSize(d) \
+    (dictIsOpenAddressing(d) ? offsetof(dictEntry,next) : sizeof(dictEntry))
+#define dictEntryMetadata(d,he) ((void*)((char*)(he)+dictEntryAllocSize(d)))
+#define dictSlots(d) (((d)->ht[0].size+(d)->ht[1].size) * \
+                      (dictIsOpenAddressing(d) ? DICT_BUCKET_SLOTS : 1))
 #define dictSize(d) ((d)->ht[0].used+(d)->ht[1].used)
 #define dictIsRehashing(d) ((d)->rehashidx != -1)
 
+/* Return the address of the bucket 'idx' of the table 'ht', whose buckets
+ * are 'bucketsize' bytes, or NULL if the bucket belongs to a segment that is
+ * not allocated, which means the bucket is empty. */
+static inline void *dictHtBucket(dictht *ht, unsigned long idx, size_t bucketsize) {
+    char *seg;
+
+    if (ht->segbits == 0) return (char*)ht->table + idx*bucketsize;
+    seg = ((char**)ht->table)[idx >> ht->segbits];
+    if (seg == NULL) return NULL;
+    return seg + (idx & ((1UL << ht->segbits)-1))*bucketsize;
+}
+
 /* API */
 dict *dictCreate(dictType *type, void *privDataPtr);
 int dictExpand(dict *d, unsigned long size);
@@ -127,6 +180,8 @@ void dictFreeUnlinkedEntry(dict *d, dictEntry *he);
 void dictRelease(dict *d);
 dictEntry * dictFind(dict *d, const void *key);
 void *dictFetchValue(dict *d, const void *key);
+void dictFindBatch(dict *d, void **keys, unsigned long count, dictEntry **des);
+void dictPrefetch(dict *d, void **keys, unsigned long count);
 int dictResize(dict *d);
 dictIterator *dictGetIterator(dict *d);
 dictIterator *dictGetSafeIterator(dict *d);
@@ -144,9 +199,12 @@ int dictRehash(dict *d, int n);
 int dictRehashMilliseconds(dict *d, int ms);
 void dictSetHashFunctionSeed(uint8_t *seed);
 uint8_t *dictGetHashFunctionSeed(void);
+int dictSetHashFunctionType(int type);
+int dictGetHashFunctionType(void);
 unsigned long dictScan(dict *d, unsigned long v, dictScanFunction *fn, dictScanBucketFunction *bucketfn, void *privdata);
 uint64_t dictGetHash(dict *d, const void *key);
 dictEntry **dictFindEntryRefByPtrAndHash(dict *d, const void *oldptr, uint64_t hash);
+size_t dictMemUsage(dict *d);
 
 /* Hash table types */
 extern dictType dictTypeHeapStringCopyKey;
@@ -159,11 +159,18 @@ void evictionPoolAlloc(void) {
  * idle time are on the left, and keys with the higher idle time on the
  * right. */
 
-void evictionPoolPopulate(int dbid, dict *sampledict, dict *keydict, struct evictionPoolEntry *pool) {
-    int j, k, count;
+void evictionPoolPopulate(redisDb *db, struct evictionPoolEntry *pool) {
+    int j, k, count, dbid = db->id;
     dictEntry *samples[server.maxmemory_samples];
 
-    count = dictGetSomeKeys(sampledict,samples,server.maxmemory_samples);
+    /* Volatile policies sample the keys from the expire index, that
+     * references the entries of the main dictionary as well. */
+    if (server.maxmemory_policy & MAXMEMORY_FLAG_ALLKEYS) {
+        count = dictGetSomeKeys(db->dict,samples,server.maxmemory_samples);
+    } else {
+        count = expireIndexGetSomeEntries(db->expires,samples,
+                                          server.maxmemory_samples);
+    }
     for (j = 0; j < count; j++) {
         unsigned long long idle;
         sds key;
@@ -172,14 +179,7 @@ void evictionPoolPopulate(int dbid, dict *sampledict, dict *keydict, struct evic
 
         de = samples[j];
         key = dictGetKey(de);
-
-        /* If the dictionary we are sampling from is not the main
-         * dictionary (but the expires one) we need to lookup the key
-         * again in the key dictionary to obtain the value object. */
-        if (server.maxmemory_policy != MAXMEMORY_VOLATILE_TTL) {
-            if (sampledict != keydict) de = dictFind(keydict, key);
-            o = dictGetVal(de);
-        }
+        o = dictGetVal(de);
 
         /* Calculate the idle time according to the policy. This is called
          * idle just because the code initially handled LRU, but is in fact
@@ -197,7 +197,7 @@ void evictionPoolPopulate(int dbid, dict *sampledict, dict *keydict, struct evic
             idle = 255-LFUDecrAndReturn(o);
         } else if (server.maxmemory_policy == MAXMEMORY_VOLATILE_TTL) {
             /* In this case the sooner the expire the better. */
-            idle = ULLONG_MAX - (long)dictGetVal(de);
+            idle = ULLONG_MAX - (long)dbEntryMetadata(db,de)->expire;
         } else {
             serverPanic("Unknown eviction policy in evictionPoolPopulate()");
         }
@@ -472,7 +472,6 @@ int freeMemoryIfNeeded(void) {
         sds bestkey = NULL;
         int bestdbid;
         redisDb *db;
-        dict *dict;
         dictEntry *de;
 
         if (server.maxmemory_policy & (MAXMEMORY_FLAG_LRU|MAXMEMORY_FLAG_LFU) ||
@@ -488,10 +487,10 @@ int freeMemoryIfNeeded(void) {
                  * every DB. */
                 for (i = 0; i < server.dbnum; i++) {
                     db = server.db+i;
-                    dict = (server.maxmemory_policy & MAXMEMORY_FLAG_ALLKEYS) ?
-                            db->dict : db->expires;
-                    if ((keys = dictSize(dict)) != 0) {
-                        evictionPoolPopulate(i, dict, db->dict, pool);
+                    keys = (server.maxmemory_policy & MAXMEMORY_FLAG_ALLKEYS) ?
+                            dictSize(db->dict) : expireIndexSize(db->expires);
+                    if (keys != 0) {
+                        evictionPoolPopulate(db, pool);
                         total_keys += keys;
                     }
                 }
@@ -502,12 +501,12 @@ int freeMemoryIfNeeded(void) {
                     if (pool[k].key == NULL) continue;
                     bestdbid = pool[k].dbid;
 
-                    if (server.maxmemory_policy & MAXMEMORY_FLAG_ALLKEYS) {
-                        de = dictFind(server.db[pool[k].dbid].dict,
-                            pool[k].key);
-                    } else {
-                        de = dictFind(server.db[pool[k].dbid].expires,
-                            pool[k].key);
+                    db = server.db+pool[k].dbid;
+                    de = dictFind(db->dict,pool[k].key);
+                    if (de && !(server.maxmemory_policy & MAXMEMORY_FLAG_ALLKEYS) &&
+                        dbEntryMetadata(db,de)->expire == -1)
+                    {
+                        de = NULL; /* The key is no longer volatile. */
                     }
 
                     /* Remove the entry from the pool. */
@@ -538,10 +537,10 @@ int freeMemoryIfNeeded(void) {
             for (i = 0; i < server.dbnum; i++) {
                 j = (++next_db) % server.dbnum;
                 db = server.db+j;
-                dict = (server.maxmemory_policy == MAXMEMORY_ALLKEYS_RANDOM) ?
-                        db->dict : db->expires;
-                if (dictSize(dict) != 0) {
-                    de = dictGetRandomKey(dict);
+                de = (server.maxmemory_policy == MAXMEMORY_ALLKEYS_RANDOM) ?
+                        dictGetRandomKey(db->dict) :
+                        expireIndexRandomEntry(db->expires);
+                if (de != NULL) {
                     bestkey = dictGetKey(de);
                     bestdbid = j;
                     break;
@@ -32,6 +32,245 @@
 
 #include "server.h"
 
+/*-----------------------------------------------------------------------------
+ * Expire index
+ *
+ * The expire time of a key is stored in the metadata of its main dict entry,
+ * so that reading it never requires a second lookup. In order to find the
+ * keys to expire or to evict, the keys having an expire set are also
+ * referenced by the expire index of the DB, that groups their entries in
+ * buckets by expire time: see the expireIndex structure in server.h.
+ *----------------------------------------------------------------------------*/
+
+#define EXPIRE_BUCKET_MIN_SIZE 4
+
+/* Return the big endian rax key of the bucket of the expire time 'when'. */
+static uint64_t expireIndexBucketKey(long long when) {
+    if (when < 0) when = 0;
+    return htonu64((uint64_t)when >> EXPIRE_INDEX_BUCKET_BITS);
+}
+
+static void expireBucketFree(void *ptr) {
+    expireBucket *eb = ptr;
+    zfree(eb->entries);
+    zfree(eb);
+}
+
+expireIndex *expireIndexCreate(void) {
+    expireIndex *ei = zmalloc(sizeof(*ei));
+
+    ei->buckets = raxNew();
+    ei->size = 0;
+    ei->slots = 0;
+    return ei;
+}
+
+/* Free the index. The referenced entries are not freed, since they belong
+ * to the main dictionary. */
+void expireIndexRelease(expireIndex *ei) {
+    raxFreeWithCallback(ei->buckets,expireBucketFree);
+    zfree(ei);
+}
+
+/* Return the bucket referencing the entry with metadata 'km'. */
+static expireBucket *expireIndexEntryBucket(expireIndex *ei, keyMetadata *km) {
+    uint64_t bkey = expireIndexBucketKey(km->expire);
+    expireBucket *eb = raxFind(ei->buckets,(unsigned char*)&bkey,sizeof(bkey));
+
+    serverAssert(eb != raxNotFound && km->expire_pos < eb->used);
+    return eb;
+}
+
+/* Reference the main dict entry 'de' of 'db', whose metadata must already
+ * hold the expire time, from the expire index of the DB. */
+void expireIndexAdd(redisDb *db, dictEntry *de) {
+    expireIndex *ei = db->expires;
+    keyMetadata *km = dbEntryMetadata(db,de);
+    uint64_t bkey = expireIndexBucketKey(km->expire);
+    expireBucket *eb = raxFind(ei->buckets,(unsigned char*)&bkey,sizeof(bkey));
+
+    if (eb == raxNotFound) {
+        eb = zmalloc(sizeof(*eb));
+        eb->entries = zmalloc(sizeof(dictEntry*)*EXPIRE_BUCKET_MIN_SIZE);
+        eb->used = 0;
+        eb->size = EXPIRE_BUCKET_MIN_SIZE;
+        ei->slots += eb->size;
+        raxInsert(ei->buckets,(unsigned char*)&bkey,sizeof(bkey),eb,NULL);
+    } else if (eb->used == eb->size) {
+        /* Grow by 50% only: buckets are many, and often large. */
+        serverAssert(eb->size < UINT32_MAX/2);
+        ei->slots += eb->size/2;
+        eb->size += eb->size/2;
+        eb->entries = zrealloc(eb->entries,sizeof(dictEntry*)*eb->size);
+    }
+    km->expire_pos = eb->used;
+    eb->entries[eb->used++] = de;
+    ei->size++;
+}
+
+/* Remove the reference to the main dict entry 'de' of 'db' from the expire
+ * index. The expire time in the entry metadata is left untouched. */
+void expireIndexDel(redisDb *db, dictEntry *de) {
+    expireIndex *ei = db->expires;
+    keyMetadata *km = dbEntryMetadata(db,de);
+    expireBucket *eb = expireIndexEntryBucket(ei,km);
+
+    serverAssert(eb->entries[km->expire_pos] == de);
+
+    /* Fill the hole with the last entry of the bucket. */
+    eb->used--;
+    if (km->expire_pos != eb->used) {
+        dictEntry *last = eb->entries[eb->used];
+        eb->entries[km->expire_pos] = last;
+        dbEntryMetadata(db,last)->expire_pos = km->expire_pos;
+    }
+    ei->size--;
+
+    if (eb->used == 0) {
+        uint64_t bkey = expireIndexBucketKey(km->expire);
+
+        ei->slots -= eb->size;
+        raxRemove(ei->buckets,(unsigned char*)&bkey,sizeof(bkey),NULL);
+        expireBucketFree(eb);
+    } else if (eb->size > EXPIRE_BUCKET_MIN_SIZE && eb->used <= eb->size/4) {
+        uint32_t size = eb->size/2;
+
+        if (size < EXPIRE_BUCKET_MIN_SIZE) size = EXPIRE_BUCKET_MIN_SIZE;
+        ei->slots -= eb->size-size;
+        eb->size = size;
+        eb->entries = zrealloc(eb->entries,sizeof(dictEntry*)*eb->size);
+    }
+}
+
+/* Update the reference to the entry 'de' of 'db' after it was reallocated
+ * at a different address, like active defrag does. */
+void expireIndexEntryMoved(redisDb *db, dictEntry *de) {
+    keyMetadata *km = dbEntryMetadata(db,de);
+    expireBucket *eb = expireIndexEntryBucket(db->expires,km);
+
+    eb->entries[km->expire_pos] = de;
+}
+
+/* Store in 'des' the 'count' entries referenced by the iterator 'ri', that
+ * must point to a bucket, starting at the position 'j' of the bucket and
+ * continuing with the following buckets, wrapping at the end. The index
+ * must have at least 'count' entries. */
+static void expireIndexCollect(expireIndex *ei, raxIterator *ri, uint32_t j, dictEntry **des, unsigned int count) {
+    expireBucket *eb = ri->data;
+    unsigned int stored = 0;
+
+    serverAssert(count <= ei->size);
+    while (stored < count) {
+        des[stored++] = eb->entries[j++];
+        if (j == eb->used) {
+            if (!raxNext(ri)) {
+                raxSeek(ri,"^",NULL,0);
+                raxNext(ri);
+            }
+            eb = ri->data;
+            j = 0;
+        }
+    }
+}
+
+/* Store in 'des' up to 'count' entries of the buckets whose whole time span
+ * ends before the unix time 'now' in milliseconds, so that every returned
+ * entry is expired, starting from the earliest bucket. The function returns
+ * the number of entries stored.
+ *
+ * Entries are taken from the tail of every bucket, so that removing them
+ * from the index in the same order never moves the entries not returned. */
+unsigned int expireIndexGetExpiredEntries(expireIndex *ei, long long now, dictEntry **des, unsigned int count) {
+    raxIterator ri;
+    unsigned int stored = 0;
+
+    if (ei->size == 0 || now < 0) return 0;
+
+    raxStart(&ri,ei->buckets);
+    raxSeek(&ri,"^",NULL,0);
+    while (stored < count && raxNext(&ri)) {
+        expireBucket *eb = ri.data;
+        uint64_t bkey;
+        uint32_t j;
+
+        memcpy(&bkey,ri.key,sizeof(bkey));
+        bkey = ntohu64(bkey);
+        if ((long long)((bkey+1) << EXPIRE_INDEX_BUCKET_BITS) > now) break;
+        for (j = eb->used; j > 0 && stored < count; j--)
+            des[stored++] = eb->entries[j-1];
+    }
+    raxStop(&ri);
+    return stored;
+}
+
+/* Return the unix time in milliseconds where the time span of the earliest
+ * bucket of the index ends, or -1 if the index is empty. */
+long long expireIndexEarliestBucketEnd(expireIndex *ei) {
+    raxIterator ri;
+    uint64_t bkey;
+
+    if (ei->size == 0) return -1;
+    raxStart(&ri,ei->buckets);
+    raxSeek(&ri,"^",NULL,0);
+    raxNext(&ri);
+    memcpy(&bkey,ri.key,sizeof(bkey));
+    raxStop(&ri);
+    return (long long)((ntohu64(bkey)+1) << EXPIRE_INDEX_BUCKET_BITS);
+}
+
+/* Store in 'des' up to 'count' entries referenced by the index, starting at
+ * a random position of a random bucket and continuing with the following
+ * buckets. Like dictGetSomeKeys() this is only useful in order to sample
+ * keys: the distribution is far from uniform, since buckets following a
+ * long span of time without expires are selected more often.
+ *
+ * The function returns the number of entries stored in 'des', that is
+ * smaller than 'count' only if the index has less entries. */
+unsigned int expireIndexGetSomeEntries(expireIndex *ei, dictEntry **des, unsigned int count) {
+    raxIterator ri;
+    uint64_t first, last, bkey;
+    expireBucket *eb;
+
+    if (count > ei->size) count = ei->size;
+    if (count == 0) return 0;
+
+    /* Seek a random bucket between the first and the last one. */
+    raxStart(&ri,ei->buckets);
+    raxSeek(&ri,"^",NULL,0);
+    raxNext(&ri);
+    memcpy(&first,ri.key,sizeof(first));
+    first = ntohu64(first);
+    raxSeek(&ri,"$",NULL,0);
+    raxNext(&ri);
+    memcpy(&last,ri.key,sizeof(last));
+    last = ntohu64(last);
+    bkey = first + ((((uint64_t)rand())<<31)^rand()) % (last-first+1);
+    bkey = htonu64(bkey);
+    raxSeek(&ri,">=",(unsigned char*)&bkey,sizeof(bkey));
+    raxNext(&ri);
+
+    eb = ri.data;
+    expireIndexCollect(ei,&ri,rand() % eb->used,des,count);
+    raxStop(&ri);
+    return count;
+}
+
+/* Return a random entry referenced by the index, or NULL if the index is
+ * empty. See expireIndexGetSomeEntries() for the distribution. */
+dictEntry *expireIndexRandomEntry(expireIndex *ei) {
+    dictEntry *de;
+
+    return expireIndexGetSomeEntries(ei,&de,1) ? de : NULL;
+}
+
+/* Return the memory used by the index. The size of the radix tree nodes is
+ * approximated, counting a node with a child pointer for every bucket. */
+size_t expireIndexMemUsage(expireIndex *ei) {
+    return sizeof(*ei) + ei->slots*sizeof(dictEntry*) +
+           raxSize(ei->buckets)*(sizeof(expireBucket)+sizeof(raxNode)+
+                                 sizeof(void*)*2);
+}
+
 /*-----------------------------------------------------------------------------
  * Incremental collection of expired keys.
  *
@@ -42,7 +281,7 @@
 
 /* Helper function for the activeExpireCycle() function.
  * This function will try to expire the key that is stored in the hash table
- * entry 'de' of the 'expires' hash table of a Redis database.
+ * entry 'de' of the main dictionary of a Redis database.
  *
  * If the key is found to be expired, it is removed from the database and
  * 1 is returned. Otherwise no operation is performed and 0 is returned.
@@ -52,7 +291,7 @@
  * The parameter 'now' is the current time in milliseconds as is passed
  * to the function to avoid too many gettimeofday() syscalls. */
 int activeExpireCycleTryExpire(redisDb *db, dictEntry *de, long long now) {
-    long long t = dictGetSignedIntegerVal(de);
+    long long t = dbEntryMetadata(db,de)->expire;
     if (now > t) {
         sds key = dictGetKey(de);
         robj *keyobj = createStringObject(key,sdslen(key));
@@ -72,10 +311,12 @@ int activeExpireCycleTryExpire(redisDb *db, dictEntry *de, long long now) {
     }
 }
 
-/* Try to expire a few timed out keys. The algorithm used is adaptive and
- * will use few CPU cycles if there are few expiring keys, otherwise
- * it will get more aggressive to avoid that too much memory is used by
- * keys that can be removed from the keyspace.
+/* Expire the keys whose time to live elapsed, walking the expire index of
+ * every DB from the earliest expire times: every bucket of the index whose
+ * time span ended is reclaimed entirely, so keys are never reclaimed later
+ * than one bucket span plus the cron period after their expire time, as long
+ * as the CPU time budget allows it. Keys of the bucket still in progress are
+ * left to the next cycles, or expired on access.
  *
  * No more than CRON_DBS_PER_CALL databases are tested at every
  * iteration.
@@ -147,7 +388,10 @@ void activeExpireCycle(int type) {
     long total_expired = 0;
 
     for (j = 0; j < dbs_per_call && timelimit_exit == 0; j++) {
-        int expired;
+        dictEntry *sampled[ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP];
+        unsigned int num, k;
+        long long now, ttl_sum;
+        int ttl_samples;
         redisDb *db = server.db+(current_db % server.dbnum);
 
         /* Increment the DB now so we are sure if we run out of time
@@ -155,62 +399,75 @@ void activeExpireCycle(int type) {
          * distribute the time evenly across DBs. */
         current_db++;
 
-        /* Continue to expire if at the end of the cycle more than 25%
-         * of the keys were expired. */
-        do {
-            unsigned long num, slots;
-            long long now, ttl_sum;
-            int ttl_samples;
-            iteration++;
+        /* If there is nothing to expire try next DB ASAP. */
+        if (expireIndexSize(db->expires) == 0) {
+            db->avg_ttl = 0;
+            continue;
+        }
 
-            /* If there is nothing to expire try next DB ASAP. */
-            if ((num = dictSize(db->expires)) == 0) {
-                db->avg_ttl = 0;
-                break;
+        /* Sample random keys among keys with an expire set, in order to
+         * estimate the average TTL and the percentage of keys that are
+         * logically expired but not yet reclaimed. */
+        now = mstime();
+        ttl_sum = 0;
+        ttl_samples = 0;
+        num = expireIndexGetSomeEntries(db->expires,sampled,
+                                        ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP);
+        for (k = 0; k < num; k++) {
+            long long ttl = dbEntryMetadata(db,sampled[k])->expire-now;
+
+            if (ttl > 0) {
+                /* We want the average TTL of keys yet not expired. */
+                ttl_sum += ttl;
+                ttl_samples++;
+            } else {
+                total_expired++;
             }
-            slots = dictSlots(db->expires);
-            now = mstime();
+            total_sampled++;
+        }
 
-            /* When there are less than 1% filled slots getting random
-             * keys is expensive, so stop here waiting for better times...
-             * The dictionary will be resized asap. */
-            if (num && slots > DICT_HT_INITIAL_SIZE &&
-                (num*100/slots < 1)) break;
-
-            /* The main collection cycle. Sample random keys among keys
-             * with an expire set, checking for expired ones. */
-            expired = 0;
-            ttl_sum = 0;
-            ttl_samples = 0;
-
-            if (num > ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP)
-                num = ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP;
-
-            while (num--) {
-                dictEntry *de;
-                long long ttl;
-
-                if ((de = dictGetRandomKey(db->expires)) == NULL) break;
-                ttl = dictGetSignedIntegerVal(de)-now;
-                if (activeExpireCycleTryExpire(db,de,now)) expired++;
-                if (ttl > 0) {
-                    /* We want the average TTL of keys yet not expired. */
-                    ttl_sum += ttl;
-                    ttl_samples++;
-                }
-                total_sampled++;
-            }
-            total_expired += expired;
+        /* Update the average TTL stats for this database. */
+        if (ttl_samples) {
+            long long avg_ttl = ttl_sum/ttl_samples;
 
-            /* Update the average TTL stats for this database. */
-            if (ttl_samples) {
-                long long avg_ttl = ttl_sum/ttl_samples;
+            /* Do a simple running average with a few samples.
+             * We just use the current estimate with a weight of 2%
+             * and the previous estimate with a weight of 98%. */
+            if (db->avg_ttl == 0) db->avg_ttl = avg_ttl;
+            db->avg_ttl = (db->avg_ttl/50)*49 + (avg_ttl/50);
+        }
+
+        /* The main collection cycle. Take the entries of the buckets whose
+         * time span ended from the expire index, and expire all of them,
+         * until there are no more or we run out of time.
+         *
+         * Expiring a key calls the keyspace notification hooks, and modules
+         * may delete or overwrite other keys from there, so we only remember
+         * the names of the sampled keys, and look every key up again right
+         * before expiring it. */
+        do {
+            sds keys[ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP];
 
-                /* Do a simple running average with a few samples.
-                 * We just use the current estimate with a weight of 2%
-                 * and the previous estimate with a weight of 98%. */
-                if (db->avg_ttl == 0) db->avg_ttl = avg_ttl;
-                db->avg_ttl = (db->avg_ttl/50)*49 + (avg_ttl/50);
+            iteration++;
+            now = mstime();
+            num = expireIndexGetExpiredEntries(db->expires,now,sampled,
+                                        ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP);
+            for (k = 0; k < num; k++)
+                keys[k] = sdsdup(dictGetKey(sampled[k]));
+            for (k = 0; k < num; k++) {
+                dictEntry *de = dictFind(db->dict,keys[k]);
+                long long lag;
+
+                sdsfree(keys[k]);
+                if (de == NULL || dbEntryMetadata(db,de)->expire == -1)
+                    continue;
+                lag = now-dbEntryMetadata(db,de)->expire;
+                if (activeExpireCycleTryExpire(db,de,now)) {
+                    server.stat_active_expiredkeys++;
+                    server.stat_expired_lag_sum += lag;
+                    if (lag > server.stat_expired_lag_max)
+                        server.stat_expired_lag_max = lag;
+                }
             }
 
             /* We can't block forever here even if there are many keys to
@@ -224,9 +481,7 @@ void activeExpireCycle(int type) {
                     break;
                 }
             }
-            /* We don't repeat the cycle if there are less than 25% of keys
-             * found expired in the current DB. */
-        } while (expired > ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP/4);
+        } while (num == ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP);
     }
 
     elapsed = ustime()-start;
@@ -300,9 +555,13 @@ void expireSlaveKeys(void) {
         while(dbids && dbid < server.dbnum) {
             if ((dbids & 1) != 0) {
                 redisDb *db = server.db+dbid;
-                dictEntry *expire = dictFind(db->expires,keyname);
+                dictEntry *expire = dictFind(db->dict,keyname);
                 int expired = 0;
 
+                /* Only keys having an expire set can be expired. */
+                if (expire && dbEntryMetadata(db,expire)->expire == -1)
+                    expire = NULL;
+
                 if (expire &&
                     activeExpireCycleTryExpire(server.db+dbid,expire,start))
                 {
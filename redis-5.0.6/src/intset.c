@@ -281,6 +281,125 @@ size_t intsetBlobLen(intset *is) {
     return sizeof(intset)+intrev32ifbe(is->length)*intrev32ifbe(is->encoding);
 }
 
+/* Return the position of the first element at or after 'pos' that is not
+ * smaller than 'value', or the intset length if there is none. The search
+ * "gallops": it probes pos+1, pos+2, pos+4, ... and then performs a binary
+ * search in the last interval, so it costs O(log(d)) where d is the distance
+ * between 'pos' and the returned position. */
+static uint32_t intsetGallop(intset *is, uint32_t pos, int64_t value,
+                             uint8_t enc)
+{
+    uint32_t len = intrev32ifbe(is->length), lo, hi, mid, step = 1;
+
+    if (pos >= len || _intsetGetEncoded(is,pos,enc) >= value) return pos;
+
+    /* Invariant: the element at 'lo' is smaller than 'value'. */
+    lo = pos;
+    while (lo+step < len && _intsetGetEncoded(is,lo+step,enc) < value) {
+        lo += step;
+        step <<= 1;
+    }
+    hi = (lo+step < len) ? lo+step : len;
+    while (lo+1 < hi) {
+        mid = lo+(hi-lo)/2;
+        if (_intsetGetEncoded(is,mid,enc) < value)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return hi;
+}
+
+/* When one intset is more than INTSET_GALLOP_RATIO times bigger than the
+ * other, intsetIntersect() searches the elements of the smaller one into
+ * the bigger one with intsetGallop() instead of merging the two. */
+#define INTSET_GALLOP_RATIO 16
+
+/* Return a new intset with the elements that are members of both 'a' and
+ * 'b'. The intersection is computed merging the two sorted arrays, or when
+ * their sizes are very different, galloping in the bigger one, so it never
+ * costs more than O(N+M), and O(N*log(M/N)) when N is much smaller than M.
+ * The elements of the intersection are members of both the intsets, so the
+ * smaller of the two encodings can always hold them. */
+intset *intsetIntersect(intset *a, intset *b) {
+    uint32_t alen, blen, i = 0, j = 0, n = 0;
+    uint8_t aenc, benc;
+    intset *is;
+
+    if (intrev32ifbe(a->length) > intrev32ifbe(b->length)) {
+        intset *tmp = a;
+        a = b;
+        b = tmp;
+    }
+    alen = intrev32ifbe(a->length);
+    blen = intrev32ifbe(b->length);
+    aenc = intrev32ifbe(a->encoding);
+    benc = intrev32ifbe(b->encoding);
+
+    is = intsetNew();
+    is->encoding = intrev32ifbe(aenc < benc ? aenc : benc);
+    is = intsetResize(is,alen);
+
+    if ((uint64_t)alen*INTSET_GALLOP_RATIO < blen) {
+        for (i = 0; i < alen && j < blen; i++) {
+            int64_t v = _intsetGetEncoded(a,i,aenc);
+
+            j = intsetGallop(b,j,v,benc);
+            if (j < blen && _intsetGetEncoded(b,j,benc) == v)
+                _intsetSet(is,n++,v);
+        }
+    } else {
+        while (i < alen && j < blen) {
+            int64_t va = _intsetGetEncoded(a,i,aenc);
+            int64_t vb = _intsetGetEncoded(b,j,benc);
+
+            if (va < vb) {
+                i++;
+            } else if (va > vb) {
+                j++;
+            } else {
+                _intsetSet(is,n++,va);
+                i++;
+                j++;
+            }
+        }
+    }
+    is->length = intrev32ifbe(n);
+    return intsetResize(is,n);
+}
+
+/* Return a new intset with the elements that are members of 'a', 'b' or
+ * both, merging the two sorted arrays in O(N+M). */
+intset *intsetUnion(intset *a, intset *b) {
+    uint32_t alen = intrev32ifbe(a->length), blen = intrev32ifbe(b->length);
+    uint8_t aenc = intrev32ifbe(a->encoding), benc = intrev32ifbe(b->encoding);
+    uint32_t i = 0, j = 0, n = 0;
+    intset *is = intsetNew();
+
+    is->encoding = intrev32ifbe(aenc > benc ? aenc : benc);
+    is = intsetResize(is,alen+blen);
+    while (i < alen && j < blen) {
+        int64_t va = _intsetGetEncoded(a,i,aenc);
+        int64_t vb = _intsetGetEncoded(b,j,benc);
+
+        if (va < vb) {
+            _intsetSet(is,n++,va);
+            i++;
+        } else if (va > vb) {
+            _intsetSet(is,n++,vb);
+            j++;
+        } else {
+            _intsetSet(is,n++,va);
+            i++;
+            j++;
+        }
+    }
+    while (i < alen) _intsetSet(is,n++,_intsetGetEncoded(a,i++,aenc));
+    while (j < blen) _intsetSet(is,n++,_intsetGetEncoded(b,j++,benc));
+    is->length = intrev32ifbe(n);
+    return intsetResize(is,n);
+}
+
 #ifdef REDIS_TEST
 #include <sys/time.h>
 #include <time.h>
@@ -458,6 +577,45 @@ int intsetTest(int argc, char **argv) {
         ok();
     }
 
+    printf("Intersection and union: "); {
+        /* Sizes both similar and skewed, so that both the merge and the
+         * galloping intersections are used, and mixed encodings. */
+        int sizes[][2] = {{0,100},{100,100},{50,2000},{3,5000},{1000,10}};
+        int bits[][2] = {{12,12},{12,20},{20,30},{30,12},{13,13}};
+        for (i = 0; i < 5; i++) {
+            intset *a = createSet(bits[i][0],sizes[i][0]);
+            intset *b = createSet(bits[i][1],sizes[i][1]);
+            intset *inter, *uni;
+            uint32_t expected = 0, j;
+            int64_t v;
+
+            if (i == 2) {
+                a = intsetAdd(a,-4294967295,NULL);
+                b = intsetAdd(b,-4294967295,NULL);
+            }
+            inter = intsetIntersect(a,b);
+            uni = intsetUnion(a,b);
+
+            for (j = 0; intsetGet(a,j,&v); j++) {
+                if (intsetFind(b,v)) {
+                    assert(intsetFind(inter,v));
+                    expected++;
+                }
+                assert(intsetFind(uni,v));
+            }
+            for (j = 0; intsetGet(b,j,&v); j++) assert(intsetFind(uni,v));
+            assert(intsetLen(inter) == expected);
+            assert(intsetLen(uni) == intsetLen(a)+intsetLen(b)-expected);
+            if (intsetLen(inter) > 1) checkConsistency(inter);
+            if (intsetLen(uni) > 1) checkConsistency(uni);
+            zfree(a);
+            zfree(b);
+            zfree(inter);
+            zfree(uni);
+        }
+        ok();
+    }
+
     printf("Stress lookups: "); {
         long num = 100000, size = 10000;
         int i, bits = 20;
@@ -46,6 +46,8 @@ int64_t intsetRandom(intset *is);
 uint8_t intsetGet(intset *is, uint32_t pos, int64_t *value);
 uint32_t intsetLen(const intset *is);
 size_t intsetBlobLen(intset *is);
+intset *intsetIntersect(intset *a, intset *b);
+intset *intsetUnion(intset *a, intset *b);
 
 #ifdef REDIS_TEST
 int intsetTest(int argc, char *argv[]);
@@ -52,10 +52,6 @@ size_t lazyfreeGetFreeEffort(robj *obj) {
  * will be reclaimed in a different bio.c thread. */
 #define LAZYFREE_THRESHOLD 64
 int dbAsyncDelete(redisDb *db, robj *key) {
-    /* Deleting an entry from the expires dict will not free the sds of
-     * the key, because it is shared with the main dictionary. */
-    if (dictSize(db->expires) > 0) dictDelete(db->expires,key->ptr);
-
     /* If the value is composed of a few allocations, to free in a lazy way
      * is actually just slower... So under a certain limit we just free
      * the object synchronously. */
@@ -64,6 +60,10 @@ int dbAsyncDelete(redisDb *db, robj *key) {
         robj *val = dictGetVal(de);
         size_t free_effort = lazyfreeGetFreeEffort(val);
 
+        /* The expire index references the entry: remove it before the
+         * entry is freed. */
+        if (dbEntryMetadata(db,de)->expire != -1) expireIndexDel(db,de);
+
         /* If releasing the object is too much work, do it in the background
          * by adding the object to the lazy free list.
          * Note that if the object is shared, to reclaim it now it is not
@@ -82,8 +82,8 @@ int dbAsyncDelete(redisDb *db, robj *key) {
     /* Release the key-val pair, or just the key if we set the val
      * field to NULL in order to lazy free it later. */
     if (de) {
+        if (server.cluster_enabled) slotToKeyDel(de);
         dictFreeUnlinkedEntry(db->dict,de);
-        if (server.cluster_enabled) slotToKeyDel(key);
         return 1;
     } else {
         return 0;
@@ -105,23 +105,16 @@ void freeObjAsync(robj *o) {
  * create a new empty set of hash tables and scheduling the old ones for
  * lazy freeing. */
 void emptyDbAsync(redisDb *db) {
-    dict *oldht1 = db->dict, *oldht2 = db->expires;
-    db->dict = dictCreate(&dbDictType,NULL);
-    db->expires = dictCreate(&keyptrDictType,NULL);
-    atomicIncr(lazyfree_objects,dictSize(oldht1));
-    bioCreateBackgroundJob(BIO_LAZY_FREE,NULL,oldht1,oldht2);
-}
-
-/* Empty the slots-keys map of Redis CLuster by creating a new empty one
- * and scheduiling the old for lazy freeing. */
-void slotToKeyFlushAsync(void) {
-    rax *old = server.cluster->slots_to_keys;
-
-    server.cluster->slots_to_keys = raxNew();
-    memset(server.cluster->slots_keys_count,0,
-           sizeof(server.cluster->slots_keys_count));
-    atomicIncr(lazyfree_objects,old->numele);
-    bioCreateBackgroundJob(BIO_LAZY_FREE,NULL,NULL,old);
+    dict *oldht = db->dict;
+    expireIndex *oldei = db->expires;
+    /* Objects referenced by the output buffers of the clients are copied,
+     * so that the bio thread is the only one touching the reference
+     * count of the objects of the database. */
+    unshareClientsReplyObjects();
+    db->dict = dbDictCreate();
+    db->expires = expireIndexCreate();
+    atomicIncr(lazyfree_objects,dictSize(oldht));
+    bioCreateBackgroundJob(BIO_LAZY_FREE,NULL,oldht,oldei);
 }
 
 /* Release objects from the lazyfree thread. It's just decrRefCount()
@@ -131,22 +124,12 @@ void lazyfreeFreeObjectFromBioThread(robj *o) {
     atomicDecr(lazyfree_objects,1);
 }
 
-/* Release a database from the lazyfree thread. The 'db' pointer is the
- * database which was substitutied with a fresh one in the main thread
- * when the database was logically deleted. 'sl' is a skiplist used by
- * Redis Cluster in order to take the hash slots -> keys mapping. This
- * may be NULL if Redis Cluster is disabled. */
-void lazyfreeFreeDatabaseFromBioThread(dict *ht1, dict *ht2) {
-    size_t numkeys = dictSize(ht1);
-    dictRelease(ht1);
-    dictRelease(ht2);
+/* Release a database from the lazyfree thread. The dict and the expire
+ * index are the ones which were substitutied with fresh ones in the main
+ * thread when the database was logically deleted. */
+void lazyfreeFreeDatabaseFromBioThread(dict *ht, expireIndex *ei) {
+    size_t numkeys = dictSize(ht);
+    dictRelease(ht);
+    expireIndexRelease(ei);
     atomicDecr(lazyfree_objects,numkeys);
 }
-
-/* Release the skiplist mapping Redis Cluster keys to slots in the
- * lazyfree thread. */
-void lazyfreeFreeSlotsMapFromBioThread(rax *rt) {
-    size_t len = rt->numele;
-    raxFree(rt);
-    atomicDecr(lazyfree_objects,len);
-}
@@ -38,9 +38,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <pthread.h>
 
 #include "listpack.h"
 #include "listpack_malloc.h"
+#include "dict.h" /* For dictGenHashFunction(). */
 
 #define LP_HDR_SIZE 6       /* 32 bit total len + 16 bit number of elements. */
 #define LP_HDR_NUMELE_UNKNOWN UINT16_MAX
@@ -214,6 +216,7 @@ unsigned char *lpNew(void) {
 
 /* Free the specified listpack. */
 void lpFree(unsigned char *lp) {
+    lpIndexInvalidate(lp);
     lp_free(lp);
 }
 
@@ -603,6 +606,9 @@ unsigned char *lpInsert(unsigned char *lp, unsigned char *ele, uint32_t size, un
      * get passed as 'where', set it to LP_REPLACE. */
     if (ele == NULL) where = LP_REPLACE;
 
+    /* The elements may move, so the lpFind() index, if any, is dropped. */
+    lpIndexInvalidate(lp);
+
     /* If we need to insert after the current element, we just jump to the
      * next element (that could be the EOF one) and handle the case of
      * inserting before. So the function will actually deal with just two
@@ -801,3 +807,413 @@ unsigned char *lpSeek(unsigned char *lp, long index) {
     }
 }
 
+
+/* Insert the element 'ele' of 'size' bytes at the head of the listpack.
+ * Same return value as lpInsert(). */
+unsigned char *lpPrepend(unsigned char *lp, unsigned char *ele, uint32_t size) {
+    unsigned char *p = lpFirst(lp);
+    if (!p) return lpAppend(lp,ele,size);
+    return lpInsert(lp,ele,size,p,LP_BEFORE,NULL);
+}
+
+/* Like lpGet(), with an interface similar to the one of ziplistGet(): if the
+ * element pointed by 'p' is a string a pointer to it is returned, and its
+ * length is stored in '*slen'. Otherwise NULL is returned and the integer
+ * value is stored in '*lval'. */
+unsigned char *lpGetValue(unsigned char *p, unsigned int *slen, long long *lval) {
+    unsigned char *vstr;
+    int64_t ele_len;
+
+    vstr = lpGet(p,&ele_len,NULL);
+    if (vstr) {
+        *slen = ele_len;
+    } else {
+        *lval = ele_len;
+    }
+    return vstr;
+}
+
+/* Return 1 if the element pointed by 'p' is equal to the string 's' of
+ * 'slen' bytes, 0 otherwise. Integer encoded elements are compared as
+ * numbers: an element is stored as an integer only if its string
+ * representation is exactly the one lpStringToInt64() accepts. */
+int lpCompare(unsigned char *p, unsigned char *s, uint32_t slen) {
+    unsigned char *value;
+    int64_t sz, sval;
+
+    if (p[0] == LP_EOF) return 0;
+    value = lpGet(p,&sz,NULL);
+    if (value) return slen == sz && memcmp(value,s,slen) == 0;
+    return lpStringToInt64((const char*)s,slen,&sval) && sval == sz;
+}
+
+/* ---------------------------- lookup index --------------------------------
+ *
+ * lpFind() scans the listpack, so with the limits of the small encodings
+ * raised to thousands of elements, every HGET or ZSCORE would compare
+ * thousands of entries. Big listpacks that are searched again and again
+ * without being modified get a side index instead: an open addressing table
+ * with the offsets of the elements lpFind() compares, by hash of their
+ * string representation. The index is not part of the listpack, so the
+ * encoding, its memory usage and its RDB serialization don't change.
+ *
+ * Indexes belong to the owner of the listpack, that is the object storing
+ * it, which calls lpFindIndexed() to search it. They are kept in a small
+ * cache keyed by the owner, and an index is used only if the owner, the
+ * address, the size and the number of elements of the listpack are the
+ * ones it was built for. Every function of this file that modifies or frees
+ * a listpack drops its index as well, since an element may be replaced in
+ * place, and code moving listpacks without this API, like active
+ * defragmentation, must call lpIndexInvalidate() with the old address.
+ *
+ * Listpacks are freed by the lazyfree thread as well, so the cache is
+ * protected by a mutex. Listpacks with less than LP_INDEX_MIN_ELEMENTS
+ * elements can't have an index, and never take it.
+ *
+ * Building the index costs a few scans of the listpack, so a listpack is
+ * indexed only after LP_INDEX_MIN_LOOKUPS searches found it unchanged: a
+ * listpack modified between searches, like the target of HSET, is just
+ * scanned as before. */
+
+#define LP_INDEX_MIN_ELEMENTS 256   /* Smaller listpacks are just scanned. */
+#define LP_INDEX_MIN_LOOKUPS 4      /* Searches before building the index. */
+#define LP_INDEX_CACHE_SIZE 16      /* Listpacks indexed at the same time. */
+
+typedef struct lpIndex {
+    const void *owner;      /* Owner of the listpack, or NULL. */
+    unsigned char *lp;      /* Listpack of this cache slot. */
+    uint32_t bytes;         /* Listpack total bytes when indexed. */
+    uint32_t elements;      /* Listpack number of elements when indexed. */
+    unsigned int skip;      /* lpFind() 'skip' the index was built for. */
+    uint32_t lookups;       /* Searches since the listpack was modified. */
+    uint32_t mask;          /* Number of slots - 1. */
+    uint32_t *offsets;      /* Element offsets, 0 for empty slots, or NULL
+                               if the index was not built yet. */
+} lpIndex;
+
+static lpIndex lpIndexCache[LP_INDEX_CACHE_SIZE];
+static pthread_mutex_t lpIndexMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static lpIndex *lpIndexSlot(const void *owner) {
+    uint64_t h = (uintptr_t)owner * 0x9E3779B97F4A7C15ULL;
+    return &lpIndexCache[h >> 60]; /* 4 bits: LP_INDEX_CACHE_SIZE slots. */
+}
+
+static void lpIndexRelease(lpIndex *idx) {
+    lp_free(idx->offsets);
+    idx->offsets = NULL;
+    idx->owner = NULL;
+    idx->lp = NULL;
+}
+
+/* Drop the index of the listpack, if any, because it is going to be
+ * modified, moved or freed. */
+void lpIndexInvalidate(unsigned char *lp) {
+    int j;
+
+    if (lpGetNumElements(lp) < LP_INDEX_MIN_ELEMENTS) return;
+    pthread_mutex_lock(&lpIndexMutex);
+    for (j = 0; j < LP_INDEX_CACHE_SIZE; j++)
+        if (lpIndexCache[j].lp == lp) lpIndexRelease(lpIndexCache+j);
+    pthread_mutex_unlock(&lpIndexMutex);
+}
+
+/* Build the index of the elements of 'lp' that lpFind() compares with the
+ * specified 'skip'. If an element is repeated, only the first one is
+ * indexed, since it is the one lpFind() returns. */
+static void lpIndexBuild(lpIndex *idx, unsigned char *lp) {
+    unsigned char *p = lp+LP_HDR_SIZE, *ele;
+    unsigned char buf[LP_INTBUF_SIZE];
+    uint32_t size = 1, elements = lpGetNumElements(lp);
+    unsigned int skipcnt = 0;
+    int64_t len;
+
+    elements = (elements+idx->skip)/(idx->skip+1);
+    while (size < elements*2) size <<= 1;
+    idx->mask = size-1;
+    idx->offsets = lp_malloc(sizeof(uint32_t)*size);
+    memset(idx->offsets,0,sizeof(uint32_t)*size);
+
+    while (p[0] != LP_EOF) {
+        if (skipcnt == 0) {
+            uint32_t j;
+
+            ele = lpGet(p,&len,buf);
+            j = dictGenHashFunction(ele,len) & idx->mask;
+            while (idx->offsets[j] &&
+                   !lpCompare(lp+idx->offsets[j],ele,len))
+                j = (j+1) & idx->mask;
+            if (idx->offsets[j] == 0) idx->offsets[j] = p-lp;
+            skipcnt = idx->skip;
+        } else {
+            skipcnt--;
+        }
+        p = lpSkip(p);
+    }
+}
+
+/* Return the index of 'owner' to search the listpack 'lp' with the
+ * specified 'skip', or NULL if the listpack should be scanned. Called with
+ * the cache mutex locked. */
+static lpIndex *lpIndexLookup(const void *owner, unsigned char *lp,
+                              unsigned int skip)
+{
+    lpIndex *idx = lpIndexSlot(owner);
+
+    if (idx->owner != owner || idx->lp != lp ||
+        idx->bytes != lpGetTotalBytes(lp) ||
+        idx->elements != lpGetNumElements(lp) || idx->skip != skip)
+    {
+        lpIndexRelease(idx);
+        idx->owner = owner;
+        idx->lp = lp;
+        idx->bytes = lpGetTotalBytes(lp);
+        idx->elements = lpGetNumElements(lp);
+        idx->skip = skip;
+        idx->lookups = 0;
+    }
+    if (idx->offsets == NULL) {
+        if (++idx->lookups < LP_INDEX_MIN_LOOKUPS) return NULL;
+        lpIndexBuild(idx,lp);
+    }
+    return idx;
+}
+
+/* Search the string 's' of 'slen' bytes with the index of 'lp'. */
+static unsigned char *lpIndexFind(lpIndex *idx, unsigned char *lp,
+                                  unsigned char *s, uint32_t slen)
+{
+    uint32_t j = dictGenHashFunction(s,slen) & idx->mask;
+
+    while (idx->offsets[j]) {
+        unsigned char *p = lp+idx->offsets[j];
+
+        if (lpCompare(p,s,slen)) return p;
+        j = (j+1) & idx->mask;
+    }
+    return NULL;
+}
+
+/* Find the element equal to the string 's' of 'slen' bytes, starting from
+ * the element pointed by 'p'. After every comparison 'skip' elements are
+ * skipped, so that for instance only the fields of a listpack of
+ * field-value pairs are compared. Returns the element found, or NULL.
+ *
+ * Small hashes and sorted sets are searched with this function, so it is
+ * written to do as little work as possible for every entry: the size of
+ * the entry is computed only once and used both to compare and to jump to
+ * the next entry, 6 bit strings (the common case of short fields) are
+ * compared without calling lpGet(), the first byte is compared before
+ * calling memcmp(), integer entries are not decoded at all if 's' is not
+ * an integer, and skipped entries are never decoded. */
+unsigned char *lpFind(unsigned char *lp, unsigned char *p, unsigned char *s,
+                      uint32_t slen, unsigned int skip)
+{
+    unsigned int skipcnt = 0;
+    int vencoding = 0; /* 1 if 's' is an integer, -1 if not, 0 if unknown. */
+    int64_t vll = 0;
+    uint32_t entrylen;
+
+    ((void) lp);
+    if (p == NULL) return NULL;
+    while (p[0] != LP_EOF) {
+        if (skipcnt == 0) {
+            if (LP_ENCODING_IS_6BIT_STR(p[0])) {
+                uint32_t len = LP_ENCODING_6BIT_STR_LEN(p);
+
+                if (len == slen && (len == 0 ||
+                    (p[1] == s[0] && memcmp(p+1,s,slen) == 0))) return p;
+                entrylen = 1+len;
+            } else {
+                int64_t count;
+                unsigned char *value;
+
+                entrylen = lpCurrentEncodedSize(p);
+                if (LP_ENCODING_IS_12BIT_STR(p[0]) ||
+                    LP_ENCODING_IS_32BIT_STR(p[0]))
+                {
+                    value = lpGet(p,&count,NULL);
+                    if (count == slen && (slen == 0 ||
+                        (value[0] == s[0] && memcmp(value,s,slen) == 0)))
+                        return p;
+                } else {
+                    /* Try to parse 's' as an integer only the first time
+                     * an integer element is found. */
+                    if (vencoding == 0)
+                        vencoding = lpStringToInt64((const char*)s,slen,
+                                                    &vll) ? 1 : -1;
+                    if (vencoding == 1) {
+                        lpGet(p,&count,NULL);
+                        if (count == vll) return p;
+                    }
+                }
+            }
+            skipcnt = skip;
+        } else {
+            entrylen = lpCurrentEncodedSize(p);
+            skipcnt--;
+        }
+        p += entrylen+lpEncodeBacklen(NULL,entrylen);
+    }
+    return NULL;
+}
+
+/* Like lpFind() starting from the first element of 'lp', but big listpacks
+ * searched again and again are searched with an index instead, kept on
+ * behalf of 'owner', see the lookup index section above. */
+unsigned char *lpFindIndexed(unsigned char *lp, const void *owner,
+                             unsigned char *s, uint32_t slen,
+                             unsigned int skip)
+{
+    uint32_t elements = lpGetNumElements(lp);
+    unsigned char *p;
+    lpIndex *idx;
+
+    if (elements < LP_INDEX_MIN_ELEMENTS || elements == LP_HDR_NUMELE_UNKNOWN)
+        return lpFind(lp,lpFirst(lp),s,slen,skip);
+    pthread_mutex_lock(&lpIndexMutex);
+    idx = lpIndexLookup(owner,lp,skip);
+    p = idx ? lpIndexFind(idx,lp,s,slen) : NULL;
+    pthread_mutex_unlock(&lpIndexMutex);
+    return idx ? p : lpFind(lp,lpFirst(lp),s,slen,skip);
+}
+
+/* Delete 'num' elements starting at the element pointed by '*p', or all the
+ * elements up to the end of the listpack if fewer are left. Returns the
+ * resulting listpack, and sets '*p' to the element that took the place of
+ * the first deleted one, or to NULL if the range reached the end of the
+ * listpack. */
+unsigned char *lpDeleteRangeWithEntry(unsigned char *lp, unsigned char **p,
+                                      unsigned long num)
+{
+    unsigned char *first = *p, *tail = *p;
+    uint32_t numele = lpGetNumElements(lp);
+    uint32_t bytes = lpGetTotalBytes(lp);
+    unsigned long poff = first-lp, deleted = 0;
+
+    lpIndexInvalidate(lp);
+    while (deleted < num && tail[0] != LP_EOF) {
+        tail = lpSkip(tail);
+        deleted++;
+    }
+
+    /* Move the elements on the right of the range, and the EOF byte. */
+    memmove(first,tail,lp+bytes-tail);
+    bytes -= tail-first;
+    lpSetTotalBytes(lp,bytes);
+    if (numele != LP_HDR_NUMELE_UNKNOWN)
+        lpSetNumElements(lp,numele-deleted);
+    lp = lp_realloc(lp,bytes);
+    *p = lp[poff] == LP_EOF ? NULL : lp+poff;
+    return lp;
+}
+
+/* Delete 'num' elements starting at the element with the specified index
+ * (see lpSeek() for the index semantics), or all the elements up to the end
+ * of the listpack if fewer are left. Returns the resulting listpack. */
+unsigned char *lpDeleteRange(unsigned char *lp, long index, unsigned long num) {
+    unsigned char *p;
+
+    if (num == 0 || (p = lpSeek(lp,index)) == NULL) return lp;
+    return lpDeleteRangeWithEntry(lp,&p,num);
+}
+
+/* Merge the listpacks 'first' and 'second' by appending 'second' to
+ * 'first'. The larger of the two is reallocated to hold the result, while
+ * the other one is freed: the pointer of the freed one is set to NULL, the
+ * other one is updated and also returned. NULL is returned, and nothing is
+ * changed, if the two listpacks can't be merged. */
+unsigned char *lpMerge(unsigned char **first, unsigned char **second) {
+    unsigned char *target, *source;
+    uint64_t first_bytes, second_bytes, target_bytes, source_bytes, lpbytes;
+    uint32_t lplength;
+    int append;
+
+    if (first == NULL || *first == NULL || second == NULL || *second == NULL)
+        return NULL;
+    if (*first == *second) return NULL;
+    lpIndexInvalidate(*first);
+    lpIndexInvalidate(*second);
+
+    first_bytes = lpGetTotalBytes(*first);
+    second_bytes = lpGetTotalBytes(*second);
+    if (first_bytes >= second_bytes) {
+        target = *first;
+        source = *second;
+        append = 1;
+    } else {
+        target = *second;
+        source = *first;
+        append = 0;
+    }
+    target_bytes = lpGetTotalBytes(target);
+    source_bytes = lpGetTotalBytes(source);
+
+    /* The merged listpack has a single header and EOF byte. */
+    lpbytes = first_bytes+second_bytes-LP_HDR_SIZE-1;
+    if (lpbytes > UINT32_MAX) return NULL;
+    lplength = lpLength(*first)+lpLength(*second);
+    if (lplength > LP_HDR_NUMELE_UNKNOWN) lplength = LP_HDR_NUMELE_UNKNOWN;
+
+    if ((target = lp_realloc(target,lpbytes)) == NULL) return NULL;
+    if (append) {
+        /* [target elements][source elements + EOF] */
+        memcpy(target+target_bytes-1,source+LP_HDR_SIZE,
+               source_bytes-LP_HDR_SIZE);
+    } else {
+        /* [source elements][target elements + EOF] */
+        memmove(target+source_bytes-1,target+LP_HDR_SIZE,
+                target_bytes-LP_HDR_SIZE);
+        memcpy(target+LP_HDR_SIZE,source+LP_HDR_SIZE,
+               source_bytes-LP_HDR_SIZE-1);
+    }
+    lpSetNumElements(target,lplength);
+    lpSetTotalBytes(target,lpbytes);
+    lp_free(source);
+
+    if (append) {
+        *first = target;
+        *second = NULL;
+    } else {
+        *first = NULL;
+        *second = target;
+    }
+    return target;
+}
+
+/* Print a human readable representation of the listpack on standard
+ * output, for debugging. */
+void lpRepr(unsigned char *lp) {
+    unsigned char *p, *vstr;
+    int64_t vlen;
+    unsigned char intbuf[LP_INTBUF_SIZE];
+    int index = 0;
+
+    printf("{total bytes %u} {num entries %u}\n", lpBytes(lp), lpLength(lp));
+    p = lpFirst(lp);
+    while (p) {
+        uint32_t encoded_size = lpCurrentEncodedSize(p);
+        unsigned long back_len = lpEncodeBacklen(NULL,encoded_size);
+
+        printf("{\n"
+               "\taddr: 0x%08lx,\n"
+               "\tindex: %2d,\n"
+               "\toffset: %1lu,\n"
+               "\tencoded size: %2u,\n"
+               "\tbacklen size: %2lu,\n"
+               "\tpayload: ",
+               (unsigned long)p, index, (unsigned long)(p-lp),
+               encoded_size, back_len);
+        vstr = lpGet(p,&vlen,intbuf);
+        if (vlen > 40) {
+            if (fwrite(vstr,40,1,stdout) == 0) perror("fwrite");
+            printf("...");
+        } else {
+            if (vlen && fwrite(vstr,vlen,1,stdout) == 0) perror("fwrite");
+        }
+        printf("\n}\n");
+        index++;
+        p = lpNext(lp,p);
+    }
+    printf("{end}\n\n");
+}
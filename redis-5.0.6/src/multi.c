@@ -146,11 +146,37 @@ void execCommandPropagateMulti(client *c) {
     decrRefCount(multistring);
 }
 
+/* Prefetch the keys of the queued commands starting from the j-th, up to
+ * DICT_BATCH_SIZE keys, and return the index of the first command whose
+ * keys were not prefetched. */
+static int execPrefetchKeys(client *c, int j) {
+    robj *keys[DICT_BATCH_SIZE];
+    int count = 0;
+
+    for (; j < c->mstate.count; j++) {
+        multiCmd *mc = c->mstate.commands+j;
+        int numkeys, k, *keyidx;
+
+        /* Don't call into modules just for a hint. */
+        if (mc->cmd->flags & CMD_MODULE) continue;
+        keyidx = getKeysFromCommand(mc->cmd,mc->argv,mc->argc,&numkeys);
+        if (count && count+numkeys > DICT_BATCH_SIZE) {
+            getKeysFreeResult(keyidx);
+            break;
+        }
+        for (k = 0; k < numkeys && count < DICT_BATCH_SIZE; k++)
+            keys[count++] = mc->argv[keyidx[k]];
+        getKeysFreeResult(keyidx);
+    }
+    dbPrefetchKeys(c->db,keys,count,1);
+    return j;
+}
+
 /* EXEC命令执行事务流程 */
 void execCommand(client *c) {
-    int j;
+    int j, prefetched = 0;
     robj **orig_argv;
-    int orig_argc;
+    int orig_argc, orig_argv_len;
     struct redisCommand *orig_cmd;
     int must_propagate = 0;             /* 决定是否需要传播到AOF文件或其他节点? */
     int was_master = server.masterhost == NULL;
@@ -188,6 +214,7 @@ void execCommand(client *c) {
 
     /* 5)备份EXEC要执行的命令 */
     orig_argv = c->argv;        /* 将该客户端命令参数复制到临时变量 */
+    orig_argv_len = c->argv_len;
     orig_argc = c->argc;        /* 该客户端命令参数个数复制到临时变量 */
     orig_cmd = c->cmd;
 
@@ -196,8 +223,11 @@ void execCommand(client *c) {
 
     /* 7)执行事务队列中的每个命令 */
     for (j = 0; j < c->mstate.count; j++) {     /* 遍历事务命令组中的每个命令 */
+        /* 批量预取后续命令的键，使多个键的缓存未命中重叠 */
+        if (j == prefetched) prefetched = execPrefetchKeys(c,j);
         c->argc = c->mstate.commands[j].argc;   /* 当前要执行的命令参数个数 */
         c->argv = c->mstate.commands[j].argv;   /* 当前要执行的命令参数 */
+        c->argv_len = c->mstate.commands[j].argc;
         c->cmd = c->mstate.commands[j].cmd;
 
         /* Propagate a MULTI request once we encounter the first command which
@@ -220,6 +250,7 @@ void execCommand(client *c) {
 
     /* 8)还原EXEC要执行的命令 */
     c->argv = orig_argv;
+    c->argv_len = orig_argv_len;
     c->argc = orig_argc;
     c->cmd = orig_cmd;
 
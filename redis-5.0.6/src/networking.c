@@ -33,8 +33,18 @@
 #include <sys/uio.h>
 #include <math.h>
 #include <ctype.h>
+#include <limits.h>
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
 
 static void setProtocolError(const char *errstr, client *c);
+static void freeClientFromIOContext(client *c);
+static void decrRefCountFromIOContext(robj *o);
+static int ioThreadsAreRunning(void);
+static void indexClientOutputBufferMemory(client *c, unsigned long mem);
+int postponeClientRead(client *c);
 
 /* Return the size consumed from the allocator, for the specified SDS string,
  * including internal fragmentation. This function is used in order to compute
@@ -58,12 +68,17 @@ size_t getStringObjectSdsUsedMemory(robj *o) {
 /* Client.reply list dup and free methods. */
 void *dupClientReplyValue(void *o) {
     clientReplyBlock *old = o;
-    clientReplyBlock *buf = zmalloc(sizeof(clientReplyBlock) + old->size);
-    memcpy(buf, o, sizeof(clientReplyBlock) + old->size);
+    size_t bufsize = old->obj ? 0 : old->size;
+    clientReplyBlock *buf = zmalloc(sizeof(clientReplyBlock) + bufsize);
+    memcpy(buf, o, sizeof(clientReplyBlock) + bufsize);
+    if (buf->obj) incrRefCount(buf->obj);
     return buf;
 }
 
 void freeClientReplyValue(void *o) {
+    clientReplyBlock *block = o;
+    /* Note that 'block' may be the NULL placeholder of a deferred length. */
+    if (block && block->obj) decrRefCountFromIOContext(block->obj);
     zfree(o);
 }
 
@@ -112,13 +127,16 @@ client *createClient(int fd) {
     c->name = NULL;
     c->bufpos = 0;
     c->qb_pos = 0;
-    c->querybuf = sdsempty();
+    c->querybuf = NULL; /* Borrowed from the pool when there is input. */
     c->pending_querybuf = sdsempty();
     c->querybuf_peak = 0;
     c->reqtype = 0;
     c->argc = 0;
+    c->argv_len = 0;
     c->argv = NULL;
     c->cmd = c->lastcmd = NULL;
+    c->batch_cmd = NULL;
+    c->batch_cmd_namelen = 0;
     c->multibulklen = 0;
     c->bulklen = -1;
     c->sentlen = 0;
@@ -137,6 +155,7 @@ client *createClient(int fd) {
     c->reply = listCreate();
     c->reply_bytes = 0;
     c->obuf_soft_limit_reached_time = 0;
+    c->obuf_indexed_mem = 0;
     listSetFreeMethod(c->reply,freeClientReplyValue);
     listSetDupMethod(c->reply,dupClientReplyValue);
     c->btype = BLOCKED_NONE;
@@ -148,6 +167,7 @@ client *createClient(int fd) {
     c->bpop.xread_group_noack = 0;
     c->bpop.numreplicas = 0;
     c->bpop.reploffset = 0;
+    c->bpop.keys_job = NULL;
     c->woff = 0;
     c->watched_keys = listCreate();
     c->pubsub_channels = dictCreate(&objectKeyPointerValueDictType,NULL);
@@ -225,8 +245,13 @@ int prepareClientToWrite(client *c) {
     if (c->fd <= 0) return C_ERR; /* Fake client for AOF loading. */
 
     /* Schedule the client to write the output buffers to the socket, unless
-     * it should already be setup to do so (it has already pending data). */
-    if (!clientHasPendingReplies(c)) clientInstallWriteHandler(c);
+     * it should already be setup to do so (it has already pending data).
+     *
+     * If CLIENT_PENDING_READ is set we are running inside an I/O thread and
+     * must not touch the global list of pending writes: the handler will be
+     * installed by handleClientsWithPendingReadsUsingThreads() later. */
+    if (!clientHasPendingReplies(c) && !(c->flags & CLIENT_PENDING_READ))
+        clientInstallWriteHandler(c);
 
     /* Authorize the caller to queue in the output buffer of this client. */
     return C_OK;
@@ -263,8 +288,9 @@ void _addReplyStringToList(client *c, const char *s, size_t len) {
      * addDeferredMultiBulkLength() is used, it sets a dummy node to NULL just
      * fo fill it later, when the size of the bulk length is set. */
 
-    /* Append to tail string when possible. */
-    if (tail) {
+    /* Append to tail string when possible. Blocks referencing an object
+     * are never appended to. */
+    if (tail && !tail->obj) {
         /* Copy the part we can fit into the tail, and leave the rest for a
          * new node */
         size_t avail = tail->size - tail->used;
@@ -282,6 +308,7 @@ void _addReplyStringToList(client *c, const char *s, size_t len) {
         /* take over the allocation's internal fragmentation */
         tail->size = zmalloc_usable(tail) - sizeof(clientReplyBlock);
         tail->used = len;
+        tail->obj = NULL;
         memcpy(tail->buf, s, len);
         listAddNodeTail(c->reply, tail);
         c->reply_bytes += tail->size;
@@ -289,6 +316,52 @@ void _addReplyStringToList(client *c, const char *s, size_t len) {
     asyncCloseClientOnOutputBufferLimitReached(c);
 }
 
+/* Append a block referencing the string object 'obj' to the reply list,
+ * instead of copying the string: the object is shared with the caller
+ * (usually the keyspace) until the block is sent to the client.
+ *
+ * This is safe since the code modifying strings in place, such as APPEND
+ * or SETRANGE, only does so when the object is not shared, otherwise a
+ * private copy is created with dbUnshareStringValue(). */
+void _addReplyObjectToList(client *c, robj *obj) {
+    if (c->flags & CLIENT_CLOSE_AFTER_REPLY) return;
+
+    clientReplyBlock *block = zmalloc(sizeof(clientReplyBlock));
+    block->size = block->used = sdslen(obj->ptr);
+    block->obj = obj;
+    incrRefCount(obj);
+    listAddNodeTail(c->reply, block);
+    c->reply_bytes += block->size;
+    asyncCloseClientOnOutputBufferLimitReached(c);
+}
+
+/* Make the reply blocks of all the clients reference private copies of the
+ * objects they share with someone else, usually the keyspace. This is
+ * called before a database is handed to the lazyfree thread: it will
+ * decrement the reference count of the objects, that is not atomic, so
+ * the main thread must not keep updating it for the same objects. */
+void unshareClientsReplyObjects(void) {
+    listIter li, bi;
+    listNode *ln, *bn;
+
+    listRewind(server.clients,&li);
+    while((ln = listNext(&li))) {
+        client *c = listNodeValue(ln);
+
+        listRewind(c->reply,&bi);
+        while((bn = listNext(&bi))) {
+            clientReplyBlock *block = listNodeValue(bn);
+            robj *obj;
+
+            if (block == NULL || block->obj == NULL ||
+                block->obj->refcount == 1) continue;
+            obj = block->obj;
+            block->obj = createRawStringObject(obj->ptr,sdslen(obj->ptr));
+            decrRefCount(obj);
+        }
+    }
+}
+
 /* -----------------------------------------------------------------------------
  * Higher level functions to queue data on the client output buffer.
  * The following functions are the ones that commands implementations will call.
@@ -298,7 +371,13 @@ void _addReplyStringToList(client *c, const char *s, size_t len) {
 void addReply(client *c, robj *obj) {
     if (prepareClientToWrite(c) != C_OK) return;
 
-    if (sdsEncodedObject(obj)) {
+    if (obj->encoding == OBJ_ENCODING_RAW &&
+        sdslen(obj->ptr) >= PROTO_REPLY_ZEROCOPY_MIN)
+    {
+        /* Large strings are not copied into the output buffers: we
+         * just reference the object. */
+        _addReplyObjectToList(c,obj);
+    } else if (sdsEncodedObject(obj)) {
         if (_addReplyToBuffer(c,obj->ptr,sdslen(obj->ptr)) != C_OK)
             _addReplyStringToList(c,obj->ptr,sdslen(obj->ptr));
     } else if (obj->encoding == OBJ_ENCODING_INT) {
@@ -445,11 +524,11 @@ void setDeferredMultiBulkLength(client *c, void *node, long length) {
      * our protocol in the node immediately after to it, in order to save a
      * write(2) syscall later. Conditions needed to do it:
      *
-     * - The next node is non-NULL,
+     * - The next node is non-NULL and doesn't reference an object,
      * - It has enough room already allocated
      * - And not too large (avoid large memmove) */
     if (ln->next != NULL && (next = listNodeValue(ln->next)) &&
-        next->size - next->used >= lenstr_len &&
+        !next->obj && next->size - next->used >= lenstr_len &&
         next->used < PROTO_REPLY_CHUNK_BYTES * 4) {
         memmove(next->buf + lenstr_len, next->buf, next->used);
         memcpy(next->buf, lenstr, lenstr_len);
@@ -461,6 +540,7 @@ void setDeferredMultiBulkLength(client *c, void *node, long length) {
         /* Take over the allocation's internal fragmentation */
         buf->size = zmalloc_usable(buf) - sizeof(clientReplyBlock);
         buf->used = lenstr_len;
+        buf->obj = NULL;
         memcpy(buf->buf, lenstr, lenstr_len);
         listNodeValue(ln) = buf;
         c->reply_bytes += buf->size;
@@ -640,6 +720,7 @@ void AddReplyFromClient(client *dst, client *src) {
     dst->reply_bytes += src->reply_bytes;
     src->reply_bytes = 0;
     src->bufpos = 0;
+    updateClientOutputBufferMemory(dst);
 }
 
 /* Copy 'src' client output buffers into 'dst' client output buffers.
@@ -770,10 +851,78 @@ void acceptUnixHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
     }
 }
 
+/* -----------------------------------------------------------------------------
+ * Arguments arena
+ *
+ * Most command arguments are small strings, that are created as embedded
+ * string objects by processMultibulkBuffer() and freed as soon as the
+ * command returns. Instead of returning them to the allocator, the objects
+ * not retained by the command (the ones we are the only owner of) are kept
+ * in the arena, and recycled for the arguments of the next commands.
+ *
+ * The arena has a bucket for every allocation size, in steps of 8 bytes,
+ * up to the biggest embedded string. Objects are allocated rounding the
+ * size to the size of their bucket, which never changes the size class of
+ * the allocator, so an object retained by a command (for instance stored as
+ * a value in the key space) uses exactly the memory of a normal object.
+ *
+ * The arena is only used by the main thread: when the I/O threads are
+ * parsing the commands objects are allocated as usually.
+ * -------------------------------------------------------------------------- */
+
+#define ARGV_ARENA_MAX_LEN 44 /* Same as OBJ_ENCODING_EMBSTR_SIZE_LIMIT. */
+#define ARGV_ARENA_HDR_SIZE (sizeof(robj)+sizeof(struct sdshdr8)+1)
+#define ARGV_ARENA_OBJ_SIZE(len) ((ARGV_ARENA_HDR_SIZE+(len)+7) & ~(size_t)7)
+#define ARGV_ARENA_BUCKET(len) \
+    ((ARGV_ARENA_OBJ_SIZE(len)-ARGV_ARENA_OBJ_SIZE(0))/8)
+#define ARGV_ARENA_BUCKETS (ARGV_ARENA_BUCKET(ARGV_ARENA_MAX_LEN)+1)
+#define ARGV_ARENA_BUCKET_SIZE 256 /* Max free objects kept per bucket. */
+
+static robj *argv_arena[ARGV_ARENA_BUCKETS][ARGV_ARENA_BUCKET_SIZE];
+static int argv_arena_len[ARGV_ARENA_BUCKETS];
+
+/* Create a string object for a command argument, using the arena for
+ * small strings. */
+static robj *createArgvStringObject(const char *ptr, size_t len) {
+    if (len > ARGV_ARENA_MAX_LEN) return createStringObject(ptr,len);
+
+    int b = ARGV_ARENA_BUCKET(len);
+    robj *o;
+    if (argv_arena_len[b] && !ioThreadsAreRunning())
+        o = argv_arena[b][--argv_arena_len[b]];
+    else
+        o = zmalloc(ARGV_ARENA_OBJ_SIZE(len));
+    return initEmbeddedStringObject(o,ptr,len);
+}
+
+/* Release a command argument: if it was not retained by the command and
+ * is suitable for the arena, recycle it, otherwise just decrement its
+ * reference count. */
+static void releaseArgvObject(robj *o) {
+    if (o->refcount == 1 && o->encoding == OBJ_ENCODING_EMBSTR &&
+        !ioThreadsAreRunning())
+    {
+        size_t len = sdslen(o->ptr);
+        int b = ARGV_ARENA_BUCKET(len);
+
+        /* Check the allocation size as well, since arguments may be
+         * objects created elsewhere and set via rewriteClientCommandArgument()
+         * and similar functions. */
+        if (len <= ARGV_ARENA_MAX_LEN &&
+            argv_arena_len[b] < ARGV_ARENA_BUCKET_SIZE &&
+            zmalloc_size(o) >= ARGV_ARENA_OBJ_SIZE(len))
+        {
+            argv_arena[b][argv_arena_len[b]++] = o;
+            return;
+        }
+    }
+    decrRefCount(o);
+}
+
 static void freeClientArgv(client *c) {
     int j;
     for (j = 0; j < c->argc; j++)
-        decrRefCount(c->argv[j]);
+        releaseArgvObject(c->argv[j]);
     c->argc = 0;
     c->cmd = NULL;
 }
@@ -834,6 +983,14 @@ void unlinkClient(client *c) {
         c->flags &= ~CLIENT_PENDING_WRITE;
     }
 
+    /* Remove from the list of pending reads if needed. */
+    if (c->flags & CLIENT_PENDING_READ) {
+        ln = listSearchKey(server.clients_pending_read,c);
+        serverAssert(ln != NULL);
+        listDelNode(server.clients_pending_read,ln);
+        c->flags &= ~CLIENT_PENDING_READ;
+    }
+
     /* When client was just unblocked because of a blocking operation,
      * remove it from the list of unblocked clients. */
     if (c->flags & CLIENT_UNBLOCKED) {
@@ -877,9 +1034,8 @@ void freeClient(client *c) {
     }
 
     /* Free the query buffer */
-    sdsfree(c->querybuf);
+    releaseClientQueryBuffer(c,1);
     sdsfree(c->pending_querybuf);
-    c->querybuf = NULL;
 
     /* Deallocate structures used to block on blocking ops. */
     if (c->flags & CLIENT_BLOCKED) unblockClient(c);
@@ -897,6 +1053,7 @@ void freeClient(client *c) {
 
     /* Free data structures. */
     listRelease(c->reply);
+    indexClientOutputBufferMemory(c,0);
     freeClientArgv(c);
 
     /* Unlink the client: this will close the socket, remove the I/O
@@ -949,9 +1106,23 @@ void freeClient(client *c) {
  * a context where calling freeClient() is not possible, because the client
  * should be valid for the continuation of the flow of the program. */
 void freeClientAsync(client *c) {
+    /* We need to handle concurrent access to the server.clients_to_close list
+     * only in the freeClientAsync() function, since it's the only function
+     * that may access the list while Redis uses I/O threads. All the other
+     * accesses are in the context of the main thread while the other threads
+     * are idle. */
+    static pthread_mutex_t async_free_queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+
     if (c->flags & CLIENT_CLOSE_ASAP || c->flags & CLIENT_LUA) return;
     c->flags |= CLIENT_CLOSE_ASAP;
+    if (server.io_threads_num == 1) {
+        /* No need to bother with locking if there's just one thread. */
+        listAddNodeTail(server.clients_to_close,c);
+        return;
+    }
+    pthread_mutex_lock(&async_free_queue_mutex);
     listAddNodeTail(server.clients_to_close,c);
+    pthread_mutex_unlock(&async_free_queue_mutex);
 }
 
 void freeClientsInAsyncFreeQueue(void) {
@@ -974,15 +1145,116 @@ client *lookupClientByID(uint64_t id) {
     return (c == raxNotFound) ? NULL : c;
 }
 
+/* Gather the static reply buffer and the head of the reply list into the
+ * array 'iov' of 'maxiov' elements, for about NET_MAX_WRITES_PER_EVENT bytes
+ * at most. Empty nodes of the reply list found in the way are released.
+ * Returns the number of iovecs filled. */
+static int _clientReplyIov(client *c, struct iovec *iov, int maxiov) {
+    int iovcnt = 0;
+    size_t iov_bytes_len = 0;
+    listIter li;
+    listNode *ln;
+    clientReplyBlock *o;
+
+    /* If the static reply buffer is not empty, send it first. */
+    if (c->bufpos > 0) {
+        iov[iovcnt].iov_base = c->buf + c->sentlen;
+        iov[iovcnt].iov_len = c->bufpos - c->sentlen;
+        iov_bytes_len += iov[iovcnt++].iov_len;
+    }
+
+    /* The first node of the reply list may be partially sent by a
+     * previous call, in which case c->sentlen is the offset inside it. */
+    size_t offset = c->bufpos > 0 ? 0 : c->sentlen;
+    listRewind(c->reply,&li);
+    while((ln = listNext(&li)) && iovcnt < maxiov &&
+          iov_bytes_len < NET_MAX_WRITES_PER_EVENT)
+    {
+        o = listNodeValue(ln);
+        if (o->used == 0) {
+            /* Empty node, just release it and skip it. */
+            c->reply_bytes -= o->size;
+            listDelNode(c->reply,ln);
+            offset = 0;
+            continue;
+        }
+        iov[iovcnt].iov_base = replyBlockData(o) + offset;
+        iov[iovcnt].iov_len = o->used - offset;
+        iov_bytes_len += iov[iovcnt++].iov_len;
+        offset = 0;
+    }
+    return iovcnt;
+}
+
+/* Consume 'nwritten' bytes of the blocks gathered by _clientReplyIov():
+ * the static buffer first, then all the nodes that were fully sent are
+ * released, leaving c->sentlen pointing inside the first node still having
+ * data to send, exactly like the single write() code path does. */
+static void _clientReplySent(client *c, ssize_t nwritten) {
+    listNode *ln;
+    clientReplyBlock *o;
+    ssize_t remaining = nwritten;
+
+    if (c->bufpos > 0) {
+        ssize_t buflen = c->bufpos - c->sentlen;
+        if (remaining < buflen) {
+            c->sentlen += remaining;
+            return;
+        }
+        /* If the buffer was sent, set bufpos to zero to continue with
+         * the remainder of the reply. */
+        c->bufpos = 0;
+        c->sentlen = 0;
+        remaining -= buflen;
+    }
+    while (remaining > 0) {
+        ln = listFirst(c->reply);
+        o = listNodeValue(ln);
+        if (remaining < (ssize_t)(o->used - c->sentlen)) {
+            c->sentlen += remaining;
+            break;
+        }
+        remaining -= (ssize_t)(o->used - c->sentlen);
+        c->reply_bytes -= o->size;
+        listDelNode(c->reply,ln);
+        c->sentlen = 0;
+    }
+    /* If there are no longer objects in the list, we expect
+     * the count of reply bytes to be exactly zero. */
+    if (listLength(c->reply) == 0)
+        serverAssert(c->reply_bytes == 0);
+}
+
+/* Transfer the static reply buffer and the head of the reply list to the
+ * socket with a single writev() call. At most IOV_MAX blocks and about
+ * NET_MAX_WRITES_PER_EVENT bytes are sent at once. The number of bytes
+ * written is stored into *nwritten.
+ *
+ * Returns C_ERR if the writev() call failed or wrote nothing, otherwise
+ * C_OK is returned. */
+static int _writevToClient(int fd, client *c, ssize_t *nwritten) {
+    struct iovec iov[IOV_MAX];
+    int iovcnt = _clientReplyIov(c,iov,IOV_MAX);
+
+    *nwritten = 0;
+    if (iovcnt == 0) return C_OK;
+    *nwritten = writev(fd,iov,iovcnt);
+    if (*nwritten <= 0) return C_ERR;
+    _clientReplySent(c,*nwritten);
+    return C_OK;
+}
+
+static int _writeToClientDone(client *c, ssize_t totwritten,
+                              ssize_t nwritten, int handler_installed);
+
 /* Write data in output buffers to client. Return C_OK if the client
  * is still valid after the call, C_ERR if it was freed. */
 int writeToClient(int fd, client *c, int handler_installed) {
     ssize_t nwritten = 0, totwritten = 0;
-    size_t objlen;
-    clientReplyBlock *o;
 
     while(clientHasPendingReplies(c)) {
-        if (c->bufpos > 0) {
+        if (listLength(c->reply) == 0) {
+            /* Just the static buffer to send: no need for writev(). */
             nwritten = write(fd,c->buf+c->sentlen,c->bufpos-c->sentlen);
             if (nwritten <= 0) break;
             c->sentlen += nwritten;
@@ -995,30 +1267,10 @@ int writeToClient(int fd, client *c, int handler_installed) {
                 c->sentlen = 0;
             }
         } else {
-            o = listNodeValue(listFirst(c->reply));
-            objlen = o->used;
-
-            if (objlen == 0) {
-                c->reply_bytes -= o->size;
-                listDelNode(c->reply,listFirst(c->reply));
-                continue;
-            }
-
-            nwritten = write(fd, o->buf + c->sentlen, objlen - c->sentlen);
-            if (nwritten <= 0) break;
-            c->sentlen += nwritten;
+            /* Send the static buffer and as many reply list nodes as
+             * possible with a single system call. */
+            if (_writevToClient(fd,c,&nwritten) == C_ERR) break;
             totwritten += nwritten;
-
-            /* If we fully sent the object on head go to the next one */
-            if (c->sentlen == objlen) {
-                c->reply_bytes -= o->size;
-                listDelNode(c->reply,listFirst(c->reply));
-                c->sentlen = 0;
-                /* If there are no longer objects in the list, we expect
-                 * the count of reply bytes to be exactly zero. */
-                if (listLength(c->reply) == 0)
-                    serverAssert(c->reply_bytes == 0);
-            }
         }
         /* Note that we avoid to send more than NET_MAX_WRITES_PER_EVENT
          * bytes, in a single threaded server it's a good idea to serve
@@ -1037,14 +1289,24 @@ int writeToClient(int fd, client *c, int handler_installed) {
              zmalloc_used_memory() < server.maxmemory) &&
             !(c->flags & CLIENT_SLAVE)) break;
     }
-    server.stat_net_output_bytes += totwritten;
+    return _writeToClientDone(c,totwritten,nwritten,handler_installed);
+}
+
+/* Update the state of the client 'c' after writing 'totwritten' bytes to its
+ * socket, 'nwritten' being the result of the last write (-1 with errno set
+ * on errors). Return C_OK if the client is still valid, C_ERR if it was
+ * freed. */
+static int _writeToClientDone(client *c, ssize_t totwritten,
+                              ssize_t nwritten, int handler_installed)
+{
+    atomicIncr(server.stat_net_output_bytes,totwritten);
     if (nwritten == -1) {
         if (errno == EAGAIN) {
             nwritten = 0;
         } else {
             serverLog(LL_VERBOSE,
                 "Error writing to client: %s", strerror(errno));
-            freeClient(c);
+            freeClientFromIOContext(c);
             return C_ERR;
         }
     }
@@ -1055,13 +1317,17 @@ int writeToClient(int fd, client *c, int handler_installed) {
          * We just rely on data / pings received for timeout detection. */
         if (!(c->flags & CLIENT_MASTER)) c->lastinteraction = server.unixtime;
     }
+    updateClientOutputBufferMemory(c);
     if (!clientHasPendingReplies(c)) {
         c->sentlen = 0;
+        /* Note that writeToClient() may be called from an I/O thread, where
+         * aeDeleteFileEvent() is not safe to call: however threads always
+         * call us with handler_installed set to 0, so we are fine. */
         if (handler_installed) aeDeleteFileEvent(server.el,c->fd,AE_WRITABLE);
 
         /* Close connection after entire reply has been sent. */
         if (c->flags & CLIENT_CLOSE_AFTER_REPLY) {
-            freeClient(c);
+            freeClientFromIOContext(c);
             return C_ERR;
         }
     }
@@ -1075,6 +1341,95 @@ void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask) {
     writeToClient(fd,privdata,1);
 }
 
+/* Install the write handler of a client that still has replies to send
+ * after the synchronous writes performed before entering the event loop. */
+static void installWriteHandler(client *c) {
+    int ae_flags = AE_WRITABLE;
+    /* For the fsync=always policy, we want that a given FD is never
+     * served for reading and writing in the same event loop iteration,
+     * so that in the middle of receiving the query, and serving it
+     * to the client, we'll call beforeSleep() that will do the
+     * actual fsync of AOF to disk. AE_BARRIER ensures that. */
+    if (server.aof_state == AOF_ON &&
+        server.aof_fsync == AOF_FSYNC_ALWAYS)
+    {
+        ae_flags |= AE_BARRIER;
+    }
+    if (aeCreateFileEvent(server.el, c->fd, ae_flags,
+        sendReplyToClient, c) == AE_ERR)
+    {
+            freeClientAsync(c);
+    }
+}
+
+/* Requests and buffers used to perform the socket I/O of many clients with
+ * aeBatchIO(), grown on demand and reused across calls. Every request can
+ * use up to NET_BATCH_IOV iovecs. */
+static aeIORequest *io_batch_reqs = NULL;
+static struct iovec *io_batch_iov = NULL;
+static listNode **io_batch_nodes = NULL;
+static int io_batch_size = 0;
+
+static void ioBatchReserve(int count) {
+    if (count <= io_batch_size) return;
+    io_batch_reqs = zrealloc(io_batch_reqs,sizeof(aeIORequest)*count);
+    io_batch_iov = zrealloc(io_batch_iov,
+                            sizeof(struct iovec)*NET_BATCH_IOV*count);
+    io_batch_nodes = zrealloc(io_batch_nodes,sizeof(listNode*)*count);
+    io_batch_size = count;
+}
+
+/* Send the replies of all the clients waiting to write with a single
+ * aeBatchIO() call, transferring up to NET_BATCH_IOV blocks per client.
+ * The clients that got their whole replies, and the ones whose socket
+ * can't accept more data (that get their write handler installed), are
+ * removed from server.clients_pending_write. The others are left in the
+ * list, so that the caller can continue with writeToClient(). */
+static void writeToClientsInBatch(void) {
+    listIter li;
+    listNode *ln;
+    int count = 0;
+
+    ioBatchReserve(listLength(server.clients_pending_write));
+    listRewind(server.clients_pending_write,&li);
+    while((ln = listNext(&li))) {
+        client *c = listNodeValue(ln);
+        aeIORequest *req = io_batch_reqs+count;
+
+        if (c->flags & CLIENT_PROTECTED || !clientHasPendingReplies(c))
+            continue;
+        req->fd = c->fd;
+        req->op = AE_IO_WRITE;
+        req->iov = io_batch_iov+NET_BATCH_IOV*count;
+        req->iovcnt = _clientReplyIov(c,req->iov,NET_BATCH_IOV);
+        if (req->iovcnt == 0) continue;
+        io_batch_nodes[count++] = ln;
+    }
+    if (count == 0 || aeBatchIO(server.el,io_batch_reqs,count) == AE_ERR)
+        return;
+
+    for (int j = 0; j < count; j++) {
+        aeIORequest *req = io_batch_reqs+j;
+        client *c = listNodeValue(io_batch_nodes[j]);
+        ssize_t nwritten = req->res, len = 0;
+
+        for (int i = 0; i < req->iovcnt; i++) len += req->iov[i].iov_len;
+        if (nwritten > 0) _clientReplySent(c,nwritten);
+        else if (nwritten == -1) errno = req->err;
+
+        /* On errors the client is freed, and removed from the list. */
+        if (_writeToClientDone(c,nwritten > 0 ? nwritten : 0,nwritten,0)
+            == C_ERR) continue;
+
+        /* Everything gathered was sent, but there is more. */
+        if (clientHasPendingReplies(c) && nwritten == len) continue;
+
+        c->flags &= ~CLIENT_PENDING_WRITE;
+        listDelNode(server.clients_pending_write,io_batch_nodes[j]);
+        if (clientHasPendingReplies(c)) installWriteHandler(c);
+    }
+}
+
 /* This function is called just before entering the event loop, in the hope
  * we can just write the replies to the client output buffer without any
  * need to use a syscall in order to install the writable event handler,
@@ -1084,6 +1439,11 @@ int handleClientsWithPendingWrites(void) {
     listNode *ln;
     int processed = listLength(server.clients_pending_write);
 
+    /* If the event loop can batch I/O, start sending the replies of all the
+     * clients with a single system call: the loop below just continues
+     * with the clients having more output than a batch transfers. */
+    if (processed > 1 && aeCanBatchIO(server.el)) writeToClientsInBatch();
+
     listRewind(server.clients_pending_write,&li);
     while((ln = listNext(&li))) {
         client *c = listNodeValue(ln);
@@ -1099,24 +1459,7 @@ int handleClientsWithPendingWrites(void) {
 
         /* If after the synchronous writes above we still have data to
          * output to the client, we need to install the writable handler. */
-        if (clientHasPendingReplies(c)) {
-            int ae_flags = AE_WRITABLE;
-            /* For the fsync=always policy, we want that a given FD is never
-             * served for reading and writing in the same event loop iteration,
-             * so that in the middle of receiving the query, and serving it
-             * to the client, we'll call beforeSleep() that will do the
-             * actual fsync of AOF to disk. AE_BARRIER ensures that. */
-            if (server.aof_state == AOF_ON &&
-                server.aof_fsync == AOF_FSYNC_ALWAYS)
-            {
-                ae_flags |= AE_BARRIER;
-            }
-            if (aeCreateFileEvent(server.el, c->fd, ae_flags,
-                sendReplyToClient, c) == AE_ERR)
-            {
-                    freeClientAsync(c);
-            }
-        }
+        if (clientHasPendingReplies(c)) installWriteHandler(c);
     }
     return processed;
 }
@@ -1130,6 +1473,14 @@ void resetClient(client *c) {
     c->multibulklen = 0;
     c->bulklen = -1;
 
+    /* The argv array is reused by the next command, unless it is so big
+     * that it's not worth to keep it around. */
+    if (c->argv_len > PROTO_REUSE_ARGV_MAX) {
+        zfree(c->argv);
+        c->argv = NULL;
+        c->argv_len = 0;
+    }
+
     /* We clear the ASKING flag as well if we are not inside a MULTI, and
      * if what we just executed is not the ASKING command itself. */
     if (!(c->flags & CLIENT_MULTI) && prevcmd != askingCommand)
@@ -1222,10 +1573,12 @@ int processInlineBuffer(client *c) {
     /* Move querybuffer position to the next query in the buffer. */
     c->qb_pos += querylen+linefeed_chars;
 
-    /* Setup argv array on client structure */
-    if (argc) {
-        if (c->argv) zfree(c->argv);
+    /* Setup argv array on client structure, if the one of the previous
+     * command is not big enough. */
+    if (argc > c->argv_len) {
+        zfree(c->argv);
         c->argv = zmalloc(sizeof(robj*)*argc);
+        c->argv_len = argc;
     }
 
     /* Create redis objects for all arguments. */
@@ -1321,9 +1674,13 @@ int processMultibulkBuffer(client *c) {
 
         c->multibulklen = ll;
 
-        /* Setup argv array on client structure */
-        if (c->argv) zfree(c->argv);
-        c->argv = zmalloc(sizeof(robj*)*c->multibulklen);
+        /* Setup argv array on client structure, if the one of the previous
+         * command is not big enough. */
+        if (c->multibulklen > c->argv_len) {
+            zfree(c->argv);
+            c->argv = zmalloc(sizeof(robj*)*c->multibulklen);
+            c->argv_len = c->multibulklen;
+        }
     }
 
     serverAssertWithInfo(c,NULL,c->multibulklen > 0);
@@ -1402,7 +1759,7 @@ int processMultibulkBuffer(client *c) {
                 sdsclear(c->querybuf);
             } else {
                 c->argv[c->argc++] =
-                    createStringObject(c->querybuf+c->qb_pos,c->bulklen);
+                    createArgvStringObject(c->querybuf+c->qb_pos,c->bulklen);
                 c->qb_pos += c->bulklen+2;
             }
             c->bulklen = -1;
@@ -1417,17 +1774,70 @@ int processMultibulkBuffer(client *c) {
     return C_ERR;
 }
 
+/* This function calls processCommand(), but also performs a few sub tasks
+ * that are useful in that context:
+ *
+ * 1. It sets the current client to the client 'c'.
+ * 2. In the case of master clients, the replication offset is updated.
+ * 3. The client is reset unless there are reasons to avoid doing it.
+ *
+ * The function returns C_ERR in case the client was freed as a side effect
+ * of processing the command, otherwise C_OK is returned. */
+int processCommandAndResetClient(client *c) {
+    int deadclient = 0;
+    server.current_client = c;
+    /* Only reset the client when the command was executed. */
+    if (processCommand(c) == C_OK) {
+        if (c->flags & CLIENT_MASTER && !(c->flags & CLIENT_MULTI)) {
+            /* Update the applied replication offset of our master. */
+            c->reploff = c->read_reploff - sdslen(c->querybuf) + c->qb_pos;
+        }
+
+        /* Don't reset the client structure for clients blocked in a
+         * module blocking command, so that the reply callback will
+         * still be able to access the client argv and argc field.
+         * The client will be reset in unblockClientFromModule(). */
+        if (!(c->flags & CLIENT_BLOCKED) || c->btype != BLOCKED_MODULE)
+            resetClient(c);
+    }
+    /* freeMemoryIfNeeded may flush slave output buffers. This may
+     * result into a slave, that may be the active client, to be
+     * freed. */
+    if (server.current_client == NULL) deadclient = 1;
+    server.current_client = NULL;
+    return deadclient ? C_ERR : C_OK;
+}
+
 /* This function is called every time, in the client structure 'c', there is
  * more query buffer to process, because we read more data from the socket
  * or because a client was blocked and later reactivated, so there could be
  * pending query buffer, already representing a full command, to process. */
 void processInputBuffer(client *c) {
-    server.current_client = c;
-
-    /* Keep processing while there is something in the input buffer */
-    while(c->qb_pos < sdslen(c->querybuf)) {
-        /* Return if clients are paused. */
-        if (!(c->flags & CLIENT_SLAVE) && clientsArePaused()) break;
+    /* Keep processing while there is something in the input buffer. All
+     * the commands processed by this loop form a batch: processCommand()
+     * remembers in c->batch_cmd the command resolved for the previous
+     * command of the batch, so that pipelines of the same command (the
+     * common case when loading data) don't need a command table lookup
+     * for every command.
+     *
+     * The other checks of processCommand() are still performed for every
+     * command: they depend on the command flags and keys, or on state the
+     * previous commands of the batch may change (memory usage, CONFIG SET,
+     * replication, ...), and cost just a few comparisons. Commands are not
+     * parsed ahead either: their argument objects may be retained (SET
+     * stores its value in the keyspace), so they can't be allocated in a
+     * per batch arena, and parsing them earlier would not save any work. */
+    while(c->querybuf && c->qb_pos < sdslen(c->querybuf)) {
+        /* Return if clients are paused. Inside an I/O thread we can't call
+         * clientsArePaused() since it may unpause clients as a side effect,
+         * so we just peek at the flag. */
+        if (!(c->flags & CLIENT_SLAVE)) {
+            if (c->flags & CLIENT_PENDING_READ) {
+                if (server.clients_paused) break;
+            } else if (clientsArePaused()) {
+                break;
+            }
+        }
 
         /* Immediately abort if the client is in the middle of something. */
         if (c->flags & CLIENT_BLOCKED) break;
@@ -1466,34 +1876,36 @@ void processInputBuffer(client *c) {
         if (c->argc == 0) {
             resetClient(c);
         } else {
-            /* Only reset the client when the command was executed. */
-            if (processCommand(c) == C_OK) {
-                if (c->flags & CLIENT_MASTER && !(c->flags & CLIENT_MULTI)) {
-                    /* Update the applied replication offset of our master. */
-                    c->reploff = c->read_reploff - sdslen(c->querybuf) + c->qb_pos;
-                }
+            /* If we are in the context of an I/O thread, we can't really
+             * execute the command here. All we can do is to flag the client
+             * as one that needs to process the command. */
+            if (c->flags & CLIENT_PENDING_READ) {
+                c->flags |= CLIENT_PENDING_COMMAND;
+                break;
+            }
 
-                /* Don't reset the client structure for clients blocked in a
-                 * module blocking command, so that the reply callback will
-                 * still be able to access the client argv and argc field.
-                 * The client will be reset in unblockClientFromModule(). */
-                if (!(c->flags & CLIENT_BLOCKED) || c->btype != BLOCKED_MODULE)
-                    resetClient(c);
+            /* We are finally ready to execute the command. */
+            if (processCommandAndResetClient(c) == C_ERR) {
+                /* If the client is no longer valid, we avoid exiting this
+                 * loop and trimming the client buffer later. So we return
+                 * ASAP in that case. */
+                return;
             }
-            /* freeMemoryIfNeeded may flush slave output buffers. This may
-             * result into a slave, that may be the active client, to be
-             * freed. */
-            if (server.current_client == NULL) break;
         }
     }
 
+    /* The command table may change before the next batch: forget the
+     * command cached for this batch. */
+    c->batch_cmd = NULL;
+
     /* Trim to pos */
-    if (server.current_client != NULL && c->qb_pos) {
+    if (c->qb_pos) {
         sdsrange(c->querybuf,c->qb_pos,-1);
         c->qb_pos = 0;
     }
 
-    server.current_client = NULL;
+    /* Give the query buffer back to the pool if everything was consumed. */
+    releaseClientQueryBuffer(c,0);
 }
 
 /* This is a wrapper for processInputBuffer that also cares about handling
@@ -1515,13 +1927,101 @@ void processInputBufferAndReplicate(client *c) {
     }
 }
 
-void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
-    client *c = (client*) privdata;
-    int nread, readlen;
+/* -----------------------------------------------------------------------------
+ * Query buffers pool
+ *
+ * Clients don't own a query buffer while idle: one is borrowed from the pool
+ * as soon as there is something to read from the socket, and it is given
+ * back once all the input was processed. This way only the clients having
+ * partial commands pending use memory for their input, that is important
+ * when there are a lot of mostly idle connections.
+ *
+ * Only buffers of the size we usually allocate for reading are pooled,
+ * bigger buffers (used for big arguments) are just freed when no longer
+ * needed. Clients representing masters always keep their query buffer, since
+ * the replication offsets are computed from it.
+ * -------------------------------------------------------------------------- */
+
+static sds querybuf_pool[QUERYBUF_POOL_SIZE];
+static int querybuf_pool_len = 0;
+static unsigned long querybuf_pool_lent = 0; /* Clients with a query buffer. */
+static pthread_mutex_t querybuf_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Both the functions below may be called by the I/O threads, so when
+ * threaded I/O is enabled the pool is protected by a mutex. */
+static void lockQueryBufferPool(void) {
+    if (server.io_threads_num > 1) pthread_mutex_lock(&querybuf_pool_mutex);
+}
+
+static void unlockQueryBufferPool(void) {
+    if (server.io_threads_num > 1) pthread_mutex_unlock(&querybuf_pool_mutex);
+}
+
+/* Return an empty query buffer, taken from the pool when possible. */
+sds borrowQueryBuffer(void) {
+    sds qb = NULL;
+
+    lockQueryBufferPool();
+    if (querybuf_pool_len) qb = querybuf_pool[--querybuf_pool_len];
+    querybuf_pool_lent++;
+    unlockQueryBufferPool();
+    if (qb == NULL) qb = sdsMakeRoomFor(sdsempty(),PROTO_IOBUF_LEN);
+    return qb;
+}
+
+/* Give back the query buffer of the client, setting c->querybuf to NULL.
+ * Unless 'force' is true, this is done only if the client has no pending
+ * input at all and is not receiving a big argument (in that case the
+ * buffer was enlarged on purpose by processMultibulkBuffer()). */
+void releaseClientQueryBuffer(client *c, int force) {
+    sds qb = c->querybuf;
+
+    if (qb == NULL) return;
+    if (!force) {
+        if (sdslen(qb) || (c->flags & CLIENT_MASTER)) return;
+        if (c->reqtype == PROTO_REQ_MULTIBULK && c->bulklen >= PROTO_MBULK_BIG_ARG)
+            return;
+    }
+    c->querybuf = NULL;
+    c->qb_pos = 0;
+
+    size_t alloc = sdsalloc(qb);
+    int pooled = 0;
+    lockQueryBufferPool();
+    querybuf_pool_lent--;
+    if (alloc >= PROTO_IOBUF_LEN && alloc <= QUERYBUF_POOL_MAX_ALLOC &&
+        querybuf_pool_len < QUERYBUF_POOL_SIZE)
+    {
+        sdsclear(qb);
+        querybuf_pool[querybuf_pool_len++] = qb;
+        pooled = 1;
+    }
+    unlockQueryBufferPool();
+    if (!pooled) sdsfree(qb);
+}
+
+/* Populate the INFO fields about the query buffers pool. */
+void getQueryBufferPoolInfo(unsigned long *free_buffers, size_t *free_memory,
+                            unsigned long *lent_buffers)
+{
+    size_t mem = 0;
+
+    lockQueryBufferPool();
+    for (int j = 0; j < querybuf_pool_len; j++)
+        mem += sdsAllocSize(querybuf_pool[j]);
+    *free_buffers = querybuf_pool_len;
+    *free_memory = mem;
+    *lent_buffers = querybuf_pool_lent;
+    unlockQueryBufferPool();
+}
+
+/* Make room in the query buffer of 'c' for the next read from its socket.
+ * Returns how many bytes should be read at the end of the buffer. */
+static int _prepareClientRead(client *c) {
+    int readlen;
     size_t qblen;
-    UNUSED(el);
-    UNUSED(mask);
 
+    if (c->querybuf == NULL) c->querybuf = borrowQueryBuffer();
     readlen = PROTO_IOBUF_LEN;
     /* If this is a multi bulk request, and we are processing a bulk reply
      * that is large enough, try to maximize the probability that the query
@@ -1542,19 +2042,29 @@ void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
     qblen = sdslen(c->querybuf);
     if (c->querybuf_peak < qblen) c->querybuf_peak = qblen;
     c->querybuf = sdsMakeRoomFor(c->querybuf, readlen);
-    nread = read(fd, c->querybuf+qblen, readlen);
+    return readlen;
+}
+
+/* Account for the 'nread' bytes read from the socket of 'c' at the end of
+ * its query buffer, 'nread' being -1 with errno set on errors. Returns C_OK
+ * if there is new data to process, or C_ERR if there is not, or if the
+ * client was freed. */
+static int _clientReadDone(client *c, ssize_t nread) {
+    size_t qblen = sdslen(c->querybuf);
+
     if (nread == -1) {
         if (errno == EAGAIN) {
-            return;
+            releaseClientQueryBuffer(c,0);
+            return C_ERR;
         } else {
             serverLog(LL_VERBOSE, "Reading from client: %s",strerror(errno));
-            freeClient(c);
-            return;
+            freeClientFromIOContext(c);
+            return C_ERR;
         }
     } else if (nread == 0) {
         serverLog(LL_VERBOSE, "Client closed connection");
-        freeClient(c);
-        return;
+        freeClientFromIOContext(c);
+        return C_ERR;
     } else if (c->flags & CLIENT_MASTER) {
         /* Append the query buffer to the pending (not applied) buffer
          * of the master. We'll use this buffer later in order to have a
@@ -1566,7 +2076,7 @@ void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
     sdsIncrLen(c->querybuf,nread);
     c->lastinteraction = server.unixtime;
     if (c->flags & CLIENT_MASTER) c->read_reploff += nread;
-    server.stat_net_input_bytes += nread;
+    atomicIncr(server.stat_net_input_bytes,nread);
     if (sdslen(c->querybuf) > server.client_max_querybuf_len) {
         sds ci = catClientInfoString(sdsempty(),c), bytes = sdsempty();
 
@@ -1574,9 +2084,26 @@ void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
         serverLog(LL_WARNING,"Closing client that reached max query buffer length: %s (qbuf initial bytes: %s)", ci, bytes);
         sdsfree(ci);
         sdsfree(bytes);
-        freeClient(c);
-        return;
+        freeClientFromIOContext(c);
+        return C_ERR;
     }
+    return C_OK;
+}
+
+void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
+    client *c = (client*) privdata;
+    int nread, readlen;
+    UNUSED(el);
+    UNUSED(mask);
+
+    /* Check if we want to read from the client later when exiting from
+     * the event loop. This is the case if threaded I/O is enabled, or if
+     * the event loop can batch reads. */
+    if (postponeClientRead(c)) return;
+
+    readlen = _prepareClientRead(c);
+    nread = read(fd, c->querybuf+sdslen(c->querybuf), readlen);
+    if (_clientReadDone(c,nread) == C_ERR) return;
 
     /* Time to process the buffer. If the client is a master we need to
      * compute the difference between the applied offset before and after
@@ -1599,7 +2126,8 @@ void getClientsMaxBuffers(unsigned long *longest_output_list,
         c = listNodeValue(ln);
 
         if (listLength(c->reply) > lol) lol = listLength(c->reply);
-        if (sdslen(c->querybuf) > bib) bib = sdslen(c->querybuf);
+        if (c->querybuf && sdslen(c->querybuf) > bib)
+            bib = sdslen(c->querybuf);
     }
     *longest_output_list = lol;
     *biggest_input_buffer = bib;
@@ -1685,8 +2213,8 @@ sds catClientInfoString(sds s, client *client) {
         (int) dictSize(client->pubsub_channels),
         (int) listLength(client->pubsub_patterns),
         (client->flags & CLIENT_MULTI) ? client->mstate.count : -1,
-        (unsigned long long) sdslen(client->querybuf),
-        (unsigned long long) sdsavail(client->querybuf),
+        (unsigned long long) (client->querybuf ? sdslen(client->querybuf) : 0),
+        (unsigned long long) (client->querybuf ? sdsavail(client->querybuf) : 0),
         (unsigned long long) client->bufpos,
         (unsigned long long) listLength(client->reply),
         (unsigned long long) getClientOutputBufferMemoryUsage(client),
@@ -1974,6 +2502,7 @@ void rewriteClientCommandVector(client *c, int argc, ...) {
     zfree(c->argv);
     /* Replace argv and argc with our new versions. */
     c->argv = argv;
+    c->argv_len = argc;
     c->argc = argc;
     c->cmd = lookupCommandOrOriginal(c->argv[0]->ptr);
     serverAssertWithInfo(c,NULL,c->cmd != NULL);
@@ -1985,6 +2514,7 @@ void replaceClientCommandVector(client *c, int argc, robj **argv) {
     freeClientArgv(c);
     zfree(c->argv);
     c->argv = argv;
+    c->argv_len = argc;
     c->argc = argc;
     c->cmd = lookupCommandOrOriginal(c->argv[0]->ptr);
     serverAssertWithInfo(c,NULL,c->cmd != NULL);
@@ -2004,8 +2534,12 @@ void replaceClientCommandVector(client *c, int argc, robj **argv) {
 void rewriteClientCommandArgument(client *c, int i, robj *newval) {
     robj *oldval;
 
-    if (i >= c->argc) {
+    serverAssertWithInfo(c,NULL,c->argv_len >= c->argc);
+    if (i >= c->argv_len) {
         c->argv = zrealloc(c->argv,sizeof(robj*)*(i+1));
+        c->argv_len = i+1;
+    }
+    if (i >= c->argc) {
         c->argc = i+1;
         c->argv[i] = NULL;
     }
@@ -2130,6 +2664,109 @@ void asyncCloseClientOnOutputBufferLimitReached(client *c) {
         serverLog(LL_WARNING,"Client %s scheduled to be closed ASAP for overcoming of output buffer limits.", client);
         sdsfree(client);
     }
+    if (server.client_obuf_total_limit) {
+        updateClientOutputBufferMemory(c);
+        enforceClientOutputBufferTotalLimit();
+    }
+}
+
+/* Normal and pub/sub clients having output buffer memory in the reply list
+ * are indexed in server.clients_by_obuf_mem, a radix tree keyed by the big
+ * endian memory usage followed by the client ID, so that the clients using
+ * more memory can be found fast when the total limit is exceeded. The
+ * index also keeps the sum of the indexed memory in server.clients_obuf_mem.
+ *
+ * This function must be called every time the reply list of a client
+ * changes size. Clients scheduled to be closed are removed from the index.
+ * The index is only updated by the main thread: when called by an I/O
+ * thread this function does nothing, and the caller will update the index
+ * again once the threads are done.
+ *
+ * The index is only needed to enforce client-output-buffer-total-limit,
+ * so when the limit is disabled the index is empty and this function does
+ * nothing: rebuildClientOutputBufferMemoryIndex() fills it again when the
+ * limit is enabled. */
+void updateClientOutputBufferMemory(client *c) {
+    unsigned long mem = 0;
+    int type;
+
+    if (server.client_obuf_total_limit == 0 || ioThreadsAreRunning()) return;
+    type = getClientType(c);
+    if (c->fd != -1 && !(c->flags & CLIENT_CLOSE_ASAP) &&
+        (type == CLIENT_TYPE_NORMAL || type == CLIENT_TYPE_PUBSUB))
+    {
+        mem = getClientOutputBufferMemoryUsage(c);
+    }
+    indexClientOutputBufferMemory(c,mem);
+}
+
+/* Index the client with the specified output buffer memory, or remove it
+ * from the index if 'mem' is zero. */
+static void indexClientOutputBufferMemory(client *c, unsigned long mem) {
+    uint64_t key[2];
+
+    if (mem == c->obuf_indexed_mem) return;
+    key[1] = htonu64(c->id);
+    if (c->obuf_indexed_mem) {
+        key[0] = htonu64(c->obuf_indexed_mem);
+        raxRemove(server.clients_by_obuf_mem,(unsigned char*)key,
+                  sizeof(key),NULL);
+        server.clients_obuf_mem -= c->obuf_indexed_mem;
+    }
+    if (mem) {
+        key[0] = htonu64(mem);
+        raxInsert(server.clients_by_obuf_mem,(unsigned char*)key,
+                  sizeof(key),c,NULL);
+        server.clients_obuf_mem += mem;
+    }
+    c->obuf_indexed_mem = mem;
+}
+
+/* Index all the clients again, or empty the index if the total limit is
+ * disabled. Called when client-output-buffer-total-limit is changed. */
+void rebuildClientOutputBufferMemoryIndex(void) {
+    listIter li;
+    listNode *ln;
+
+    listRewind(server.clients,&li);
+    while((ln = listNext(&li))) {
+        client *c = listNodeValue(ln);
+
+        if (server.client_obuf_total_limit)
+            updateClientOutputBufferMemory(c);
+        else
+            indexClientOutputBufferMemory(c,0);
+    }
+}
+
+/* If the output buffers of the normal and pub/sub clients use more memory
+ * than client-output-buffer-total-limit, schedule the clients with the
+ * biggest output buffers to be closed, until we are back under the limit.
+ * Closing the biggest clients first frees the most memory disconnecting
+ * as few clients as possible. */
+void enforceClientOutputBufferTotalLimit(void) {
+    raxIterator ri;
+
+    if (server.client_obuf_total_limit == 0 || ioThreadsAreRunning()) return;
+    while (server.clients_obuf_mem > server.client_obuf_total_limit) {
+        client *c;
+
+        raxStart(&ri,server.clients_by_obuf_mem);
+        raxSeek(&ri,"$",NULL,0);
+        raxNext(&ri);
+        c = ri.data;
+        raxStop(&ri);
+
+        sds client = catClientInfoString(sdsempty(),c);
+        freeClientAsync(c);
+        serverLog(LL_WARNING,"Client %s scheduled to be closed ASAP for overcoming of the total output buffer limit.", client);
+        sdsfree(client);
+        server.stat_evicted_clients++;
+
+        /* Clients flagged with CLOSE_ASAP are removed from the index. Lua
+         * clients are never indexed, so this always makes progress. */
+        updateClientOutputBufferMemory(c);
+    }
 }
 
 /* Helper function used by freeMemoryIfNeeded() in order to flush slaves
@@ -2233,9 +2870,17 @@ int clientsArePaused(void) {
  * write, close sequence needed to serve a client.
  *
  * The function returns the total number of events processed. */
+int ProcessingEventsWhileBlocked = 0;
 int processEventsWhileBlocked(void) {
     int iterations = 4; /* See the function top-comment. */
     int count = 0;
+
+    /* Note: when we are processing events while blocked (for instance during
+     * busy Lua scripts), we set a global flag. When such flag is set, we
+     * avoid handling the read part of clients using threaded I/O, since
+     * the pending reads would only be served after the blocking operation
+     * returns. */
+    ProcessingEventsWhileBlocked = 1;
     while (iterations--) {
         int events = 0;
         events += aeProcessEvents(server.el, AE_FILE_EVENTS|AE_DONT_WAIT);
@@ -2243,5 +2888,402 @@ int processEventsWhileBlocked(void) {
         if (!events) break;
         count += events;
     }
+    ProcessingEventsWhileBlocked = 0;
+    return count;
+}
+
+/* ==========================================================================
+ * Threaded I/O
+ * ========================================================================== */
+
+#define IO_THREADS_MAX_NUM 128
+#define IO_THREADS_OP_IDLE 0
+#define IO_THREADS_OP_READ 1
+#define IO_THREADS_OP_WRITE 2
+
+pthread_t io_threads[IO_THREADS_MAX_NUM];
+pthread_mutex_t io_threads_mutex[IO_THREADS_MAX_NUM];
+unsigned long io_threads_pending[IO_THREADS_MAX_NUM];
+int io_threads_op = IO_THREADS_OP_IDLE; /* IO_THREADS_OP_... value. */
+
+/* This is the list of clients each thread will serve when threaded I/O is
+ * used. We spawn io_threads_num-1 threads, since one is the main thread
+ * itself. */
+list *io_threads_list[IO_THREADS_MAX_NUM];
+
+/* Objects referenced by reply blocks released while the I/O threads were
+ * writing to the clients: the reference count of objects is not atomic, so
+ * they are released by the main thread once the batch is completed. */
+list *io_threads_deferred_decr;
+pthread_mutex_t io_threads_deferred_decr_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Free the client synchronously when called from the main thread outside
+ * of a threaded I/O batch, otherwise schedule it for asynchronous freeing:
+ * an I/O thread can't touch the global client structures. */
+static void freeClientFromIOContext(client *c) {
+    if (io_threads_op == IO_THREADS_OP_IDLE)
+        freeClient(c);
+    else
+        freeClientAsync(c);
+}
+
+/* Return true if we are inside a threaded I/O batch, that is, the I/O
+ * threads may be running and accessing the clients. */
+static int ioThreadsAreRunning(void) {
+    return io_threads_op != IO_THREADS_OP_IDLE;
+}
+
+/* Like freeClientFromIOContext() but for the objects referenced by the
+ * reply blocks of the clients. */
+static void decrRefCountFromIOContext(robj *o) {
+    if (io_threads_op == IO_THREADS_OP_IDLE) {
+        decrRefCount(o);
+    } else {
+        pthread_mutex_lock(&io_threads_deferred_decr_mutex);
+        listAddNodeTail(io_threads_deferred_decr,o);
+        pthread_mutex_unlock(&io_threads_deferred_decr_mutex);
+    }
+}
+
+static unsigned long getIOPendingCount(int i) {
+    unsigned long count;
+    atomicGet(io_threads_pending[i],count);
     return count;
 }
+
+static void setIOPendingCount(int i, unsigned long count) {
+    atomicSet(io_threads_pending[i],count);
+}
+
+void *IOThreadMain(void *myid) {
+    /* The ID is the thread number (from 0 to server.io_threads_num-1), and is
+     * used by the thread to just manipulate a single sub-array of clients. */
+    long id = (unsigned long)myid;
+
+    while(1) {
+        /* Wait for start */
+        for (int j = 0; j < 1000000; j++) {
+            if (getIOPendingCount(id) != 0) break;
+        }
+
+        /* Give the main thread a chance to stop this thread. */
+        if (getIOPendingCount(id) == 0) {
+            pthread_mutex_lock(&io_threads_mutex[id]);
+            pthread_mutex_unlock(&io_threads_mutex[id]);
+            continue;
+        }
+
+        serverAssert(getIOPendingCount(id) != 0);
+
+        /* Process: note that the main thread will never touch our list
+         * before we drop the pending count to 0. */
+        listIter li;
+        listNode *ln;
+        listRewind(io_threads_list[id],&li);
+        while((ln = listNext(&li))) {
+            client *c = listNodeValue(ln);
+            if (io_threads_op == IO_THREADS_OP_WRITE) {
+                writeToClient(c->fd,c,0);
+            } else if (io_threads_op == IO_THREADS_OP_READ) {
+                readQueryFromClient(server.el,c->fd,c,0);
+            } else {
+                serverPanic("io_threads_op value is unknown");
+            }
+        }
+        listEmpty(io_threads_list[id]);
+        setIOPendingCount(id,0);
+    }
+}
+
+/* Initialize the data structures needed for threaded I/O. */
+void initThreadedIO(void) {
+    server.io_threads_active = 0; /* We start with threads not active. */
+
+    /* Don't spawn any thread if the user selected a single thread:
+     * we'll handle I/O directly from the main thread. */
+    if (server.io_threads_num == 1) return;
+
+    if (server.io_threads_num > IO_THREADS_MAX_NUM) {
+        serverLog(LL_WARNING,"Fatal: too many I/O threads configured. "
+                             "The maximum number is %d.", IO_THREADS_MAX_NUM);
+        exit(1);
+    }
+
+    io_threads_deferred_decr = listCreate();
+    listSetFreeMethod(io_threads_deferred_decr,decrRefCountVoid);
+
+    /* Spawn and initialize the I/O threads. */
+    for (int i = 0; i < server.io_threads_num; i++) {
+        /* Things we do for all the threads including the main thread. */
+        io_threads_list[i] = listCreate();
+        if (i == 0) continue; /* Thread 0 is the main thread. */
+
+        /* Things we do only for the additional threads. */
+        pthread_t tid;
+        pthread_mutex_init(&io_threads_mutex[i],NULL);
+        setIOPendingCount(i,0);
+        pthread_mutex_lock(&io_threads_mutex[i]); /* Thread will be stopped. */
+        if (pthread_create(&tid,NULL,IOThreadMain,(void*)(long)i) != 0) {
+            serverLog(LL_WARNING,"Fatal: Can't initialize IO thread.");
+            exit(1);
+        }
+        io_threads[i] = tid;
+    }
+}
+
+void startThreadedIO(void) {
+    serverAssert(server.io_threads_active == 0);
+    for (int j = 1; j < server.io_threads_num; j++)
+        pthread_mutex_unlock(&io_threads_mutex[j]);
+    server.io_threads_active = 1;
+}
+
+void stopThreadedIO(void) {
+    /* We may have still clients with pending reads when this function
+     * is called: handle them before stopping the threads. */
+    handleClientsWithPendingReadsUsingThreads();
+    serverAssert(server.io_threads_active == 1);
+    for (int j = 1; j < server.io_threads_num; j++)
+        pthread_mutex_lock(&io_threads_mutex[j]);
+    server.io_threads_active = 0;
+}
+
+/* This function checks if there are not enough pending clients to justify
+ * taking the I/O threads active: in that case I/O threads are stopped if
+ * currently active. We track the pending writes as a measure of clients
+ * we need to handle in parallel, however the I/O threading is disabled
+ * globally for reads as well if we have too little pending clients.
+ *
+ * The function returns 0 if the I/O threading should be used because there
+ * are enough active threads, otherwise 1 is returned and the I/O threads
+ * could be possibly stopped (if already active) as a side effect. */
+int stopThreadedIOIfNeeded(void) {
+    int pending = listLength(server.clients_pending_write);
+
+    /* Return ASAP if IO threads are disabled (single threaded mode). */
+    if (server.io_threads_num == 1) return 1;
+
+    if (pending < (server.io_threads_num*2)) {
+        if (server.io_threads_active) stopThreadedIO();
+        return 1;
+    } else {
+        return 0;
+    }
+}
+
+/* Spread the clients of 'clients' across the per-thread lists, set the
+ * operation to perform, serve the main thread slice synchronously, and
+ * wait for the other threads to finish their slice. */
+static void runThreadedIOBatch(list *clients, int op) {
+    listIter li;
+    listNode *ln;
+    int item_id = 0;
+
+    /* Distribute the clients across N different lists. */
+    listRewind(clients,&li);
+    while((ln = listNext(&li))) {
+        client *c = listNodeValue(ln);
+        int target_id = item_id % server.io_threads_num;
+        listAddNodeTail(io_threads_list[target_id],c);
+        item_id++;
+    }
+
+    /* Give the start condition to the waiting threads, by setting the
+     * start condition atomic var. */
+    io_threads_op = op;
+    for (int j = 1; j < server.io_threads_num; j++) {
+        int count = listLength(io_threads_list[j]);
+        setIOPendingCount(j,count);
+    }
+
+    /* Also use the main thread to process a slice of clients. */
+    listRewind(io_threads_list[0],&li);
+    while((ln = listNext(&li))) {
+        client *c = listNodeValue(ln);
+        if (op == IO_THREADS_OP_WRITE)
+            writeToClient(c->fd,c,0);
+        else
+            readQueryFromClient(server.el,c->fd,c,0);
+    }
+    listEmpty(io_threads_list[0]);
+
+    /* Wait for all the other threads to end their work. */
+    while(1) {
+        unsigned long pending = 0;
+        for (int j = 1; j < server.io_threads_num; j++)
+            pending += getIOPendingCount(j);
+        if (pending == 0) break;
+    }
+    io_threads_op = IO_THREADS_OP_IDLE;
+
+    /* Release the objects of the reply blocks sent by the threads. */
+    listEmpty(io_threads_deferred_decr);
+}
+
+/* Like handleClientsWithPendingWrites(), but when there are enough clients
+ * with pending output the writes are performed in parallel by the I/O
+ * threads. Installing the write handlers, that is not thread safe, is
+ * done later by the main thread alone. */
+int handleClientsWithPendingWritesUsingThreads(void) {
+    int processed = listLength(server.clients_pending_write);
+    if (processed == 0) return 0; /* Return ASAP if there are no clients. */
+
+    /* If I/O threads are disabled or we have few clients to serve, don't
+     * use I/O threads, but the boring synchronous code. */
+    if (stopThreadedIOIfNeeded()) {
+        return handleClientsWithPendingWrites();
+    }
+
+    /* Start threads if needed. */
+    if (!server.io_threads_active) startThreadedIO();
+
+    /* Clients that are going to be closed ASAP or that are protected
+     * should not be served: remove them from the list. */
+    listIter li;
+    listNode *ln;
+    listRewind(server.clients_pending_write,&li);
+    while((ln = listNext(&li))) {
+        client *c = listNodeValue(ln);
+        c->flags &= ~CLIENT_PENDING_WRITE;
+        if (c->flags & (CLIENT_CLOSE_ASAP|CLIENT_PROTECTED))
+            listDelNode(server.clients_pending_write,ln);
+    }
+
+    runThreadedIOBatch(server.clients_pending_write,IO_THREADS_OP_WRITE);
+
+    /* Run the list of clients again to install the write handler where
+     * needed. */
+    listRewind(server.clients_pending_write,&li);
+    while((ln = listNext(&li))) {
+        client *c = listNodeValue(ln);
+
+        /* Skip clients freed by the threads because of an I/O error or
+         * because the whole reply was sent and CLOSE_AFTER_REPLY is set. */
+        if (c->flags & CLIENT_CLOSE_ASAP) continue;
+
+        /* The threads can't update the output buffer memory index. */
+        updateClientOutputBufferMemory(c);
+
+        /* Install the write handler if there are pending writes in some
+         * of the clients. */
+        if (clientHasPendingReplies(c)) installWriteHandler(c);
+    }
+    listEmpty(server.clients_pending_write);
+
+    /* Clients that the threads could only flag for closing are released
+     * now, instead of waiting for the next serverCron() call. */
+    freeClientsInAsyncFreeQueue();
+    return processed;
+}
+
+/* Return 1 if we want to handle the client read later using threaded I/O,
+ * or together with the reads of the other clients if the event loop can
+ * batch I/O. This is called by the readable handler of the event loop.
+ * As a side effect of calling this function the client is put in the
+ * pending read clients and flagged as such. */
+int postponeClientRead(client *c) {
+    if (((server.io_threads_active && server.io_threads_do_reads) ||
+         aeCanBatchIO(server.el)) &&
+        !ProcessingEventsWhileBlocked &&
+        !(c->flags & (CLIENT_MASTER|CLIENT_SLAVE|CLIENT_PENDING_READ|
+                      CLIENT_PROTECTED)))
+    {
+        c->flags |= CLIENT_PENDING_READ;
+        /* Append the client, so that the commands of different clients
+         * are executed in the same order their sockets became readable. */
+        listAddNodeTail(server.clients_pending_read,c);
+        return 1;
+    } else {
+        return 0;
+    }
+}
+
+/* Read from the sockets of all the clients of server.clients_pending_read
+ * with a single aeBatchIO() call. The clients freed because of read errors
+ * are removed from the list as a side effect. */
+static void readQueryFromClientsInBatch(void) {
+    listIter li;
+    listNode *ln;
+    int count = 0;
+
+    ioBatchReserve(listLength(server.clients_pending_read));
+    listRewind(server.clients_pending_read,&li);
+    while((ln = listNext(&li))) {
+        client *c = listNodeValue(ln);
+        aeIORequest *req = io_batch_reqs+count;
+
+        req->fd = c->fd;
+        req->op = AE_IO_READ;
+        req->iov = io_batch_iov+count;
+        req->iov->iov_len = _prepareClientRead(c);
+        req->iov->iov_base = c->querybuf+sdslen(c->querybuf);
+        req->iovcnt = 1;
+        io_batch_nodes[count++] = ln;
+    }
+    if (aeBatchIO(server.el,io_batch_reqs,count) == AE_ERR) {
+        for (int j = 0; j < count; j++) {
+            aeIORequest *req = io_batch_reqs+j;
+            req->res = read(req->fd,req->iov->iov_base,req->iov->iov_len);
+            req->err = errno;
+        }
+    }
+
+    for (int j = 0; j < count; j++) {
+        aeIORequest *req = io_batch_reqs+j;
+        client *c = listNodeValue(io_batch_nodes[j]);
+
+        if (req->res == -1) errno = req->err;
+        _clientReadDone(c,req->res);
+    }
+}
+
+/* When threaded I/O is also enabled for the reading + parsing side, the
+ * readable handler will just put normal clients into a queue of clients to
+ * process (instead of serving them synchronously). This function runs
+ * the queue using the I/O threads, and process them in order to accumulate
+ * the reads in the buffers, and also parse the first command available
+ * rendering it in the client structures. Commands are then executed
+ * serially by the main thread, as usually.
+ *
+ * When the I/O threads are not reading, the queue is populated only if the
+ * event loop can batch I/O: the reads are then performed at once by the
+ * main thread with readQueryFromClientsInBatch(). */
+int handleClientsWithPendingReadsUsingThreads(void) {
+    int processed = listLength(server.clients_pending_read);
+    if (processed == 0) return 0;
+
+    if (server.io_threads_active && server.io_threads_do_reads)
+        runThreadedIOBatch(server.clients_pending_read,IO_THREADS_OP_READ);
+    else
+        readQueryFromClientsInBatch();
+
+    /* Run the list of clients again to process the new buffers. */
+    while(listLength(server.clients_pending_read)) {
+        listNode *ln = listFirst(server.clients_pending_read);
+        client *c = listNodeValue(ln);
+        c->flags &= ~CLIENT_PENDING_READ;
+        listDelNode(server.clients_pending_read,ln);
+
+        /* Clients with I/O errors were flagged to be closed by the thread
+         * that served them: nothing more to do here. */
+        if (c->flags & CLIENT_CLOSE_ASAP) continue;
+
+        if (c->flags & CLIENT_PENDING_COMMAND) {
+            c->flags &= ~CLIENT_PENDING_COMMAND;
+            if (processCommandAndResetClient(c) == C_ERR) {
+                /* If the client is no longer valid, we avoid
+                 * processing the client later. So we just go
+                 * to the next. */
+                continue;
+            }
+        }
+        processInputBuffer(c);
+
+        /* We may have pending replies if a thread readQueryFromClient()
+         * produced replies (for instance protocol errors) and did not
+         * install a write handler, since it can't. */
+        if (!(c->flags & CLIENT_PENDING_WRITE) && clientHasPendingReplies(c))
+            clientInstallWriteHandler(c);
+    }
+    return processed;
+}
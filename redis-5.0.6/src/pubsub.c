@@ -37,6 +37,7 @@ void freePubsubPattern(void *p) {
     pubsubPattern *pat = p;
 
     decrRefCount(pat->pattern);
+    stringmatchFree(pat->matcher);
     zfree(pat);
 }
 
@@ -134,6 +135,8 @@ int pubsubSubscribePattern(client *c, robj *pattern) {
         incrRefCount(pattern);
         pat = zmalloc(sizeof(*pat));
         pat->pattern = getDecodedObject(pattern);
+        pat->matcher = stringmatchCompile(pat->pattern->ptr,
+                                          sdslen(pat->pattern->ptr),0);
         pat->client = c;
         listAddNodeTail(server.pubsub_patterns,pat);
     }
@@ -253,10 +256,9 @@ int pubsubPublishMessage(robj *channel, robj *message) {
         while ((ln = listNext(&li)) != NULL) {
             pubsubPattern *pat = ln->value;
 
-            if (stringmatchlen((char*)pat->pattern->ptr,
-                                sdslen(pat->pattern->ptr),
-                                (char*)channel->ptr,
-                                sdslen(channel->ptr),0)) {
+            if (stringmatchCompiled(pat->matcher,
+                                    (char*)channel->ptr,
+                                    sdslen(channel->ptr))) {
                 addReply(pat->client,shared.mbulkhdr[4]);
                 addReply(pat->client,shared.pmessagebulk);
                 addReplyBulk(pat->client,pat->pattern);
@@ -338,6 +340,8 @@ NULL
     {
         /* PUBSUB CHANNELS [<pattern>] */
         sds pat = (c->argc == 2) ? NULL : c->argv[2]->ptr;
+        stringmatchPattern *matcher = pat ?
+            stringmatchCompile(pat,sdslen(pat),0) : NULL;
         dictIterator *di = dictGetIterator(server.pubsub_channels);
         dictEntry *de;
         long mblen = 0;
@@ -348,14 +352,15 @@ NULL
             robj *cobj = dictGetKey(de);
             sds channel = cobj->ptr;
 
-            if (!pat || stringmatchlen(pat, sdslen(pat),
-                                       channel, sdslen(channel),0))
+            if (!matcher || stringmatchCompiled(matcher,
+                                                channel, sdslen(channel)))
             {
                 addReplyBulk(c,cobj);
                 mblen++;
             }
         }
         dictReleaseIterator(di);
+        stringmatchFree(matcher);
         setDeferredMultiBulkLength(c,replylen,mblen);
     } else if (!strcasecmp(c->argv[1]->ptr,"numsub") && c->argc >= 2) {
         /* PUBSUB NUMSUB [Channel_1 ... Channel_N] */
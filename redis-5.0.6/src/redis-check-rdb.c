@@ -85,7 +85,12 @@ char *rdb_type_string[] = {
     "zset-ziplist",
     "hash-ziplist",
     "quicklist",
-    "stream"
+    "stream",
+    "hash-listpack",
+    "zset-listpack",
+    "quicklist-v2",
+    "",
+    "set-listpack"
 };
 
 /* Show a few stats collected into 'rdbstate' */
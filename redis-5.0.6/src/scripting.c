@@ -441,11 +441,13 @@ int luaRedisGenericCommand(lua_State *lua, int raise_error) {
 
     /* Setup our fake client for command execution */
     c->argv = argv;
+    c->argv_len = argv_size;
     c->argc = argc;
 
     /* Process module hooks */
     moduleCallCommandFilters(c);
     argv = c->argv;
+    argv_size = c->argv_len;
     argc = c->argc;
 
     /* Log the command if debugging is active. */
@@ -591,7 +593,7 @@ int luaRedisGenericCommand(lua_State *lua, int raise_error) {
         while(listLength(c->reply)) {
             clientReplyBlock *o = listNodeValue(listFirst(c->reply));
 
-            reply = sdscatlen(reply,o->buf,o->used);
+            reply = sdscatlen(reply,replyBlockData(o),o->used);
             listDelNode(c->reply,listFirst(c->reply));
         }
     }
@@ -171,6 +171,7 @@ struct redisCommand redisCommandTable[] = {
     {"srandmember",srandmemberCommand,-2,"rR",0,NULL,1,1,1,0,0},
     {"sinter",sinterCommand,-2,"rS",0,NULL,1,-1,1,0,0},
     {"sinterstore",sinterstoreCommand,-3,"wm",0,NULL,1,-1,1,0,0},
+    {"sintercard",sintercardCommand,-3,"r",0,intercardGetKeys,0,0,0,0,0},
     {"sunion",sunionCommand,-2,"rS",0,NULL,1,-1,1,0,0},
     {"sunionstore",sunionstoreCommand,-3,"wm",0,NULL,1,-1,1,0,0},
     {"sdiff",sdiffCommand,-2,"rS",0,NULL,1,-1,1,0,0},
@@ -185,6 +186,7 @@ struct redisCommand redisCommandTable[] = {
     {"zremrangebylex",zremrangebylexCommand,4,"w",0,NULL,1,1,1,0,0},
     {"zunionstore",zunionstoreCommand,-4,"wm",0,zunionInterGetKeys,0,0,0,0,0},
     {"zinterstore",zinterstoreCommand,-4,"wm",0,zunionInterGetKeys,0,0,0,0,0},
+    {"zintercard",zintercardCommand,-3,"r",0,intercardGetKeys,0,0,0,0,0},
     {"zrange",zrangeCommand,-4,"r",0,NULL,1,1,1,0,0},
     {"zrangebyscore",zrangebyscoreCommand,-4,"r",0,NULL,1,1,1,0,0},
     {"zrevrangebyscore",zrevrangebyscoreCommand,-4,"r",0,NULL,1,1,1,0,0},
@@ -505,6 +507,16 @@ void dictSdsDestructor(void *privdata, void *val)
     sdsfree(val);
 }
 
+/* Size and copy callbacks used by the dictionaries embedding sds keys in
+ * their entries. */
+size_t dictSdsKeyEmbedLen(const void *key) {
+    return sdsinplacelen(sdslen((sds)key));
+}
+
+void *dictSdsKeyEmbed(void *buf, const void *key) {
+    return sdsnewinplace(buf,key,sdslen((sds)key));
+}
+
 int dictObjKeyCompare(void *privdata, const void *key1,
         const void *key2)
 {
@@ -608,14 +620,33 @@ dictType zsetDictType = {
     NULL                       /* val destructor */
 };
 
-/* Db->dict, keys are sds strings, vals are Redis objects. */
+/* Db->dict, keys are sds strings embedded in the entries, vals are Redis
+ * objects. Every entry also carries the keyMetadata of the key. */
 dictType dbDictType = {
     dictSdsHash,                /* hash function */
     NULL,                       /* key dup */
     NULL,                       /* val dup */
     dictSdsKeyCompare,          /* key compare */
-    dictSdsDestructor,          /* key destructor */
-    dictObjectDestructor   /* val destructor */
+    NULL,                       /* key destructor, keys are embedded */
+    dictObjectDestructor,       /* val destructor */
+    1,                          /* open addressing */
+    dictSdsKeyEmbedLen,         /* key embed len */
+    dictSdsKeyEmbed,            /* key embed */
+    sizeof(keyMetadata)         /* entry metadata bytes */
+};
+
+/* Db->dict in cluster mode: entries also link the keys by hash slot. */
+dictType clusterDbDictType = {
+    dictSdsHash,                /* hash function */
+    NULL,                       /* key dup */
+    NULL,                       /* val dup */
+    dictSdsKeyCompare,          /* key compare */
+    NULL,                       /* key destructor, keys are embedded */
+    dictObjectDestructor,       /* val destructor */
+    1,                          /* open addressing */
+    dictSdsKeyEmbedLen,         /* key embed len */
+    dictSdsKeyEmbed,            /* key embed */
+    sizeof(clusterKeyMetadata)  /* entry metadata bytes */
 };
 
 /* server.lua_scripts sha (as sds string) -> scripts (as robj) cache. */
@@ -628,16 +659,6 @@ dictType shaScriptObjectDictType = {
     dictObjectDestructor        /* val destructor */
 };
 
-/* Db->expires */
-dictType keyptrDictType = {
-    dictSdsHash,                /* hash function */
-    NULL,                       /* key dup */
-    NULL,                       /* val dup */
-    dictSdsKeyCompare,          /* key compare */
-    NULL,                       /* key destructor */
-    NULL                        /* val destructor */
-};
-
 /* Command table. sds string -> command struct pointer. */
 dictType commandTableDictType = {
     dictSdsCaseHash,            /* hash function */
@@ -648,7 +669,7 @@ dictType commandTableDictType = {
     NULL                        /* val destructor */
 };
 
-/* Hash type hash table (note that small hashes are represented with ziplists) */
+/* Hash type hash table (note that small hashes are represented with listpacks) */
 dictType hashDictType = {
     dictSdsHash,                /* hash function */
     NULL,                       /* key dup */
@@ -739,10 +760,9 @@ int htNeedsResize(dict *dict) {
 /* If the percentage of used slots in the HT reaches HASHTABLE_MIN_FILL
  * we resize the hash table to save memory */
 void tryResizeHashTables(int dbid) {
-    if (htNeedsResize(server.db[dbid].dict))
+    if (htNeedsResize(server.db[dbid].dict) &&
+        !backgroundKeysScanningDb(&server.db[dbid]))
         dictResize(server.db[dbid].dict);
-    if (htNeedsResize(server.db[dbid].expires))
-        dictResize(server.db[dbid].expires);
 }
 
 /* Our hash table implementation performs rehashing incrementally while
@@ -758,11 +778,6 @@ int incrementallyRehash(int dbid) {
         dictRehashMilliseconds(server.db[dbid].dict,1);
         return 1; /* already used our millisecond for this loop... */
     }
-    /* Expires */
-    if (dictIsRehashing(server.db[dbid].expires)) {
-        dictRehashMilliseconds(server.db[dbid].expires,1);
-        return 1; /* already used our millisecond for this loop... */
-    }
     return 0;
 }
 
@@ -849,13 +864,25 @@ int clientsCronHandleTimeout(client *c, mstime_t now_ms) {
  *
  * The function always returns 0 as it never terminates the client. */
 int clientsCronResizeQueryBuffer(client *c) {
+    /* Give the query buffer back to the pool if there is nothing pending,
+     * as it may happen to clients that were blocked. Idle clients don't
+     * own a query buffer at all, see borrowQueryBuffer(). */
+    releaseClientQueryBuffer(c,0);
+    if (c->querybuf == NULL) {
+        c->querybuf_peak = 0;
+        return 0;
+    }
+
     size_t querybuf_size = sdsAllocSize(c->querybuf);
     time_t idletime = server.unixtime - c->lastinteraction;
 
     /* There are two conditions to resize the query buffer:
      * 1) Query buffer is > BIG_ARG and too big for latest peak.
-     * 2) Query buffer is > BIG_ARG and client is idle. */
+     * 2) Query buffer is > BIG_ARG and client is idle.
+     * Buffers having the size used by the pool are left alone: they are
+     * given back to the pool as they are once the client is done. */
     if (querybuf_size > PROTO_MBULK_BIG_ARG &&
+        sdsalloc(c->querybuf) > QUERYBUF_POOL_MAX_ALLOC &&
          ((querybuf_size/(c->querybuf_peak+1)) > 2 ||
           idletime > 2))
     {
@@ -905,7 +932,7 @@ size_t ClientsPeakMemInput[CLIENTS_PEAK_MEM_USAGE_SLOTS];
 size_t ClientsPeakMemOutput[CLIENTS_PEAK_MEM_USAGE_SLOTS];
 
 int clientsCronTrackExpansiveClients(client *c) {
-    size_t in_usage = sdsAllocSize(c->querybuf);
+    size_t in_usage = c->querybuf ? sdsAllocSize(c->querybuf) : 0;
     size_t out_usage = getClientOutputBufferMemoryUsage(c);
     int i = server.unixtime % CLIENTS_PEAK_MEM_USAGE_SLOTS;
     int zeroidx = (i+1) % CLIENTS_PEAK_MEM_USAGE_SLOTS;
@@ -1185,7 +1212,7 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
 
             size = dictSlots(server.db[j].dict);
             used = dictSize(server.db[j].dict);
-            vkeys = dictSize(server.db[j].expires);
+            vkeys = expireIndexSize(server.db[j].expires);
             if (used || vkeys) {
                 serverLog(LL_VERBOSE,"DB %d: %lld keys (%lld volatile) in %lld slots HT.",j,used,vkeys,size);
                 /* dictPrintStats(server.dict); */
@@ -1360,6 +1387,12 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
 void beforeSleep(struct aeEventLoop *eventLoop) {
     UNUSED(eventLoop);
 
+    /* Read and parse the queries of the clients postponed by the readable
+     * handler using the I/O threads, then execute their commands. This
+     * needs to happen ASAP, since the following steps may depend on the
+     * effects of such commands (blocked clients, AOF, replies...). */
+    handleClientsWithPendingReadsUsingThreads();
+
     /* Call the Redis Cluster before sleep function. Note that this function
      * may change the state of Redis Cluster (from ok to fail or vice versa),
      * so it's a good idea to call it before serving the unblocked clients
@@ -1403,7 +1436,7 @@ void beforeSleep(struct aeEventLoop *eventLoop) {
     flushAppendOnlyFile(0);
 
     /* Handle writes with pending output buffers. */
-    handleClientsWithPendingWrites();
+    handleClientsWithPendingWritesUsingThreads();
 
     /* Before we are going to sleep, let the threads access the dataset by
      * releasing the GIL. Redis main thread will not touch anything at this
@@ -1522,6 +1555,8 @@ void initServerConfig(void) {
     pthread_mutex_init(&server.next_client_id_mutex,NULL);
     pthread_mutex_init(&server.lruclock_mutex,NULL);
     pthread_mutex_init(&server.unixtime_mutex,NULL);
+    pthread_mutex_init(&server.stat_net_input_bytes_mutex,NULL);
+    pthread_mutex_init(&server.stat_net_output_bytes_mutex,NULL);
 
     updateCachedTime();
     getRandomHexChars(server.runid,CONFIG_RUN_ID_SIZE);
@@ -1536,6 +1571,11 @@ void initServerConfig(void) {
     server.arch_bits = (sizeof(long) == 8) ? 64 : 32;
     server.port = CONFIG_DEFAULT_SERVER_PORT;
     server.tcp_backlog = CONFIG_DEFAULT_TCP_BACKLOG;
+    server.tcp_listen_sockets = CONFIG_DEFAULT_TCP_LISTEN_SOCKETS;
+    server.tcp_defer_accept = CONFIG_DEFAULT_TCP_DEFER_ACCEPT;
+    server.tcp_fastopen = CONFIG_DEFAULT_TCP_FASTOPEN;
+    server.io_threads_num = CONFIG_DEFAULT_IO_THREADS_NUM;
+    server.io_threads_do_reads = CONFIG_DEFAULT_IO_THREADS_DO_READS;
     server.bindaddr_count = 0;
     server.unixsocket = NULL;
     server.unixsocketperm = CONFIG_DEFAULT_UNIX_SOCKET_PERM;
@@ -1565,6 +1605,7 @@ void initServerConfig(void) {
     server.daemonize = CONFIG_DEFAULT_DAEMONIZE;
     server.supervised = 0;
     server.supervised_mode = SUPERVISED_NONE;
+    server.hash_function = CONFIG_DEFAULT_HASH_FUNCTION;
     server.aof_state = AOF_OFF;
     server.aof_fsync = CONFIG_DEFAULT_AOF_FSYNC;
     server.aof_no_fsync_on_rewrite = CONFIG_DEFAULT_AOF_NO_FSYNC_ON_REWRITE;
@@ -1608,6 +1649,8 @@ void initServerConfig(void) {
     server.list_max_ziplist_size = OBJ_LIST_MAX_ZIPLIST_SIZE;
     server.list_compress_depth = OBJ_LIST_COMPRESS_DEPTH;
     server.set_max_intset_entries = OBJ_SET_MAX_INTSET_ENTRIES;
+    server.set_max_listpack_entries = OBJ_SET_MAX_LISTPACK_ENTRIES;
+    server.set_max_listpack_value = OBJ_SET_MAX_LISTPACK_VALUE;
     server.zset_max_ziplist_entries = OBJ_ZSET_MAX_ZIPLIST_ENTRIES;
     server.zset_max_ziplist_value = OBJ_ZSET_MAX_ZIPLIST_VALUE;
     server.hll_sparse_max_bytes = CONFIG_DEFAULT_HLL_SPARSE_MAX_BYTES;
@@ -1631,6 +1674,7 @@ void initServerConfig(void) {
     server.lazyfree_lazy_eviction = CONFIG_DEFAULT_LAZYFREE_LAZY_EVICTION;
     server.lazyfree_lazy_expire = CONFIG_DEFAULT_LAZYFREE_LAZY_EXPIRE;
     server.lazyfree_lazy_server_del = CONFIG_DEFAULT_LAZYFREE_LAZY_SERVER_DEL;
+    server.keys_background_threshold = CONFIG_DEFAULT_KEYS_BACKGROUND_THRESHOLD;
     server.always_show_logo = CONFIG_DEFAULT_ALWAYS_SHOW_LOGO;
     server.lua_time_limit = LUA_SCRIPT_TIME_LIMIT;
 
@@ -1680,6 +1724,7 @@ void initServerConfig(void) {
     /* Client output buffer limits */
     for (j = 0; j < CLIENT_TYPE_OBUF_COUNT; j++)
         server.client_obuf_limits[j] = clientBufferLimitsDefaults[j];
+    server.client_obuf_total_limit = CONFIG_DEFAULT_CLIENT_OBUF_TOTAL_LIMIT;
 
     /* Double constants initialization */
     R_Zero = 0.0;
@@ -1894,11 +1939,43 @@ void checkTcpBacklogSettings(void) {
 #endif
 }
 
+/* Create 'sockets' listening sockets bound to the specified address and
+ * port, storing them in 'fds' starting at index '*count'. When more than a
+ * single socket is requested, they are created with SO_REUSEPORT, so that the
+ * kernel spreads the incoming connections across their accept queues: this
+ * way we have a bigger aggregated backlog, and every event loop iteration can
+ * accept up to MAX_ACCEPTS_PER_CALL connections from each socket.
+ *
+ * On error C_ERR is returned, with errno and server.neterr set by anet. */
+static int listenToAddress(int port, char *bindaddr, int ipv6, int sockets,
+                           int *fds, int *count)
+{
+    int j, fd;
+
+    for (j = 0; j < sockets; j++) {
+        if (sockets == 1)
+            fd = ipv6 ?
+                anetTcp6Server(server.neterr,port,bindaddr,server.tcp_backlog) :
+                anetTcpServer(server.neterr,port,bindaddr,server.tcp_backlog);
+        else
+            fd = ipv6 ?
+                anetTcp6ReusePortServer(server.neterr,port,bindaddr,
+                                        server.tcp_backlog) :
+                anetTcpReusePortServer(server.neterr,port,bindaddr,
+                                       server.tcp_backlog);
+        if (fd == ANET_ERR) return C_ERR;
+        anetNonBlock(NULL,fd);
+        fds[(*count)++] = fd;
+    }
+    return C_OK;
+}
+
 /* Initialize a set of file descriptors to listen to the specified 'port'
  * binding the addresses specified in the Redis server configuration.
  *
  * The listening file descriptors are stored in the integer array 'fds'
- * and their number is set in '*count'.
+ * and their number is set in '*count'. For every address 'sockets'
+ * file descriptors are created, see listenToAddress().
  *
  * The addresses to bind are specified in the global server.bindaddr array
  * and their number is server.bindaddr_count. If the server configuration
@@ -1912,7 +1989,7 @@ void checkTcpBacklogSettings(void) {
  * impossible to bind, or no bind addresses were specified in the server
  * configuration but the function is not able to bind * for at least
  * one of the IPv4 or IPv6 protocols. */
-int listenToPort(int port, int *fds, int *count) {
+int listenToPort(int port, int *fds, int *count, int sockets) {
     int j;
 
     /* Force binding of 0.0.0.0 if no bind address is specified, always
@@ -1920,57 +1997,44 @@ int listenToPort(int port, int *fds, int *count) {
     if (server.bindaddr_count == 0) server.bindaddr[0] = NULL;
     for (j = 0; j < server.bindaddr_count || j == 0; j++) {
         if (server.bindaddr[j] == NULL) {
-            int unsupported = 0;
+            int bound = 0, unsupported = 0;
             /* Bind * for both IPv6 and IPv4, we enter here only if
              * server.bindaddr_count == 0. */
-            fds[*count] = anetTcp6Server(server.neterr,port,NULL,
-                server.tcp_backlog);
-            if (fds[*count] != ANET_ERR) {
-                anetNonBlock(NULL,fds[*count]);
-                (*count)++;
+            if (listenToAddress(port,NULL,1,sockets,fds,count) == C_OK) {
+                bound++;
             } else if (errno == EAFNOSUPPORT) {
                 unsupported++;
                 serverLog(LL_WARNING,"Not listening to IPv6: unsupproted");
             }
 
-            if (*count == 1 || unsupported) {
+            if (bound || unsupported) {
                 /* Bind the IPv4 address as well. */
-                fds[*count] = anetTcpServer(server.neterr,port,NULL,
-                    server.tcp_backlog);
-                if (fds[*count] != ANET_ERR) {
-                    anetNonBlock(NULL,fds[*count]);
-                    (*count)++;
+                if (listenToAddress(port,NULL,0,sockets,fds,count) == C_OK) {
+                    bound++;
                 } else if (errno == EAFNOSUPPORT) {
                     unsupported++;
                     serverLog(LL_WARNING,"Not listening to IPv4: unsupproted");
                 }
             }
             /* Exit the loop if we were able to bind * on IPv4 and IPv6,
-             * otherwise fds[*count] will be ANET_ERR and we'll print an
-             * error and return to the caller with an error. */
-            if (*count + unsupported == 2) break;
-        } else if (strchr(server.bindaddr[j],':')) {
-            /* Bind IPv6 address. */
-            fds[*count] = anetTcp6Server(server.neterr,port,server.bindaddr[j],
-                server.tcp_backlog);
-        } else {
-            /* Bind IPv4 address. */
-            fds[*count] = anetTcpServer(server.neterr,port,server.bindaddr[j],
-                server.tcp_backlog);
-        }
-        if (fds[*count] == ANET_ERR) {
-            serverLog(LL_WARNING,
-                "Could not create server TCP listening socket %s:%d: %s",
-                server.bindaddr[j] ? server.bindaddr[j] : "*",
-                port, server.neterr);
-                if (errno == ENOPROTOOPT     || errno == EPROTONOSUPPORT ||
-                    errno == ESOCKTNOSUPPORT || errno == EPFNOSUPPORT ||
-                    errno == EAFNOSUPPORT    || errno == EADDRNOTAVAIL)
-                    continue;
-            return C_ERR;
+             * otherwise we'll print an error and return to the caller with
+             * an error. */
+            if (bound + unsupported == 2) break;
+        } else if (listenToAddress(port,server.bindaddr[j],
+                   strchr(server.bindaddr[j],':') != NULL,
+                   sockets,fds,count) == C_OK)
+        {
+            continue;
         }
-        anetNonBlock(NULL,fds[*count]);
-        (*count)++;
+        serverLog(LL_WARNING,
+            "Could not create server TCP listening socket %s:%d: %s",
+            server.bindaddr[j] ? server.bindaddr[j] : "*",
+            port, server.neterr);
+            if (errno == ENOPROTOOPT     || errno == EPROTONOSUPPORT ||
+                errno == ESOCKTNOSUPPORT || errno == EPFNOSUPPORT ||
+                errno == EAFNOSUPPORT    || errno == EADDRNOTAVAIL)
+                continue;
+        return C_ERR;
     }
     return C_OK;
 }
@@ -1986,7 +2050,11 @@ void resetServerStats(void) {
     server.stat_expiredkeys = 0;
     server.stat_expired_stale_perc = 0;
     server.stat_expired_time_cap_reached_count = 0;
+    server.stat_active_expiredkeys = 0;
+    server.stat_expired_lag_sum = 0;
+    server.stat_expired_lag_max = 0;
     server.stat_evictedkeys = 0;
+    server.stat_evicted_clients = 0;
     server.stat_keyspace_misses = 0;
     server.stat_keyspace_hits = 0;
     server.stat_active_defrag_hits = 0;
@@ -2029,10 +2097,13 @@ void initServer(void) {
     server.current_client = NULL;
     server.clients = listCreate();
     server.clients_index = raxNew();
+    server.clients_by_obuf_mem = raxNew();
+    server.clients_obuf_mem = 0;
     server.clients_to_close = listCreate();
     server.slaves = listCreate();
     server.monitors = listCreate();
     server.clients_pending_write = listCreate();
+    server.clients_pending_read = listCreate();
     server.slaveseldb = -1; /* Force to emit the first SELECT command. */
     server.unblocked_clients = listCreate();
     server.ready_keys = listCreate();
@@ -2054,9 +2125,30 @@ void initServer(void) {
 
     /* Open the TCP listening socket for the user commands. */
     if (server.port != 0 &&
-        listenToPort(server.port,server.ipfd,&server.ipfd_count) == C_ERR)
+        listenToPort(server.port,server.ipfd,&server.ipfd_count,
+                     server.tcp_listen_sockets) == C_ERR)
         exit(1);
 
+    /* Tune the TCP listening sockets. Failing to do so is not fatal, and
+     * is reported just once. */
+    int defer_accept = server.tcp_defer_accept, fastopen = server.tcp_fastopen;
+    for (j = 0; j < server.ipfd_count; j++) {
+        if (defer_accept &&
+            anetDeferAccept(server.neterr,server.ipfd[j],defer_accept) == ANET_ERR)
+        {
+            serverLog(LL_WARNING,"Unable to set TCP_DEFER_ACCEPT: %s",
+                server.neterr);
+            defer_accept = 0;
+        }
+        if (fastopen &&
+            anetFastOpen(server.neterr,server.ipfd[j],fastopen) == ANET_ERR)
+        {
+            serverLog(LL_WARNING,"Unable to set TCP_FASTOPEN: %s",
+                server.neterr);
+            fastopen = 0;
+        }
+    }
+
     /* Open the listening Unix domain socket. */
     if (server.unixsocket != NULL) {
         unlink(server.unixsocket); /* don't care if this fails */
@@ -2077,8 +2169,8 @@ void initServer(void) {
 
     /* Create the Redis databases, and initialize other internal state. */
     for (j = 0; j < server.dbnum; j++) {
-        server.db[j].dict = dictCreate(&dbDictType,NULL);
-        server.db[j].expires = dictCreate(&keyptrDictType,NULL);
+        server.db[j].dict = dbDictCreate();
+        server.db[j].expires = expireIndexCreate();
         server.db[j].blocking_keys = dictCreate(&keylistDictType,NULL);
         server.db[j].ready_keys = dictCreate(&objectKeyPointerValueDictType,NULL);
         server.db[j].watched_keys = dictCreate(&keylistDictType,NULL);
@@ -2180,6 +2272,7 @@ void initServer(void) {
     slowlogInit();
     latencyMonitorInit();
     bioInit();
+    initThreadedIO();
     server.initial_memory_usage = zmalloc_used_memory();
 }
 
@@ -2280,6 +2373,32 @@ struct redisCommand *lookupCommand(sds name) {
     return dictFetchValue(server.commands, name);
 }
 
+/* Lookup the command of the client 'c', trying first the command cached
+ * for the batch processInputBuffer() is running (see c->batch_cmd). Note
+ * that we compare the name as sent by the client and not the command name,
+ * that may be different because of rename-command. */
+struct redisCommand *lookupClientCommand(client *c) {
+    sds name = c->argv[0]->ptr;
+    size_t len = sdslen(name);
+    struct redisCommand *cmd;
+
+    if (c->batch_cmd && c->batch_cmd_namelen == len &&
+        memcmp(c->batch_cmd_name,name,len) == 0)
+    {
+        return c->batch_cmd;
+    }
+
+    cmd = lookupCommand(name);
+    if (cmd && len <= PROTO_BATCH_CMDNAME_LEN) {
+        memcpy(c->batch_cmd_name,name,len);
+        c->batch_cmd_namelen = len;
+        c->batch_cmd = cmd;
+    } else {
+        c->batch_cmd = NULL;
+    }
+    return cmd;
+}
+
 struct redisCommand *lookupCommandByCString(char *s) {
     struct redisCommand *cmd;
     sds name = sdsnew(s);
@@ -2557,7 +2676,7 @@ int processCommand(client *c) {
 
     /* Now lookup the command and check ASAP about trivial error conditions
      * such as wrong arity, bad command name and so forth. */
-    c->cmd = c->lastcmd = lookupCommand(c->argv[0]->ptr);
+    c->cmd = c->lastcmd = lookupClientCommand(c);
     if (!c->cmd) {
         flagTransaction(c);
         sds args = sdsempty();
@@ -2820,7 +2939,17 @@ int prepareForShutdown(int flags) {
      * send them pending writes. */
     flushSlavesOutputBuffers();
 
-    /* Close the listening sockets. Apparently this allows faster restarts. */
+    /* Close the listening sockets. Apparently this allows faster restarts.
+     * Their events are deleted first: the io_uring event loop holds a
+     * reference to the watched files, and the sockets would otherwise keep
+     * accepting connections until the kernel tears the ring down, after we
+     * exit. */
+    for (int j = 0; j < server.ipfd_count; j++)
+        aeDeleteFileEvent(server.el,server.ipfd[j],AE_READABLE);
+    if (server.sofd != -1) aeDeleteFileEvent(server.el,server.sofd,AE_READABLE);
+    if (server.cluster_enabled)
+        for (int j = 0; j < server.cfd_count; j++)
+            aeDeleteFileEvent(server.el,server.cfd[j],AE_READABLE);
     closeListeningSockets(1);
     serverLog(LL_WARNING,"%s is now ready to exit, bye bye...",
         server.sentinel_mode ? "Sentinel" : "Redis");
@@ -3181,9 +3310,11 @@ sds genRedisInfoString(char *section) {
             "connected_clients:%lu\r\n"
             "client_recent_max_input_buffer:%zu\r\n"
             "client_recent_max_output_buffer:%zu\r\n"
+            "clients_output_buffer_memory:%zu\r\n"
             "blocked_clients:%d\r\n",
             listLength(server.clients)-listLength(server.slaves),
             maxin, maxout,
+            server.clients_obuf_mem,
             server.blocked_clients);
     }
 
@@ -3200,8 +3331,13 @@ sds genRedisInfoString(char *section) {
         size_t total_system_mem = server.system_memory_size;
         const char *evict_policy = evictPolicyToString();
         long long memory_lua = (long long)lua_gc(server.lua,LUA_GCCOUNT,0)*1024;
+        unsigned long querybuf_pool_free, querybuf_pool_lent;
+        size_t querybuf_pool_mem;
         struct redisMemOverhead *mh = getMemoryOverheadData();
 
+        getQueryBufferPoolInfo(&querybuf_pool_free,&querybuf_pool_mem,
+                               &querybuf_pool_lent);
+
         /* Peak memory is updated from time to time by serverCron() so it
          * may happen that the instantaneous value is slightly bigger than
          * the peak value. This may confuse users, so we update the peak
@@ -3256,6 +3392,9 @@ sds genRedisInfoString(char *section) {
             "mem_replication_backlog:%zu\r\n"
             "mem_clients_slaves:%zu\r\n"
             "mem_clients_normal:%zu\r\n"
+            "mem_querybuf_pool:%zu\r\n"
+            "querybuf_pool_free:%lu\r\n"
+            "querybuf_pool_lent:%lu\r\n"
             "mem_aof_buffer:%zu\r\n"
             "mem_allocator:%s\r\n"
             "active_defrag_running:%d\r\n"
@@ -3296,6 +3435,9 @@ sds genRedisInfoString(char *section) {
             mh->repl_backlog,
             mh->clients_slaves,
             mh->clients_normal,
+            querybuf_pool_mem,
+            querybuf_pool_free,
+            querybuf_pool_lent,
             mh->aof_buffer,
             ZMALLOC_LIB,
             server.active_defrag_running,
@@ -3396,6 +3538,28 @@ sds genRedisInfoString(char *section) {
 
     /* Stats */
     if (allsections || defsections || !strcasecmp(section,"stats")) {
+        long long now = mstime(), expired_backlog = 0;
+        unsigned long rehashing = 0, rehash_done = 0, rehash_total = 0;
+        unsigned long rehash_pending_keys = 0;
+
+        for (j = 0; j < server.dbnum; j++) {
+            dict *d = server.db[j].dict;
+            long long end = expireIndexEarliestBucketEnd(server.db[j].expires);
+
+            /* How late the active expire cycle is in reclaiming the earliest
+             * bucket of expired keys, across all the DBs. */
+            if (end != -1 && now-end > expired_backlog)
+                expired_backlog = now-end;
+
+            /* Progress of the incremental rehashing of the keyspaces. */
+            if (dictIsRehashing(d)) {
+                rehashing++;
+                rehash_done += d->rehashidx;
+                rehash_total += d->ht[0].size;
+                rehash_pending_keys += d->ht[0].used;
+            }
+        }
+
         if (sections++) info = sdscat(info,"\r\n");
         info = sdscatprintf(info,
             "# Stats\r\n"
@@ -3413,7 +3577,15 @@ sds genRedisInfoString(char *section) {
             "expired_keys:%lld\r\n"
             "expired_stale_perc:%.2f\r\n"
             "expired_time_cap_reached_count:%lld\r\n"
+            "expired_active_keys:%lld\r\n"
+            "expired_lag_avg_ms:%lld\r\n"
+            "expired_lag_max_ms:%lld\r\n"
+            "expired_backlog_ms:%lld\r\n"
+            "rehashing_dbs:%lu\r\n"
+            "rehashing_progress_perc:%.2f\r\n"
+            "rehashing_pending_keys:%lu\r\n"
             "evicted_keys:%lld\r\n"
+            "evicted_clients:%lld\r\n"
             "keyspace_hits:%lld\r\n"
             "keyspace_misses:%lld\r\n"
             "pubsub_channels:%ld\r\n"
@@ -3424,7 +3596,8 @@ sds genRedisInfoString(char *section) {
             "active_defrag_hits:%lld\r\n"
             "active_defrag_misses:%lld\r\n"
             "active_defrag_key_hits:%lld\r\n"
-            "active_defrag_key_misses:%lld\r\n",
+            "active_defrag_key_misses:%lld\r\n"
+            "io_threads_active:%d\r\n",
             server.stat_numconnections,
             server.stat_numcommands,
             getInstantaneousMetric(STATS_METRIC_COMMAND),
@@ -3439,7 +3612,16 @@ sds genRedisInfoString(char *section) {
             server.stat_expiredkeys,
             server.stat_expired_stale_perc*100,
             server.stat_expired_time_cap_reached_count,
+            server.stat_active_expiredkeys,
+            server.stat_active_expiredkeys ?
+                server.stat_expired_lag_sum/server.stat_active_expiredkeys : 0,
+            server.stat_expired_lag_max,
+            expired_backlog,
+            rehashing,
+            rehash_total ? (double)rehash_done*100/rehash_total : 0,
+            rehash_pending_keys,
             server.stat_evictedkeys,
+            server.stat_evicted_clients,
             server.stat_keyspace_hits,
             server.stat_keyspace_misses,
             dictSize(server.pubsub_channels),
@@ -3450,7 +3632,8 @@ sds genRedisInfoString(char *section) {
             server.stat_active_defrag_hits,
             server.stat_active_defrag_misses,
             server.stat_active_defrag_key_hits,
-            server.stat_active_defrag_key_misses);
+            server.stat_active_defrag_key_misses,
+            server.io_threads_active);
     }
 
     /* Replication */
@@ -3633,7 +3816,7 @@ sds genRedisInfoString(char *section) {
             long long keys, vkeys;
 
             keys = dictSize(server.db[j].dict);
-            vkeys = dictSize(server.db[j].expires);
+            vkeys = expireIndexSize(server.db[j].expires);
             if (keys || vkeys) {
                 info = sdscatprintf(info,
                     "db%d:keys=%lld,expires=%lld,avg_ttl=%lld\r\n",
@@ -4156,6 +4339,19 @@ int main(int argc, char **argv) {
         serverLog(LL_WARNING, "Configuration loaded");
     }
 
+    /* The hash function can only change before the dicts are populated.
+     * Sentinel already populated its tables while loading the configuration,
+     * so it always uses the default. */
+    if (!server.sentinel_mode && server.hash_function != DICT_HASH_SIPHASH) {
+        if (dictSetHashFunctionType(server.hash_function) == DICT_OK) {
+            moduleRegisterCoreAPI();
+        } else {
+            serverLog(LL_WARNING,"WARNING: the CPU does not support the "
+                "selected hash-function, using siphash instead.");
+            server.hash_function = DICT_HASH_SIPHASH;
+        }
+    }
+
     server.supervised = redisIsSupervised(server.supervised_mode);
     int background = server.daemonize && !server.supervised;
     if (background) daemonize();
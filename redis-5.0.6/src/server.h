@@ -58,6 +58,7 @@ typedef long long mstime_t; /* millisecond time type. */
 #include "zmalloc.h" /* total memory usage aware version of malloc/free */
 #include "anet.h"    /* Networking the easy way */
 #include "ziplist.h" /* Compact list data structure */
+#include "listpack.h" /* Compact list of strings */
 #include "intset.h"  /* Compact integer set structure */
 #include "version.h" /* Version macro */
 #include "util.h"    /* Misc functions useful in many places */
@@ -85,11 +86,19 @@ typedef long long mstime_t; /* millisecond time type. */
 #define MAX_CLIENTS_PER_CLOCK_TICK 200          /* HZ is adapted based on that. */
 #define CONFIG_DEFAULT_SERVER_PORT        6379  /* TCP port. */
 #define CONFIG_DEFAULT_TCP_BACKLOG       511    /* TCP listen backlog. */
+#define CONFIG_DEFAULT_TCP_LISTEN_SOCKETS 1     /* Sockets per bind address. */
+#define CONFIG_MAX_TCP_LISTEN_SOCKETS    16
+#define CONFIG_DEFAULT_TCP_DEFER_ACCEPT  0      /* TCP_DEFER_ACCEPT seconds. */
+#define CONFIG_DEFAULT_TCP_FASTOPEN      0      /* TCP_FASTOPEN queue length. */
+#define CONFIG_DEFAULT_IO_THREADS_NUM    1      /* Single threaded by default */
+#define CONFIG_DEFAULT_IO_THREADS_DO_READS 0    /* Read + parse from threads? */
 #define CONFIG_DEFAULT_CLIENT_TIMEOUT       0   /* Default client timeout: infinite */
+#define CONFIG_DEFAULT_CLIENT_OBUF_TOTAL_LIMIT 0 /* No total output limit. */
 #define CONFIG_DEFAULT_DBNUM     16
 #define CONFIG_MAX_LINE    1024
 #define CRON_DBS_PER_CALL 16
 #define NET_MAX_WRITES_PER_EVENT (1024*64)
+#define NET_BATCH_IOV 16 /* Output buffer blocks per client in batched I/O. */
 #define PROTO_SHARED_SELECT_CMDS 10
 #define OBJ_SHARED_INTEGERS 10000
 #define OBJ_SHARED_BULKHDR_LEN 32
@@ -157,6 +166,8 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CONFIG_DEFAULT_LAZYFREE_LAZY_EVICTION 0
 #define CONFIG_DEFAULT_LAZYFREE_LAZY_EXPIRE 0
 #define CONFIG_DEFAULT_LAZYFREE_LAZY_SERVER_DEL 0
+#define CONFIG_DEFAULT_KEYS_BACKGROUND_THRESHOLD 100000
+#define CONFIG_DEFAULT_HASH_FUNCTION DICT_HASH_SIPHASH
 #define CONFIG_DEFAULT_ALWAYS_SHOW_LOGO 0
 #define CONFIG_DEFAULT_ACTIVE_DEFRAG 0
 #define CONFIG_DEFAULT_DEFRAG_THRESHOLD_LOWER 10 /* don't defrag when fragmentation is below 10% */
@@ -184,8 +195,13 @@ typedef long long mstime_t; /* millisecond time type. */
 #define PROTO_MAX_QUERYBUF_LEN  (1024*1024*1024) /* 1GB max query buffer. */
 #define PROTO_IOBUF_LEN         (1024*16)  /* Generic I/O buffer size */
 #define PROTO_REPLY_CHUNK_BYTES (16*1024) /* 16k output buffer */
+#define PROTO_REPLY_ZEROCOPY_MIN (1024*16) /* Min len of zero copy replies */
 #define PROTO_INLINE_MAX_SIZE   (1024*64) /* Max size of inline reads */
 #define PROTO_MBULK_BIG_ARG     (1024*32)
+#define PROTO_REUSE_ARGV_MAX    1024 /* Max argv array size kept for reuse. */
+#define PROTO_BATCH_CMDNAME_LEN 24 /* Max len of the batch cached cmd name. */
+#define QUERYBUF_POOL_SIZE      128 /* Max idle query buffers in the pool. */
+#define QUERYBUF_POOL_MAX_ALLOC (PROTO_IOBUF_LEN*2) /* Bigger ones not pooled */
 #define LONG_STR_SIZE      21          /* Bytes needed for long -> str + '\0' */
 #define REDIS_AUTOSYNC_BYTES (1024*1024*32) /* fdatasync every 32MB */
 
@@ -257,6 +273,13 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CLIENT_LUA_DEBUG_SYNC (1<<26)  /* EVAL debugging without fork() */
 #define CLIENT_MODULE (1<<27) /* Non connected client used by some module. */
 #define CLIENT_PROTECTED (1<<28) /* Client should not be freed for now. */
+#define CLIENT_PENDING_READ (1<<29) /* The client has pending reads and was put
+                                       in the list of clients we can read
+                                       from using the I/O threads. */
+#define CLIENT_PENDING_COMMAND (1<<30) /* Used in threaded I/O to signal after
+                                          we return single threaded that the
+                                          client has already pending commands
+                                          to be executed. */
 
 /* Client block type (btype field in client structure)
  * if CLIENT_BLOCKED flag is set. */
@@ -266,7 +289,8 @@ typedef long long mstime_t; /* millisecond time type. */
 #define BLOCKED_MODULE 3  /* Blocked by a loadable module. */
 #define BLOCKED_STREAM 4  /* XREAD. */
 #define BLOCKED_ZSET 5    /* BZPOP et al. */
-#define BLOCKED_NUM 6     /* Number of blocked states. */
+#define BLOCKED_KEYS 6    /* KEYS running in background. */
+#define BLOCKED_NUM 7     /* Number of blocked states. */
 
 /* Client request types */
 #define PROTO_REQ_INLINE 1
@@ -359,6 +383,8 @@ typedef long long mstime_t; /* millisecond time type. */
 #define OBJ_HASH_MAX_ZIPLIST_ENTRIES 512
 #define OBJ_HASH_MAX_ZIPLIST_VALUE 64
 #define OBJ_SET_MAX_INTSET_ENTRIES 512
+#define OBJ_SET_MAX_LISTPACK_ENTRIES 128
+#define OBJ_SET_MAX_LISTPACK_VALUE 64
 #define OBJ_ZSET_MAX_ZIPLIST_ENTRIES 128
 #define OBJ_ZSET_MAX_ZIPLIST_VALUE 64
 #define OBJ_STREAM_NODE_MAX_BYTES 4096
@@ -599,12 +625,13 @@ typedef struct RedisModuleDigest {
 #define OBJ_ENCODING_HT 2      /* Encoded as hash table */
 #define OBJ_ENCODING_ZIPMAP 3  /* Encoded as zipmap */
 #define OBJ_ENCODING_LINKEDLIST 4 /* No longer used: old list encoding. */
-#define OBJ_ENCODING_ZIPLIST 5 /* Encoded as ziplist */
+#define OBJ_ENCODING_ZIPLIST 5 /* No longer used: old list/hash/zset encoding. */
 #define OBJ_ENCODING_INTSET 6  /* Encoded as intset */
 #define OBJ_ENCODING_SKIPLIST 7  /* Encoded as skiplist */
 #define OBJ_ENCODING_EMBSTR 8  /* Embedded sds string encoding */
-#define OBJ_ENCODING_QUICKLIST 9 /* Encoded as linked list of ziplists */
+#define OBJ_ENCODING_QUICKLIST 9 /* Encoded as linked list of listpacks */
 #define OBJ_ENCODING_STREAM 10 /* Encoded as a radix tree of listpacks */
+#define OBJ_ENCODING_LISTPACK 11 /* Encoded as a listpack */
 
 #define LRU_BITS 24
 #define LRU_CLOCK_MAX ((1<<LRU_BITS)-1) /* Max value of obj->lru */
@@ -635,18 +662,68 @@ typedef struct redisObject {
 struct evictionPoolEntry; /* Defined in evict.c */
 
 /* This structure is used in order to represent the output buffer of a client,
- * which is actually a linked list of blocks like that, that is: client->reply. */
+ * which is actually a linked list of blocks like that, that is: client->reply.
+ *
+ * When 'obj' is not NULL the block does not own any buffer: it holds a
+ * reference to a large string object and the data to send is the SDS string
+ * of the object itself (see addReply()). In that case 'size' and 'used' are
+ * both set to the length of the string, so that nothing is ever appended to
+ * the block. Use replyBlockData() to access the data of any block. */
 typedef struct clientReplyBlock {
     size_t size, used;
+    robj *obj;
     char buf[];
 } clientReplyBlock;
 
+#define replyBlockData(b) ((b)->obj ? (char*)(b)->obj->ptr : (b)->buf)
+
+/* Metadata stored inside every entry of the main dictionary of a DB, see
+ * dbDictType. The expire time lives here, so that it can be read with the
+ * same lookup used to find the key. */
+typedef struct __attribute__ ((__packed__)) keyMetadata {
+    long long expire;           /* Unix time in ms, or -1 if no expire is set. */
+    uint32_t expire_pos;        /* Position inside the expire index bucket. */
+} keyMetadata;
+
+#define dbEntryMetadata(db,de) ((keyMetadata*)dictEntryMetadata((db)->dict,de))
+
+/* In cluster mode the entries of the main dict also link together the keys
+ * of the same hash slot, see slotToKeyAdd(). */
+typedef struct __attribute__ ((__packed__)) clusterKeyMetadata {
+    keyMetadata km;
+    struct dictEntry *slot_prev, *slot_next;
+} clusterKeyMetadata;
+
+#define dbEntrySlotMetadata(db,de) \
+    ((clusterKeyMetadata*)dictEntryMetadata((db)->dict,de))
+
+/* The keys with an expire set are indexed by expire time: the index maps
+ * every 2^EXPIRE_INDEX_BUCKET_BITS milliseconds time span to the bucket of
+ * the main dict entries expiring in that span, in no particular order.
+ * Entries remember their position inside the bucket, so that they can be
+ * removed in constant time. The active expire cycle reclaims buckets once
+ * their time span ended, so the span bounds how late keys are reclaimed. */
+#define EXPIRE_INDEX_BUCKET_BITS 8
+
+typedef struct expireBucket {
+    dictEntry **entries;
+    uint32_t used, size;
+} expireBucket;
+
+typedef struct expireIndex {
+    rax *buckets;               /* Big endian bucket time -> expireBucket. */
+    unsigned long size;         /* Number of indexed keys. */
+    unsigned long slots;        /* Total number of slots of the buckets. */
+} expireIndex;
+
+#define expireIndexSize(ei) ((ei)->size)
+
 /* Redis database representation. There are multiple databases identified
  * by integers from 0 (the default database) up to the max configured
  * database. The database number is the 'id' field in the structure. */
 typedef struct redisDb {
     dict *dict;                 /* The keyspace for this DB */
-    dict *expires;              /* Timeout of keys with a timeout set */
+    expireIndex *expires;       /* Keys with a timeout set, by expire time */
     dict *blocking_keys;        /* Keys with clients waiting for data (BLPOP)*/
     dict *ready_keys;           /* Blocked keys that received a PUSH */
     dict *watched_keys;         /* WATCHED keys for MULTI/EXEC CAS */
@@ -700,6 +777,9 @@ typedef struct blockingState {
     void *module_blocked_handle; /* RedisModuleBlockedClient structure.
                                     which is opaque for the Redis core, only
                                     handled in module.c. */
+
+    /* BLOCKED_KEYS */
+    struct bgkeysJob *keys_job; /* The background KEYS job of the client. */
 } blockingState;
 
 /* The following structure represents a node in the server.ready_keys list,
@@ -733,8 +813,14 @@ typedef struct client {
                                the master. */
     size_t querybuf_peak;   /* Recent (100ms or more) peak of querybuf size. */
     int argc;               /* Num of arguments of current command. */
+    int argv_len;           /* Size of argv array (may be more than argc). */
     robj **argv;            /* Arguments of current command. */
     struct redisCommand *cmd, *lastcmd;  /* Last command executed. */
+    struct redisCommand *batch_cmd; /* Command of the previous command in the
+                                       batch processInputBuffer() is running,
+                                       sent with the name batch_cmd_name. */
+    char batch_cmd_name[PROTO_BATCH_CMDNAME_LEN];
+    size_t batch_cmd_namelen;
     int reqtype;            /* Request protocol type: PROTO_REQ_* */
     int multibulklen;       /* Number of multi bulk arguments left to read. */
     long bulklen;           /* Length of bulk argument in multi bulk request. */
@@ -745,6 +831,8 @@ typedef struct client {
     time_t ctime;           /* Client creation time. */
     time_t lastinteraction; /* Time of the last interaction, used for timeout */
     time_t obuf_soft_limit_reached_time;
+    unsigned long obuf_indexed_mem; /* Output buffer memory the client is
+                                       indexed with in clients_by_obuf_mem. */
     int flags;              /* Client flags: CLIENT_* macros. */
     int authenticated;      /* When requirepass is non-NULL. */
     int replstate;          /* Replication state if this is a slave. */
@@ -975,11 +1063,14 @@ struct redisServer {
     /* Networking */
     int port;                   /* TCP listening port */
     int tcp_backlog;            /* TCP listen() backlog */
+    int tcp_listen_sockets;     /* SO_REUSEPORT sockets per bind address */
+    int tcp_defer_accept;       /* TCP_DEFER_ACCEPT timeout, 0 = disabled */
+    int tcp_fastopen;           /* TCP_FASTOPEN queue length, 0 = disabled */
     char *bindaddr[CONFIG_BINDADDR_MAX]; /* Addresses we should bind to */
     int bindaddr_count;         /* Number of addresses in server.bindaddr[] */
     char *unixsocket;           /* UNIX socket path */
     mode_t unixsocketperm;      /* UNIX socket permission */
-    int ipfd[CONFIG_BINDADDR_MAX]; /* TCP socket file descriptors */
+    int ipfd[CONFIG_BINDADDR_MAX*CONFIG_MAX_TCP_LISTEN_SOCKETS]; /* TCP socket file descriptors */
     int ipfd_count;             /* Used slots in ipfd[] */
     int sofd;                   /* Unix socket file descriptor */
     int cfd[CONFIG_BINDADDR_MAX];/* Cluster bus listening socket */
@@ -987,15 +1078,22 @@ struct redisServer {
     list *clients;              /* List of active clients */
     list *clients_to_close;     /* Clients to close asynchronously */
     list *clients_pending_write; /* There is to write or install handler. */
+    list *clients_pending_read;  /* Client has pending read socket buffers. */
     list *slaves, *monitors;    /* List of slaves and MONITORs */
     client *current_client; /* Current client, only used on crash report */
     rax *clients_index;         /* Active clients dictionary by client ID. */
+    rax *clients_by_obuf_mem;   /* Normal and pub/sub clients with a reply list
+                                   ordered by output buffer memory. */
+    size_t clients_obuf_mem;    /* Output memory of clients_by_obuf_mem. */
     int clients_paused;         /* True if clients are currently paused */
     mstime_t clients_pause_end_time; /* Time when we undo clients_paused */
     char neterr[ANET_ERR_LEN];   /* Error buffer for anet.c */
     dict *migrate_cached_sockets;/* MIGRATE cached sockets */
     uint64_t next_client_id;    /* Next client unique ID. Incremental. */
     int protected_mode;         /* Don't accept external connections. */
+    int io_threads_num;         /* Number of IO threads to use. */
+    int io_threads_do_reads;    /* Read and parse from IO threads? */
+    int io_threads_active;      /* Are the IO threads currently active? */
     /* RDB / AOF loading information */
     int loading;                /* We are loading data from disk if true */
     off_t loading_total_bytes;
@@ -1013,9 +1111,14 @@ struct redisServer {
     long long stat_numcommands;     /* Number of processed commands */
     long long stat_numconnections;  /* Number of connections received */
     long long stat_expiredkeys;     /* Number of expired keys */
+    long long stat_active_expiredkeys; /* Keys expired by the active cycle */
+    long long stat_expired_lag_sum; /* Sum of their delays past expire, ms. */
+    long long stat_expired_lag_max; /* Max delay past expire, ms. */
     double stat_expired_stale_perc; /* Percentage of keys probably expired */
     long long stat_expired_time_cap_reached_count; /* Early expire cylce stops.*/
     long long stat_evictedkeys;     /* Number of evicted keys (maxmemory) */
+    long long stat_evicted_clients; /* Clients closed because of the total
+                                       output buffer limit. */
     long long stat_keyspace_hits;   /* Number of successful lookups of keys */
     long long stat_keyspace_misses; /* Number of failed lookups of keys */
     long long stat_active_defrag_hits;      /* number of allocations moved */
@@ -1063,8 +1166,12 @@ struct redisServer {
     int dbnum;                      /* Total number of configured DBs */
     int supervised;                 /* 1 if supervised, 0 otherwise. */
     int supervised_mode;            /* See SUPERVISED_* */
+    int hash_function;              /* See DICT_HASH_*, set at startup. */
     int daemonize;                  /* True if running as a daemon */
     clientBufferLimitsConfig client_obuf_limits[CLIENT_TYPE_OBUF_COUNT];
+    unsigned long long client_obuf_total_limit; /* Max output buffer memory
+                                                   of all the normal and
+                                                   pub/sub clients. */
     /* AOF persistence */
     int aof_state;                  /* AOF_(ON|OFF|WAIT_REWRITE) */
     int aof_fsync;                  /* Kind of fsync() policy */
@@ -1219,6 +1326,8 @@ struct redisServer {
     size_t hash_max_ziplist_entries;
     size_t hash_max_ziplist_value;
     size_t set_max_intset_entries;
+    size_t set_max_listpack_entries;
+    size_t set_max_listpack_value;
     size_t zset_max_ziplist_entries;
     size_t zset_max_ziplist_value;
     size_t hll_sparse_max_bytes;
@@ -1278,6 +1387,10 @@ struct redisServer {
     int lazyfree_lazy_eviction;
     int lazyfree_lazy_expire;
     int lazyfree_lazy_server_del;
+    /* Background KEYS */
+    unsigned long keys_background_threshold; /* Run KEYS in background against
+                                                DBs with at least this many
+                                                keys. 0 = never. */
     /* Latency monitor */
     long long latency_monitor_threshold;
     dict *latency_events;
@@ -1295,11 +1408,14 @@ struct redisServer {
     pthread_mutex_t lruclock_mutex;
     pthread_mutex_t next_client_id_mutex;
     pthread_mutex_t unixtime_mutex;
+    pthread_mutex_t stat_net_input_bytes_mutex;
+    pthread_mutex_t stat_net_output_bytes_mutex;
 };
 
 typedef struct pubsubPattern {
     client *client;
     robj *pattern;
+    stringmatchPattern *matcher;    /* 'pattern' compiled for PUBLISH. */
 } pubsubPattern;
 
 typedef void redisCommandProc(client *c);
@@ -1358,6 +1474,8 @@ typedef struct {
     int encoding;
     int ii; /* intset iterator */
     dictIterator *di;
+    unsigned char *lpi; /* listpack iterator */
+    sds lpele; /* Last element returned for listpack sets. */
 } setTypeIterator;
 
 /* Structure to hold hash iteration abstraction. Note that iteration over
@@ -1392,11 +1510,11 @@ extern dictType zsetDictType;
 extern dictType clusterNodesDictType;
 extern dictType clusterNodesBlackListDictType;
 extern dictType dbDictType;
+extern dictType clusterDbDictType;
 extern dictType shaScriptObjectDictType;
 extern double R_Zero, R_PosInf, R_NegInf, R_Nan;
 extern dictType hashDictType;
 extern dictType replScriptCacheDictType;
-extern dictType keyptrDictType;
 extern dictType modulesDictType;
 
 /*-----------------------------------------------------------------------------
@@ -1405,6 +1523,7 @@ extern dictType modulesDictType;
 
 /* Modules */
 void moduleInitModulesSystem(void);
+void moduleRegisterCoreAPI(void);
 int moduleLoad(const char *path, void **argv, int argc);
 void moduleLoadFromQueue(void);
 int *moduleGetCommandKeysViaAPI(struct redisCommand *cmd, robj **argv, int argc, int *numkeys);
@@ -1449,6 +1568,7 @@ void acceptUnixHandler(aeEventLoop *el, int fd, void *privdata, int mask);
 void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask);
 void addReplyString(client *c, const char *s, size_t len);
 void AddReplyFromClient(client *c, client *src);
+void unshareClientsReplyObjects(void);
 void addReplyBulk(client *c, robj *obj);
 void addReplyBulkCString(client *c, const char *s);
 void addReplyBulkCBuffer(client *c, const void *p, size_t len);
@@ -1469,6 +1589,10 @@ size_t sdsZmallocSize(sds s);
 size_t getStringObjectSdsUsedMemory(robj *o);
 void freeClientReplyValue(void *o);
 void *dupClientReplyValue(void *o);
+sds borrowQueryBuffer(void);
+void releaseClientQueryBuffer(client *c, int force);
+void getQueryBufferPoolInfo(unsigned long *free_buffers, size_t *free_memory,
+                            unsigned long *lent_buffers);
 void getClientsMaxBuffers(unsigned long *longest_output_list,
                           unsigned long *biggest_input_buffer);
 char *getClientPeerId(client *client);
@@ -1480,16 +1604,23 @@ void replaceClientCommandVector(client *c, int argc, robj **argv);
 unsigned long getClientOutputBufferMemoryUsage(client *c);
 void freeClientsInAsyncFreeQueue(void);
 void asyncCloseClientOnOutputBufferLimitReached(client *c);
+void updateClientOutputBufferMemory(client *c);
+void rebuildClientOutputBufferMemoryIndex(void);
+void enforceClientOutputBufferTotalLimit(void);
 int getClientType(client *c);
 int getClientTypeByName(char *name);
 char *getClientTypeName(int class);
 void flushSlavesOutputBuffers(void);
 void disconnectSlaves(void);
-int listenToPort(int port, int *fds, int *count);
+int listenToPort(int port, int *fds, int *count, int sockets);
 void pauseClients(mstime_t duration);
 int clientsArePaused(void);
 int processEventsWhileBlocked(void);
 int handleClientsWithPendingWrites(void);
+int handleClientsWithPendingWritesUsingThreads(void);
+int handleClientsWithPendingReadsUsingThreads(void);
+int processCommandAndResetClient(client *c);
+void initThreadedIO(void);
 int clientHasPendingReplies(client *c);
 void unlinkClient(client *c);
 int writeToClient(int fd, client *c, int handler_installed);
@@ -1519,7 +1650,6 @@ robj *listTypeGet(listTypeEntry *entry);
 void listTypeInsert(listTypeEntry *entry, robj *value, int where);
 int listTypeEqual(listTypeEntry *entry, robj *o);
 void listTypeDelete(listTypeIterator *iter, listTypeEntry *entry);
-void listTypeConvert(robj *subject, int enc);
 void unblockClientWaitingData(client *c);
 void popGenericCommand(client *c, int where);
 
@@ -1549,6 +1679,7 @@ robj *createObject(int type, void *ptr);
 robj *createStringObject(const char *ptr, size_t len);
 robj *createRawStringObject(const char *ptr, size_t len);
 robj *createEmbeddedStringObject(const char *ptr, size_t len);
+robj *initEmbeddedStringObject(robj *o, const char *ptr, size_t len);
 robj *dupStringObject(const robj *o);
 int isSdsRepresentableAsLongLong(sds s, long long *llval);
 int isObjectRepresentableAsLongLong(robj *o, long long *llongval);
@@ -1559,12 +1690,12 @@ robj *createStringObjectFromLongLong(long long value);
 robj *createStringObjectFromLongLongForValue(long long value);
 robj *createStringObjectFromLongDouble(long double value, int humanfriendly);
 robj *createQuicklistObject(void);
-robj *createZiplistObject(void);
 robj *createSetObject(void);
 robj *createIntsetObject(void);
+robj *createSetListpackObject(void);
 robj *createHashObject(void);
 robj *createZsetObject(void);
-robj *createZsetZiplistObject(void);
+robj *createZsetListpackObject(void);
 robj *createStreamObject(void);
 robj *createModuleObject(moduleType *mt, void *value);
 int getLongFromObjectOrReply(client *c, robj *o, long *target, const char *msg);
@@ -1694,14 +1825,14 @@ unsigned char *zzlFirstInRange(unsigned char *zl, zrangespec *range);
 unsigned char *zzlLastInRange(unsigned char *zl, zrangespec *range);
 unsigned long zsetLength(const robj *zobj);
 void zsetConvert(robj *zobj, int encoding);
-void zsetConvertToZiplistIfNeeded(robj *zobj, size_t maxelelen);
+void zsetConvertToListpackIfNeeded(robj *zobj, size_t maxelelen);
 int zsetScore(robj *zobj, sds member, double *score);
 unsigned long zslGetRank(zskiplist *zsl, double score, sds o);
 int zsetAdd(robj *zobj, double score, sds ele, int *flags, double *newscore);
 long zsetRank(robj *zobj, sds ele, int reverse);
 int zsetDel(robj *zobj, sds ele);
 void genericZpopCommand(client *c, robj **keyv, int keyc, int where, int emitkey, robj *countarg);
-sds ziplistGetObject(unsigned char *sptr);
+sds lpGetObject(unsigned char *sptr);
 int zslValueGteMin(double value, zrangespec *spec);
 int zslValueLteMax(double value, zrangespec *spec);
 void zslFreeLexRange(zlexrangespec *spec);
@@ -1723,6 +1854,7 @@ int freeMemoryIfNeededAndSafe(void);
 int processCommand(client *c);
 void setupSignalHandlers(void);
 struct redisCommand *lookupCommand(sds name);
+struct redisCommand *lookupClientCommand(client *c);
 struct redisCommand *lookupCommandByCString(char *s);
 struct redisCommand *lookupCommandOrOriginal(sds name);
 void call(client *c, int flags);
@@ -1764,6 +1896,7 @@ int restartServer(int flags, mstime_t delay);
 
 /* Set data type */
 robj *setTypeCreate(sds value);
+robj *setTypeCreateFromElements(sds *eles, unsigned long count);
 int setTypeAdd(robj *subject, sds value);
 int setTypeRemove(robj *subject, sds value);
 int setTypeIsMember(robj *subject, sds value);
@@ -1790,10 +1923,10 @@ unsigned long hashTypeLength(const robj *o);
 hashTypeIterator *hashTypeInitIterator(robj *subject);
 void hashTypeReleaseIterator(hashTypeIterator *hi);
 int hashTypeNext(hashTypeIterator *hi);
-void hashTypeCurrentFromZiplist(hashTypeIterator *hi, int what,
-                                unsigned char **vstr,
-                                unsigned int *vlen,
-                                long long *vll);
+void hashTypeCurrentFromListpack(hashTypeIterator *hi, int what,
+                                 unsigned char **vstr,
+                                 unsigned int *vlen,
+                                 long long *vll);
 sds hashTypeCurrentFromHashTable(hashTypeIterator *hi, int what);
 void hashTypeCurrentObject(hashTypeIterator *hi, int what, unsigned char **vstr, unsigned int *vlen, long long *vll);
 sds hashTypeCurrentObjectNewSds(hashTypeIterator *hi, int what);
@@ -1825,6 +1958,7 @@ int rewriteConfig(char *path);
 int removeExpire(redisDb *db, robj *key);
 void propagateExpire(redisDb *db, robj *key, int lazy);
 int expireIfNeeded(redisDb *db, robj *key);
+int keyEntryIsExpired(redisDb *db, dictEntry *de);
 long long getExpire(redisDb *db, robj *key);
 void setExpire(client *c, redisDb *db, robj *key, long long when);
 robj *lookupKey(redisDb *db, robj *key, int flags);
@@ -1833,6 +1967,8 @@ robj *lookupKeyWrite(redisDb *db, robj *key);
 robj *lookupKeyReadOrReply(client *c, robj *key, robj *reply);
 robj *lookupKeyWriteOrReply(client *c, robj *key, robj *reply);
 robj *lookupKeyReadWithFlags(redisDb *db, robj *key, int flags);
+void lookupKeysRead(redisDb *db, robj **keys, int count, robj **vals);
+void dbPrefetchKeys(redisDb *db, robj **keys, int count, int step);
 robj *objectCommandLookup(client *c, robj *key);
 robj *objectCommandLookupOrReply(client *c, robj *key, robj *reply);
 void objectSetLRUOrLFU(robj *val, long long lfu_freq, long long lru_idle,
@@ -1861,19 +1997,28 @@ unsigned int delKeysInSlot(unsigned int hashslot);
 int verifyClusterConfigWithData(void);
 void scanGenericCommand(client *c, robj *o, unsigned long cursor);
 int parseScanCursorOrReply(client *c, robj *o, unsigned long *cursor);
-void slotToKeyAdd(robj *key);
-void slotToKeyDel(robj *key);
+void slotToKeyAdd(dictEntry *de);
+void slotToKeyDel(dictEntry *de);
+void slotToKeyEntryMoved(dictEntry *de);
 void slotToKeyFlush(void);
+dict *dbDictCreate(void);
 int dbAsyncDelete(redisDb *db, robj *key);
 void emptyDbAsync(redisDb *db);
-void slotToKeyFlushAsync(void);
 size_t lazyfreeGetPendingObjectsCount(void);
 void freeObjAsync(robj *o);
 
+/* bgkeys.c -- KEYS in background */
+int startBackgroundKeys(client *c, sds pattern);
+void replyToBackgroundKeysClient(client *c);
+void unblockClientFromBackgroundKeys(client *c);
+int backgroundKeysScanningDb(redisDb *db);
+void backgroundKeysSwapDb(int id1, int id2);
+
 /* API to get key arguments from commands */
 int *getKeysFromCommand(struct redisCommand *cmd, robj **argv, int argc, int *numkeys);
 void getKeysFreeResult(int *result);
 int *zunionInterGetKeys(struct redisCommand *cmd,robj **argv, int argc, int *numkeys);
+int *intercardGetKeys(struct redisCommand *cmd,robj **argv, int argc, int *numkeys);
 int *evalGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys);
 int *sortGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys);
 int *migrateGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys);
@@ -1927,6 +2072,16 @@ void expireSlaveKeys(void);
 void rememberSlaveKeyWithExpire(redisDb *db, robj *key);
 void flushSlaveKeysWithExpireList(void);
 size_t getSlaveKeyWithExpireCount(void);
+expireIndex *expireIndexCreate(void);
+void expireIndexRelease(expireIndex *ei);
+void expireIndexAdd(redisDb *db, dictEntry *de);
+void expireIndexDel(redisDb *db, dictEntry *de);
+void expireIndexEntryMoved(redisDb *db, dictEntry *de);
+unsigned int expireIndexGetExpiredEntries(expireIndex *ei, long long now, dictEntry **des, unsigned int count);
+long long expireIndexEarliestBucketEnd(expireIndex *ei);
+unsigned int expireIndexGetSomeEntries(expireIndex *ei, dictEntry **des, unsigned int count);
+dictEntry *expireIndexRandomEntry(expireIndex *ei);
+size_t expireIndexMemUsage(expireIndex *ei);
 
 /* evict.c -- maxmemory handling and LRU eviction. */
 void evictionPoolAlloc(void);
@@ -2003,6 +2158,7 @@ void scardCommand(client *c);
 void spopCommand(client *c);
 void srandmemberCommand(client *c);
 void sinterCommand(client *c);
+void sintercardCommand(client *c);
 void sinterstoreCommand(client *c);
 void sunionCommand(client *c);
 void sunionstoreCommand(client *c);
@@ -2072,6 +2228,7 @@ void hstrlenCommand(client *c);
 void zremrangebyrankCommand(client *c);
 void zunionstoreCommand(client *c);
 void zinterstoreCommand(client *c);
+void zintercardCommand(client *c);
 void zscanCommand(client *c);
 void hkeysCommand(client *c);
 void hvalsCommand(client *c);
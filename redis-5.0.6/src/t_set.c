@@ -37,14 +37,56 @@ void sunionDiffGenericCommand(client *c, robj **setkeys, int setnum,
                               robj *dstkey, int op);
 
 /* Factory method to return a set that *can* hold "value". When the object has
- * an integer-encodable value, an intset will be returned. Otherwise a regular
- * hash table. */
+ * an integer-encodable value, an intset will be returned. Otherwise a listpack
+ * if the value is small enough, or a regular hash table. */
 robj *setTypeCreate(sds value) {
     if (isSdsRepresentableAsLongLong(value,NULL) == C_OK)
         return createIntsetObject();
+    if (server.set_max_listpack_entries &&
+        sdslen(value) <= server.set_max_listpack_value)
+        return createSetListpackObject();
     return createSetObject();
 }
 
+/* Create a set with the 'count' distinct elements of 'eles', directly in the
+ * encoding that adding them one after the other with setTypeAdd() would end
+ * with, so that the set is never converted while it is populated. */
+robj *setTypeCreateFromElements(sds *eles, unsigned long count) {
+    unsigned long j;
+    size_t maxlen = 0;
+    int allints = 1;
+    robj *set;
+
+    for (j = 0; j < count; j++) {
+        if (allints && isSdsRepresentableAsLongLong(eles[j],NULL) != C_OK)
+            allints = 0;
+        if (sdslen(eles[j]) > maxlen) maxlen = sdslen(eles[j]);
+    }
+
+    if (allints && count <= server.set_max_intset_entries) {
+        long long llval;
+
+        set = createIntsetObject();
+        for (j = 0; j < count; j++) {
+            isSdsRepresentableAsLongLong(eles[j],&llval);
+            set->ptr = intsetAdd(set->ptr,llval,NULL);
+        }
+    } else if (!allints && count <= server.set_max_listpack_entries &&
+               maxlen <= server.set_max_listpack_value)
+    {
+        set = createSetListpackObject();
+        for (j = 0; j < count; j++)
+            set->ptr = lpAppend(set->ptr,(unsigned char*)eles[j],
+                                sdslen(eles[j]));
+    } else {
+        set = createSetObject();
+        if (count > DICT_HT_INITIAL_SIZE) dictExpand(set->ptr,count);
+        for (j = 0; j < count; j++)
+            dictAdd(set->ptr,sdsdup(eles[j]),NULL);
+    }
+    return set;
+}
+
 /* Add the specified value into a set.
  *
  * If the value was already member of the set, nothing is done and 0 is
@@ -71,7 +113,16 @@ int setTypeAdd(robj *subject, sds value) {
                 return 1;
             }
         } else {
-            /* Failed to get integer from object, convert to regular set. */
+            /* Failed to get integer from object, convert to a listpack if
+             * the set is small enough, otherwise to a regular set. */
+            if (intsetLen(subject->ptr) < server.set_max_listpack_entries &&
+                sdslen(value) <= server.set_max_listpack_value)
+            {
+                setTypeConvert(subject,OBJ_ENCODING_LISTPACK);
+                subject->ptr = lpAppend(subject->ptr,(unsigned char*)value,
+                                        sdslen(value));
+                return 1;
+            }
             setTypeConvert(subject,OBJ_ENCODING_HT);
 
             /* The set *was* an intset and this value is not integer
@@ -79,6 +130,22 @@ int setTypeAdd(robj *subject, sds value) {
             serverAssert(dictAdd(subject->ptr,sdsdup(value),NULL) == DICT_OK);
             return 1;
         }
+    } else if (subject->encoding == OBJ_ENCODING_LISTPACK) {
+        unsigned char *lp = subject->ptr;
+
+        if (lpFindIndexed(lp,subject,(unsigned char*)value,sdslen(value),0))
+            return 0;
+        if (lpLength(lp) < server.set_max_listpack_entries &&
+            sdslen(value) <= server.set_max_listpack_value)
+        {
+            subject->ptr = lpAppend(lp,(unsigned char*)value,sdslen(value));
+        } else {
+            /* Convert to regular set when the listpack would contain too
+             * many or too big entries. */
+            setTypeConvert(subject,OBJ_ENCODING_HT);
+            serverAssert(dictAdd(subject->ptr,sdsdup(value),NULL) == DICT_OK);
+        }
+        return 1;
     } else {
         serverPanic("Unknown set encoding");
     }
@@ -98,6 +165,14 @@ int setTypeRemove(robj *setobj, sds value) {
             setobj->ptr = intsetRemove(setobj->ptr,llval,&success);
             if (success) return 1;
         }
+    } else if (setobj->encoding == OBJ_ENCODING_LISTPACK) {
+        unsigned char *lp = setobj->ptr;
+        unsigned char *p = lpFindIndexed(lp,setobj,(unsigned char*)value,
+                                         sdslen(value),0);
+        if (p != NULL) {
+            setobj->ptr = lpDelete(lp,p,NULL);
+            return 1;
+        }
     } else {
         serverPanic("Unknown set encoding");
     }
@@ -112,6 +187,10 @@ int setTypeIsMember(robj *subject, sds value) {
         if (isSdsRepresentableAsLongLong(value,&llval) == C_OK) {
             return intsetFind((intset*)subject->ptr,llval);
         }
+    } else if (subject->encoding == OBJ_ENCODING_LISTPACK) {
+        unsigned char *lp = subject->ptr;
+        return lpFindIndexed(lp,subject,(unsigned char*)value,
+                             sdslen(value),0) != NULL;
     } else {
         serverPanic("Unknown set encoding");
     }
@@ -126,6 +205,9 @@ setTypeIterator *setTypeInitIterator(robj *subject) {
         si->di = dictGetIterator(subject->ptr);
     } else if (si->encoding == OBJ_ENCODING_INTSET) {
         si->ii = 0;
+    } else if (si->encoding == OBJ_ENCODING_LISTPACK) {
+        si->lpi = lpFirst(subject->ptr);
+        si->lpele = NULL;
     } else {
         serverPanic("Unknown set encoding");
     }
@@ -135,16 +217,31 @@ setTypeIterator *setTypeInitIterator(robj *subject) {
 void setTypeReleaseIterator(setTypeIterator *si) {
     if (si->encoding == OBJ_ENCODING_HT)
         dictReleaseIterator(si->di);
+    else if (si->encoding == OBJ_ENCODING_LISTPACK)
+        sdsfree(si->lpele);
     zfree(si);
 }
 
+/* Copy the listpack entry 'p' into the sds string 'buf', that is created
+ * if NULL, and return it. */
+static sds setTypeListpackGet(unsigned char *p, sds buf) {
+    unsigned char intbuf[LP_INTBUF_SIZE], *str;
+    int64_t len;
+
+    str = lpGet(p,&len,intbuf);
+    if (buf == NULL) return sdsnewlen(str,len);
+    return sdscpylen(buf,(char*)str,len);
+}
+
 /* Move to the next entry in the set. Returns the object at the current
  * position.
  *
  * Since set elements can be internally be stored as SDS strings or
  * simple arrays of integers, setTypeNext returns the encoding of the
  * set object you are iterating, and will populate the appropriate pointer
- * (sdsele) or (llele) accordingly.
+ * (sdsele) or (llele) accordingly. Elements of listpack encoded sets are
+ * returned as SDS strings owned by the iterator, only valid until the next
+ * call.
  *
  * Note that both the sdsele and llele pointers should be passed and cannot
  * be NULL since the function will try to defensively populate the non
@@ -161,6 +258,12 @@ int setTypeNext(setTypeIterator *si, sds *sdsele, int64_t *llele) {
         if (!intsetGet(si->subject->ptr,si->ii++,llele))
             return -1;
         *sdsele = NULL; /* Not needed. Defensive. */
+    } else if (si->encoding == OBJ_ENCODING_LISTPACK) {
+        if (si->lpi == NULL) return -1;
+        si->lpele = setTypeListpackGet(si->lpi,si->lpele);
+        si->lpi = lpNext(si->subject->ptr,si->lpi);
+        *sdsele = si->lpele;
+        *llele = -123456789; /* Not needed. Defensive. */
     } else {
         serverPanic("Wrong set encoding in setTypeNext");
     }
@@ -185,6 +288,7 @@ sds setTypeNextObject(setTypeIterator *si) {
         case OBJ_ENCODING_INTSET:
             return sdsfromlonglong(intele);
         case OBJ_ENCODING_HT:
+        case OBJ_ENCODING_LISTPACK:
             return sdsdup(sdsele);
         default:
             serverPanic("Unsupported encoding");
@@ -204,8 +308,13 @@ sds setTypeNextObject(setTypeIterator *si) {
  *
  * Note that both the sdsele and llele pointers should be passed and cannot
  * be NULL since the function will try to defensively populate the non
- * used field with values which are easy to trap if misused. */
+ * used field with values which are easy to trap if misused.
+ *
+ * Elements of listpack encoded sets are returned as an SDS string owned
+ * by this function, only valid until the next call. */
 int setTypeRandomElement(robj *setobj, sds *sdsele, int64_t *llele) {
+    static sds lpele = NULL;
+
     if (setobj->encoding == OBJ_ENCODING_HT) {
         dictEntry *de = dictGetRandomKey(setobj->ptr);
         *sdsele = dictGetKey(de);
@@ -213,6 +322,13 @@ int setTypeRandomElement(robj *setobj, sds *sdsele, int64_t *llele) {
     } else if (setobj->encoding == OBJ_ENCODING_INTSET) {
         *llele = intsetRandom(setobj->ptr);
         *sdsele = NULL; /* Not needed. Defensive. */
+    } else if (setobj->encoding == OBJ_ENCODING_LISTPACK) {
+        unsigned char *lp = setobj->ptr;
+        unsigned char *p = lpSeek(lp,random() % lpLength(lp));
+
+        lpele = setTypeListpackGet(p,lpele);
+        *sdsele = lpele;
+        *llele = -123456789; /* Not needed. Defensive. */
     } else {
         serverPanic("Unknown set encoding");
     }
@@ -224,6 +340,8 @@ unsigned long setTypeSize(const robj *subject) {
         return dictSize((const dict*)subject->ptr);
     } else if (subject->encoding == OBJ_ENCODING_INTSET) {
         return intsetLen((const intset*)subject->ptr);
+    } else if (subject->encoding == OBJ_ENCODING_LISTPACK) {
+        return lpLength((unsigned char*)subject->ptr);
     } else {
         serverPanic("Unknown set encoding");
     }
@@ -231,31 +349,49 @@ unsigned long setTypeSize(const robj *subject) {
 
 /* Convert the set to specified encoding. The resulting dict (when converting
  * to a hash table) is presized to hold the number of elements in the original
- * set. */
+ * set. Intsets can be converted to listpacks or hash tables, listpacks only
+ * to hash tables. */
 void setTypeConvert(robj *setobj, int enc) {
     setTypeIterator *si;
     serverAssertWithInfo(NULL,setobj,setobj->type == OBJ_SET &&
-                             setobj->encoding == OBJ_ENCODING_INTSET);
+                             (setobj->encoding == OBJ_ENCODING_INTSET ||
+                              setobj->encoding == OBJ_ENCODING_LISTPACK));
 
     if (enc == OBJ_ENCODING_HT) {
-        int64_t intele;
         dict *d = dictCreate(&setDictType,NULL);
         sds element;
 
         /* Presize the dict to avoid rehashing */
-        dictExpand(d,intsetLen(setobj->ptr));
+        dictExpand(d,setTypeSize(setobj));
 
-        /* To add the elements we extract integers and create redis objects */
+        /* Add a copy of every element, integers are turned into strings. */
         si = setTypeInitIterator(setobj);
-        while (setTypeNext(si,&element,&intele) != -1) {
-            element = sdsfromlonglong(intele);
+        while ((element = setTypeNextObject(si)) != NULL)
             serverAssert(dictAdd(d,element,NULL) == DICT_OK);
-        }
         setTypeReleaseIterator(si);
 
+        if (setobj->encoding == OBJ_ENCODING_LISTPACK)
+            lpFree(setobj->ptr);
+        else
+            zfree(setobj->ptr);
         setobj->encoding = OBJ_ENCODING_HT;
-        zfree(setobj->ptr);
         setobj->ptr = d;
+    } else if (enc == OBJ_ENCODING_LISTPACK &&
+               setobj->encoding == OBJ_ENCODING_INTSET)
+    {
+        unsigned char *lp = lpNew();
+        unsigned char buf[LONG_STR_SIZE];
+        int64_t intele;
+        int ii = 0, len;
+
+        while (intsetGet(setobj->ptr,ii++,&intele)) {
+            len = ll2string((char*)buf,sizeof(buf),intele);
+            lp = lpAppend(lp,buf,len);
+        }
+
+        setobj->encoding = OBJ_ENCODING_LISTPACK;
+        zfree(setobj->ptr);
+        setobj->ptr = lp;
     } else {
         serverPanic("Unsupported set conversion");
     }
@@ -789,8 +925,12 @@ int qsortCompareSetsByRevCardinality(const void *s1, const void *s2) {
     return 0;
 }
 
-void sinterGenericCommand(client *c, robj **setkeys,
-                          unsigned long setnum, robj *dstkey) {
+/* SINTER, SINTERSTORE and SINTERCARD. When 'cardinality_only' is true only
+ * the number of elements of the intersection is replied, stopping as soon
+ * as it reaches 'limit' if not zero, and the elements are never copied. */
+void sinterGenericCommand(client *c, robj **setkeys, unsigned long setnum,
+                          robj *dstkey, int cardinality_only,
+                          unsigned long limit) {
     robj **sets = zmalloc(sizeof(robj*)*setnum);
     setTypeIterator *si;
     robj *dstset = NULL;
@@ -798,7 +938,6 @@ void sinterGenericCommand(client *c, robj **setkeys,
     int64_t intobj;
     void *replylen = NULL;
     unsigned long j, cardinality = 0;
-    int encoding;
 
     for (j = 0; j < setnum; j++) {
         robj *setobj = dstkey ?
@@ -812,6 +951,8 @@ void sinterGenericCommand(client *c, robj **setkeys,
                     server.dirty++;
                 }
                 addReply(c,shared.czero);
+            } else if (cardinality_only) {
+                addReply(c,shared.czero);
             } else {
                 addReply(c,shared.emptymultibulk);
             }
@@ -832,65 +973,145 @@ void sinterGenericCommand(client *c, robj **setkeys,
      * the intersection set size, so we use a trick, append an empty object
      * to the output list and save the pointer to later modify it with the
      * right length */
-    if (!dstkey) {
+    if (!dstkey && !cardinality_only)
         replylen = addDeferredMultiBulkLength(c);
-    } else {
-        /* If we have a target key where to store the resulting set
-         * create this key with an empty set inside */
-        dstset = createIntsetObject();
-    }
 
-    /* Iterate all the elements of the first (smallest) set, and test
-     * the element against all the other sets, if at least one set does
-     * not include the element it is discarded */
-    si = setTypeInitIterator(sets[0]);
-    while((encoding = setTypeNext(si,&elesds,&intobj)) != -1) {
-        for (j = 1; j < setnum; j++) {
+    if (sets[0]->encoding == OBJ_ENCODING_INTSET) {
+        /* The smallest set is an intset: intersect it with all the other
+         * intsets using intsetIntersect(), that merges the sorted arrays
+         * instead of searching every element, then test what is left
+         * against the sets with a different encoding. */
+        intset *is = sets[0]->ptr, *dstis = NULL;
+        char buf[LONG_STR_SIZE];
+        int mixed = 0;
+        uint32_t ii;
+
+        for (j = 1; j < setnum && intsetLen(is); j++) {
             if (sets[j] == sets[0]) continue;
-            if (encoding == OBJ_ENCODING_INTSET) {
-                /* intset with intset is simple... and fast */
-                if (sets[j]->encoding == OBJ_ENCODING_INTSET &&
-                    !intsetFind((intset*)sets[j]->ptr,intobj))
-                {
-                    break;
-                /* in order to compare an integer with an object we
-                 * have to use the generic function, creating an object
-                 * for this */
-                } else if (sets[j]->encoding == OBJ_ENCODING_HT) {
-                    elesds = sdsfromlonglong(intobj);
-                    if (!setTypeIsMember(sets[j],elesds)) {
-                        sdsfree(elesds);
-                        break;
-                    }
-                    sdsfree(elesds);
+            if (sets[j]->encoding != OBJ_ENCODING_INTSET) {
+                mixed = 1;
+                continue;
+            }
+            intset *res = intsetIntersect(is,sets[j]->ptr);
+            if (is != sets[0]->ptr) zfree(is);
+            is = res;
+        }
+
+        if (!mixed && cardinality_only) {
+            cardinality = intsetLen(is);
+            if (limit && cardinality > limit) cardinality = limit;
+        } else if (!mixed && dstkey) {
+            /* The intersection is already the resulting set. */
+            if (is == sets[0]->ptr) {
+                is = zmalloc(intsetBlobLen(sets[0]->ptr));
+                memcpy(is,sets[0]->ptr,intsetBlobLen(sets[0]->ptr));
+            }
+            dstis = is;
+            is = NULL;
+        } else {
+            /* The other sets are checked converting the integers into
+             * the same string, that is never reallocated after the first
+             * few elements. */
+            elesds = mixed ? sdsempty() : NULL;
+            if (dstkey) dstis = intsetNew();
+            for (ii = 0; intsetGet(is,ii,&intobj); ii++) {
+                if (mixed)
+                    elesds = sdscpylen(elesds,buf,ll2string(buf,sizeof(buf),
+                                                            intobj));
+                for (j = 1; j < setnum; j++) {
+                    if (sets[j] == sets[0] ||
+                        sets[j]->encoding == OBJ_ENCODING_INTSET) continue;
+                    if (!setTypeIsMember(sets[j],elesds)) break;
                 }
-            } else if (encoding == OBJ_ENCODING_HT) {
-                if (!setTypeIsMember(sets[j],elesds)) {
-                    break;
+                if (j < setnum) continue;
+
+                if (dstkey) {
+                    /* Elements are appended in order, so this is cheap. */
+                    dstis = intsetAdd(dstis,intobj,NULL);
+                } else {
+                    if (!cardinality_only) addReplyBulkLongLong(c,intobj);
+                    cardinality++;
+                    if (limit && cardinality == limit) break;
                 }
             }
+            sdsfree(elesds);
         }
+        if (is != sets[0]->ptr) zfree(is);
 
-        /* Only take action when all sets contain the member */
-        if (j == setnum) {
-            if (!dstkey) {
-                if (encoding == OBJ_ENCODING_HT)
-                    addReplyBulkCBuffer(c,elesds,sdslen(elesds));
-                else
-                    addReplyBulkLongLong(c,intobj);
-                cardinality++;
-            } else {
-                if (encoding == OBJ_ENCODING_INTSET) {
-                    elesds = sdsfromlonglong(intobj);
-                    setTypeAdd(dstset,elesds);
-                    sdsfree(elesds);
+        if (dstkey) {
+            dstset = createObject(OBJ_SET,dstis);
+            dstset->encoding = OBJ_ENCODING_INTSET;
+            if (intsetLen(dstis) > server.set_max_intset_entries)
+                setTypeConvert(dstset,OBJ_ENCODING_HT);
+        }
+    } else {
+        /* Iterate all the elements of the first (smallest) set, and test
+         * them against all the other sets DICT_BATCH_SIZE at a time, so
+         * that the lookups into the hash table encoded sets are performed
+         * by dictFindBatch(), overlapping their cache misses. Elements that
+         * are not in some set are discarded. The elements of a listpack are
+         * copied into strings owned by the batch, since the iterator reuses
+         * the same string. */
+        sds batch[DICT_BATCH_SIZE], copies[DICT_BATCH_SIZE], *res = NULL;
+        dictEntry *des[DICT_BATCH_SIZE];
+        unsigned long n, k, m, reslen = 0, rescap = 0;
+        int copy = sets[0]->encoding != OBJ_ENCODING_HT, done = 0;
+
+        if (copy) for (k = 0; k < DICT_BATCH_SIZE; k++) copies[k] = sdsempty();
+        si = setTypeInitIterator(sets[0]);
+        while (!done) {
+            for (n = 0; n < DICT_BATCH_SIZE; n++) {
+                if (setTypeNext(si,&elesds,&intobj) == -1) {
+                    done = 1;
+                    break;
+                }
+                if (copy) {
+                    copies[n] = sdscpylen(copies[n],elesds,sdslen(elesds));
+                    elesds = copies[n];
+                }
+                batch[n] = elesds;
+            }
+
+            for (j = 1; j < setnum && n; j++) {
+                int ht = sets[j]->encoding == OBJ_ENCODING_HT;
+
+                if (sets[j] == sets[0]) continue;
+                if (ht) dictFindBatch(sets[j]->ptr,(void**)batch,n,des);
+                for (k = 0, m = 0; k < n; k++) {
+                    if (ht ? des[k] != NULL : setTypeIsMember(sets[j],batch[k]))
+                        batch[m++] = batch[k];
+                }
+                n = m;
+            }
+
+            /* Only take action for the elements all sets contain. */
+            for (k = 0; k < n; k++) {
+                if (dstkey) {
+                    if (reslen == rescap) {
+                        rescap = rescap ? rescap*2 : DICT_BATCH_SIZE;
+                        res = zrealloc(res,sizeof(sds)*rescap);
+                    }
+                    res[reslen++] = copy ? sdsdup(batch[k]) : batch[k];
                 } else {
-                    setTypeAdd(dstset,elesds);
+                    if (!cardinality_only)
+                        addReplyBulkCBuffer(c,batch[k],sdslen(batch[k]));
+                    cardinality++;
+                    if (limit && cardinality == limit) {
+                        done = 1;
+                        break;
+                    }
                 }
             }
         }
+        setTypeReleaseIterator(si);
+        if (copy) for (k = 0; k < DICT_BATCH_SIZE; k++) sdsfree(copies[k]);
+
+        if (dstkey) {
+            dstset = setTypeCreateFromElements(res,reslen);
+            if (copy) for (k = 0; k < reslen; k++) sdsfree(res[k]);
+            zfree(res);
+        }
     }
-    setTypeReleaseIterator(si);
 
     if (dstkey) {
         /* Store the resulting set into the target, if the intersection
@@ -910,6 +1131,8 @@ void sinterGenericCommand(client *c, robj **setkeys,
         }
         signalModifiedKey(c->db,dstkey);
         server.dirty++;
+    } else if (cardinality_only) {
+        addReplyLongLong(c,cardinality);
     } else {
         setDeferredMultiBulkLength(c,replylen,cardinality);
     }
@@ -917,11 +1140,42 @@ void sinterGenericCommand(client *c, robj **setkeys,
 }
 
 void sinterCommand(client *c) {
-    sinterGenericCommand(c,c->argv+1,c->argc-1,NULL);
+    sinterGenericCommand(c,c->argv+1,c->argc-1,NULL,0,0);
 }
 
 void sinterstoreCommand(client *c) {
-    sinterGenericCommand(c,c->argv+2,c->argc-2,c->argv[1]);
+    sinterGenericCommand(c,c->argv+2,c->argc-2,c->argv[1],0,0);
+}
+
+/* SINTERCARD numkeys key [key ...] [LIMIT limit] */
+void sintercardCommand(client *c) {
+    long j, numkeys, limit = 0;
+
+    if (getLongFromObjectOrReply(c,c->argv[1],&numkeys,NULL) != C_OK)
+        return;
+    if (numkeys < 1) {
+        addReplyError(c,"numkeys should be greater than 0");
+        return;
+    }
+    if (numkeys > c->argc-2) {
+        addReplyError(c,"Number of keys can't be greater than number of args");
+        return;
+    }
+
+    for (j = 2+numkeys; j < c->argc; j++) {
+        if (!strcasecmp(c->argv[j]->ptr,"limit") && j+1 < c->argc) {
+            if (getLongFromObjectOrReply(c,c->argv[++j],&limit,NULL) != C_OK)
+                return;
+            if (limit < 0) {
+                addReplyError(c,"LIMIT can't be negative");
+                return;
+            }
+        } else {
+            addReply(c,shared.syntaxerr);
+            return;
+        }
+    }
+    sinterGenericCommand(c,c->argv+2,numkeys,NULL,1,limit);
 }
 
 #define SET_OP_UNION 0
@@ -987,21 +1241,67 @@ void sunionDiffGenericCommand(client *c, robj **setkeys, int setnum,
 
     /* We need a temp set object to store our union. If the dstkey
      * is not NULL (that is, we are inside an SUNIONSTORE operation) then
-     * this set object will be the resulting object to set into the target key*/
-    dstset = createIntsetObject();
+     * this set object will be the resulting object to set into the target key.
+     * The union creates it by itself, directly in its final encoding. */
+    if (op != SET_OP_UNION) dstset = createIntsetObject();
 
     if (op == SET_OP_UNION) {
         /* Union is trivial, just add every element of every set to the
-         * temporary set. */
+         * temporary set. When the encoding of the result is known in
+         * advance the set is created directly with it: the union of intsets
+         * is computed merging them with intsetUnion(), and when some set
+         * is too big for an intset or a listpack, the union is a hash table
+         * presized for that set. */
+        unsigned long maxsize = 0;
+        int allintsets = 1, encoding;
+        int64_t intobj;
+
         for (j = 0; j < setnum; j++) {
             if (!sets[j]) continue; /* non existing keys are like empty sets */
+            if (sets[j]->encoding != OBJ_ENCODING_INTSET) allintsets = 0;
+            if (setTypeSize(sets[j]) > maxsize) maxsize = setTypeSize(sets[j]);
+        }
 
-            si = setTypeInitIterator(sets[j]);
-            while((ele = setTypeNextObject(si)) != NULL) {
-                if (setTypeAdd(dstset,ele)) cardinality++;
-                sdsfree(ele);
+        if (allintsets) {
+            intset *is = intsetNew();
+
+            for (j = 0; j < setnum; j++) {
+                if (!sets[j]) continue;
+                intset *res = intsetUnion(is,sets[j]->ptr);
+                zfree(is);
+                is = res;
+            }
+            dstset = createObject(OBJ_SET,is);
+            dstset->encoding = OBJ_ENCODING_INTSET;
+            cardinality = intsetLen(is);
+            if (intsetLen(is) > server.set_max_intset_entries)
+                setTypeConvert(dstset,OBJ_ENCODING_HT);
+        } else {
+            if (maxsize > server.set_max_intset_entries &&
+                maxsize > server.set_max_listpack_entries)
+            {
+                dstset = createSetObject();
+                dictExpand(dstset->ptr,maxsize);
+            } else {
+                dstset = createIntsetObject();
+            }
+
+            for (j = 0; j < setnum; j++) {
+                if (!sets[j]) continue;
+
+                si = setTypeInitIterator(sets[j]);
+                while((encoding = setTypeNext(si,&ele,&intobj)) != -1) {
+                    if (encoding == OBJ_ENCODING_INTSET) {
+                        ele = sdsfromlonglong(intobj);
+                        if (setTypeAdd(dstset,ele)) cardinality++;
+                        sdsfree(ele);
+                    } else {
+                        /* setTypeAdd() copies the element only if added. */
+                        if (setTypeAdd(dstset,ele)) cardinality++;
+                    }
+                }
+                setTypeReleaseIterator(si);
             }
-            setTypeReleaseIterator(si);
         }
     } else if (op == SET_OP_DIFF && sets[0] && diff_algo == 1) {
         /* DIFF Algorithm 1:
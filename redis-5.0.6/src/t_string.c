@@ -283,18 +283,25 @@ void getrangeCommand(client *c) {
 }
 
 void mgetCommand(client *c) {
-    int j;
+    robj *vals[DICT_BATCH_SIZE];
+    int j, k;
 
     addReplyMultiBulkLen(c,c->argc-1);
-    for (j = 1; j < c->argc; j++) {
-        robj *o = lookupKeyRead(c->db,c->argv[j]);
-        if (o == NULL) {
-            addReply(c,shared.nullbulk);
-        } else {
-            if (o->type != OBJ_STRING) {
+    for (j = 1; j < c->argc; j += DICT_BATCH_SIZE) {
+        int n = c->argc-j < DICT_BATCH_SIZE ? c->argc-j : DICT_BATCH_SIZE;
+
+        lookupKeysRead(c->db,c->argv+j,n,vals);
+        for (k = 0; k < n; k++) {
+            robj *o = vals[k];
+            if (o == NULL) {
                 addReply(c,shared.nullbulk);
             } else {
-                addReplyBulk(c,o);
+                if (o->type != OBJ_STRING) {
+                    addReply(c,shared.nullbulk);
+                } else {
+                    addReplyBulk(c,o);
+                }
+                decrRefCount(o);
             }
         }
     }
@@ -312,6 +319,8 @@ void msetGenericCommand(client *c, int nx) {
      * set anything if at least one key alerady exists. */
     if (nx) {
         for (j = 1; j < c->argc; j += 2) {
+            if ((j-1) % (DICT_BATCH_SIZE*2) == 0)
+                dbPrefetchKeys(c->db,c->argv+j,(c->argc-j)/2,2);
             if (lookupKeyWrite(c->db,c->argv[j]) != NULL) {
                 addReply(c, shared.czero);
                 return;
@@ -320,6 +329,8 @@ void msetGenericCommand(client *c, int nx) {
     }
 
     for (j = 1; j < c->argc; j += 2) {
+        if ((j-1) % (DICT_BATCH_SIZE*2) == 0)
+            dbPrefetchKeys(c->db,c->argv+j,(c->argc-j)/2,2);
         c->argv[j+1] = tryObjectEncoding(c->argv[j+1]);
         setKey(c->db,c->argv[j],c->argv[j+1]);
         notifyKeyspaceEvent(NOTIFY_STRING,"set",c->argv[j],c->db->id);
@@ -43,6 +43,71 @@
 
 #include "util.h"
 #include "sha1.h"
+#include "zmalloc.h"
+
+/* Match the character 'c' against the character class starting at
+ * '*pattern', just after the opening bracket. On return '*pattern' points
+ * to the closing bracket, or to the last character of the pattern if the
+ * class is not terminated. */
+static int stringmatchClass(const char **patternp, int *patternLenp,
+        char c, int nocase)
+{
+    const char *pattern = *patternp;
+    int patternLen = *patternLenp;
+    int not, match;
+
+    not = pattern[0] == '^';
+    if (not) {
+        pattern++;
+        patternLen--;
+    }
+    match = 0;
+    while(1) {
+        if (pattern[0] == '\\' && patternLen >= 2) {
+            pattern++;
+            patternLen--;
+            if (pattern[0] == c)
+                match = 1;
+        } else if (pattern[0] == ']') {
+            break;
+        } else if (patternLen == 0) {
+            pattern--;
+            patternLen++;
+            break;
+        } else if (pattern[1] == '-' && patternLen >= 3) {
+            int start = pattern[0];
+            int end = pattern[2];
+            int cc = c;
+            if (start > end) {
+                int t = start;
+                start = end;
+                end = t;
+            }
+            if (nocase) {
+                start = tolower(start);
+                end = tolower(end);
+                cc = tolower(cc);
+            }
+            pattern += 2;
+            patternLen -= 2;
+            if (cc >= start && cc <= end)
+                match = 1;
+        } else {
+            if (!nocase) {
+                if (pattern[0] == c)
+                    match = 1;
+            } else {
+                if (tolower((int)pattern[0]) == tolower((int)c))
+                    match = 1;
+            }
+        }
+        pattern++;
+        patternLen--;
+    }
+    *patternp = pattern;
+    *patternLenp = patternLen;
+    return not ? !match : match;
+}
 
 /* Glob-style pattern matching. */
 int stringmatchlen(const char *pattern, int patternLen,
@@ -73,67 +138,13 @@ int stringmatchlen(const char *pattern, int patternLen,
             stringLen--;
             break;
         case '[':
-        {
-            int not, match;
-
             pattern++;
             patternLen--;
-            not = pattern[0] == '^';
-            if (not) {
-                pattern++;
-                patternLen--;
-            }
-            match = 0;
-            while(1) {
-                if (pattern[0] == '\\' && patternLen >= 2) {
-                    pattern++;
-                    patternLen--;
-                    if (pattern[0] == string[0])
-                        match = 1;
-                } else if (pattern[0] == ']') {
-                    break;
-                } else if (patternLen == 0) {
-                    pattern--;
-                    patternLen++;
-                    break;
-                } else if (pattern[1] == '-' && patternLen >= 3) {
-                    int start = pattern[0];
-                    int end = pattern[2];
-                    int c = string[0];
-                    if (start > end) {
-                        int t = start;
-                        start = end;
-                        end = t;
-                    }
-                    if (nocase) {
-                        start = tolower(start);
-                        end = tolower(end);
-                        c = tolower(c);
-                    }
-                    pattern += 2;
-                    patternLen -= 2;
-                    if (c >= start && c <= end)
-                        match = 1;
-                } else {
-                    if (!nocase) {
-                        if (pattern[0] == string[0])
-                            match = 1;
-                    } else {
-                        if (tolower((int)pattern[0]) == tolower((int)string[0]))
-                            match = 1;
-                    }
-                }
-                pattern++;
-                patternLen--;
-            }
-            if (not)
-                match = !match;
-            if (!match)
+            if (!stringmatchClass(&pattern,&patternLen,string[0],nocase))
                 return 0; /* no match */
             string++;
             stringLen--;
             break;
-        }
         case '\\':
             if (patternLen >= 2) {
                 pattern++;
@@ -171,20 +182,258 @@ int stringmatch(const char *pattern, const char *string, int nocase) {
     return stringmatchlen(pattern,strlen(pattern),string,strlen(string),nocase);
 }
 
-/* Fuzz stringmatchlen() trying to crash it with bad input. */
+/* Compiled glob-style patterns.
+ *
+ * stringmatchlen() interprets the pattern again for every string, and
+ * backtracks recursively at every '*'. When many strings are matched
+ * against the same pattern, as KEYS, SCAN MATCH and pattern subscriptions
+ * do, the pattern is better compiled once with stringmatchCompile(), and
+ * strings are then matched with stringmatchCompiled(), with the same exact
+ * results of stringmatchlen().
+ *
+ * Patterns made only of literal characters and '*', like "user:*:name" or
+ * "*session*", are matched checking the literal prefix and suffix, and
+ * looking for the literals in between with memchr(), that is vectorized by
+ * most libc implementations. Other patterns are compiled to a sequence of
+ * tokens, each being either a '*' or a 256 bits set of the characters
+ * matching a single position of the string, so that '?', character classes
+ * and case insensitive characters all cost a single bit test. Such tokens
+ * can be matched in a single pass, only going back to the last '*' seen on
+ * mismatch. */
+
+#define STRINGMATCH_STAR 1      /* Token matching any number of characters. */
+
+typedef struct stringmatchToken {
+    int star;                   /* STRINGMATCH_STAR or 0. */
+    uint64_t set[4];            /* Characters matching this position. */
+} stringmatchToken;
+
+struct stringmatchPattern {
+    int patternLen;             /* Length of the original pattern. */
+    int literal;                /* True if the pattern is only literals and
+                                   '*': 'buf' and 'seglen' are used. */
+    int minlen;                 /* Min length of a matching string. */
+    int stars;                  /* Number of '*' (after collapsing them). */
+    /* Literal patterns: the stars+1 literal segments, concatenated. */
+    char *buf;
+    int *seglen;
+    /* Other patterns. */
+    int numtokens;
+    stringmatchToken *tokens;
+};
+
+static void stringmatchSetAdd(uint64_t *set, unsigned char c) {
+    set[c >> 6] |= 1ULL << (c & 63);
+}
+
+static int stringmatchSetHas(const uint64_t *set, unsigned char c) {
+    return (set[c >> 6] >> (c & 63)) & 1;
+}
+
+/* Compile the glob-style 'pattern' of 'patternLen' bytes, which is parsed
+ * exactly like stringmatchlen() does. The returned pattern should be
+ * released with stringmatchFree(). */
+stringmatchPattern *stringmatchCompile(const char *pattern, int patternLen,
+        int nocase)
+{
+    stringmatchPattern *sp = zcalloc(sizeof(*sp));
+    int buflen = 0;
+
+    sp->patternLen = patternLen;
+    sp->literal = !nocase;
+    sp->tokens = zmalloc(sizeof(stringmatchToken)*(patternLen ? patternLen : 1));
+    sp->buf = zmalloc(patternLen ? patternLen : 1);
+    sp->seglen = zcalloc(sizeof(int)*(patternLen+1));
+    while(patternLen) {
+        stringmatchToken *t = sp->tokens+sp->numtokens++;
+        int c;
+
+        memset(t,0,sizeof(*t));
+        switch(pattern[0]) {
+        case '*':
+            while (patternLen > 1 && pattern[1] == '*') {
+                pattern++;
+                patternLen--;
+            }
+            t->star = STRINGMATCH_STAR;
+            sp->stars++;
+            break;
+        case '?':
+            memset(t->set,0xff,sizeof(t->set));
+            sp->literal = 0;
+            break;
+        case '[':
+        {
+            const char *p = NULL;
+            int plen = 0;
+
+            pattern++;
+            patternLen--;
+            for (c = 0; c < 256; c++) {
+                p = pattern;
+                plen = patternLen;
+                if (stringmatchClass(&p,&plen,(char)c,nocase))
+                    stringmatchSetAdd(t->set,c);
+            }
+            pattern = p;
+            patternLen = plen;
+            sp->literal = 0;
+            break;
+        }
+        case '\\':
+            if (patternLen >= 2) {
+                pattern++;
+                patternLen--;
+            }
+            /* fall through */
+        default:
+            for (c = 0; c < 256; c++) {
+                if (nocase ? tolower((int)pattern[0]) == tolower((char)c) :
+                             pattern[0] == (char)c)
+                    stringmatchSetAdd(t->set,c);
+            }
+            sp->buf[buflen++] = pattern[0];
+            sp->seglen[sp->stars]++;
+            break;
+        }
+        if (!t->star) sp->minlen++;
+        pattern++;
+        patternLen--;
+    }
+    if (sp->literal) {
+        zfree(sp->tokens);
+        sp->tokens = NULL;
+    } else {
+        zfree(sp->buf);
+        zfree(sp->seglen);
+        sp->buf = NULL;
+        sp->seglen = NULL;
+    }
+    return sp;
+}
+
+void stringmatchFree(stringmatchPattern *sp) {
+    if (sp == NULL) return;
+    zfree(sp->tokens);
+    zfree(sp->buf);
+    zfree(sp->seglen);
+    zfree(sp);
+}
+
+/* Match a literal pattern: the first segment is a prefix, the last one a
+ * suffix, and the ones in between should appear in order, without
+ * overlapping, in the rest of the string. */
+static int stringmatchLiteral(const stringmatchPattern *sp,
+        const char *string, int stringLen)
+{
+    const char *seg = sp->buf, *end;
+    int j, len = sp->seglen[0];
+
+    if (sp->stars == 0)
+        return stringLen == len && memcmp(string,seg,len) == 0;
+    if (stringLen < sp->minlen || memcmp(string,seg,len) != 0) return 0;
+    string += len;
+    stringLen -= len;
+    seg += len;
+
+    /* Check the suffix now, so that the middle segments are searched in
+     * what is left between the prefix and the suffix. */
+    end = sp->buf + sp->minlen - sp->seglen[sp->stars];
+    if (memcmp(string+stringLen-sp->seglen[sp->stars],end,
+               sp->seglen[sp->stars]) != 0) return 0;
+    stringLen -= sp->seglen[sp->stars];
+
+    for (j = 1; j < sp->stars; j++) {
+        const char *found;
+
+        /* Keys are usually short, so instead of memmem(), that has some
+         * setup cost, look for the first character with memchr(), and
+         * verify the rest of the segment where it is found. */
+        len = sp->seglen[j];
+        while (1) {
+            found = stringLen >= len ? memchr(string,seg[0],stringLen-len+1) :
+                                       NULL;
+            if (found == NULL) return 0;
+            if (memcmp(found+1,seg+1,len-1) == 0) break;
+            stringLen -= (found-string)+1;
+            string = found+1;
+        }
+        stringLen -= (found-string)+len;
+        string = found+len;
+        seg += len;
+    }
+    return 1;
+}
+
+/* Match a string against a compiled pattern. Returns 1 on match, like
+ * stringmatchlen() with the same pattern would, otherwise 0. The pattern
+ * is not modified, so different threads can use it at the same time. */
+int stringmatchCompiled(const stringmatchPattern *sp, const char *string,
+        int stringLen)
+{
+    const stringmatchToken *t = sp->tokens;
+    int tok = 0, startok = -1, starpos = 0, pos = 0;
+
+    /* Like stringmatchlen(), an empty string only matches an empty
+     * pattern, even "*". */
+    if (stringLen == 0) return sp->patternLen == 0;
+    if (stringLen < sp->minlen) return 0;
+    if (sp->stars == 0 && stringLen != sp->minlen) return 0;
+    if (sp->literal) return stringmatchLiteral(sp,string,stringLen);
+
+    while (pos < stringLen) {
+        if (tok < sp->numtokens && t[tok].star) {
+            startok = tok++;
+            starpos = pos;
+        } else if (tok < sp->numtokens &&
+                   stringmatchSetHas(t[tok].set,string[pos]))
+        {
+            tok++;
+            pos++;
+        } else if (startok != -1) {
+            /* Let the last '*' match one more character, and retry. */
+            tok = startok+1;
+            pos = ++starpos;
+        } else {
+            return 0;
+        }
+    }
+    while (tok < sp->numtokens && t[tok].star) tok++;
+    return tok == sp->numtokens;
+}
+
+/* Fuzz stringmatchlen() trying to crash it with bad input, and check
+ * that compiled patterns give the same results. Returns the number of
+ * strings where the results differ. */
 int stringmatchlen_fuzz_test(void) {
+    const char *charset = "*?[]^-\\abAB\xe9";
     char str[32];
-    char pat[32];
-    int cycles = 10000000;
-    int total_matches = 0;
+    char pat[33];
+    int cycles = 100000;
+    int mismatches = 0;
     while(cycles--) {
-        int strlen = rand() % sizeof(str);
-        int patlen = rand() % sizeof(pat);
-        for (int j = 0; j < strlen; j++) str[j] = rand() % 128;
-        for (int j = 0; j < patlen; j++) pat[j] = rand() % 128;
-        total_matches += stringmatchlen(pat, patlen, str, strlen, 0);
+        int patlen = rand() % (sizeof(pat)-1);
+        int nocase = cycles & 1;
+        int special = cycles & 2;
+        stringmatchPattern *sp;
+
+        /* Half of the times use mostly special characters, to actually
+         * exercise the different kinds of patterns. */
+        for (int j = 0; j < patlen; j++)
+            pat[j] = special ? charset[rand() % 13] : rand() % 128;
+        pat[patlen] = '\0';
+        sp = stringmatchCompile(pat, patlen, nocase);
+        for (int i = 0; i < 100; i++) {
+            int strlen = rand() % sizeof(str);
+
+            for (int j = 0; j < strlen; j++)
+                str[j] = special ? charset[rand() % 13] : rand() % 128;
+            if (stringmatchlen(pat, patlen, str, strlen, nocase) !=
+                stringmatchCompiled(sp, str, strlen)) mismatches++;
+        }
+        stringmatchFree(sp);
     }
-    return total_matches;
+    return mismatches;
 }
 
 /* Convert a string representing an amount of memory into the number of
@@ -472,7 +721,7 @@ int string2ld(const char *s, size_t slen, long double *dp) {
  * required. The representation should always be parsable by strtod(3).
  * This function does not support human-friendly formatting like ld2string
  * does. It is intended mainly to be used inside t_zset.c when writing scores
- * into a ziplist representing a sorted set. */
+ * into a listpack representing a sorted set. */
 int d2string(char *buf, size_t len, double value) {
     if (isnan(value)) {
         len = snprintf(buf,len,"nan");
@@ -41,6 +41,10 @@
 int stringmatchlen(const char *p, int plen, const char *s, int slen, int nocase);
 int stringmatch(const char *p, const char *s, int nocase);
 int stringmatchlen_fuzz_test(void);
+typedef struct stringmatchPattern stringmatchPattern;
+stringmatchPattern *stringmatchCompile(const char *p, int plen, int nocase);
+int stringmatchCompiled(const stringmatchPattern *sp, const char *s, int slen);
+void stringmatchFree(stringmatchPattern *sp);
 long long memtoll(const char *p, int *err);
 uint32_t digits10(uint64_t v);
 uint32_t sdigits10(int64_t v);
@@ -0,0 +1,63 @@
+#define REDISMODULE_EXPERIMENTAL_API
+#include "redismodule.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+/* test.call_generic <command> [arg ...]: run the command with RM_Call()
+ * and reply with what it replied. */
+int test_call_generic(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+{
+    if (argc < 2) {
+        RedisModule_WrongArity(ctx);
+        return REDISMODULE_OK;
+    }
+
+    const char *cmdname = RedisModule_StringPtrLen(argv[1], NULL);
+    RedisModuleCallReply *reply = RedisModule_Call(ctx, cmdname, "v", argv+2, argc-2);
+    if (reply) {
+        RedisModule_ReplyWithCallReply(ctx, reply);
+        RedisModule_FreeCallReply(reply);
+    } else {
+        RedisModule_ReplyWithError(ctx, strerror(errno));
+    }
+    return REDISMODULE_OK;
+}
+
+/* When a key named "refresh:<n>" expires, set again all the keys from
+ * "refresh:0" to "refresh:9", without a TTL. */
+int test_refresh_on_expire(RedisModuleCtx *ctx, int type, const char *event, RedisModuleString *key)
+{
+    REDISMODULE_NOT_USED(type);
+    REDISMODULE_NOT_USED(event);
+
+    const char *keyname = RedisModule_StringPtrLen(key, NULL);
+    if (strncmp(keyname, "refresh:", 8) != 0) return REDISMODULE_OK;
+
+    for (int j = 0; j < 10; j++) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "refresh:%d", j);
+        RedisModuleCallReply *reply = RedisModule_Call(ctx, "SET", "cc", buf, "refreshed");
+        if (reply) RedisModule_FreeCallReply(reply);
+    }
+    return REDISMODULE_OK;
+}
+
+int RedisModule_OnLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    REDISMODULE_NOT_USED(argv);
+    REDISMODULE_NOT_USED(argc);
+
+    if (RedisModule_Init(ctx,"misc",1,REDISMODULE_APIVER_1)
+            == REDISMODULE_ERR) return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx,"test.call_generic",
+                test_call_generic,"write deny-oom",0,0,0) == REDISMODULE_ERR)
+            return REDISMODULE_ERR;
+
+    if (RedisModule_SubscribeToKeyspaceEvents(ctx,REDISMODULE_NOTIFY_EXPIRED,
+                test_refresh_on_expire) == REDISMODULE_ERR)
+            return REDISMODULE_ERR;
+
+    return REDISMODULE_OK;
+}
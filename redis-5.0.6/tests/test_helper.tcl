@@ -62,6 +62,10 @@ set ::all_tests {
     unit/lazyfree
     unit/wait
     unit/pendingquerybuf
+    unit/querybuf
+    unit/threaded-io
+    unit/batched-io
+    unit/networking
 }
 # Index to the next test to run in the ::all_tests list.
 set ::next_test 0
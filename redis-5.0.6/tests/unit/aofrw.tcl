@@ -106,10 +106,10 @@ start_server {tags {"aofrw"} overrides {aof-use-rdb-preamble no}} {
     }
 
     foreach d {string int} {
-        foreach e {intset hashtable} {
+        foreach e {intset listpack hashtable} {
             test "AOF rewrite of set with $e encoding, $d data" {
                 r flushall
-                if {$e eq {intset}} {set len 10} else {set len 1000}
+                if {$e eq {hashtable}} {set len 1000} else {set len 10}
                 for {set j 0} {$j < $len} {incr j} {
                     if {$d eq {string}} {
                         set data [randstring 0 16 alpha]
@@ -118,7 +118,10 @@ start_server {tags {"aofrw"} overrides {aof-use-rdb-preamble no}} {
                     }
                     r sadd key $data
                 }
-                if {$d ne {string}} {
+                if {$e eq {listpack}} {
+                    r sadd key x ; # Make sure it's not intset encoded
+                    assert_equal [r object encoding key] $e
+                } elseif {$d ne {string}} {
                     assert_equal [r object encoding key] $e
                 }
                 set d1 [r debug digest]
@@ -134,10 +137,10 @@ start_server {tags {"aofrw"} overrides {aof-use-rdb-preamble no}} {
     }
 
     foreach d {string int} {
-        foreach e {ziplist hashtable} {
+        foreach e {listpack hashtable} {
             test "AOF rewrite of hash with $e encoding, $d data" {
                 r flushall
-                if {$e eq {ziplist}} {set len 10} else {set len 1000}
+                if {$e eq {listpack}} {set len 10} else {set len 1000}
                 for {set j 0} {$j < $len} {incr j} {
                     if {$d eq {string}} {
                         set data [randstring 0 16 alpha]
@@ -160,10 +163,10 @@ start_server {tags {"aofrw"} overrides {aof-use-rdb-preamble no}} {
     }
 
     foreach d {string int} {
-        foreach e {ziplist skiplist} {
+        foreach e {listpack skiplist} {
             test "AOF rewrite of zset with $e encoding, $d data" {
                 r flushall
-                if {$e eq {ziplist}} {set len 10} else {set len 1000}
+                if {$e eq {listpack}} {set len 10} else {set len 1000}
                 for {set j 0} {$j < $len} {incr j} {
                     if {$d eq {string}} {
                         set data [randstring 0 16 alpha]
@@ -0,0 +1,110 @@
+start_server {tags {"batched-io"}} {
+    # Batched socket I/O is only performed by the io_uring event loop, see
+    # 'make test-iouring'. With other backends these tests still check that
+    # the same workloads are served by the usual read(2) and write(2) path.
+    test {Many pipelining clients are served correctly} {
+        set clients {}
+        for {set j 0} {$j < 32} {incr j} {
+            lappend clients [redis_deferring_client]
+        }
+
+        set j 0
+        foreach rd $clients {
+            for {set i 0} {$i < 100} {incr i} {
+                $rd set key:$j:$i val:$j:$i
+                $rd get key:$j:$i
+            }
+            incr j
+        }
+        set j 0
+        foreach rd $clients {
+            for {set i 0} {$i < 100} {incr i} {
+                assert_equal OK [$rd read]
+                assert_equal val:$j:$i [$rd read]
+            }
+            incr j
+        }
+
+        foreach rd $clients {$rd close}
+        r dbsize
+    } {3200}
+
+    test {Big replies are delivered in full next to clients not reading} {
+        r del biglist
+        for {set i 0} {$i < 10000} {incr i} {
+            r rpush biglist [string repeat x 100]$i
+        }
+
+        # The replies of these clients fill the socket buffers: they are
+        # only read after the other clients got theirs.
+        set stalled {}
+        for {set j 0} {$j < 4} {incr j} {
+            set rd [redis_deferring_client]
+            $rd lrange biglist 0 -1
+            lappend stalled $rd
+        }
+        set clients {}
+        for {set j 0} {$j < 16} {incr j} {
+            set rd [redis_deferring_client]
+            $rd lrange biglist 0 99
+            $rd ping
+            lappend clients $rd
+        }
+        foreach rd $clients {
+            assert_equal 100 [llength [$rd read]]
+            assert_equal PONG [$rd read]
+            $rd close
+        }
+        foreach rd $stalled {
+            set reply [$rd read]
+            assert_equal 10000 [llength $reply]
+            assert_equal [string repeat x 100]9999 [lindex $reply end]
+            $rd close
+        }
+    }
+
+    test {Clients closing the connection don't affect the others} {
+        set clients {}
+        for {set j 0} {$j < 16} {incr j} {
+            set rd [redis_deferring_client]
+            $rd lrange biglist 0 -1
+            lappend clients $rd
+        }
+        # Half of the clients go away without reading their reply.
+        set j 0
+        set survivors {}
+        foreach rd $clients {
+            if {$j % 2} {
+                $rd close
+            } else {
+                lappend survivors $rd
+            }
+            incr j
+        }
+        foreach rd $survivors {
+            assert_equal 10000 [llength [$rd read]]
+            $rd close
+        }
+        r ping
+    } {PONG}
+
+    test {Protocol errors are reported to clients served in batch} {
+        set clients {}
+        for {set j 0} {$j < 16} {incr j} {
+            set rd [redis_deferring_client]
+            $rd ping
+            lappend clients $rd
+        }
+        set s [socket [srv 0 host] [srv 0 port]]
+        fconfigure $s -translation binary
+        puts -nonewline $s "*3000000000\r\n"
+        flush $s
+        foreach rd $clients {
+            assert_equal PONG [$rd read]
+            $rd close
+        }
+        set e [gets $s]
+        close $s
+        set e
+    } {*Protocol error*}
+}
@@ -178,6 +178,17 @@ start_server {tags {"expire"}} {
         list $size1 $size2 $size3
     } {3 3 0}
 
+    test {Keys repeated in MGET and EXISTS are lazy expired once} {
+        r flushdb
+        r debug set-active-expire 0
+        r psetex foo 1 a
+        r set bar b
+        after 10
+        set res [list [r mget foo bar foo bar] [r exists foo bar foo]]
+        r debug set-active-expire 1
+        lappend res [r dbsize]
+    } {{{} b {} b} 1 1}
+
     test {EXPIRE should not resurrect keys (issue #1026)} {
         r debug set-active-expire 0
         r set foo bar
@@ -219,4 +230,56 @@ start_server {tags {"expire"}} {
         set ttl [r ttl foo]
         assert {$ttl <= 98 && $ttl > 90}
     }
+
+    test {Keys with an expire are tracked when the expire changes or is removed} {
+        r config set appendonly no
+        r flushdb
+        for {set j 0} {$j < 1000} {incr j} {
+            r set key$j val ex 100
+        }
+        set volatile 1000
+        for {set j 0} {$j < 1000} {incr j 3} {
+            r pexpire key$j [expr {200000+$j*10}]
+        }
+        for {set j 1} {$j < 1000} {incr j 3} {
+            r persist key$j
+            incr volatile -1
+        }
+        for {set j 0} {$j < 1000} {incr j 6} {
+            r del key$j
+            incr volatile -1
+        }
+        assert_match "*keys=[r dbsize],expires=$volatile,*" [r info keyspace]
+        for {set j 3} {$j < 1000} {incr j 6} {
+            r pexpire key$j 1
+        }
+        wait_for_condition 50 100 {
+            [r dbsize] == 1000-167-167
+        } else {
+            fail "Keys with an expired TTL were not actively expired"
+        }
+        assert_equal -1 [r ttl key1]
+        assert {[r pttl key2] > 90000}
+    }
+
+    test {All the expired keys are actively expired, with lag stats} {
+        r flushdb
+        r config resetstat
+        r debug populate 10000 persistent
+        for {set j 0} {$j < 1000} {incr j} {
+            r set volatile$j val ex 1000
+        }
+        for {set j 0} {$j < 100} {incr j} {
+            r psetex expiring$j 100 val
+        }
+        wait_for_condition 50 100 {
+            [r dbsize] == 11000
+        } else {
+            fail "Keys with an expired TTL were not actively expired"
+        }
+        assert_equal 100 [s expired_active_keys]
+        assert {[s expired_lag_max_ms] < 5000}
+        assert {[s expired_lag_avg_ms] <= [s expired_lag_max_ms]}
+        assert_equal 0 [s expired_backlog_ms]
+    }
 }
@@ -24,6 +24,25 @@ start_server {tags {"keyspace"}} {
         lsort [r keys *]
     } {foo_a foo_b foo_c key_x key_y key_z}
 
+    test {KEYS with literal, class and escaped patterns} {
+        r set {a*b} hello
+        r set {a?b} hello
+        set res {}
+        lappend res [lsort [r keys *_*]]
+        lappend res [lsort [r keys *o_*]]
+        lappend res [lsort [r keys key_x]]
+        lappend res [lsort [r keys {*_[^a-b]}]]
+        lappend res [lsort [r keys {?o?_[ac]}]]
+        lappend res [lsort [r keys {a\*b}]]
+        lappend res [lsort [r keys {a[*?]b}]]
+        r del {a*b} {a?b}
+        set res
+    } {{foo_a foo_b foo_c key_x key_y key_z} {foo_a foo_b foo_c} key_x {foo_c key_x key_y key_z} {foo_a foo_c} a*b {a*b a?b}}
+
+    test {Compiled patterns match like stringmatchlen()} {
+        r debug stringmatch-test
+    } {Apparently Redis did not crash: test passed}
+
     test {DBSIZE} {
         r dbsize
     } {6}
@@ -272,4 +291,90 @@ start_server {tags {"keyspace"}} {
         r keys *
         r keys *
     } {dlskeriewrioeuwqoirueioqwrueoqwrueqw}
+
+    test {KEYS in background against big databases} {
+        r flushdb
+        r config set keys-background-threshold 1000
+        r debug populate 50000
+        for {set j 0} {$j < 100} {incr j} {
+            r set foo$j bar
+        }
+        r psetex foo100 1 bar
+        after 10
+        set expected {}
+        for {set j 0} {$j < 100} {incr j} {
+            lappend expected foo$j
+        }
+        assert_equal [lsort $expected] [lsort [r keys foo*]]
+        assert_equal 50100 [llength [r keys *]]
+        assert_equal {foo10 foo20 foo30 foo40 foo50 foo60 foo70 foo80 foo90} \
+            [lsort [r keys foo?0]]
+        r multi
+        r keys foo1
+        assert_equal {foo1} [lindex [r exec] 0]
+        assert_equal {foo1} [r eval {return redis.call('keys','foo1')} 0]
+        r config set keys-background-threshold 100000
+    }
+
+    test {Clients closed during a background KEYS are handled} {
+        r config set keys-background-threshold 1000
+        for {set j 0} {$j < 10} {incr j} {
+            set rd [redis_deferring_client]
+            $rd keys key:1*
+            $rd close
+        }
+        set rd [redis_deferring_client]
+        $rd keys key:1*
+        $rd ping
+        set res [llength [$rd read]]
+        lappend res [$rd read]
+        $rd close
+        r config set keys-background-threshold 100000
+        set res
+    } {11111 PONG}
+
+    test {SWAPDB restarts a background KEYS against the swapped database} {
+        r flushdb
+        r config set keys-background-threshold 1000
+        r debug populate 200000
+        r select 10
+        r flushdb
+        r debug populate 1000 other
+        r select 9
+        set rd [redis_deferring_client]
+        $rd keys *
+        wait_for_condition 100 1 {
+            [s blocked_clients] == 1
+        } else {
+            fail "KEYS was not started in background"
+        }
+        # The client is still in DB 9, that now holds the keys of DB 10.
+        r swapdb 9 10
+        set keys [$rd read]
+        $rd close
+        r swapdb 9 10
+        r select 10
+        r flushdb
+        r select 9
+        r config set keys-background-threshold 100000
+        list [llength $keys] [llength [lsearch -all -not -glob $keys other:*]]
+    } {1000 0}
+
+    test {Deleting and adding keys doesn't leave every bucket ever full} {
+        r flushdb
+        r debug populate 5000 old
+        # Replace every key three times, one at a time.
+        r eval {
+            for j=0,14999 do
+                redis.call('del','old:'..j)
+                redis.call('set','old:'..(j+5000),j)
+            end
+        } 0
+        regexp {table size: (\d+) buckets} [r debug htstats 9] - size
+        regexp {buckets ever full: (\d+)} [r debug htstats 9] - everfull
+        assert {$everfull < $size*3/4}
+        assert_equal 5000 [r dbsize]
+        assert_equal {} [r get old:0]
+        r get old:19999
+    } {14999}
 }
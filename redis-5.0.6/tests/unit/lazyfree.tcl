@@ -36,4 +36,30 @@ start_server {tags {"lazyfree"}} {
             fail "Memory is not reclaimed by FLUSHDB ASYNC"
         }
     }
+
+    test "FLUSHDB ASYNC with big values pending in the output buffers" {
+        set orig [string repeat x 4000000]
+        for {set j 0} {$j < 10} {incr j} {
+            r set bigkey:$j $orig
+        }
+        set rd [redis_deferring_client]
+        $rd client setname bigreader
+        $rd read
+        $rd mget bigkey:0 bigkey:1 bigkey:2 bigkey:3 bigkey:4 \
+                 bigkey:5 bigkey:6 bigkey:7 bigkey:8 bigkey:9
+        wait_for_condition 50 100 {
+            [string match {*name=bigreader*cmd=mget*} [r client list]]
+        } else {
+            fail "MGET was not processed"
+        }
+        r flushdb async
+        wait_for_condition 50 100 {
+            [s lazyfree_pending_objects] == 0
+        } else {
+            fail "FLUSHDB ASYNC did not complete"
+        }
+        set res [$rd read]
+        $rd close
+        list [llength $res] [lsort -unique $res] [r dbsize]
+    } [list 10 [string repeat x 4000000] 0]
 }
@@ -0,0 +1,57 @@
+set testmodule [file normalize tests/modules/misc.so]
+
+start_server {tags {"modules"}} {
+    r module load $testmodule
+
+    test {RM_Call() of a command rewriting its arguments} {
+        r set foo 1.5
+        assert_equal 4 [r test.call_generic incrbyfloat foo 2.5]
+        assert_equal 4 [r test.call_generic incrbyfloat foo 0]
+        r get foo
+    } {4}
+
+    test {Active expire with a notification callback setting other keys} {
+        r flushall
+        r config resetstat
+        r debug set-active-expire 0
+        for {set j 0} {$j < 10} {incr j} {
+            r psetex refresh:$j 1 value
+        }
+        after 10
+        r debug set-active-expire 1
+        wait_for_condition 100 10 {
+            [s expired_keys] > 0
+        } else {
+            fail "Keys were not expired"
+        }
+        # The keys set again by the callback are not expired.
+        list [s expired_keys] [r dbsize] [r ttl refresh:5] [r get refresh:9]
+    } {10 10 -1 refreshed}
+
+    test {MGET of expired keys with a notification callback setting other keys} {
+        r flushall
+        r debug set-active-expire 0
+        set keys {}
+        for {set j 0} {$j < 10} {incr j} {
+            r psetex refresh:$j 1 value
+            lappend keys refresh:$j
+        }
+        after 10
+        # The first key is deleted after the callback set it again.
+        set res [r mget {*}$keys]
+        r debug set-active-expire 1
+        list [lindex $res 0] [lsort -unique [lrange $res 1 end]]
+    } {{} refreshed}
+
+    test {MGET of a key overwritten by the callback of a later expired key} {
+        r flushall
+        r debug set-active-expire 0
+        set value [string repeat x 100]
+        r set refresh:5 $value
+        r psetex refresh:0 1 value
+        after 10
+        set res [r mget refresh:5 refresh:0]
+        r debug set-active-expire 1
+        list [expr {[lindex $res 0] eq $value}] [lindex $res 1] [r get refresh:5]
+    } {1 {} refreshed}
+}
@@ -0,0 +1,40 @@
+start_server {tags {"networking"} overrides {tcp-listen-sockets 4 tcp-defer-accept 5 tcp-fastopen 16}} {
+    test {CONFIG GET reports the listening sockets configuration} {
+        list [lindex [r config get tcp-listen-sockets] 1] \
+             [lindex [r config get tcp-defer-accept] 1] \
+             [lindex [r config get tcp-fastopen] 1]
+    } {4 5 16}
+
+    test {Connections are accepted from every listening socket} {
+        set clients {}
+        for {set j 0} {$j < 64} {incr j} {
+            set rd [redis [srv 0 host] [srv 0 port] 0]
+            $rd select 9
+            lappend clients $rd
+        }
+        set j 0
+        foreach rd $clients {
+            $rd set key:$j $j
+            incr j
+        }
+        set j 0
+        set res {}
+        foreach rd $clients {
+            if {[$rd get key:$j] ne $j} {lappend res $j}
+            $rd close
+            incr j
+        }
+        set res
+    } {}
+
+    test {Connected clients are tracked across listening sockets} {
+        set clients {}
+        for {set j 0} {$j < 16} {incr j} {
+            lappend clients [redis [srv 0 host] [srv 0 port] 0]
+        }
+        foreach rd $clients {$rd ping}
+        set connected [s connected_clients]
+        foreach rd $clients {$rd close}
+        expr {$connected >= 17}
+    } {1}
+}
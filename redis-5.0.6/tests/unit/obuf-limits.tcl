@@ -71,3 +71,72 @@ start_server {tags {"obuf-limits"}} {
         $rd1 close
     }
 }
+
+start_server {tags {"obuf-limits"}} {
+    test {Client output buffer total limit closes the biggest clients first} {
+        r config set client-output-buffer-total-limit 500000
+        set rd1 [redis_deferring_client]
+        set rd2 [redis_deferring_client]
+        $rd1 client setname big
+        $rd1 read
+        $rd2 client setname small
+        $rd2 read
+
+        $rd1 subscribe foo bar
+        $rd1 read
+        $rd1 read
+        $rd2 subscribe foo
+        $rd2 read
+
+        set payload [string repeat x 1000]
+        while 1 {
+            r publish foo $payload
+            r publish bar $payload
+            set clients [r client list]
+            if {![string match {*name=big*} $clients]} break
+            assert {[s clients_output_buffer_memory] <= 500000}
+        }
+        assert_match {*name=small*} [r client list]
+        assert {[s evicted_clients] >= 1}
+        assert {[s clients_output_buffer_memory] <= 500000}
+        $rd1 close
+        $rd2 close
+        r config set client-output-buffer-total-limit 0
+    }
+
+    test {Client output buffer memory is released once the reply is sent} {
+        r config set client-output-buffer-total-limit 100mb
+        set rd1 [redis_deferring_client]
+        $rd1 subscribe foo
+        $rd1 read
+        set payload [string repeat x 1000]
+        for {set j 0} {$j < 100} {incr j} {
+            r publish foo $payload
+        }
+        for {set j 0} {$j < 100} {incr j} {
+            $rd1 read
+        }
+        set mem [s clients_output_buffer_memory]
+        $rd1 close
+        r config set client-output-buffer-total-limit 0
+        set mem
+    } {0}
+
+    test {Client output buffer memory is only tracked with a total limit} {
+        set rd1 [redis_deferring_client]
+        $rd1 subscribe foo
+        $rd1 read
+        set payload [string repeat x 100000]
+        for {set j 0} {$j < 200} {incr j} {
+            r publish foo $payload
+        }
+        set disabled [s clients_output_buffer_memory]
+        # Enabling the limit indexes the clients with pending output.
+        r config set client-output-buffer-total-limit 100mb
+        set enabled [s clients_output_buffer_memory]
+        r config set client-output-buffer-total-limit 0
+        set disabled_again [s clients_output_buffer_memory]
+        $rd1 close
+        list $disabled [expr {$enabled > 0}] $disabled_again
+    } {0 1 0}
+}
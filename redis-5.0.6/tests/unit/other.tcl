@@ -246,3 +246,19 @@ start_server {tags {"other"}} {
         r save
     } {OK}
 }
+
+start_server {tags {"other"} overrides {hash-function aesni}} {
+    test {Keys and fields are found with the aesni hash function} {
+        r debug populate 10000
+        for {set j 0} {$j < 1000} {incr j} {
+            r hset myhash field:$j $j
+        }
+        r debug reload
+        assert {[lindex [r config get hash-function] 1] in {aesni siphash}}
+        assert_equal 10001 [r dbsize]
+        assert_equal value:1234 [r get key:1234]
+        assert_equal 999 [r hget myhash field:999]
+        assert_equal 1000 [r hlen myhash]
+        assert_equal 1000 [llength [r hkeys myhash]]
+    }
+}
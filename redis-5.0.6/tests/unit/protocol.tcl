@@ -115,3 +115,126 @@ start_server {tags {"regression"}} {
         $rd read
     }
 }
+
+start_server {tags {"protocol"}} {
+    test "Replies spanning many reply blocks are sent intact" {
+        # Build a reply made of many small elements, so that it is stored
+        # in a long list of reply blocks, and read it slowly in order to
+        # force partial writes of the gathered blocks.
+        r del biglist
+        set elements {}
+        for {set j 0} {$j < 20000} {incr j} {
+            lappend elements "element:$j:[string repeat x [expr {$j % 97}]]"
+        }
+        r rpush biglist {*}$elements
+        r set small foo
+
+        set s [socket [srv 0 host] [srv 0 port]]
+        fconfigure $s -translation binary -buffering none -buffersize 4096
+        set proto "*2\r\n\$6\r\nSELECT\r\n\$1\r\n9\r\n"
+        append proto "*2\r\n\$3\r\nGET\r\n\$5\r\nsmall\r\n"
+        append proto "*4\r\n\$6\r\nLRANGE\r\n\$7\r\nbiglist\r\n\$1\r\n0\r\n\$2\r\n-1\r\n"
+        append proto "*2\r\n\$3\r\nGET\r\n\$5\r\nsmall\r\n"
+        puts -nonewline $s $proto
+        flush $s
+        after 100
+
+        set reply {}
+        assert_equal {+OK} [string trim [gets $s]]
+        assert_equal {$3} [string trim [gets $s]]
+        assert_equal foo [string trim [gets $s]]
+        assert_equal {*20000} [string trim [gets $s]]
+        for {set j 0} {$j < 20000} {incr j} {
+            gets $s
+            lappend reply [string trim [gets $s]]
+        }
+        assert_equal {$3} [string trim [gets $s]]
+        assert_equal foo [string trim [gets $s]]
+        close $s
+        assert_equal $elements $reply
+    }
+}
+
+start_server {tags {"protocol"}} {
+    test "Pipelines mixing commands, arities and errors are processed in order" {
+        set s [socket [srv 0 host] [srv 0 port]]
+        fconfigure $s -translation binary
+        set proto "*2\r\n\$6\r\nSELECT\r\n\$1\r\n9\r\n"
+        for {set j 0} {$j < 500} {incr j} {
+            append proto "*3\r\n\$3\r\nSET\r\n\$[string length k$j]\r\nk$j\r\n\$[string length $j]\r\n$j\r\n"
+            append proto "*2\r\n\$4\r\nINCR\r\n\$[string length k$j]\r\nk$j\r\n"
+            append proto "*2\r\n\$3\r\nSET\r\n\$[string length k$j]\r\nk$j\r\n"
+            append proto "PING\r\n"
+        }
+        puts -nonewline $s $proto
+        flush $s
+        assert_equal {+OK} [string trim [gets $s]]
+        for {set j 0} {$j < 500} {incr j} {
+            assert_equal {+OK} [string trim [gets $s]]
+            assert_equal ":[expr {$j+1}]" [string trim [gets $s]]
+            assert_match {-ERR wrong number of arguments*} [gets $s]
+            assert_equal {+PONG} [string trim [gets $s]]
+        }
+        close $s
+        r get k499
+    } {500}
+
+    test "Pipelined MSET commands with a varying number of arguments" {
+        set rd [redis_deferring_client]
+        for {set j 1} {$j <= 200} {incr j} {
+            set args {}
+            for {set i 0} {$i < $j} {incr i} {lappend args mk$i $j}
+            $rd mset {*}$args
+            $rd get mk0
+        }
+        for {set j 1} {$j <= 200} {incr j} {
+            assert_equal OK [$rd read]
+            assert_equal $j [$rd read]
+        }
+        $rd close
+        list [r get mk0] [r get mk199]
+    } {200 200}
+}
+
+start_server {tags {"protocol"} overrides {rename-command {set myset}}} {
+    test "Renamed commands can't be called with the original name in pipelines" {
+        set s [socket [srv 0 host] [srv 0 port]]
+        fconfigure $s -translation binary
+        set proto "*3\r\n\$5\r\nmyset\r\n\$3\r\nkey\r\n\$1\r\n1\r\n"
+        append proto "*3\r\n\$3\r\nset\r\n\$3\r\nkey\r\n\$1\r\n2\r\n"
+        append proto "*3\r\n\$5\r\nmyset\r\n\$3\r\nkey\r\n\$1\r\n3\r\n"
+        append proto "*2\r\n\$3\r\nget\r\n\$3\r\nkey\r\n"
+        puts -nonewline $s $proto
+        flush $s
+        set replies {}
+        for {set j 0} {$j < 4} {incr j} {lappend replies [string trim [gets $s]]}
+        lappend replies [string trim [gets $s]]
+        close $s
+        list [lindex $replies 0] [string match {-ERR unknown command*} [lindex $replies 1]] [lindex $replies 2] [lindex $replies 3] [lindex $replies 4]
+    } {+OK 1 +OK {$1} 3}
+}
+
+start_server {tags {"protocol"}} {
+    test "Small arguments retained by commands are not recycled" {
+        # Values of SET are stored as they are, while the arguments of
+        # the other commands are released after the command: make sure
+        # the stored objects are never reused for the next arguments.
+        set rd [redis_deferring_client]
+        for {set j 0} {$j < 2000} {incr j} {
+            set len [expr {$j % 45}]
+            $rd set key:$j [string repeat [expr {$j % 10}] $len]
+            $rd hset hash:[expr {$j % 7}] field:$j [string repeat z $len]
+            $rd sadd set field:$j
+        }
+        for {set j 0} {$j < 2000} {incr j} {
+            $rd read; $rd read; $rd read
+        }
+        $rd close
+        for {set j 0} {$j < 2000} {incr j} {
+            set len [expr {$j % 45}]
+            assert_equal [string repeat [expr {$j % 10}] $len] [r get key:$j]
+            assert_equal [string repeat z $len] [r hget hash:[expr {$j % 7}] field:$j]
+        }
+        r scard set
+    } {2000}
+}
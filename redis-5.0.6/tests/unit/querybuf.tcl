@@ -0,0 +1,50 @@
+start_server {tags {"querybuf"}} {
+    test {Idle clients don't hold a query buffer} {
+        set clients {}
+        for {set j 0} {$j < 20} {incr j} {
+            set rd [redis_deferring_client]
+            $rd ping
+            assert_equal PONG [$rd read]
+            lappend clients $rd
+        }
+        # Only the client running INFO owns a query buffer.
+        assert_equal 1 [s querybuf_pool_lent]
+        foreach rd $clients {$rd close}
+    }
+
+    test {Idle clients are reported with an empty query buffer} {
+        set rd [redis_deferring_client]
+        $rd client setname idleclient
+        $rd read
+        set list [r client list]
+        $rd close
+        set list
+    } {*name=idleclient * qbuf=0 qbuf-free=0 *}
+
+    test {Clients with a partial command pending hold a query buffer} {
+        set fd [socket [srv 0 host] [srv 0 port]]
+        fconfigure $fd -translation binary
+        puts -nonewline $fd "*1\r\n\$4\r\nPI"
+        flush $fd
+        wait_for_condition 50 100 {
+            [s querybuf_pool_lent] == 2
+        } else {
+            fail "The partial command didn't borrow a query buffer"
+        }
+        puts -nonewline $fd "NG\r\n"
+        flush $fd
+        set reply [gets $fd]
+        close $fd
+        # The buffer was given back to the pool.
+        assert {[s querybuf_pool_free] > 0}
+        list $reply [s querybuf_pool_lent]
+    } [list "+PONG\r" 1]
+
+    test {Big arguments are read correctly using pooled buffers} {
+        set big [string repeat x 100000]
+        r set bigarg $big
+        r set small foo
+        list [string equal $big [r get bigarg]] [r get small] \
+             [s querybuf_pool_lent]
+    } {1 foo 1}
+}
@@ -17,6 +17,23 @@ start_server {tags {"scan"}} {
         assert_equal 1000 [llength $keys]
     }
 
+    test "SCAN does not return duplicates if the table is not resized" {
+        r flushdb
+        r debug populate 50000
+
+        set cur 0
+        set keys {}
+        while 1 {
+            set res [r scan $cur count 100]
+            set cur [lindex $res 0]
+            lappend keys {*}[lindex $res 1]
+            if {$cur == 0} break
+        }
+
+        assert_equal 50000 [llength $keys]
+        assert_equal 50000 [llength [lsort -unique $keys]]
+    }
+
     test "SCAN COUNT" {
         r flushdb
         r debug populate 1000
@@ -53,7 +70,7 @@ start_server {tags {"scan"}} {
         assert_equal 100 [llength $keys]
     }
 
-    foreach enc {intset hashtable} {
+    foreach enc {intset listpack hashtable} {
         test "SSCAN with encoding $enc" {
             # Create the Set
             r del set
@@ -62,6 +79,9 @@ start_server {tags {"scan"}} {
             } else {
                 set prefix "ele:"
             }
+            if {$enc eq {hashtable}} {
+                r config set set-max-listpack-entries 0
+            }
             set elements {}
             for {set j 0} {$j < 100} {incr j} {
                 lappend elements ${prefix}${j}
@@ -70,6 +90,7 @@ start_server {tags {"scan"}} {
 
             # Verify that the encoding matches.
             assert {[r object encoding set] eq $enc}
+            r config set set-max-listpack-entries 128
 
             # Test SSCAN
             set cur 0
@@ -87,11 +108,11 @@ start_server {tags {"scan"}} {
         }
     }
 
-    foreach enc {ziplist hashtable} {
+    foreach enc {listpack hashtable} {
         test "HSCAN with encoding $enc" {
             # Create the Hash
             r del hash
-            if {$enc eq {ziplist}} {
+            if {$enc eq {listpack}} {
                 set count 30
             } else {
                 set count 1000
@@ -127,11 +148,11 @@ start_server {tags {"scan"}} {
         }
     }
 
-    foreach enc {ziplist skiplist} {
+    foreach enc {listpack skiplist} {
         test "ZSCAN with encoding $enc" {
             # Create the Sorted Set
             r del zset
-            if {$enc eq {ziplist}} {
+            if {$enc eq {listpack}} {
                 set count 30
             } else {
                 set count 1000
@@ -282,4 +303,37 @@ start_server {tags {"scan"}} {
             }
         }
     }
+    test "SCAN and SSCAN with segmented hash tables" {
+        r flushdb
+        r debug populate 200000
+        set allkeys {}
+        set cursor 0
+        while 1 {
+            lassign [r scan $cursor count 500] cursor items
+            foreach k $items {dict set allkeys $k 1}
+            if {$cursor == 0} break
+        }
+        assert_equal 200000 [dict size $allkeys]
+        assert_match {*rehashing_progress_perc:*} [r info stats]
+
+        r eval {for i=1,150000 do redis.call('sadd','set',i) end} 0
+        set seen {}
+        set cursor 0
+        set iteration 0
+        while 1 {
+            lassign [r sscan set $cursor count 500] cursor items
+            foreach i $items {dict set seen $i 1}
+            # Shrink the set while scanning.
+            if {[incr iteration] == 10} {
+                r eval {for i=1000,150000 do redis.call('srem','set',i) end} 0
+            }
+            if {$cursor == 0} break
+        }
+        for {set j 1} {$j < 1000} {incr j} {
+            assert {[dict exists $seen $j]}
+        }
+        assert_equal 999 [r scard set]
+        r debug reload
+        assert_equal 200001 [r dbsize]
+    }
 }
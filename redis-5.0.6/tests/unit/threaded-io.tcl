@@ -0,0 +1,108 @@
+start_server {tags {"threaded-io"} overrides {io-threads 4 io-threads-do-reads yes}} {
+    test {CONFIG GET reports the I/O threads configuration} {
+        list [lindex [r config get io-threads] 1] \
+             [lindex [r config get io-threads-do-reads] 1]
+    } {4 yes}
+
+    test {Many pipelining clients are served correctly with I/O threads} {
+        set clients {}
+        for {set j 0} {$j < 32} {incr j} {
+            lappend clients [redis_deferring_client]
+        }
+
+        # Send all the writes first, so that there are enough clients with
+        # pending replies to activate the threads.
+        set j 0
+        foreach rd $clients {
+            for {set i 0} {$i < 100} {incr i} {
+                $rd set key:$j:$i val:$j:$i
+            }
+            incr j
+        }
+        foreach rd $clients {
+            for {set i 0} {$i < 100} {incr i} {
+                assert_equal OK [$rd read]
+            }
+        }
+
+        set j 0
+        foreach rd $clients {
+            for {set i 0} {$i < 100} {incr i} {
+                $rd get key:$j:$i
+            }
+            incr j
+        }
+        set j 0
+        foreach rd $clients {
+            for {set i 0} {$i < 100} {incr i} {
+                assert_equal val:$j:$i [$rd read]
+            }
+            incr j
+        }
+
+        foreach rd $clients {$rd close}
+        r dbsize
+    } {3200}
+
+    test {Big replies are delivered in full with I/O threads} {
+        r del biglist
+        for {set i 0} {$i < 10000} {incr i} {
+            r rpush biglist [string repeat x 100]$i
+        }
+        set clients {}
+        for {set j 0} {$j < 16} {incr j} {
+            set rd [redis_deferring_client]
+            $rd lrange biglist 0 -1
+            lappend clients $rd
+        }
+        foreach rd $clients {
+            set reply [$rd read]
+            assert_equal 10000 [llength $reply]
+            assert_equal [string repeat x 100]9999 [lindex $reply end]
+            $rd close
+        }
+    }
+
+    test {Big string values are delivered in full with I/O threads} {
+        set val [string repeat v 200000]
+        r set bigval $val
+        set clients {}
+        for {set j 0} {$j < 16} {incr j} {
+            set rd [redis_deferring_client]
+            $rd mget bigval bigval
+            lappend clients $rd
+        }
+        # Wait for all the replies to be queued before deleting the key.
+        wait_for_condition 50 100 {
+            [regexp -all {cmd=mget} [r client list]] == 16
+        } else {
+            fail "MGET was not processed by all the clients"
+        }
+        r del bigval
+        foreach rd $clients {
+            assert_equal [list $val $val] [$rd read]
+            $rd close
+        }
+        r exists bigval
+    } {0}
+
+    test {Protocol errors are reported with I/O threads} {
+        set clients {}
+        for {set j 0} {$j < 16} {incr j} {
+            set rd [redis_deferring_client]
+            $rd ping
+            lappend clients $rd
+        }
+        set s [socket [srv 0 host] [srv 0 port]]
+        fconfigure $s -translation binary
+        puts -nonewline $s "*3000000000\r\n"
+        flush $s
+        foreach rd $clients {
+            assert_equal PONG [$rd read]
+            $rd close
+        }
+        set e [gets $s]
+        close $s
+        set e
+    } {*Protocol error*}
+}
@@ -14,8 +14,8 @@ start_server {tags {"hash"}} {
         list [r hlen smallhash]
     } {8}
 
-    test {Is the small hash encoded with a ziplist?} {
-        assert_encoding ziplist smallhash
+    test {Is the small hash encoded with a listpack?} {
+        assert_encoding listpack smallhash
     }
 
     test {HSET/HLEN - Big hash creation} {
@@ -252,7 +252,7 @@ start_server {tags {"hash"}} {
         lappend rv [r hexists bighash nokey]
     } {1 0 1 0}
 
-    test {Is a ziplist encoded Hash promoted on big payload?} {
+    test {Is a listpack encoded Hash promoted on big payload?} {
         r hset smallhash foo [string repeat a 1024]
         r debug object smallhash
     } {*hashtable*}
@@ -438,12 +438,71 @@ start_server {tags {"hash"}} {
         }
     }
 
-    test {Hash ziplist regression test for large keys} {
+    test {Hash listpack regression test for large keys} {
         r hset hash kkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkk a
         r hset hash kkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkk b
         r hget hash kkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkk
     } {b}
 
+    test {Hash listpack lookup of fields of every encoding} {
+        r del hash
+        r config set hash-max-ziplist-value 1000
+        set fields [list {} 0 7 -1 200 -5000 100000 -100000000 \
+                        1234567890123 -9223372036854775808 007 1.5 x \
+                        [string repeat a 63] [string repeat b 64] \
+                        [string repeat c 500]]
+        set i 0
+        foreach f $fields {
+            r hset hash $f v$i
+            incr i
+        }
+        assert_encoding listpack hash
+        set i 0
+        foreach f $fields {
+            assert_equal v$i [r hget hash $f]
+            incr i
+        }
+        assert_equal {} [r hget hash 00]
+        assert_equal {} [r hget hash 8]
+        assert_equal {} [r hget hash [string repeat a 62]]
+        assert_equal {} [r hget hash v0]
+        r config set hash-max-ziplist-value 64
+    }
+
+    test {Hash listpack lookups in big hashes across updates} {
+        r del hash
+        r config set hash-max-ziplist-entries 1000
+        set d [dict create]
+        # Integer and string fields, with values equal to other fields.
+        for {set j 0} {$j < 400} {incr j} {
+            set f [expr {$j % 3 ? "field:$j" : $j}]
+            set v [expr {$j % 2 ? "field:[expr {$j+1}]" : $j}]
+            r hset hash $f $v
+            dict set d $f $v
+        }
+        for {set round 0} {$round < 5} {incr round} {
+            assert_encoding listpack hash
+            # Search enough times for the listpack to get indexed.
+            dict for {f v} $d {
+                assert_equal $v [r hget hash $f]
+            }
+            assert_equal {} [r hget hash field:0]
+            assert_equal {} [r hget hash 1]
+            assert_equal {} [r hget hash missing]
+            # Delete, add, and change the size of some fields.
+            set f field:[expr {$round*3+1}]
+            r hdel hash $f
+            dict unset d $f
+            r hset hash new:$round $round
+            dict set d new:$round $round
+            r hset hash [expr {$round*3}] [string repeat x 60]
+            dict set d [expr {$round*3}] [string repeat x 60]
+            r hincrby hash new:0 1
+            dict incr d new:0
+        }
+        r config set hash-max-ziplist-entries 512
+    }
+
     foreach size {10 512} {
         test "Hash fuzzing #1 - $size fields" {
             for {set times 0} {$times < 10} {incr times} {
@@ -505,7 +564,7 @@ start_server {tags {"hash"}} {
         }
     }
 
-    test {Stress test the hash ziplist -> hashtable encoding conversion} {
+    test {Stress test the hash listpack -> hashtable encoding conversion} {
         r config set hash-max-ziplist-entries 32
         for {set j 0} {$j < 100} {incr j} {
             r del myhash
@@ -2,6 +2,7 @@ start_server {
     tags {"set"}
     overrides {
         "set-max-intset-entries" 512
+        "set-max-listpack-entries" 0
     }
 } {
     proc create_set {key entries} {
@@ -9,6 +10,13 @@ start_server {
         foreach entry $entries { r sadd $key $entry }
     }
 
+    # Small sets of strings are listpack encoded only for the tests of
+    # the listpack encoding: the other tests use regular sets.
+    proc set_listpack_enabled {type} {
+        r config set set-max-listpack-entries \
+            [expr {$type eq {listpack} ? 128 : 0}]
+    }
+
     test {SADD, SCARD, SISMEMBER, SMEMBERS basics - regular set} {
         create_set myset {foo}
         assert_encoding hashtable myset
@@ -59,6 +67,24 @@ start_server {
         assert_encoding hashtable myset
     }
 
+    test "SISMEMBER and SREM in a big listpack set across updates" {
+        r del myset
+        r config set set-max-listpack-entries 1000
+        for {set i 0} {$i < 300} {incr i} { r sadd myset m$i $i }
+        for {set round 0} {$round < 3} {incr round} {
+            assert_encoding listpack myset
+            # Search enough times for the listpack to get indexed.
+            for {set i 0} {$i < 300} {incr i} {
+                set member [expr {$i < $round ? 0 : 1}]
+                assert_equal $member [r sismember myset m$i]
+                assert_equal $member [r sismember myset $i]
+            }
+            assert_equal 0 [r sismember myset 300]
+            assert_equal 2 [r srem myset m$round $round]
+        }
+        r config set set-max-listpack-entries 0
+    }
+
     test {Variadic SADD} {
         r del myset
         assert_equal 3 [r sadd myset a b c]
@@ -184,6 +210,16 @@ start_server {
             assert_equal [list 195 199 $large] [lsort [r smembers setres]]
         }
 
+        test "SINTERCARD with two and three sets - $type" {
+            assert_equal 6 [r sintercard 2 set1 set2]
+            assert_equal 3 [r sintercard 3 set1 set2 set3]
+            assert_equal [r scard set5] [r sintercard 1 set5]
+            assert_equal 2 [r sintercard 2 set1 set2 limit 2]
+            assert_equal 6 [r sintercard 2 set1 set2 LIMIT 0]
+            assert_equal 6 [r sintercard 2 set1 set2 limit 100]
+            assert_equal 3 [r sintercard 2 set3 set3 limit 3]
+        }
+
         test "SUNION with non existing keys - $type" {
             set expected [lsort -uniq "[r smembers set1] [r smembers set2]"]
             assert_equal $expected [lsort [r sunion nokey1 set1 set2 nokey2]]
@@ -273,6 +309,115 @@ start_server {
         lsort [r sinter set1 set2]
     } {1 2 3}
 
+    test "SINTER and SUNION of intsets with skewed sizes" {
+        r del set1 set2 set3
+        for {set i 0} {$i < 500} {incr i} { r sadd set1 [expr {$i*3}] }
+        r sadd set2 -1 0 3 7 300 1497 1500
+        r sadd set3 3 1497 2147483648
+        assert_encoding intset set1
+        assert_equal {0 3 300 1497} [lsort -integer [r sinter set1 set2]]
+        assert_equal {3 1497} [lsort -integer [r sinter set2 set1 set3]]
+        assert_equal 2 [r sinterstore setres set3 set1 set2]
+        assert_encoding intset setres
+        assert_equal {3 1497} [lsort -integer [r smembers setres]]
+        assert_equal 503 [r sunionstore setres set1 set2]
+        assert_encoding intset setres
+        assert_equal 1 [r sismember setres 1500]
+        assert_equal 504 [r sunionstore setres set1 set2 set3]
+        assert_encoding intset setres
+        assert_equal 1 [r sismember setres 2147483648]
+        # The union of intsets can be too big to be an intset.
+        r del set4
+        for {set i 0} {$i < 20} {incr i} { r sadd set4 [expr {$i*3+1}] }
+        assert_equal 523 [r sunionstore setres set1 set2 set3 set4]
+        assert_encoding hashtable setres
+    }
+
+    test "SINTERSTORE and SUNIONSTORE create the result with the right encoding" {
+        create_set set1 {a b c 1 2 3}
+        create_set set2 {b c 2 3 4}
+        r sadd set2 a
+        r srem set2 a b c
+        assert_encoding hashtable set2
+        assert_equal 2 [r sinterstore setres set1 set2]
+        assert_encoding intset setres
+        assert_equal {2 3} [lsort [r smembers setres]]
+        create_set set2 {b c 2}
+        assert_equal 3 [r sinterstore setres set1 set2]
+        assert_encoding hashtable setres
+        assert_equal {2 b c} [lsort [r smembers setres]]
+        r del set3
+        for {set i 0} {$i < 600} {incr i} { r sadd set3 $i }
+        assert_equal 602 [r sunionstore setres set3 set2]
+        assert_encoding hashtable setres
+    }
+
+    test "SINTER and SUNION fuzzing" {
+        for {set j 0} {$j < 50} {incr j} {
+            set args {}
+            set num_sets [expr {[randomInt 4]+1}]
+            for {set i 0} {$i < $num_sets} {incr i} {
+                unset -nocomplain s$i
+                array set s$i {}
+                set num_elements [randomInt 200]
+                r del set_$i
+                lappend args set_$i
+                while {$num_elements} {
+                    # Elements from a small range, so that the sets have a
+                    # good amount of elements in common.
+                    randpath {
+                        set ele [randomInt 300]
+                    } {
+                        set ele "s[randomInt 300]"
+                    } {
+                        set ele [randomInt 300]
+                    }
+                    r sadd set_$i $ele
+                    set s${i}($ele) x
+                    incr num_elements -1
+                }
+            }
+            set inter {}
+            set union {}
+            foreach ele [array names s0] {
+                set found 1
+                for {set i 1} {$i < $num_sets} {incr i} {
+                    if {![info exists s${i}($ele)]} {set found 0}
+                }
+                if {$found} {lappend inter $ele}
+            }
+            for {set i 0} {$i < $num_sets} {incr i} {
+                lappend union {*}[array names s$i]
+            }
+            assert_equal [lsort $inter] [lsort [r sinter {*}$args]]
+            assert_equal [llength $inter] [r sintercard $num_sets {*}$args]
+            set limit [randomInt 10]
+            set expected [expr {$limit && $limit < [llength $inter] ?
+                                $limit : [llength $inter]}]
+            assert_equal $expected \
+                [r sintercard $num_sets {*}$args limit $limit]
+            assert_equal [lsort -unique $union] [lsort [r sunion {*}$args]]
+            r sinterstore setres {*}$args
+            assert_equal [lsort $inter] [lsort [r smembers setres]]
+            r sunionstore setres {*}$args
+            assert_equal [lsort -unique $union] [lsort [r smembers setres]]
+        }
+    }
+
+    test "SINTERCARD against non existing keys and errors" {
+        create_set set1 {a b c}
+        assert_equal 0 [r sintercard 2 set1 nokey]
+        assert_equal 0 [r sintercard 1 nokey limit 1]
+        assert_error "*numkeys*" {r sintercard 0 set1}
+        assert_error "*Number of keys*" {r sintercard 3 set1 set1}
+        assert_error "*syntax*" {r sintercard 1 set1 foo bar}
+        assert_error "*syntax*" {r sintercard 1 set1 limit}
+        assert_error "*LIMIT*" {r sintercard 1 set1 limit -1}
+        r set key1 x
+        assert_error "WRONGTYPE*" {r sintercard 2 set1 key1}
+        assert_equal {set1 set2} [r command getkeys sintercard 2 set1 set2 limit 1]
+    }
+
     test "SINTERSTORE against non existing keys should delete dstkey" {
         r set setres xxx
         assert_equal 0 [r sinterstore setres foo111 bar222]
@@ -285,7 +430,9 @@ start_server {
         assert_equal 0 [r exists setres]
     }
 
-    foreach {type contents} {hashtable {a b c} intset {1 2 3}} {
+    foreach {type contents} {hashtable {a b c} listpack {a b c} intset {1 2 3}} {
+        set_listpack_enabled $type
+
         test "SPOP basics - $type" {
             create_set myset $contents
             assert_encoding $type myset
@@ -310,18 +457,22 @@ start_server {
             assert_equal $contents [lsort [array names myset]]
         }
     }
+    set_listpack_enabled hashtable
 
     foreach {type contents} {
         hashtable {a b c d e f g h i j k l m n o p q r s t u v w x y z} 
+        listpack {a b c d e f g h i j k l m n o p q r s t u v w x y z}
         intset {1 10 11 12 13 14 15 16 17 18 19 2 20 21 22 23 24 25 26 3 4 5 6 7 8 9}
     } {
-        test "SPOP with <count>" {
+        set_listpack_enabled $type
+        test "SPOP with <count> - $type" {
             create_set myset $contents
             assert_encoding $type myset
             assert_equal $contents [lsort [concat [r spop myset 11] [r spop myset 9] [r spop myset 0] [r spop myset 4] [r spop myset 1] [r spop myset 0] [r spop myset 1] [r spop myset 0]]]
             assert_equal 0 [r scard myset]
         }
     }
+    set_listpack_enabled hashtable
 
     # As seen in intsetRandomMembers
     test "SPOP using integers, testing Knuth's and Floyd's algorithm" {
@@ -387,6 +538,15 @@ start_server {
             KIMBERLY DEBORAH JESSICA SHIRLEY CYNTHIA ANGELA MELISSA
             BRENDA AMY ANNA REBECCA VIRGINIA KATHLEEN
         }
+        listpack {
+            1 5 10 50 125 50000 33959417 4775547 65434162
+            12098459 427716 483706 2726473884 72615637475
+            MARY PATRICIA LINDA BARBARA ELIZABETH JENNIFER MARIA
+            SUSAN MARGARET DOROTHY LISA NANCY KAREN BETTY HELEN
+            SANDRA DONNA CAROL RUTH SHARON MICHELLE LAURA SARAH
+            KIMBERLY DEBORAH JESSICA SHIRLEY CYNTHIA ANGELA MELISSA
+            BRENDA AMY ANNA REBECCA VIRGINIA KATHLEEN
+        }
         intset {
             0 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19
             20 21 22 23 24 25 26 27 28 29
@@ -394,8 +554,10 @@ start_server {
             40 41 42 43 44 45 46 47 48 49
         }
     } {
+        set_listpack_enabled $type
         test "SRANDMEMBER with <count> - $type" {
             create_set myset $contents
+            assert_encoding $type myset
             unset -nocomplain myset
             array set myset {}
             foreach ele [r smembers myset] {
@@ -484,6 +646,7 @@ start_server {
             }
         }
     }
+    set_listpack_enabled hashtable
 
     proc setup_move {} {
         r del myset3 myset4
@@ -563,6 +726,139 @@ start_server {
         lsort [r smembers set]
     } {a b c}
 
+    test "SADD, SISMEMBER, SREM basics - listpack" {
+        set_listpack_enabled listpack
+        create_set myset {foo 1 -5 bar}
+        assert_encoding listpack myset
+        assert_equal 0 [r sadd myset foo 1 -5]
+        assert_equal 1 [r sadd myset {}]
+        assert_equal 5 [r scard myset]
+        foreach ele {foo 1 -5 bar {}} {
+            assert_equal 1 [r sismember myset $ele]
+        }
+        foreach ele {fo 01 -6 2 baz} {
+            assert_equal 0 [r sismember myset $ele]
+        }
+        assert_equal {{} -5 1 bar foo} [lsort [r smembers myset]]
+        assert_equal 2 [r srem myset 1 foo nokey]
+        assert_equal {{} -5 bar} [lsort [r smembers myset]]
+        assert_encoding listpack myset
+    }
+
+    test "Set encoding conversions - listpack" {
+        create_set myset {1 2 3}
+        assert_encoding intset myset
+        r sadd myset a
+        assert_encoding listpack myset
+        assert_equal {1 2 3 a} [lsort [r smembers myset]]
+
+        # Too many entries.
+        r config set set-max-listpack-entries 10
+        for {set i 0} {$i < 6} {incr i} { r sadd myset ele:$i }
+        assert_encoding listpack myset
+        r sadd myset ele:6
+        assert_encoding hashtable myset
+        assert_equal 11 [r scard myset]
+
+        # Too long entries.
+        create_set myset {a b}
+        r sadd myset [string repeat x 64]
+        assert_encoding listpack myset
+        r sadd myset [string repeat x 65]
+        assert_encoding hashtable myset
+        create_set myset [list [string repeat x 65]]
+        assert_encoding hashtable myset
+
+        # An intset that is too big for a listpack becomes a regular set.
+        create_set myset {1 2 3 4 5 6 7 8 9 10 11}
+        assert_encoding intset myset
+        r sadd myset a
+        assert_encoding hashtable myset
+        set_listpack_enabled listpack
+    }
+
+    test "Set encoding after DEBUG RELOAD - listpack" {
+        create_set myset {a b c 1}
+        set_listpack_enabled hashtable
+        create_set myhashset {a b c}
+        assert_encoding hashtable myhashset
+        set_listpack_enabled listpack
+        r debug reload
+        assert_encoding listpack myset
+        assert_encoding listpack myhashset
+        assert_equal {1 a b c} [lsort [r smembers myset]]
+        assert_equal {a b c} [lsort [r smembers myhashset]]
+    }
+
+    test "SINTER, SUNION, SDIFF with mixed encodings - listpack" {
+        create_set set1 {a b c 1 2}
+        create_set set2 {1 2 3}
+        create_set set3 {b c d 2}
+        set_listpack_enabled hashtable
+        create_set set4 {c 1 2 e}
+        set_listpack_enabled listpack
+        assert_encoding listpack set1
+        assert_encoding intset set2
+        assert_encoding listpack set3
+        assert_encoding hashtable set4
+        assert_equal {1 2} [lsort [r sinter set1 set2]]
+        assert_equal {1 2} [lsort [r sinter set2 set1]]
+        assert_equal {2} [lsort [r sinter set1 set2 set3 set4]]
+        assert_equal {2 b c} [lsort [r sinter set1 set3]]
+        assert_equal {2 c} [lsort [r sinter set3 set4]]
+        assert_equal 3 [r sinterstore setres set1 set3]
+        assert_encoding listpack setres
+        assert_equal 3 [r sintercard 2 set1 set3]
+        assert_equal 1 [r sintercard 4 set1 set2 set3 set4]
+        assert_equal 2 [r sintercard 2 set3 set1 limit 2]
+        assert_equal {2 b c} [lsort [r smembers setres]]
+        assert_equal {1 2 3 a b c d e} [lsort [r sunion set1 set2 set3 set4]]
+        assert_equal 6 [r sunionstore setres set1 set3]
+        assert_encoding listpack setres
+        assert_equal {a b} [lsort [r sdiff set1 set2 set4]]
+        assert_equal {a} [lsort [r sdiff set1 set3 set4]]
+        assert_equal {d} [lsort [r sdiff set3 set1 set4]]
+    }
+
+    test "SINTERSTORE of regular sets creates a listpack - listpack" {
+        set_listpack_enabled hashtable
+        create_set set1 {a b c 1 2}
+        create_set set2 {b c d 2}
+        set_listpack_enabled listpack
+        assert_encoding hashtable set1
+        assert_encoding hashtable set2
+        assert_equal 3 [r sinterstore setres set1 set2]
+        assert_encoding listpack setres
+        assert_equal {2 b c} [lsort [r smembers setres]]
+    }
+
+    test "SMOVE with listpack sets" {
+        create_set set1 {a b 1}
+        create_set set2 {1 2}
+        assert_equal 1 [r smove set1 set2 a]
+        assert_encoding listpack set2
+        assert_equal {1 2 a} [lsort [r smembers set2]]
+        assert_equal 1 [r smove set2 set1 2]
+        assert_equal 0 [r smove set1 set2 a]
+        assert_equal {1 2 b} [lsort [r smembers set1]]
+        r del set3
+        assert_equal 1 [r smove set1 set3 b]
+        assert_encoding listpack set3
+    }
+
+    test "SSCAN and ZUNIONSTORE with listpack sets" {
+        create_set myset {a b c 1 2 3}
+        assert_equal {1 2 3 a b c} [lsort [lindex [r sscan myset 0] 1]]
+        assert_equal {1 a} [lsort [lindex [r sscan myset 0 match {[1a]}] 1]]
+        r del zset
+        r zadd zset 5 a 7 1 9 z
+        assert_equal 2 [r zinterstore zres 2 myset zset]
+        assert_equal {a 6 1 8} [r zrange zres 0 -1 withscores]
+        assert_equal 7 [r zunionstore zres 2 myset zset]
+        assert_equal 1 [r zscore zres b]
+        set_listpack_enabled hashtable
+    }
+
     tags {slow} {
         test {intsets implementation stress testing} {
             for {set j 0} {$j < 20} {incr j} {
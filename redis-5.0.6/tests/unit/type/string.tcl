@@ -119,6 +119,19 @@ start_server {tags {"string"}} {
         r mget foo baazz bar myset
     } {BAR {} FOO {}}
 
+    test {MGET and EXISTS with many keys} {
+        r flushdb
+        set keys {}
+        set expected {}
+        for {set j 0} {$j < 100} {incr j} {
+            if {$j % 3} {r set key$j val$j; lappend expected val$j} else {lappend expected {}}
+            lappend keys key$j
+        }
+        assert_equal $expected [r mget {*}$keys]
+        assert_equal 66 [r exists {*}$keys]
+        assert_equal 66 [r del {*}$keys]
+    }
+
     test {GETSET (set new value)} {
         r del foo
         list [r getset foo xyz] [r get foo]
@@ -419,4 +432,37 @@ start_server {tags {"string"}} {
         r set foo bar
         r getrange foo 0 4294967297
     } {bar}
+
+    test {GET and MGET of big values sent without copying them} {
+        set a [string repeat a 100000]
+        set b [string repeat b 1000000]
+        r set biga $a
+        r set bigb $b
+        r set foo small
+        assert_equal $a [r get biga]
+        assert_equal [list $b small $a] [r mget bigb foo biga]
+    }
+
+    test {Big values pending in the output buffer survive key changes} {
+        set orig [string repeat x 4000000]
+        r set bigkey $orig
+        set rd [redis_deferring_client]
+        $rd client setname bigreader
+        $rd read
+        $rd mget bigkey bigkey
+        # Wait for the reply to be queued before modifying the key.
+        wait_for_condition 50 100 {
+            [string match {*name=bigreader*cmd=mget*} [r client list]]
+        } else {
+            fail "GET was not processed"
+        }
+        r append bigkey foo
+        r setrange bigkey 0 yyy
+        r setbit bigkey 100 1
+        set changed [r get bigkey]
+        r del bigkey
+        assert_equal [list $orig $orig] [$rd read]
+        $rd close
+        list [string length $changed] [string range $changed 0 2]
+    } {4000003 yyy}
 }
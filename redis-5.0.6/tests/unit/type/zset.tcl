@@ -7,7 +7,7 @@ start_server {tags {"zset"}} {
     }
 
     proc basics {encoding} {
-        if {$encoding == "ziplist"} {
+        if {$encoding == "listpack"} {
             r config set zset-max-ziplist-entries 128
             r config set zset-max-ziplist-value 64
         } elseif {$encoding == "skiplist"} {
@@ -629,6 +629,34 @@ start_server {tags {"zset"}} {
             assert_equal {b 2 c 3} [r zrange zsetc 0 -1 withscores]
         }
 
+        test "ZINTERCARD basics - $encoding" {
+            assert_equal 2 [r zintercard 2 zseta zsetb]
+            assert_equal 1 [r zintercard 2 zseta zsetb limit 1]
+            assert_equal 2 [r zintercard 2 zseta zsetb LIMIT 0]
+            assert_equal 2 [r zintercard 2 zseta zsetb limit 5]
+            assert_equal 3 [r zintercard 2 zseta zseta]
+            assert_equal 0 [r zintercard 2 zseta nokey]
+        }
+
+        test "ZINTERCARD with a regular set - $encoding" {
+            r del seta
+            r sadd seta a b c 1
+            r zadd zsetd 1 1 2 2
+            assert_equal 2 [r zintercard 2 seta zsetb]
+            assert_equal 1 [r zintercard 2 seta zsetd]
+            assert_equal 0 [r zintercard 3 seta zsetb zsetd]
+        }
+
+        test "ZINTERCARD errors - $encoding" {
+            assert_error "*numkeys*" {r zintercard 0 zseta}
+            assert_error "*syntax*" {r zintercard 3 zseta zsetb}
+            assert_error "*syntax*" {r zintercard 2 zseta zsetb weights 1 2}
+            assert_error "*syntax*" {r zintercard 2 zseta zsetb aggregate max}
+            assert_error "*LIMIT*" {r zintercard 2 zseta zsetb limit -1}
+            r set foo bar
+            assert_error "WRONGTYPE*" {r zintercard 2 zseta foo}
+        }
+
         foreach cmd {ZUNIONSTORE ZINTERSTORE} {
             test "$cmd with +inf/-inf scores - $encoding" {
                 r del zsetinf1 zsetinf2
@@ -735,7 +763,7 @@ start_server {tags {"zset"}} {
         }
     }
 
-    basics ziplist
+    basics listpack
     basics skiplist
 
     test {ZINTERSTORE regression with two sets, intset+hashtable} {
@@ -751,7 +779,7 @@ start_server {tags {"zset"}} {
         r zrange out 0 -1 withscores
     } {neginf 0}
 
-    test {ZINTERSTORE #516 regression, mixed sets and ziplist zsets} {
+    test {ZINTERSTORE #516 regression, mixed sets and listpack zsets} {
         r sadd one 100 101 102 103
         r sadd two 100 200 201 202
         r zadd three 1 500 1 501 1 502 1 503 1 100
@@ -786,7 +814,7 @@ start_server {tags {"zset"}} {
     }
 
     proc stressers {encoding} {
-        if {$encoding == "ziplist"} {
+        if {$encoding == "listpack"} {
             # Little extra to allow proper fuzzing in the sorting stresser
             r config set zset-max-ziplist-entries 256
             r config set zset-max-ziplist-value 64
@@ -1198,7 +1226,7 @@ start_server {tags {"zset"}} {
     }
 
     tags {"slow"} {
-        stressers ziplist
+        stressers listpack
         stressers skiplist
     }
 